@@ -170,6 +170,16 @@ namespace GamescopeWSILayer {
     return s_minImageCount;
   }
 
+  static bool getGeometryCacheEnabled() {
+    static bool s_geometryCacheEnabled = []() -> bool {
+      if (auto enabled = parseEnv<bool>("GAMESCOPE_WSI_GEOMETRY_CACHE")) {
+        return *enabled;
+      }
+      return true;
+    }();
+    return s_geometryCacheEnabled;
+  }
+
   static bool getEnsureMinImageCount() {
     static bool s_ensureMinImageCount = []() -> bool {
       if (auto ensure = parseEnv<bool>("GAMESCOPE_WSI_ENSURE_MIN_IMAGE_COUNT")) {
@@ -414,6 +424,10 @@ namespace GamescopeWSILayer {
     // Cached for comparison.
     std::optional<VkRect2D> cachedWindowRect;
 
+    // Event-driven geometry for X11 surfaces, so presents don't need X round trips.
+    // Null if disabled or the window could not be tracked, then we query synchronously.
+    std::unique_ptr<xcb::WindowGeometryTracker> geometryTracker;
+
     bool isWayland() const {
       // Is native Wayland?
       return connection == nullptr;
@@ -432,21 +446,21 @@ namespace GamescopeWSILayer {
       if (isWayland())
         return true;
 
-      auto rect = xcb::getWindowRect(connection, window);
-      auto largestObscuringWindowSize = xcb::getLargestObscuringChildWindowSize(connection, window);
-      auto toplevelWindow = xcb::getToplevelWindow(connection, window);
-      if (!rect || !largestObscuringWindowSize || !toplevelWindow) {
+      std::optional<xcb::WindowGeometry> geometry;
+      if (geometryTracker)
+        geometry = geometryTracker->snapshot();
+      if (!geometry)
+        geometry = xcb::queryWindowGeometry(connection, window);
+      if (!geometry) {
         fprintf(stderr, "[Gamescope WSI] canBypassXWayland: failed to get window info for window 0x%x.\n", window);
         return false;
       }
 
-      cachedWindowRect = *rect;
+      const VkRect2D& rect = geometry->rect;
+      const VkRect2D& toplevelRect = geometry->toplevelRect;
+      const VkExtent2D& largestObscuringWindowSize = geometry->largestObscuringChildSize;
 
-      auto toplevelRect = xcb::getWindowRect(connection, *toplevelWindow);
-      if (!toplevelRect) {
-        fprintf(stderr, "[Gamescope WSI] canBypassXWayland: failed to get window info for window 0x%x.\n", window);
-        return false;
-      }
+      cachedWindowRect = rect;
 
       // Some games do things like have a 1280x800 top-level window and
       // a 1280x720 child window for "fullscreen".
@@ -458,9 +472,9 @@ namespace GamescopeWSILayer {
       // If we have any child windows obscuring us bigger than 1x1,
       // then we cannot flip.
       // (There can be dummy composite redirect windows and whatever.)
-      if (largestObscuringWindowSize->width > 1 || largestObscuringWindowSize->height > 1) {
+      if (largestObscuringWindowSize.width > 1 || largestObscuringWindowSize.height > 1) {
 #if GAMESCOPE_WSI_BYPASS_DEBUG
-        fprintf(stderr, "[Gamescope WSI] Largest obscuring window size: %u %u\n", largestObscuringWindowSize->width, largestObscuringWindowSize->height);
+        fprintf(stderr, "[Gamescope WSI] Largest obscuring window size: %u %u\n", largestObscuringWindowSize.width, largestObscuringWindowSize.height);
 #endif
         return false;
       }
@@ -470,16 +484,16 @@ namespace GamescopeWSILayer {
       //
       // Some games like Halo Infinite, make a child window that is 1280x802px
       // I have no idea how thtat happens, or whether its an app or Wine bug or not.
-      if (*toplevelWindow != window) {
-        if (iabs(rect->offset.x) > 1 ||
-            iabs(rect->offset.y) > 1 ||
-            iabs(int32_t(toplevelRect->extent.width)  - int32_t(rect->extent.width)) > 2 ||
-            iabs(int32_t(toplevelRect->extent.height) - int32_t(rect->extent.height)) > 2) {
+      if (geometry->toplevelWindow != window) {
+        if (iabs(rect.offset.x) > 1 ||
+            iabs(rect.offset.y) > 1 ||
+            iabs(int32_t(toplevelRect.extent.width)  - int32_t(rect.extent.width)) > 2 ||
+            iabs(int32_t(toplevelRect.extent.height) - int32_t(rect.extent.height)) > 2) {
   #if GAMESCOPE_WSI_BYPASS_DEBUG
           fprintf(stderr, "[Gamescope WSI] Not within 1px margin of error. Offset: %d %d Extent: %u %u vs %u %u\n",
-            rect->offset.x, rect->offset.y,
-            toplevelRect->extent.width, toplevelRect->extent.height,
-            rect->extent.width, rect->extent.height);
+            rect.offset.x, rect.offset.y,
+            toplevelRect.extent.width, toplevelRect.extent.height,
+            rect.extent.width, rect.extent.height);
   #endif
           return false;
         }
@@ -1033,7 +1047,11 @@ namespace GamescopeWSILayer {
         return result;
       }
 
-      fprintf(stderr, "[Gamescope WSI] Made gamescope surface for xid: 0x%x\n", window);
+      std::unique_ptr<xcb::WindowGeometryTracker> geometryTracker;
+      if (getGeometryCacheEnabled())
+        geometryTracker = xcb::WindowGeometryTracker::create(connection, window);
+
+      fprintf(stderr, "[Gamescope WSI] Made gamescope surface for xid: 0x%x (geometry cache: %s)\n", window, geometryTracker ? "yes" : "no");
       auto gamescopeSurface = GamescopeSurface::create(*pSurface, GamescopeSurfaceData {
         .instance        = instance,
         .display         = gamescopeInstance->display,
@@ -1044,6 +1062,7 @@ namespace GamescopeWSILayer {
         .window          = window,
         .flags           = flags,
         .hdrOutput       = hdrOutput,
+        .geometryTracker = std::move(geometryTracker),
       });
 
       DumpGamescopeSurfaceState(gamescopeInstance, gamescopeSurface);
@@ -0,0 +1,106 @@
+#include <benchmark/benchmark.h>
+#include <vulkan/vulkan.h>
+
+#include "xcb_helpers.hpp"
+
+// What canBypassXWayland has to gather on every QueuePresentKHR, either with
+// synchronous round trips or from the event-driven WindowGeometryTracker.
+// Needs an X server on $DISPLAY (eg. run it inside of gamescope).
+
+struct BenchWindow
+{
+    xcb_connection_t* connection = nullptr;
+    xcb_window_t toplevel = XCB_NONE;
+    xcb_window_t window = XCB_NONE;
+};
+
+static bool CreateBenchWindow(BenchWindow &bench, uint32_t uChildCount)
+{
+    bench.connection = xcb_connect(nullptr, nullptr);
+    if (xcb_connection_has_error(bench.connection))
+        return false;
+
+    xcb_screen_t* screen = xcb_setup_roots_iterator(xcb_get_setup(bench.connection)).data;
+
+    // Same shape as a Wine game: a toplevel with the swapchain window as
+    // a child, and possibly a few small (eg. 1x1 dummy) windows inside of that.
+    bench.toplevel = xcb_generate_id(bench.connection);
+    xcb_create_window(bench.connection, XCB_COPY_FROM_PARENT, bench.toplevel, screen->root,
+        0, 0, 1280, 800, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+
+    bench.window = xcb_generate_id(bench.connection);
+    xcb_create_window(bench.connection, XCB_COPY_FROM_PARENT, bench.window, bench.toplevel,
+        0, 0, 1280, 800, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+
+    for (uint32_t i = 0; i < uChildCount; i++)
+    {
+        xcb_window_t child = xcb_generate_id(bench.connection);
+        xcb_create_window(bench.connection, XCB_COPY_FROM_PARENT, child, bench.window,
+            0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+        xcb_map_window(bench.connection, child);
+    }
+
+    xcb_map_window(bench.connection, bench.window);
+    xcb_map_window(bench.connection, bench.toplevel);
+    // Round trip so everything above has been processed.
+    free(xcb_get_input_focus_reply(bench.connection, xcb_get_input_focus(bench.connection), nullptr));
+    return true;
+}
+
+static void DestroyBenchWindow(BenchWindow &bench)
+{
+    if (bench.toplevel != XCB_NONE)
+        xcb_destroy_window(bench.connection, bench.toplevel);
+    xcb_disconnect(bench.connection);
+}
+
+static void BenchmarkWindowGeometry_RoundTrips(benchmark::State &state)
+{
+    BenchWindow bench;
+    if (!CreateBenchWindow(bench, state.range(0)))
+    {
+        state.SkipWithError("Could not connect to $DISPLAY");
+        DestroyBenchWindow(bench);
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        auto geometry = xcb::queryWindowGeometry(bench.connection, bench.window);
+        benchmark::DoNotOptimize(geometry);
+    }
+
+    DestroyBenchWindow(bench);
+}
+BENCHMARK(BenchmarkWindowGeometry_RoundTrips)->Arg(0)->Arg(8);
+
+static void BenchmarkWindowGeometry_Cached(benchmark::State &state)
+{
+    BenchWindow bench;
+    if (!CreateBenchWindow(bench, state.range(0)))
+    {
+        state.SkipWithError("Could not connect to $DISPLAY");
+        DestroyBenchWindow(bench);
+        return;
+    }
+
+    auto tracker = xcb::WindowGeometryTracker::create(bench.connection, bench.window);
+    if (!tracker)
+    {
+        state.SkipWithError("Could not create WindowGeometryTracker");
+        DestroyBenchWindow(bench);
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        auto geometry = tracker->snapshot();
+        benchmark::DoNotOptimize(geometry);
+    }
+
+    tracker = nullptr;
+    DestroyBenchWindow(bench);
+}
+BENCHMARK(BenchmarkWindowGeometry_Cached)->Arg(0)->Arg(8);
+
+BENCHMARK_MAIN();
@@ -3,7 +3,18 @@
 #include <X11/Xlib-xcb.h>
 #include <xcb/composite.h>
 #include <cstdio>
+#include <cerrno>
+#include <cstring>
 #include <optional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 namespace xcb {
 
@@ -149,6 +160,195 @@ namespace xcb {
     return largestExtent;
   }
 
+  struct WindowGeometry {
+    VkRect2D rect;
+    xcb_window_t toplevelWindow;
+    VkRect2D toplevelRect;
+    VkExtent2D largestObscuringChildSize;
+  };
+
+  static std::optional<WindowGeometry> queryWindowGeometry(xcb_connection_t* connection, xcb_window_t window) {
+    auto rect = getWindowRect(connection, window);
+    auto largestObscuringChildSize = getLargestObscuringChildWindowSize(connection, window);
+    auto toplevelWindow = getToplevelWindow(connection, window);
+    if (!rect || !largestObscuringChildSize || !toplevelWindow)
+      return std::nullopt;
+
+    auto toplevelRect = getWindowRect(connection, *toplevelWindow);
+    if (!toplevelRect)
+      return std::nullopt;
+
+    return WindowGeometry {
+      .rect                      = *rect,
+      .toplevelWindow            = *toplevelWindow,
+      .toplevelRect              = *toplevelRect,
+      .largestObscuringChildSize = *largestObscuringChildSize,
+    };
+  }
+
+  // Keeps a WindowGeometry snapshot of a window up to date from
+  // Structure/SubstructureNotify events on a private connection.
+  //
+  // All the round trips happen on the tracker's own thread, when something
+  // actually changed, so snapshot() never touches the X server.
+  class WindowGeometryTracker {
+  public:
+    static std::unique_ptr<WindowGeometryTracker> create(xcb_connection_t* appConnection, xcb_window_t window) {
+      // We can't get the display name back out of an xcb connection, so
+      // connect to $DISPLAY and make sure it sees the same window.
+      xcb_connection_t* connection = xcb_connect(nullptr, nullptr);
+      if (xcb_connection_has_error(connection)) {
+        xcb_disconnect(connection);
+        return nullptr;
+      }
+
+      auto appRect = getWindowRect(appConnection, window);
+      auto ourRect = getWindowRect(connection, window);
+      if (!appRect || !ourRect ||
+          appRect->offset.x != ourRect->offset.x || appRect->offset.y != ourRect->offset.y ||
+          appRect->extent.width != ourRect->extent.width || appRect->extent.height != ourRect->extent.height) {
+        fprintf(stderr, "[Gamescope WSI] Geometry cache: window 0x%x is not visible on $DISPLAY, not tracking it.\n", window);
+        xcb_disconnect(connection);
+        return nullptr;
+      }
+
+      int wakeFd = eventfd(0, EFD_CLOEXEC);
+      if (wakeFd < 0) {
+        xcb_disconnect(connection);
+        return nullptr;
+      }
+
+      auto tracker = std::unique_ptr<WindowGeometryTracker>(new WindowGeometryTracker(connection, window, wakeFd));
+      tracker->resync();
+      tracker->m_thread = std::thread([tracker = tracker.get()]() { tracker->run(); });
+      return tracker;
+    }
+
+    ~WindowGeometryTracker() {
+      if (m_thread.joinable()) {
+        uint64_t value = 1;
+        (void) !write(m_wakeFd, &value, sizeof(value));
+        m_thread.join();
+      }
+      close(m_wakeFd);
+      xcb_disconnect(m_connection);
+    }
+
+    WindowGeometryTracker(const WindowGeometryTracker&) = delete;
+    WindowGeometryTracker& operator=(const WindowGeometryTracker&) = delete;
+
+    // std::nullopt if the window could not be queried, or the tracker stopped.
+    std::optional<WindowGeometry> snapshot() const {
+      std::unique_lock lock(m_mutex);
+      return m_geometry;
+    }
+
+  private:
+    WindowGeometryTracker(xcb_connection_t* connection, xcb_window_t window, int wakeFd)
+      : m_connection(connection), m_window(window), m_wakeFd(wakeFd) {}
+
+    static bool affectsGeometry(uint8_t responseType) {
+      switch (responseType) {
+        case XCB_CONFIGURE_NOTIFY:
+        case XCB_MAP_NOTIFY:
+        case XCB_UNMAP_NOTIFY:
+        case XCB_CREATE_NOTIFY:
+        case XCB_DESTROY_NOTIFY:
+        case XCB_REPARENT_NOTIFY:
+        case XCB_GRAVITY_NOTIFY:
+        case XCB_CIRCULATE_NOTIFY:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    void selectInput(xcb_window_t window, uint32_t eventMask) {
+      xcb_change_window_attributes(m_connection, window, XCB_CW_EVENT_MASK, &eventMask);
+    }
+
+    // Watch the window, its children (via SubstructureNotify) and every
+    // ancestor up to the toplevel, then take a fresh snapshot.
+    // Events that arrive while we are querying will just trigger another resync.
+    void resync() {
+      std::vector<xcb_window_t> ancestors;
+      for (xcb_window_t window = m_window;;) {
+        auto reply = Reply<xcb_query_tree_reply_t>{ xcb_query_tree_reply(m_connection, xcb_query_tree(m_connection, window), nullptr) };
+        if (!reply || reply->parent == reply->root)
+          break;
+        window = reply->parent;
+        ancestors.push_back(window);
+      }
+
+      selectInput(m_window, XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY);
+      for (xcb_window_t ancestor : m_watchedAncestors) {
+        if (std::find(ancestors.begin(), ancestors.end(), ancestor) == ancestors.end())
+          selectInput(ancestor, XCB_EVENT_MASK_NO_EVENT);
+      }
+      for (xcb_window_t ancestor : ancestors)
+        selectInput(ancestor, XCB_EVENT_MASK_STRUCTURE_NOTIFY);
+      m_watchedAncestors = std::move(ancestors);
+
+      std::optional<WindowGeometry> geometry = queryWindowGeometry(m_connection, m_window);
+
+      std::unique_lock lock(m_mutex);
+      m_geometry = geometry;
+    }
+
+    void run() {
+      pthread_setname_np(pthread_self(), "gamescope-wsi-geo");
+
+      processEvents();
+
+      // Nothing is keeping the snapshot up to date anymore, whatever stopped us,
+      // so make presents go back to querying the window themselves.
+      std::unique_lock lock(m_mutex);
+      m_geometry = std::nullopt;
+    }
+
+    void processEvents() {
+      pollfd fds[2] = {
+        { .fd = xcb_get_file_descriptor(m_connection), .events = POLLIN, .revents = 0 },
+        { .fd = m_wakeFd,                              .events = POLLIN, .revents = 0 },
+      };
+
+      for (;;) {
+        // Coalesce everything that is already queued into one resync.
+        bool dirty = false;
+        while (auto event = Reply<xcb_generic_event_t>{ xcb_poll_for_event(m_connection) })
+          dirty |= affectsGeometry(event->response_type & ~0x80);
+
+        if (xcb_connection_has_error(m_connection)) {
+          fprintf(stderr, "[Gamescope WSI] Geometry cache: lost X connection for window 0x%x.\n", m_window);
+          return;
+        }
+
+        if (dirty) {
+          resync();
+          continue;
+        }
+
+        xcb_flush(m_connection);
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+          fprintf(stderr, "[Gamescope WSI] Geometry cache: poll failed for window 0x%x: %s.\n", m_window, strerror(errno));
+          return;
+        }
+
+        if (fds[1].revents & POLLIN)
+          return;
+      }
+    }
+
+    xcb_connection_t* m_connection;
+    xcb_window_t m_window;
+    int m_wakeFd;
+    std::thread m_thread;
+    std::vector<xcb_window_t> m_watchedAncestors;
+
+    mutable std::mutex m_mutex;
+    std::optional<WindowGeometry> m_geometry;
+  };
+
 }
 
 inline int32_t iabs(int32_t a) {
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include <xdg-shell-client-protocol.h>
+
+// Measures how fast gamescope takes SHM commits.
+//
+// Maps an xdg_toplevel and commits full-surface damage into a small pool of wl_shm
+// buffers, as fast as buffers come back (no frame callbacks), then reports commits/sec
+// and the average time between committing a buffer and gamescope releasing it.
+//
+// With a damage size, only a square of that size moving over a static background
+// is damaged every commit instead, for comparing how long gamescope's composites
+// take on the GPU for small vs. full damage (composite_gpu_timing + composite_damage_stats).
+//
+// Usage: gamescope_shm_bench [width] [height] [seconds] [buffers] [damage size]
+
+#define WAYLAND_NULL() []<typename... Args> ( void *pData, Args... args ) { }
+#define WAYLAND_USERDATA_TO_THIS(type, name) []<typename... Args> ( void *pData, Args... args ) { type *pThing = (type *)pData; pThing->name( std::forward<Args>(args)... ); }
+
+namespace gamescope
+{
+    static uint64_t GetTimeNs()
+    {
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return uint64_t( ts.tv_sec ) * 1'000'000'000ul + uint64_t( ts.tv_nsec );
+    }
+
+    class CShmBench
+    {
+    public:
+        ~CShmBench();
+
+        bool Init( uint32_t uWidth, uint32_t uHeight, uint32_t uBufferCount, uint32_t uDamageSize );
+        void Run( uint32_t uSeconds );
+
+    private:
+        struct ShmBuffer_t
+        {
+            CShmBench *pBench = nullptr;
+            wl_buffer *pBuffer = nullptr;
+            uint32_t *pPixels = nullptr;
+            bool bBusy = false;
+            uint64_t ulCommitTime = 0;
+        };
+
+        void DrawAndCommit( ShmBuffer_t *pBuffer );
+        void GetDamageSquare( uint64_t ulFrame, int32_t *pnX, int32_t *pnY ) const;
+
+        void Wayland_Registry_Global( wl_registry *pRegistry, uint32_t uName, const char *pInterface, uint32_t uVersion );
+        void Wayland_WMBase_Ping( xdg_wm_base *pWMBase, uint32_t uSerial );
+        void Wayland_XdgSurface_Configure( xdg_surface *pXdgSurface, uint32_t uSerial );
+        static void Wayland_Buffer_Release( void *pData, wl_buffer *pBuffer );
+
+        static const wl_registry_listener s_RegistryListener;
+        static const xdg_wm_base_listener s_WMBaseListener;
+        static const xdg_surface_listener s_XdgSurfaceListener;
+        static const xdg_toplevel_listener s_XdgToplevelListener;
+        static const wl_buffer_listener s_BufferListener;
+
+        wl_display *m_pDisplay = nullptr;
+        wl_compositor *m_pCompositor = nullptr;
+        wl_shm *m_pShm = nullptr;
+        xdg_wm_base *m_pWMBase = nullptr;
+
+        wl_surface *m_pSurface = nullptr;
+        xdg_surface *m_pXdgSurface = nullptr;
+        xdg_toplevel *m_pXdgToplevel = nullptr;
+        bool m_bConfigured = false;
+
+        uint32_t m_uWidth = 0;
+        uint32_t m_uHeight = 0;
+        uint32_t m_uDamageSize = 0;
+        void *m_pPoolData = nullptr;
+        size_t m_zPoolSize = 0;
+        std::vector<ShmBuffer_t> m_Buffers;
+
+        uint64_t m_ulFrame = 0;
+        uint64_t m_ulReleases = 0;
+        uint64_t m_ulTotalLatency = 0;
+    };
+
+    CShmBench::~CShmBench()
+    {
+        for ( ShmBuffer_t &buffer : m_Buffers )
+            wl_buffer_destroy( buffer.pBuffer );
+        if ( m_pPoolData )
+            munmap( m_pPoolData, m_zPoolSize );
+        if ( m_pXdgToplevel )
+            xdg_toplevel_destroy( m_pXdgToplevel );
+        if ( m_pXdgSurface )
+            xdg_surface_destroy( m_pXdgSurface );
+        if ( m_pSurface )
+            wl_surface_destroy( m_pSurface );
+        if ( m_pDisplay )
+            wl_display_disconnect( m_pDisplay );
+    }
+
+    bool CShmBench::Init( uint32_t uWidth, uint32_t uHeight, uint32_t uBufferCount, uint32_t uDamageSize )
+    {
+        m_uWidth = uWidth;
+        m_uHeight = uHeight;
+        m_uDamageSize = std::min( uDamageSize, std::min( uWidth, uHeight ) );
+
+        const char *pDisplayName = getenv( "GAMESCOPE_WAYLAND_DISPLAY" );
+        if ( !pDisplayName || !*pDisplayName )
+            pDisplayName = "gamescope-0";
+
+        if ( !( m_pDisplay = wl_display_connect( pDisplayName ) ) )
+        {
+            fprintf( stderr, "Failed to open GAMESCOPE_WAYLAND_DISPLAY.\n" );
+            return false;
+        }
+
+        {
+            wl_registry *pRegistry;
+            if ( !( pRegistry = wl_display_get_registry( m_pDisplay ) ) )
+            {
+                fprintf( stderr, "Failed to get wl_registry.\n" );
+                return false;
+            }
+
+            wl_registry_add_listener( pRegistry, &s_RegistryListener, (void *)this );
+            wl_display_roundtrip( m_pDisplay );
+
+            if ( !m_pCompositor || !m_pShm || !m_pWMBase )
+            {
+                fprintf( stderr, "Missing wl_compositor, wl_shm or xdg_wm_base.\n" );
+                return false;
+            }
+
+            wl_registry_destroy( pRegistry );
+        }
+
+        const int32_t nStride = int32_t( m_uWidth * 4 );
+        const size_t zBufferSize = size_t( nStride ) * m_uHeight;
+        m_zPoolSize = zBufferSize * uBufferCount;
+
+        int nFd = memfd_create( "gamescope-shm-bench", MFD_CLOEXEC );
+        if ( nFd < 0 || ftruncate( nFd, m_zPoolSize ) != 0 )
+        {
+            fprintf( stderr, "Failed to create SHM pool.\n" );
+            return false;
+        }
+
+        m_pPoolData = mmap( nullptr, m_zPoolSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0 );
+        if ( m_pPoolData == MAP_FAILED )
+        {
+            m_pPoolData = nullptr;
+            close( nFd );
+            fprintf( stderr, "Failed to map SHM pool.\n" );
+            return false;
+        }
+
+        wl_shm_pool *pPool = wl_shm_create_pool( m_pShm, nFd, int32_t( m_zPoolSize ) );
+        close( nFd );
+
+        m_Buffers.resize( uBufferCount );
+        for ( uint32_t i = 0; i < uBufferCount; i++ )
+        {
+            ShmBuffer_t &buffer = m_Buffers[i];
+            buffer.pBench = this;
+            buffer.pPixels = reinterpret_cast<uint32_t *>( reinterpret_cast<uint8_t *>( m_pPoolData ) + zBufferSize * i );
+            buffer.pBuffer = wl_shm_pool_create_buffer( pPool, int32_t( zBufferSize * i ), int32_t( m_uWidth ), int32_t( m_uHeight ), nStride, WL_SHM_FORMAT_XRGB8888 );
+            wl_buffer_add_listener( buffer.pBuffer, &s_BufferListener, &buffer );
+        }
+        wl_shm_pool_destroy( pPool );
+
+        m_pSurface = wl_compositor_create_surface( m_pCompositor );
+        m_pXdgSurface = xdg_wm_base_get_xdg_surface( m_pWMBase, m_pSurface );
+        xdg_surface_add_listener( m_pXdgSurface, &s_XdgSurfaceListener, (void *)this );
+        m_pXdgToplevel = xdg_surface_get_toplevel( m_pXdgSurface );
+        xdg_toplevel_add_listener( m_pXdgToplevel, &s_XdgToplevelListener, (void *)this );
+        xdg_toplevel_set_title( m_pXdgToplevel, "gamescope_shm_bench" );
+        wl_surface_commit( m_pSurface );
+
+        while ( !m_bConfigured )
+        {
+            if ( wl_display_dispatch( m_pDisplay ) < 0 )
+                return false;
+        }
+
+        return true;
+    }
+
+    void CShmBench::GetDamageSquare( uint64_t ulFrame, int32_t *pnX, int32_t *pnY ) const
+    {
+        // Bounce along the diagonal, a few pixels per frame.
+        const uint32_t uRangeX = m_uWidth - m_uDamageSize + 1;
+        const uint32_t uRangeY = m_uHeight - m_uDamageSize + 1;
+        const uint64_t ulStep = ulFrame * 7;
+        *pnX = int32_t( ulStep % uRangeX );
+        *pnY = int32_t( ulStep % uRangeY );
+    }
+
+    void CShmBench::DrawAndCommit( ShmBuffer_t *pBuffer )
+    {
+        // Touch every pixel, like a software renderer would.
+        const uint32_t uColor = uint32_t( m_ulFrame * 0x010305 );
+        const size_t zPixels = size_t( m_uWidth ) * m_uHeight;
+
+        wl_surface_attach( m_pSurface, pBuffer->pBuffer, 0, 0 );
+
+        if ( m_uDamageSize )
+        {
+            // Every buffer gets the whole frame, so the damage only has to cover
+            // where the square was last frame and where it is now.
+            for ( size_t i = 0; i < zPixels; i++ )
+                pBuffer->pPixels[i] = 0xff202020;
+
+            int32_t nX, nY;
+            GetDamageSquare( m_ulFrame, &nX, &nY );
+            for ( uint32_t y = 0; y < m_uDamageSize; y++ )
+            {
+                uint32_t *pRow = pBuffer->pPixels + size_t( nY + y ) * m_uWidth + nX;
+                for ( uint32_t x = 0; x < m_uDamageSize; x++ )
+                    pRow[x] = uColor;
+            }
+            wl_surface_damage_buffer( m_pSurface, nX, nY, int32_t( m_uDamageSize ), int32_t( m_uDamageSize ) );
+
+            if ( m_ulFrame )
+            {
+                GetDamageSquare( m_ulFrame - 1, &nX, &nY );
+                wl_surface_damage_buffer( m_pSurface, nX, nY, int32_t( m_uDamageSize ), int32_t( m_uDamageSize ) );
+            }
+        }
+        else
+        {
+            for ( size_t i = 0; i < zPixels; i++ )
+                pBuffer->pPixels[i] = uColor;
+
+            wl_surface_damage_buffer( m_pSurface, 0, 0, int32_t( m_uWidth ), int32_t( m_uHeight ) );
+        }
+
+        wl_surface_commit( m_pSurface );
+
+        pBuffer->bBusy = true;
+        pBuffer->ulCommitTime = GetTimeNs();
+        m_ulFrame++;
+    }
+
+    void CShmBench::Run( uint32_t uSeconds )
+    {
+        const uint64_t ulStart = GetTimeNs();
+        const uint64_t ulEnd = ulStart + uint64_t( uSeconds ) * 1'000'000'000ul;
+
+        while ( GetTimeNs() < ulEnd )
+        {
+            bool bCommitted = false;
+            for ( ShmBuffer_t &buffer : m_Buffers )
+            {
+                if ( !buffer.bBusy )
+                {
+                    DrawAndCommit( &buffer );
+                    bCommitted = true;
+                    break;
+                }
+            }
+
+            if ( bCommitted )
+            {
+                wl_display_flush( m_pDisplay );
+                wl_display_dispatch_pending( m_pDisplay );
+            }
+            else if ( wl_display_dispatch( m_pDisplay ) < 0 )
+            {
+                fprintf( stderr, "Lost connection to gamescope.\n" );
+                return;
+            }
+        }
+
+        const double flSeconds = double( GetTimeNs() - ulStart ) / 1'000'000'000.0;
+        fprintf( stdout, "%ux%u, %zu buffers, %s damage: %lu commits in %.2fs, %.1f commits/sec, %.3fms average commit -> release\n",
+            m_uWidth, m_uHeight, m_Buffers.size(), m_uDamageSize ? "partial" : "full",
+            m_ulFrame, flSeconds, double( m_ulFrame ) / flSeconds,
+            m_ulReleases ? double( m_ulTotalLatency ) / double( m_ulReleases ) / 1'000'000.0 : 0.0 );
+    }
+
+    void CShmBench::Wayland_Registry_Global( wl_registry *pRegistry, uint32_t uName, const char *pInterface, uint32_t uVersion )
+    {
+        if ( !strcmp( pInterface, wl_compositor_interface.name ) )
+        {
+            m_pCompositor = (decltype(m_pCompositor)) wl_registry_bind( pRegistry, uName, &wl_compositor_interface, 4u );
+        }
+        else if ( !strcmp( pInterface, wl_shm_interface.name ) )
+        {
+            m_pShm = (decltype(m_pShm)) wl_registry_bind( pRegistry, uName, &wl_shm_interface, 1u );
+        }
+        else if ( !strcmp( pInterface, xdg_wm_base_interface.name ) )
+        {
+            m_pWMBase = (decltype(m_pWMBase)) wl_registry_bind( pRegistry, uName, &xdg_wm_base_interface, 1u );
+            xdg_wm_base_add_listener( m_pWMBase, &s_WMBaseListener, (void *)this );
+        }
+    }
+
+    void CShmBench::Wayland_WMBase_Ping( xdg_wm_base *pWMBase, uint32_t uSerial )
+    {
+        xdg_wm_base_pong( pWMBase, uSerial );
+    }
+
+    void CShmBench::Wayland_XdgSurface_Configure( xdg_surface *pXdgSurface, uint32_t uSerial )
+    {
+        xdg_surface_ack_configure( pXdgSurface, uSerial );
+        m_bConfigured = true;
+    }
+
+    /*static*/ void CShmBench::Wayland_Buffer_Release( void *pData, wl_buffer *pBuffer )
+    {
+        ShmBuffer_t *pShmBuffer = reinterpret_cast<ShmBuffer_t *>( pData );
+        pShmBuffer->bBusy = false;
+        pShmBuffer->pBench->m_ulReleases++;
+        pShmBuffer->pBench->m_ulTotalLatency += GetTimeNs() - pShmBuffer->ulCommitTime;
+    }
+
+    const wl_registry_listener CShmBench::s_RegistryListener =
+    {
+        .global        = WAYLAND_USERDATA_TO_THIS( CShmBench, Wayland_Registry_Global ),
+        .global_remove = WAYLAND_NULL(),
+    };
+
+    const xdg_wm_base_listener CShmBench::s_WMBaseListener =
+    {
+        .ping = WAYLAND_USERDATA_TO_THIS( CShmBench, Wayland_WMBase_Ping ),
+    };
+
+    const xdg_surface_listener CShmBench::s_XdgSurfaceListener =
+    {
+        .configure = WAYLAND_USERDATA_TO_THIS( CShmBench, Wayland_XdgSurface_Configure ),
+    };
+
+    const xdg_toplevel_listener CShmBench::s_XdgToplevelListener =
+    {
+        .configure = WAYLAND_NULL(),
+        .close     = WAYLAND_NULL(),
+    };
+
+    const wl_buffer_listener CShmBench::s_BufferListener =
+    {
+        .release = CShmBench::Wayland_Buffer_Release,
+    };
+
+    static int RunShmBench( int argc, char *argv[] )
+    {
+        uint32_t uWidth   = argc > 1 ? uint32_t( atoi( argv[1] ) ) : 1920;
+        uint32_t uHeight  = argc > 2 ? uint32_t( atoi( argv[2] ) ) : 1080;
+        uint32_t uSeconds = argc > 3 ? uint32_t( atoi( argv[3] ) ) : 10;
+        uint32_t uBuffers = argc > 4 ? uint32_t( atoi( argv[4] ) ) : 3;
+        uint32_t uDamageSize = argc > 5 ? uint32_t( atoi( argv[5] ) ) : 0;
+
+        if ( !uWidth || !uHeight || !uBuffers )
+        {
+            fprintf( stderr, "Usage: %s [width] [height] [seconds] [buffers] [damage size]\n", argv[0] );
+            return 1;
+        }
+
+        gamescope::CShmBench bench;
+        if ( !bench.Init( uWidth, uHeight, uBuffers, uDamageSize ) )
+            return 1;
+
+        bench.Run( uSeconds );
+
+        return 0;
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    return gamescope::RunShmBench( argc, argv );
+}
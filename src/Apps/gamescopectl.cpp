@@ -63,6 +63,7 @@ namespace gamescope
         void Wayland_GamescopeControl_FeatureSupport( gamescope_control *pGamescopeControl, uint32_t uFeature, uint32_t uVersion, uint32_t uFlags );
         void Wayland_GamescopeControl_ActiveDisplayInfo( gamescope_control *pGamescopeControl, const char *pConnectorName, const char *pDisplayMake, const char *pDisplayModel, uint32_t uDisplayFlags, wl_array *pValidRefreshRatesArray );
         void Wayland_GamescopeControl_ScreenshotTaken( gamescope_control *pGamescopeControl, const char *pPath );
+        void Wayland_GamescopeControl_FrameTiming( gamescope_control *pGamescopeControl, uint32_t uFrameID, uint32_t uFlags, wl_array *pTimings, wl_array *pCounters );
         static const gamescope_control_listener s_GamescopeControlListener;
 
         void Wayland_GamescopePrivate_Log( gamescope_private *pGamescopePrivate, const char *pText );
@@ -186,12 +187,17 @@ namespace gamescope
     {
         fprintf( stderr, "Screenshot taken to: %s\n", pPath );
     }
+    void GamescopeCtl::Wayland_GamescopeControl_FrameTiming( gamescope_control *pGamescopeControl, uint32_t uFrameID, uint32_t uFlags, wl_array *pTimings, wl_array *pCounters )
+    {
+        // We never ask for these, but they are the same as 'gamescopectl dump_frame_timing'.
+    }
 
     const gamescope_control_listener GamescopeCtl::s_GamescopeControlListener =
     {
         .feature_support     = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_FeatureSupport ),
         .active_display_info = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_ActiveDisplayInfo ),
         .screenshot_taken    = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_ScreenshotTaken ),
+        .frame_timing        = WAYLAND_USERDATA_TO_THIS( GamescopeCtl, Wayland_GamescopeControl_FrameTiming ),
     };
 
     void GamescopeCtl::Wayland_GamescopePrivate_Log( gamescope_private *pGamescopePrivate, const char *pText )
@@ -226,6 +232,8 @@ namespace gamescope
                 return "Refresh Cycle Only Change Refresh Rate";
             case GAMESCOPE_CONTROL_FEATURE_MURA_CORRECTION:
                 return "Mura Correction";
+            case GAMESCOPE_CONTROL_FEATURE_FRAME_TIMING:
+                return "Frame Timing";
             default:
                 return "Unknown";
         }
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <poll.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cinttypes>
@@ -23,13 +24,13 @@
 #include <span>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "backend.h"
 #include "color_helpers.h"
 #include "Utils/Defer.h"
+#include "Utils/PlaneAssignmentCache.h"
 #include "drm_include.h"
 #include "edid.h"
 #include "gamescope_shared.h"
@@ -53,6 +54,7 @@
 #include "wlr_end.hpp"
 
 #include "gamescope-control-protocol.h"
+#include "FrameTelemetry.h"
 
 static constexpr bool k_bUseCursorPlane = false;
 
@@ -72,6 +74,8 @@ gamescope::ConVar<bool> cv_drm_debug_disable_color_range( "drm_debug_disable_col
 gamescope::ConVar<bool> cv_drm_debug_disable_explicit_sync( "drm_debug_disable_explicit_sync", false, "Force disable explicit sync on the DRM backend." );
 gamescope::ConVar<bool> cv_drm_debug_disable_in_fence_fd( "drm_debug_disable_in_fence_fd", false, "Force disable IN_FENCE_FD being set to avoid over-synchronization on the DRM backend." );
 
+gamescope::ConVar<int> cv_drm_liftoff_cache_size( "drm_liftoff_cache_size", 64, "How many layer configurations to remember liftoff's plane assignment (or failure) for." );
+
 gamescope::ConVar<bool> cv_drm_allow_dynamic_modes_for_external_display( "drm_allow_dynamic_modes_for_external_display", false, "Allow dynamic mode/refresh rate switching for external displays." );
 
 int HackyDRMPresent( const FrameInfo_t *pFrameInfo, bool bAsync );
@@ -126,6 +130,8 @@ struct drm_t {
 	struct liftoff_device *lo_device;
 	struct liftoff_output *lo_output;
 	struct liftoff_layer *lo_layers[ k_nMaxLayers ];
+	// What's set on lo_layers, for replaying cached plane assignments.
+	gamescope::CLayerProperties lo_layer_properties[ k_nMaxLayers ];
 
 	std::shared_ptr<gamescope::BackendBlob> sdr_static_metadata;
 
@@ -284,6 +290,9 @@ namespace gamescope
 
 		drmModePlane *GetModePlane() const { return m_pPlane.get(); }
 
+		// For properties set through liftoff, which we don't track. 0 if there's no such property.
+		uint32_t GetPropertyId( const char *pszName ) const;
+
 		struct PlaneProperties
 		{
 			std::optional<CDRMAtomicProperty> *begin() { return &FB_ID; }
@@ -324,6 +333,7 @@ namespace gamescope
 	private:
 		CAutoDeletePtr<drmModePlane> m_pPlane;
 		PlaneProperties m_Props;
+		DRMObjectRawProperties m_RawProperties;
 	};
 
 	class CDRMCRTC final : public CDRMAtomicTypedObject<DRM_MODE_OBJECT_CRTC>
@@ -732,6 +742,7 @@ static void page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsi
 	// This is the last vblank time
 	uint64_t vblanktime = sec * 1'000'000'000lu + usec * 1'000lu;
 	GetVBlankTimer().MarkVBlank( vblanktime, true );
+	gamescope::CFrameTelemetry::Get().MarkFlip( vblanktime );
 
 	// TODO: get the fbids_queued instance from data if we ever have more than one in flight
 
@@ -1726,7 +1737,18 @@ struct LiftoffStateCacheEntryKasher
 };
 
 
-std::unordered_set<LiftoffStateCacheEntry, LiftoffStateCacheEntryKasher> g_LiftoffStateCache;
+// Layer configurations liftoff could or couldn't put on planes.
+using LiftoffStateCache = gamescope::CPlaneAssignmentCache<LiftoffStateCacheEntry, LiftoffStateCacheEntryKasher, k_nMaxLayers>;
+LiftoffStateCache g_LiftoffStateCache;
+
+static gamescope::ConCommand cc_drm_liftoff_cache_stats( "drm_liftoff_cache_stats", "Print how often liftoff plane assignments came from the cache and how many test commits that took.",
+[]( std::span<std::string_view> args )
+{
+	const gamescope::PlaneAssignmentCacheStats_t stats = g_LiftoffStateCache.GetStats();
+
+	console_log.infof( "Liftoff cache: %" PRIu64 "/%d entries, %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " known unsupported, %" PRIu64 " failed replays, %" PRIu64 " test commits, %" PRIu64 " evictions",
+		stats.ulEntries, int( cv_drm_liftoff_cache_size ), stats.ulHits, stats.ulMisses, stats.ulUnsupportedHits, stats.ulReplayFailures, stats.ulTestCommits, stats.ulEvictions );
+});
 
 static inline amdgpu_transfer_function colorspace_to_plane_degamma_tf(GamescopeAppTextureColorspace colorspace)
 {
@@ -2011,9 +2033,20 @@ namespace gamescope
 			m_Props.AMD_PLANE_LUT3D          = CDRMAtomicProperty::Instantiate( "AMD_PLANE_LUT3D",          this, *rawProperties );
 			m_Props.AMD_PLANE_BLEND_TF       = CDRMAtomicProperty::Instantiate( "AMD_PLANE_BLEND_TF",       this, *rawProperties );
 			m_Props.AMD_PLANE_BLEND_LUT      = CDRMAtomicProperty::Instantiate( "AMD_PLANE_BLEND_LUT",      this, *rawProperties );
+
+			m_RawProperties = std::move( *rawProperties );
 		}
 	}
 
+	uint32_t CDRMPlane::GetPropertyId( const char *pszName ) const
+	{
+		auto iter = m_RawProperties.find( pszName );
+		if ( iter == m_RawProperties.end() )
+			return 0;
+
+		return iter->second.uPropertyId;
+	}
+
 	/////////////////////////
 	// CDRMCRTC
 	/////////////////////////
@@ -2498,6 +2531,92 @@ namespace gamescope
 	}
 }
 
+// Plane properties and test commits for replaying cached liftoff plane
+// assignments into drm->req.
+class CDRMLiftoffRequest final : public gamescope::IKMSPlaneProperties
+{
+public:
+	CDRMLiftoffRequest( struct drm_t *drm ) : m_pDRM( drm ) {}
+
+	uint32_t GetPlanePropertyId( uint32_t uPlaneId, const char *pszName ) override
+	{
+		for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : m_pDRM->planes )
+		{
+			if ( pPlane->GetObjectId() == uPlaneId )
+				return pPlane->GetPropertyId( pszName );
+		}
+
+		return 0;
+	}
+
+	int GetRequestCursor() override
+	{
+		return drmModeAtomicGetCursor( m_pDRM->req );
+	}
+
+	void SetRequestCursor( int nCursor ) override
+	{
+		drmModeAtomicSetCursor( m_pDRM->req, nCursor );
+	}
+
+	bool AddProperty( uint32_t uObjectId, uint32_t uPropertyId, uint64_t ulValue ) override
+	{
+		return drmModeAtomicAddProperty( m_pDRM->req, uObjectId, uPropertyId, ulValue ) >= 0;
+	}
+
+	int TestCommit() override
+	{
+		// Same flags as liftoff's own test commits.
+		const uint32_t uFlags = ( m_pDRM->flags & ~DRM_MODE_PAGE_FLIP_EVENT ) | DRM_MODE_ATOMIC_TEST_ONLY;
+		return drmModeAtomicCommit( m_pDRM->fd, m_pDRM->req, uFlags, nullptr );
+	}
+
+private:
+	struct drm_t *m_pDRM = nullptr;
+};
+
+static void drm_layer_set_property( struct drm_t *drm, int nLayer, const char *pszName, uint64_t ulValue )
+{
+	liftoff_layer_set_property( drm->lo_layers[ nLayer ], pszName, ulValue );
+	drm->lo_layer_properties[ nLayer ].Set( pszName, ulValue );
+}
+
+static void drm_layer_unset_property( struct drm_t *drm, int nLayer, const char *pszName )
+{
+	liftoff_layer_unset_property( drm->lo_layers[ nLayer ], pszName );
+	drm->lo_layer_properties[ nLayer ].Unset( pszName );
+}
+
+static void drm_clear_layer_properties( struct drm_t *drm )
+{
+	for ( int i = 0; i < k_nMaxLayers; i++ )
+		drm->lo_layer_properties[ i ].Clear();
+}
+
+// Remembers which planes liftoff just put the layers on.
+static void drm_record_liftoff_assignment( struct drm_t *drm, const LiftoffStateCacheEntry &entry, int nLayerCount )
+{
+	uint32_t uPlaneIds[ k_nMaxLayers ];
+	for ( int i = 0; i < nLayerCount; i++ )
+	{
+		struct liftoff_plane *pPlane = liftoff_layer_get_plane( drm->lo_layers[ i ] );
+		if ( !pPlane )
+			return;
+
+		uPlaneIds[ i ] = liftoff_plane_get_id( pPlane );
+	}
+
+	// liftoff turns off every plane it didn't use.
+	std::vector<uint32_t> unusedPlaneIds;
+	for ( std::unique_ptr< gamescope::CDRMPlane > &pPlane : drm->planes )
+	{
+		if ( std::find( uPlaneIds, uPlaneIds + nLayerCount, pPlane->GetObjectId() ) == uPlaneIds + nLayerCount )
+			unusedPlaneIds.push_back( pPlane->GetObjectId() );
+	}
+
+	g_LiftoffStateCache.RecordSupported( entry, std::span<const uint32_t>( uPlaneIds, nLayerCount ), unusedPlaneIds );
+}
+
 static int
 drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, bool needs_modeset )
 {
@@ -2507,11 +2626,14 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 	// move to another CRTC or whatever which might have differing caps.
 	// (same with different modes)
 	if (needs_modeset)
-		g_LiftoffStateCache.clear();
+		g_LiftoffStateCache.Clear();
 
-	if (is_liftoff_caching_enabled())
+	g_LiftoffStateCache.SetMaxEntries( std::max( int( cv_drm_liftoff_cache_size ), 1 ) );
+
+	const bool bCaching = is_liftoff_caching_enabled();
+	if (bCaching)
 	{
-		if (g_LiftoffStateCache.count(entry) != 0)
+		if (g_LiftoffStateCache.Find(entry) == LiftoffStateCache::Lookup_t::Unsupported)
 			return -EINVAL;
 	}
 
@@ -2533,17 +2655,17 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			const int nFence = cv_drm_debug_disable_in_fence_fd ? -1 : g_nAlwaysSignalledSyncFile;
 
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", pDrmFb->GetFbId());
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", nFence );
+			drm_layer_set_property( drm, i, "FB_ID", pDrmFb->GetFbId());
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", nFence );
 			drm->m_FbIdsInRequest.emplace_back( pDrmFb );
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "zpos", entry.layerState[i].zpos );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "alpha", frameInfo->layers[ i ].opacity * 0xffff);
+			drm_layer_set_property( drm, i, "zpos", entry.layerState[i].zpos );
+			drm_layer_set_property( drm, i, "alpha", frameInfo->layers[ i ].opacity * 0xffff);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_X", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_Y", 0);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_W", entry.layerState[i].srcW );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "SRC_H", entry.layerState[i].srcH );
+			drm_layer_set_property( drm, i, "SRC_X", 0);
+			drm_layer_set_property( drm, i, "SRC_Y", 0);
+			drm_layer_set_property( drm, i, "SRC_W", entry.layerState[i].srcW );
+			drm_layer_set_property( drm, i, "SRC_H", entry.layerState[i].srcH );
 
 			uint64_t ulOrientation = DRM_MODE_ROTATE_0;
 			switch ( drm->pConnector->GetCurrentOrientation() )
@@ -2562,13 +2684,13 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 				ulOrientation = DRM_MODE_ROTATE_180;
 				break;
 			}
-			liftoff_layer_set_property( drm->lo_layers[ i ], "rotation", ulOrientation );
+			drm_layer_set_property( drm, i, "rotation", ulOrientation );
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_X", entry.layerState[i].crtcX);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_Y", entry.layerState[i].crtcY);
+			drm_layer_set_property( drm, i, "CRTC_X", entry.layerState[i].crtcX);
+			drm_layer_set_property( drm, i, "CRTC_Y", entry.layerState[i].crtcY);
 
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_W", entry.layerState[i].crtcW);
-			liftoff_layer_set_property( drm->lo_layers[ i ], "CRTC_H", entry.layerState[i].crtcH);
+			drm_layer_set_property( drm, i, "CRTC_W", entry.layerState[i].crtcW);
+			drm_layer_set_property( drm, i, "CRTC_H", entry.layerState[i].crtcH);
 
 			if ( frameInfo->layers[i].applyColorMgmt )
 			{
@@ -2576,20 +2698,20 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 				if ( !cv_drm_debug_disable_color_encoding && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_ENCODING", entry.layerState[i].colorEncoding );
+					drm_layer_set_property( drm, i, "COLOR_ENCODING", entry.layerState[i].colorEncoding );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
+					drm_layer_unset_property( drm, i, "COLOR_ENCODING" );
 				}
 
 				if ( !cv_drm_debug_disable_color_range && bYCbCr )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "COLOR_RANGE",    entry.layerState[i].colorRange );
+					drm_layer_set_property( drm, i, "COLOR_RANGE",    entry.layerState[i].colorRange );
 				}
 				else
 				{
-					liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+					drm_layer_unset_property( drm, i, "COLOR_RANGE" );
 				}
 
 				if ( drm_supports_color_mgmt( drm ) )
@@ -2613,23 +2735,23 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 					bool bUseDegamma = !cv_drm_debug_disable_degamma_tf;
 					if ( bUseDegamma )
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", degamma_tf );
+						drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", degamma_tf );
 					else
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", 0 );
 
 					bool bUseShaperAnd3DLUT = !cv_drm_debug_disable_shaper_and_3dlut;
 					if ( bUseShaperAnd3DLUT )
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", shaper_tf );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", drm->pending.shaperlut_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", shaper_tf );
+						drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", drm->pending.lut3d_id[ ColorSpaceToEOTFIndex( entry.layerState[i].colorspace ) ]->GetBlobValue() );
 						// Josh: See shaders/colorimetry.h colorspace_blend_tf if you have questions as to why we start doing sRGB for BLEND_TF despite potentially working in Gamma 2.2 space prior.
 					}
 					else
 					{
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-						liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+						drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
 					}
 				}
 			}
@@ -2637,47 +2759,56 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 			{
 				if ( drm_supports_color_mgmt( drm ) )
 				{
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 				}
 			}
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
 				if (!cv_drm_debug_disable_blend_tf && !bSinglePlane)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
+					drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", drm->pending.output_tf );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+					drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
 
 				if (!cv_drm_debug_disable_ctm && frameInfo->layers[i].ctm != nullptr)
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", frameInfo->layers[i].ctm->GetBlobValue() );
 				else
-					liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+					drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 		else
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "FB_ID", 0 );
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_layer_set_property( drm, i, "FB_ID", 0 );
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
 
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_ENCODING" );
-			liftoff_layer_unset_property( drm->lo_layers[ i ], "COLOR_RANGE" );
+			drm_layer_unset_property( drm, i, "COLOR_ENCODING" );
+			drm_layer_unset_property( drm, i, "COLOR_RANGE" );
 
 			if ( drm_supports_color_mgmt( drm ) )
 			{
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_LUT", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_SHAPER_TF", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_LUT3D", 0 );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
-				liftoff_layer_set_property( drm->lo_layers[ i ], "AMD_PLANE_CTM", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_DEGAMMA_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_LUT", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_SHAPER_TF", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_LUT3D", 0 );
+				drm_layer_set_property( drm, i, "AMD_PLANE_BLEND_TF", AMDGPU_TRANSFER_FUNCTION_DEFAULT );
+				drm_layer_set_property( drm, i, "AMD_PLANE_CTM", 0 );
 			}
 		}
 	}
 
+	// Known to work, skip straight to checking it still does.
+	CDRMLiftoffRequest liftoffRequest( drm );
+	if ( bCaching && !needs_modeset &&
+	     g_LiftoffStateCache.TryReplay( entry, drm->lo_layer_properties, drm->pCRTC->GetObjectId(), &liftoffRequest ) )
+	{
+		drm_log.debugf( "can drm present %i layers (cached)", frameInfo->layerCount );
+		return 0;
+	}
+
 	struct liftoff_output_apply_options lo_options = {
 		.timeout_ns = std::numeric_limits<int64_t>::max()
 	};
@@ -2697,7 +2828,7 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 		attempted_in_fence_fallback = true;
 		for ( int i = 0; i < frameInfo->layerCount; i++ )
 		{
-			liftoff_layer_set_property( drm->lo_layers[ i ], "IN_FENCE_FD", -1 );
+			drm_layer_set_property( drm, i, "IN_FENCE_FD", -1 );
 		}
 
 		ret = liftoff_output_apply( drm->lo_output, drm->req, drm->flags, &lo_options );
@@ -2718,11 +2849,14 @@ drm_prepare_liftoff( struct drm_t *drm, const struct FrameInfo_t *frameInfo, boo
 
 	// If we aren't modesetting and we got -EINVAL, that means that we
 	// probably can't do this layout, so add it to our state cache so we don't
-	// try it again.
+	// try it again. If it worked, remember how, so next time it's just one
+	// test commit.
 	if (!needs_modeset)
 	{
 		if (ret == -EINVAL)
-			g_LiftoffStateCache.insert(entry);
+			g_LiftoffStateCache.RecordUnsupported(entry);
+		else if (ret == 0 && bCaching)
+			drm_record_liftoff_assignment( drm, entry, frameInfo->layerCount );
 	}
 
 	if ( ret == 0 )
@@ -3029,6 +3163,7 @@ static bool drm_set_crtc( struct drm_t *drm, gamescope::CDRMCRTC *pCRTC )
 		if ( drm->lo_layers[ i ] == nullptr )
 			return false;
 	}
+	drm_clear_layer_properties( drm );
 
 	liftoff_output_destroy( drm->lo_output );
 	drm->lo_output = lo_output;
@@ -3072,6 +3207,7 @@ static void drm_unset_connector( struct drm_t *drm )
 		liftoff_layer_destroy( drm->lo_layers[ i ] );
 		drm->lo_layers[ i ] = nullptr;
 	}
+	drm_clear_layer_properties( drm );
 
 	liftoff_output_destroy(drm->lo_output);
 	drm->lo_output = nullptr;
@@ -3524,6 +3660,7 @@ namespace gamescope
 				g_uCompositeDebug |= CompositeDebugFlag::Markers_Partial;
 
 			std::optional oCompositeResult = vulkan_composite( &compositeFrameInfo, nullptr, !bNeedsFullComposite );
+			gamescope::CFrameTelemetry::Get().MarkCompositeSubmit();
 
 			m_bWasCompositing = true;
 
@@ -3536,6 +3673,7 @@ namespace gamescope
 			}
 
 			vulkan_wait( *oCompositeResult, true );
+			gamescope::CFrameTelemetry::Get().MarkGPUDone();
 
 			FrameInfo_t presentCompFrameInfo = {};
 			presentCompFrameInfo.allowVRR = pFrameInfo->allowVRR;
@@ -3889,6 +4027,8 @@ namespace gamescope
 
 				return ret;
 			} else {
+				gamescope::CFrameTelemetry::Get().MarkCommit();
+
 				// Our request went through!
 				// Clear what we swapped with (what was previously queued)
 				drm->m_FbIdsInRequest.clear();
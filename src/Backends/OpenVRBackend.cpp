@@ -1049,9 +1049,7 @@ namespace gamescope
 
                                                     vDelta *= float( cv_vr_trackpad_sensitivity );
 
-                                                    wlserver_lock();
-                                                    wlserver_mousemotion( vDelta.x, vDelta.y, ++m_uFakeTimestamp );
-                                                    wlserver_unlock();
+                                                    wlserver_queue_mousemotion( vDelta.x, vDelta.y, ++m_uFakeTimestamp );
                                                 }
                                             }
                                             else
@@ -1111,15 +1109,11 @@ namespace gamescope
                                                     uint64_t ulClickTime = ulNow - m_ulMouseDownTime;
                                                     if ( ulClickTime <= cv_vr_trackpad_click_time && flMaxAbsTotalDelta <= cv_vr_trackpad_click_max_delta )
                                                     {
-                                                        wlserver_lock();
-                                                        wlserver_mousebutton( BTN_LEFT, true, ++m_uFakeTimestamp );
-                                                        wlserver_unlock();
+                                                        wlserver_queue_mousebutton( BTN_LEFT, true, ++m_uFakeTimestamp );
 
                                                         sleep_for_nanos( g_SteamCompMgrLimitedAppRefreshCycle + 1'000'000 );
 
-                                                        wlserver_lock();
-                                                        wlserver_mousebutton( BTN_LEFT, false, ++m_uFakeTimestamp );
-                                                        wlserver_unlock();
+                                                        wlserver_queue_mousebutton( BTN_LEFT, false, ++m_uFakeTimestamp );
                                                     }
                                                     else
                                                     {
@@ -1145,9 +1139,7 @@ namespace gamescope
                                         SetFocus( pConnector );
                                         float flX = -vrEvent.data.scroll.xdelta * m_flScrollSpeed;
                                         float flY = -vrEvent.data.scroll.ydelta * m_flScrollSpeed;
-                                        wlserver_lock();
-                                        wlserver_mousewheel( flX, flY, ++m_uFakeTimestamp );
-                                        wlserver_unlock();
+                                        wlserver_queue_mousewheel( flX, flY, ++m_uFakeTimestamp );
                                         bDidScrollThisFrame = true;
                                         break;
                                     }
@@ -662,9 +662,7 @@ namespace gamescope
 					{
 						if ( g_bWindowFocused )
 						{
-							wlserver_lock();
-							wlserver_mousemotion( event.motion.xrel, event.motion.yrel, fake_timestamp );
-							wlserver_unlock();
+							wlserver_queue_mousemotion( event.motion.xrel, event.motion.yrel, fake_timestamp );
 						}
 					}
 					else
@@ -683,19 +681,15 @@ namespace gamescope
 				case SDL_MOUSEBUTTONDOWN:
 				case SDL_MOUSEBUTTONUP:
 				{
-					wlserver_lock();
-					wlserver_mousebutton( SDLButtonToLinuxButton( event.button.button ),
+					wlserver_queue_mousebutton( SDLButtonToLinuxButton( event.button.button ),
 										event.button.state == SDL_PRESSED,
 										fake_timestamp );
-					wlserver_unlock();
 				}
 				break;
 
 				case SDL_MOUSEWHEEL:
 				{
-					wlserver_lock();
-					wlserver_mousewheel( -event.wheel.x, -event.wheel.y, fake_timestamp );
-					wlserver_unlock();
+					wlserver_queue_mousewheel( -event.wheel.x, -event.wheel.y, fake_timestamp );
 				}
 				break;
 
@@ -796,9 +790,7 @@ namespace gamescope
 					if ( event.key.repeat )
 						break;
 
-					wlserver_lock();
-					wlserver_key( key, event.type == SDL_KEYDOWN, fake_timestamp );
-					wlserver_unlock();
+					wlserver_queue_key( key, event.type == SDL_KEYDOWN, fake_timestamp );
 				}
 				break;
 
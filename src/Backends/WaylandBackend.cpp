@@ -2,6 +2,7 @@
 #include "rendervulkan.hpp"
 #include "wlserver.hpp"
 #include "vblankmanager.hpp"
+#include "FrameTelemetry.h"
 #include "steamcompmgr.hpp"
 #include "edid.h"
 #include "Utils/Defer.h"
@@ -1070,6 +1071,7 @@ namespace gamescope
             else
             {
                 std::optional oCompositeResult = vulkan_composite( (FrameInfo_t *)pFrameInfo, nullptr, false );
+                gamescope::CFrameTelemetry::Get().MarkCompositeSubmit();
 
                 if ( !oCompositeResult )
                 {
@@ -1078,6 +1080,7 @@ namespace gamescope
                 }
 
                 vulkan_wait( *oCompositeResult, true );
+                gamescope::CFrameTelemetry::Get().MarkGPUDone();
 
                 FrameInfo_t::Layer_t compositeLayer{};
                 compositeLayer.scale.x = 1.0;
@@ -2913,9 +2916,7 @@ namespace gamescope
             }
         }
 
-        wlserver_lock();
-        wlserver_key( uKey, bPressed, ++m_uFakeTimestamp );
-        wlserver_unlock();
+        wlserver_queue_key( uKey, bPressed, ++m_uFakeTimestamp );
     }
 
     // Registry
@@ -3035,9 +3036,7 @@ namespace gamescope
         if ( !cv_wayland_mouse_warp_without_keyboard_focus && !m_bKeyboardEntered )
             return;
 
-        wlserver_lock();
-        wlserver_mousebutton( uButton, uState == WL_POINTER_BUTTON_STATE_PRESSED, ++m_uFakeTimestamp );
-        wlserver_unlock();
+        wlserver_queue_mousebutton( uButton, uState == WL_POINTER_BUTTON_STATE_PRESSED, ++m_uFakeTimestamp );
     }
     void CWaylandInputThread::Wayland_Pointer_Axis( wl_pointer *pPointer, uint32_t uTime, uint32_t uAxis, wl_fixed_t fValue )
     {
@@ -3079,9 +3078,7 @@ namespace gamescope
         if ( flX == 0.0 && flY == 0.0 )
             return;
 
-        wlserver_lock();
-        wlserver_mousewheel( flX, flY, ++m_uFakeTimestamp );
-        wlserver_unlock();
+        wlserver_queue_mousewheel( flX, flY, ++m_uFakeTimestamp );
     }
 
     // Keyboard
@@ -3182,9 +3179,7 @@ namespace gamescope
         if ( !cv_wayland_mouse_relmotion_without_keyboard_focus && !m_bKeyboardEntered )
             return;
 
-        wlserver_lock();
-        wlserver_mousemotion( wl_fixed_to_double( fDxUnaccel ), wl_fixed_to_double( fDyUnaccel ), ++m_uFakeTimestamp );
-        wlserver_unlock();
+        wlserver_queue_mousemotion( wl_fixed_to_double( fDxUnaccel ), wl_fixed_to_double( fDyUnaccel ), ++m_uFakeTimestamp );
     }
 
     /////////////////////////
@@ -10,16 +10,67 @@ namespace gamescope
     // CBufferMemo
     /////////////////
 
-    CBufferMemo::CBufferMemo( CBufferMemoizer *pMemoizer, wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture )
+    // Past this many rects, take their bounding box instead.
+    static constexpr int k_nMaxDamageRects = 16;
+
+    CBufferMemo::CBufferMemo( CBufferMemoizer *pMemoizer, wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture, wlr_surface *pSurface )
         : m_pMemoizer{ pMemoizer }
         , m_pBuffer{ pBuffer }
+        , m_pSurface{ pSurface }
         , m_pVulkanTexture{ std::move( pTexture ) }
     {
+        pixman_region32_init( &m_Damage );
     }
 
     CBufferMemo::~CBufferMemo()
     {
         wl_list_remove( &m_DeleteListener.link );
+        pixman_region32_fini( &m_Damage );
+    }
+
+    void CBufferMemo::AddDamage( const std::optional<std::vector<pixman_box32_t>> &oDamage )
+    {
+        if ( m_bFullDamage )
+            return;
+
+        if ( !oDamage )
+        {
+            m_bFullDamage = true;
+            pixman_region32_clear( &m_Damage );
+            return;
+        }
+
+        for ( const pixman_box32_t &box : *oDamage )
+            pixman_region32_union_rect( &m_Damage, &m_Damage, box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1 );
+
+        if ( pixman_region32_n_rects( &m_Damage ) > k_nMaxDamageRects )
+        {
+            pixman_box32_t extents = *pixman_region32_extents( &m_Damage );
+            pixman_region32_reset( &m_Damage, &extents );
+        }
+    }
+
+    std::optional<std::vector<pixman_box32_t>> CBufferMemo::TakeDamage( wlr_surface *pSurface )
+    {
+        // Whatever happened to it on another surface, we never heard about.
+        bool bFullDamage = m_bFullDamage || m_pSurface != pSurface;
+
+        std::vector<pixman_box32_t> damage;
+        if ( !bFullDamage )
+        {
+            int nRects = 0;
+            const pixman_box32_t *pRects = pixman_region32_rectangles( &m_Damage, &nRects );
+            damage.assign( pRects, pRects + nRects );
+        }
+
+        m_pSurface = pSurface;
+        m_bFullDamage = false;
+        pixman_region32_clear( &m_Damage );
+
+        if ( bFullDamage )
+            return std::nullopt;
+
+        return damage;
     }
 
     void CBufferMemo::Finalize()
@@ -49,7 +100,7 @@ namespace gamescope
         return iter->second.GetVulkanTexture();
     }
 
-    void CBufferMemoizer::MemoizeBuffer( wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture )
+    void CBufferMemoizer::MemoizeBuffer( wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture, wlr_surface *pSurface )
     {
         memo_log.debugf( "Memoizing new buffer: wlr_buffer %p -> texture: %p", pBuffer, pTexture.get() );
 
@@ -64,7 +115,7 @@ namespace gamescope
             std::scoped_lock lock{ m_mutBufferMemos };
             auto [ iter, bSuccess ] = m_BufferMemos.emplace( std::piecewise_construct,
                 std::forward_as_tuple( pBuffer ),
-                std::forward_as_tuple( this, pBuffer, std::move( pTexture ) ) );
+                std::forward_as_tuple( this, pBuffer, std::move( pTexture ), pSurface ) );
 
             assert( bSuccess );
             pMemo = &iter->second;
@@ -81,4 +132,24 @@ namespace gamescope
         assert( iter != m_BufferMemos.end() );
         m_BufferMemos.erase( iter );
     }
-}
\ No newline at end of file
+
+    void CBufferMemoizer::AddSurfaceDamage( wlr_surface *pSurface, const std::optional<std::vector<pixman_box32_t>> &oDamage )
+    {
+        std::scoped_lock lock{ m_mutBufferMemos };
+        for ( auto &[ pBuffer, memo ] : m_BufferMemos )
+        {
+            if ( memo.GetSurface() == pSurface )
+                memo.AddDamage( oDamage );
+        }
+    }
+
+    std::optional<std::vector<pixman_box32_t>> CBufferMemoizer::TakeBufferDamage( wlr_buffer *pBuffer, wlr_surface *pSurface )
+    {
+        std::scoped_lock lock{ m_mutBufferMemos };
+        auto iter = m_BufferMemos.find( pBuffer );
+        if ( iter == m_BufferMemos.end() )
+            return std::nullopt;
+
+        return iter->second.TakeDamage( pSurface );
+    }
+}
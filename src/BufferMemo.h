@@ -3,8 +3,12 @@
 #include "rc.h"
 #include "rendervulkan.hpp"
 
+#include <optional>
 #include <unordered_map>
 #include <mutex>
+#include <vector>
+
+#include <pixman-1/pixman.h>
 
 struct wl_listener;
 struct wlr_buffer;
@@ -21,21 +25,34 @@ namespace gamescope
     class CBufferMemo
     {
     public:
-        CBufferMemo( CBufferMemoizer *pMemoizer, wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture );
+        CBufferMemo( CBufferMemoizer *pMemoizer, wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture, wlr_surface *pSurface );
         ~CBufferMemo();
 
+        CBufferMemo( const CBufferMemo & ) = delete;
+        CBufferMemo &operator=( const CBufferMemo & ) = delete;
+
         void Finalize();
 
         CBufferMemoizer *GetMemoizer() const { return m_pMemoizer; }
 
         const OwningRc<CVulkanTexture> &GetVulkanTexture() const { return m_pVulkanTexture; }
 
+        wlr_surface *GetSurface() const { return m_pSurface; }
+        void AddDamage( const std::optional<std::vector<pixman_box32_t>> &oDamage );
+        std::optional<std::vector<pixman_box32_t>> TakeDamage( wlr_surface *pSurface );
+
         void OnBufferDestroyed( void *pUserData );
     private:
         CBufferMemoizer *m_pMemoizer = nullptr;
         wlr_buffer *m_pBuffer = nullptr;
         wl_listener m_DeleteListener = WAYLAND_LISTENER( m_DeleteListener, OnBufferDestroyed );
 
+        // The surface this buffer was last committed to, and what the client has
+        // damaged on that surface since the texture was last updated from it.
+        wlr_surface *m_pSurface = nullptr;
+        bool m_bFullDamage = false;
+        pixman_region32_t m_Damage;
+
         // OwningRc to have a private reference:
         // So we can keep the CVulkanTexture, as public references
         // determine when we give the texture/buffer back to the app.
@@ -48,8 +65,16 @@ namespace gamescope
         // Must return an OwningRc for the locking to make sense and not deadlock.
         OwningRc<CVulkanTexture> LookupVulkanTexture( wlr_buffer *pBuffer ) const;
 
-        void MemoizeBuffer( wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture );
+        void MemoizeBuffer( wlr_buffer *pBuffer, OwningRc<CVulkanTexture> pTexture, wlr_surface *pSurface = nullptr );
         void UnmemoizeBuffer( wlr_buffer *pBuffer );
+
+        // Buffer age for textures that get updated from the buffer's memory (wl_shm):
+        // a commit's damage is relative to the surface's previous commit, which may
+        // well have used another buffer. So it goes to every buffer of the surface,
+        // and a buffer takes everything that built up since its last update when it
+        // gets committed again. std::nullopt means everything.
+        void AddSurfaceDamage( wlr_surface *pSurface, const std::optional<std::vector<pixman_box32_t>> &oDamage );
+        std::optional<std::vector<pixman_box32_t>> TakeBufferDamage( wlr_buffer *pBuffer, wlr_surface *pSurface );
     private:
         mutable std::mutex m_mutBufferMemos;
         std::unordered_map<wlr_buffer *, CBufferMemo> m_BufferMemos;
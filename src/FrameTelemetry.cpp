@@ -0,0 +1,201 @@
+#include "FrameTelemetry.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "convar.h"
+#include "log.hpp"
+#include "steamcompmgr.hpp"
+#include "vblankmanager.hpp"
+
+namespace gamescope
+{
+    CFrameTelemetry &CFrameTelemetry::Get()
+    {
+        static CFrameTelemetry s_Instance;
+        return s_Instance;
+    }
+
+    void CFrameTelemetry::BeginFrame( const VBlankTime &time )
+    {
+        m_PendingRecord = FrameTelemetryRecord_t
+        {
+            .ulTargetVBlank = time.schedule.ulTargetVBlank,
+            .ulScheduledWakeup = time.schedule.ulScheduledWakeupPoint,
+            .ulWakeup = time.ulWakeupTime,
+            .ulLatch = get_time_in_nanos(),
+        };
+        m_bInFrame = true;
+    }
+
+    void CFrameTelemetry::MarkCompositeSubmit()
+    {
+        if ( m_bInFrame )
+            m_PendingRecord.ulCompositeSubmit = get_time_in_nanos();
+    }
+
+    void CFrameTelemetry::MarkGPUDone()
+    {
+        if ( m_bInFrame )
+            m_PendingRecord.ulGPUDone = get_time_in_nanos();
+    }
+
+    void CFrameTelemetry::MarkCommit()
+    {
+        if ( m_bInFrame )
+            m_PendingRecord.ulCommit = get_time_in_nanos();
+    }
+
+    void CFrameTelemetry::MarkFlip( uint64_t ulFlipTime )
+    {
+        m_ulLastFlip.store( ulFlipTime, std::memory_order_release );
+    }
+
+    FrameTelemetryRecord_t CFrameTelemetry::EndFrame( bool bComposited, uint64_t ulRefreshCycle )
+    {
+        m_bInFrame = false;
+
+        FrameTelemetryRecord_t record = m_PendingRecord;
+
+        // The DRM backend waits for the flip before returning from the present,
+        // so anything at or after our commit is ours.
+        const uint64_t ulLastFlip = m_ulLastFlip.load( std::memory_order_acquire );
+        if ( record.ulCommit && ulLastFlip >= record.ulCommit )
+            record.ulFlip = ulLastFlip;
+
+        if ( bComposited )
+            record.uFlags |= FrameTelemetryFlag_Composited;
+
+        if ( record.ulWakeup > record.ulScheduledWakeup + k_ulLateWakeupThreshold )
+            record.uFlags |= FrameTelemetryFlag_LateWakeup;
+
+        // Landing more than half a cycle after the vblank we were aiming for
+        // means we got the one after it (or later).
+        if ( record.ulFlip && record.ulFlip > record.ulTargetVBlank + ulRefreshCycle / 2 )
+            record.uFlags |= FrameTelemetryFlag_MissedVBlank;
+
+        const uint64_t ulFrameIndex = m_ulFrameCount.load( std::memory_order_relaxed );
+        record.ulFrameID = ulFrameIndex;
+
+        Slot_t &slot = m_Slots[ ulFrameIndex % k_uRecordCount ];
+        slot.ulSeq.store( ulFrameIndex * 2 + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+        slot.record = record;
+        slot.ulSeq.store( ( ulFrameIndex + 1 ) * 2, std::memory_order_release );
+        m_ulFrameCount.store( ulFrameIndex + 1, std::memory_order_release );
+
+        m_ulFrames.fetch_add( 1, std::memory_order_relaxed );
+        if ( bComposited )
+            m_ulComposited.fetch_add( 1, std::memory_order_relaxed );
+        if ( record.uFlags & FrameTelemetryFlag_MissedVBlank )
+            m_ulMissedVBlanks.fetch_add( 1, std::memory_order_relaxed );
+        if ( record.uFlags & FrameTelemetryFlag_LateWakeup )
+            m_ulLateWakeups.fetch_add( 1, std::memory_order_relaxed );
+
+        return record;
+    }
+
+    std::vector<FrameTelemetryRecord_t> CFrameTelemetry::GetRecentFrames( uint32_t uMaxRecords ) const
+    {
+        const uint64_t ulFrameCount = m_ulFrameCount.load( std::memory_order_acquire );
+        const uint64_t ulCount = std::min<uint64_t>( { ulFrameCount, uMaxRecords, k_uRecordCount } );
+
+        std::vector<FrameTelemetryRecord_t> records;
+        records.reserve( ulCount );
+        for ( uint64_t ulFrameIndex = ulFrameCount - ulCount; ulFrameIndex < ulFrameCount; ulFrameIndex++ )
+        {
+            const Slot_t &slot = m_Slots[ ulFrameIndex % k_uRecordCount ];
+            const uint64_t ulExpectedSeq = ( ulFrameIndex + 1 ) * 2;
+
+            if ( slot.ulSeq.load( std::memory_order_acquire ) != ulExpectedSeq )
+                continue;
+
+            FrameTelemetryRecord_t record = slot.record;
+
+            std::atomic_thread_fence( std::memory_order_acquire );
+            // Overwritten while we were copying it, skip.
+            if ( slot.ulSeq.load( std::memory_order_relaxed ) != ulExpectedSeq )
+                continue;
+
+            records.push_back( record );
+        }
+
+        return records;
+    }
+
+    FrameTelemetryCounters_t CFrameTelemetry::GetCounters() const
+    {
+        FrameTelemetryCounters_t counters =
+        {
+            .ulFrames = m_ulFrames.load( std::memory_order_relaxed ),
+            .ulComposited = m_ulComposited.load( std::memory_order_relaxed ),
+            .ulMissedVBlanks = m_ulMissedVBlanks.load( std::memory_order_relaxed ),
+            .ulLateWakeups = m_ulLateWakeups.load( std::memory_order_relaxed ),
+        };
+        counters.ulScanout = counters.ulFrames - std::min( counters.ulComposited, counters.ulFrames );
+        return counters;
+    }
+
+    void CFrameTelemetry::ResetCounters()
+    {
+        m_ulFrames = 0;
+        m_ulComposited = 0;
+        m_ulMissedVBlanks = 0;
+        m_ulLateWakeups = 0;
+    }
+
+    // Stage time relative to the target vblank, in ms. Negative is before it.
+    static double StageOffsetMs( uint64_t ulStage, uint64_t ulTargetVBlank )
+    {
+        return ( int64_t( ulStage ) - int64_t( ulTargetVBlank ) ) / 1'000'000.0;
+    }
+
+    static ConCommand cc_dump_frame_timing( "dump_frame_timing", "Print frame timing counters and the latest frames' timings. Args: [frame count, default 16]",
+    []( std::span<std::string_view> args )
+    {
+        uint32_t uFrameCount = 16;
+        if ( args.size() > 1 )
+        {
+            if ( std::optional<uint32_t> oCount = Parse<uint32_t>( args[1] ) )
+                uFrameCount = *oCount;
+        }
+
+        CFrameTelemetry &telemetry = CFrameTelemetry::Get();
+
+        FrameTelemetryCounters_t counters = telemetry.GetCounters();
+        console_log.infof( "Frames: %" PRIu64 " (%" PRIu64 " composited, %" PRIu64 " scanout) - missed vblanks: %" PRIu64 " - late wakeups: %" PRIu64,
+            counters.ulFrames, counters.ulComposited, counters.ulScanout, counters.ulMissedVBlanks, counters.ulLateWakeups );
+
+        if ( !uFrameCount )
+            return;
+
+        console_log.infof( "Times are in ms relative to the target vblank, '-' if the frame skipped that stage." );
+        console_log.infof( "%10s %9s %9s %9s %9s %9s %9s %9s  %s", "frame", "sched", "wakeup", "latch", "submit", "gpu", "commit", "flip", "flags" );
+
+        for ( const FrameTelemetryRecord_t &record : telemetry.GetRecentFrames( uFrameCount ) )
+        {
+            char szStages[7][16];
+            const uint64_t ulStages[7] = { record.ulScheduledWakeup, record.ulWakeup, record.ulLatch, record.ulCompositeSubmit, record.ulGPUDone, record.ulCommit, record.ulFlip };
+            for ( uint32_t i = 0; i < 7; i++ )
+            {
+                if ( ulStages[i] )
+                    snprintf( szStages[i], sizeof( szStages[i] ), "%.3f", StageOffsetMs( ulStages[i], record.ulTargetVBlank ) );
+                else
+                    snprintf( szStages[i], sizeof( szStages[i] ), "-" );
+            }
+
+            console_log.infof( "%10" PRIu64 " %9s %9s %9s %9s %9s %9s %9s  %s%s%s",
+                record.ulFrameID,
+                szStages[0], szStages[1], szStages[2], szStages[3], szStages[4], szStages[5], szStages[6],
+                ( record.uFlags & FrameTelemetryFlag_Composited ) ? "composited " : "scanout ",
+                ( record.uFlags & FrameTelemetryFlag_MissedVBlank ) ? "missed " : "",
+                ( record.uFlags & FrameTelemetryFlag_LateWakeup ) ? "late " : "" );
+        }
+    });
+
+    static ConCommand cc_reset_frame_timing( "reset_frame_timing", "Reset the frame timing counters.",
+    []( std::span<std::string_view> args )
+    {
+        CFrameTelemetry::Get().ResetCounters();
+    });
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace gamescope
+{
+    struct VBlankTime;
+
+    // Matches gamescope_control_frame_timing_flags.
+    enum FrameTelemetryFlags : uint32_t
+    {
+        FrameTelemetryFlag_Composited   = ( 1u << 0 ),
+        FrameTelemetryFlag_MissedVBlank = ( 1u << 1 ),
+        FrameTelemetryFlag_LateWakeup   = ( 1u << 2 ),
+    };
+
+    // CLOCK_MONOTONIC nanoseconds for each stage of a presented frame.
+    // 0 if the frame didn't go through that stage, eg. no composite
+    // for direct scanout or no flip on the nested backends.
+    struct FrameTelemetryRecord_t
+    {
+        uint64_t ulFrameID = 0;
+        uint64_t ulTargetVBlank = 0;
+        uint64_t ulScheduledWakeup = 0;
+        uint64_t ulWakeup = 0;
+        uint64_t ulLatch = 0;
+        uint64_t ulCompositeSubmit = 0;
+        uint64_t ulGPUDone = 0;
+        uint64_t ulCommit = 0;
+        uint64_t ulFlip = 0;
+        uint32_t uFlags = 0;
+    };
+
+    struct FrameTelemetryCounters_t
+    {
+        uint64_t ulFrames = 0;
+        uint64_t ulComposited = 0;
+        uint64_t ulScanout = 0;
+        uint64_t ulMissedVBlanks = 0;
+        uint64_t ulLateWakeups = 0;
+    };
+
+    // Per-frame timings of the vblank timer -> paint -> flip pipeline,
+    // kept in a ring that can be read from any thread without blocking the
+    // compositor. Every slot has a seqlock style sequence:
+    // odd while being written, ( frame + 1 ) * 2 once complete.
+    class CFrameTelemetry
+    {
+    public:
+        static constexpr uint32_t k_uRecordCount = 512;
+        // How far past the scheduled wakeup point still counts as on time.
+        static constexpr uint64_t k_ulLateWakeupThreshold = 500'000; // 0.5ms
+
+        static CFrameTelemetry &Get();
+
+        // Everything but MarkFlip is only called from the steamcompmgr thread.
+        void BeginFrame( const VBlankTime &time );
+        void MarkCompositeSubmit();
+        void MarkGPUDone();
+        void MarkCommit();
+        // From the page flip handler.
+        void MarkFlip( uint64_t ulFlipTime );
+        FrameTelemetryRecord_t EndFrame( bool bComposited, uint64_t ulRefreshCycle );
+
+        // Up to uMaxRecords of the latest frames, oldest first.
+        std::vector<FrameTelemetryRecord_t> GetRecentFrames( uint32_t uMaxRecords ) const;
+        FrameTelemetryCounters_t GetCounters() const;
+        void ResetCounters();
+
+    private:
+        struct Slot_t
+        {
+            std::atomic<uint64_t> ulSeq = { 0 };
+            FrameTelemetryRecord_t record;
+        };
+        Slot_t m_Slots[ k_uRecordCount ];
+        std::atomic<uint64_t> m_ulFrameCount = { 0 };
+
+        FrameTelemetryRecord_t m_PendingRecord;
+        bool m_bInFrame = false;
+
+        std::atomic<uint64_t> m_ulLastFlip = { 0 };
+
+        std::atomic<uint64_t> m_ulFrames = { 0 };
+        std::atomic<uint64_t> m_ulComposited = { 0 };
+        std::atomic<uint64_t> m_ulMissedVBlanks = { 0 };
+        std::atomic<uint64_t> m_ulLateWakeups = { 0 };
+    };
+}
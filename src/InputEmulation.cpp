@@ -170,9 +170,7 @@ namespace gamescope
                 {
                     GetBackend()->NotifyPhysicalInput( InputType::Mouse );
 
-                    wlserver_lock();
-                    wlserver_mousemotion( eis_event_pointer_get_dx( pEisEvent ), eis_event_pointer_get_dy( pEisEvent ), ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousemotion( eis_event_pointer_get_dx( pEisEvent ), eis_event_pointer_get_dy( pEisEvent ), ++s_uSequence );
                 }
                 break;
 
@@ -180,25 +178,19 @@ namespace gamescope
                 {
                     GetBackend()->NotifyPhysicalInput( InputType::Mouse );
 
-                    wlserver_lock();
-                    wlserver_mousewarp( eis_event_pointer_get_absolute_x( pEisEvent ), eis_event_pointer_get_absolute_y( pEisEvent ), ++s_uSequence, true );
-                    wlserver_unlock();
+                    wlserver_queue_mousewarp( eis_event_pointer_get_absolute_x( pEisEvent ), eis_event_pointer_get_absolute_y( pEisEvent ), ++s_uSequence, true );
                 }
                 break;
 
                 case EIS_EVENT_BUTTON_BUTTON:
                 {
-                    wlserver_lock();
-                    wlserver_mousebutton( eis_event_button_get_button( pEisEvent ), eis_event_button_get_is_press( pEisEvent ), ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousebutton( eis_event_button_get_button( pEisEvent ), eis_event_button_get_is_press( pEisEvent ), ++s_uSequence );
                 }
                 break;
 
                 case EIS_EVENT_SCROLL_DELTA:
                 {
-                    wlserver_lock();
-                    wlserver_mousewheel( eis_event_scroll_get_dx( pEisEvent ), eis_event_scroll_get_dy( pEisEvent ), ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousewheel( eis_event_scroll_get_dx( pEisEvent ), eis_event_scroll_get_dy( pEisEvent ), ++s_uSequence );
                 }
                 break;
 
@@ -211,9 +203,7 @@ namespace gamescope
 
                 case EIS_EVENT_KEYBOARD_KEY:
                 {
-                    wlserver_lock();
-                    wlserver_key( eis_event_keyboard_get_key( pEisEvent ), eis_event_keyboard_get_key_is_press( pEisEvent ), ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_key( eis_event_keyboard_get_key( pEisEvent ), eis_event_keyboard_get_key_is_press( pEisEvent ), ++s_uSequence );
                 }
                 break;
 
@@ -236,9 +226,7 @@ namespace gamescope
                     if ( flScrollX == 0.0 && flScrollY == 0.0 )
                         break;
 
-                    wlserver_lock();
-                    wlserver_mousewheel( flScrollX, flScrollY, ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousewheel( flScrollX, flScrollY, ++s_uSequence );
                 }
                 break;
 
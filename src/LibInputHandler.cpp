@@ -112,9 +112,7 @@ namespace gamescope
 
                     GetBackend()->NotifyPhysicalInput( InputType::Mouse );
 
-                    wlserver_lock();
-                    wlserver_mousemotion( flDx, flDy, ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousemotion( flDx, flDy, ++s_uSequence );
                 }
                 break;
 
@@ -127,9 +125,7 @@ namespace gamescope
 
                     GetBackend()->NotifyPhysicalInput( InputType::Mouse );
 
-                    wlserver_lock();
-                    wlserver_mousewarp( flX, flY, ++s_uSequence, true );
-                    wlserver_unlock();
+                    wlserver_queue_mousewarp( flX, flY, ++s_uSequence, true );
                 }
                 break;
 
@@ -140,9 +136,7 @@ namespace gamescope
                     uint32_t uButton = libinput_event_pointer_get_button( pPointerEvent );
                     libinput_button_state eButtonState = libinput_event_pointer_get_button_state( pPointerEvent );
 
-                    wlserver_lock();
-                    wlserver_mousebutton( uButton, eButtonState == LIBINPUT_BUTTON_STATE_PRESSED, ++s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_mousebutton( uButton, eButtonState == LIBINPUT_BUTTON_STATE_PRESSED, ++s_uSequence );
                 }
                 break;
 
@@ -175,9 +169,7 @@ namespace gamescope
                     uint32_t uKey = libinput_event_keyboard_get_key( pKeyboardEvent );
                     libinput_key_state eState = libinput_event_keyboard_get_key_state( pKeyboardEvent );
 
-                    wlserver_lock();
-                wlserver_key( uKey, eState == LIBINPUT_KEY_STATE_PRESSED, ++    s_uSequence );
-                    wlserver_unlock();
+                    wlserver_queue_key( uKey, eState == LIBINPUT_KEY_STATE_PRESSED, ++s_uSequence );
                 }
                 break;
 
@@ -195,9 +187,7 @@ namespace gamescope
 
             if ( flScrollX != 0.0 || flScrollY != 0.0 )
             {
-                wlserver_lock();
-                wlserver_mousewheel( flScrollX, flScrollY, ++s_uSequence );
-                wlserver_unlock();
+                wlserver_queue_mousewheel( flScrollX, flScrollY, ++s_uSequence );
             }
         }
     }
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace gamescope
+{
+    // Half-open rect, [nX1, nX2) x [nY1, nY2).
+    struct DamageRect_t
+    {
+        int32_t nX1 = 0;
+        int32_t nY1 = 0;
+        int32_t nX2 = 0;
+        int32_t nY2 = 0;
+
+        bool IsEmpty() const { return nX2 <= nX1 || nY2 <= nY1; }
+        int64_t Area() const { return IsEmpty() ? 0 : int64_t( nX2 - nX1 ) * int64_t( nY2 - nY1 ); }
+
+        DamageRect_t Union( const DamageRect_t &other ) const
+        {
+            if ( IsEmpty() )
+                return other;
+            if ( other.IsEmpty() )
+                return *this;
+
+            return DamageRect_t{ std::min( nX1, other.nX1 ), std::min( nY1, other.nY1 ), std::max( nX2, other.nX2 ), std::max( nY2, other.nY2 ) };
+        }
+
+        DamageRect_t Intersect( const DamageRect_t &other ) const
+        {
+            DamageRect_t result{ std::max( nX1, other.nX1 ), std::max( nY1, other.nY1 ), std::min( nX2, other.nX2 ), std::min( nY2, other.nY2 ) };
+            return result.IsEmpty() ? DamageRect_t{} : result;
+        }
+
+        // Overlapping or sharing an edge.
+        bool Touches( const DamageRect_t &other ) const
+        {
+            return nX1 <= other.nX2 && other.nX1 <= nX2 &&
+                   nY1 <= other.nY2 && other.nY1 <= nY2;
+        }
+
+        bool operator == ( const DamageRect_t &other ) const = default;
+    };
+
+    // Buffer damage of a surface's commit relative to the last few commits
+    // before it, so a layer can still be partially recomposited if we
+    // skipped some of the commits in between.
+    class CCommitDamageHistory
+    {
+    public:
+        static constexpr uint32_t k_uMaxEntries = 4;
+
+        // Chains onto the previous commit of the same surface, rDamage being
+        // what changed since that one.
+        void Chain( const CCommitDamageHistory &prev, uint64_t ulPrevCommitID, const DamageRect_t &rDamage )
+        {
+            m_Entries[ 0 ] = Entry_t{ ulPrevCommitID, rDamage };
+            m_uCount = 1;
+
+            for ( uint32_t i = 0; i < prev.m_uCount && m_uCount < k_uMaxEntries; i++ )
+                m_Entries[ m_uCount++ ] = Entry_t{ prev.m_Entries[ i ].ulBaseCommitID, prev.m_Entries[ i ].rDamage.Union( rDamage ) };
+        }
+
+        // Bounding box of everything that changed since ulCommitID,
+        // nullopt if we don't know (eg. it's too old, or the whole buffer was damaged).
+        std::optional<DamageRect_t> DamageSince( uint64_t ulCommitID ) const
+        {
+            for ( uint32_t i = 0; i < m_uCount; i++ )
+            {
+                if ( m_Entries[ i ].ulBaseCommitID == ulCommitID )
+                    return m_Entries[ i ].rDamage;
+            }
+
+            return std::nullopt;
+        }
+
+    private:
+        struct Entry_t
+        {
+            uint64_t ulBaseCommitID = 0;
+            DamageRect_t rDamage;
+        };
+        std::array<Entry_t, k_uMaxEntries> m_Entries{};
+        uint32_t m_uCount = 0;
+    };
+
+    // The output pixels a texture rect can affect when the composite shaders sample
+    // it at ( output + offset ) * scale, padded for the filter footprint.
+    inline DamageRect_t TextureDamageToOutput( const DamageRect_t &rTexDamage, float flOffsetX, float flOffsetY, float flScaleX, float flScaleY )
+    {
+        if ( rTexDamage.IsEmpty() || flScaleX <= 0.0f || flScaleY <= 0.0f )
+            return DamageRect_t{};
+
+        // Bilinear and band-limited filtering reach up to a texel (or output pixel,
+        // when minifying) past the sample point.
+        const float flPadX = 1.0f + 1.0f / flScaleX;
+        const float flPadY = 1.0f + 1.0f / flScaleY;
+
+        return DamageRect_t
+        {
+            int32_t( std::floor( rTexDamage.nX1 / flScaleX - flOffsetX - flPadX ) ),
+            int32_t( std::floor( rTexDamage.nY1 / flScaleY - flOffsetY - flPadY ) ),
+            int32_t( std::ceil ( rTexDamage.nX2 / flScaleX - flOffsetX + flPadX ) ),
+            int32_t( std::ceil ( rTexDamage.nY2 / flScaleY - flOffsetY + flPadY ) ),
+        };
+    }
+
+    // What needs recompositing in an output image: a handful of tile aligned
+    // rects that get merged together once there are too many, or everything.
+    class CDamageRegion
+    {
+    public:
+        // A multiple of the composite shaders' 8x8 workgroups.
+        static constexpr int32_t k_nTileSize = 32;
+        static constexpr uint32_t k_uMaxRects = 8;
+
+        static CDamageRegion Full()
+        {
+            CDamageRegion region;
+            region.MarkFull();
+            return region;
+        }
+
+        void MarkFull()
+        {
+            m_bFull = true;
+            m_uRectCount = 0;
+        }
+
+        bool IsFull() const { return m_bFull; }
+        bool IsEmpty() const { return !m_bFull && m_uRectCount == 0; }
+
+        std::span<const DamageRect_t> Rects() const { return std::span<const DamageRect_t>{ m_Rects.data(), m_uRectCount }; }
+
+        int64_t Area() const
+        {
+            int64_t lArea = 0;
+            for ( const DamageRect_t &rect : Rects() )
+                lArea += rect.Area();
+            return lArea;
+        }
+
+        void Add( const DamageRect_t &rect )
+        {
+            if ( m_bFull || rect.IsEmpty() )
+                return;
+
+            DamageRect_t rTile = SnapToTiles( rect );
+
+            // Fold in everything this overlaps, which can make it grow into more.
+            for ( uint32_t i = 0; i < m_uRectCount; )
+            {
+                if ( m_Rects[ i ].Touches( rTile ) )
+                {
+                    rTile = rTile.Union( m_Rects[ i ] );
+                    m_Rects[ i ] = m_Rects[ --m_uRectCount ];
+                    i = 0;
+                    continue;
+                }
+                i++;
+            }
+
+            if ( m_uRectCount == k_uMaxRects )
+                MergeCheapestPair();
+
+            m_Rects[ m_uRectCount++ ] = rTile;
+        }
+
+        void Add( const CDamageRegion &other )
+        {
+            if ( other.m_bFull )
+            {
+                MarkFull();
+                return;
+            }
+
+            for ( const DamageRect_t &rect : other.Rects() )
+                Add( rect );
+        }
+
+        // Drops the parts outside of the output and goes full if most of it
+        // is damaged anyway, as one big dispatch beats a few slightly smaller ones.
+        void Clip( int32_t nWidth, int32_t nHeight, float flFullThreshold = 0.75f )
+        {
+            if ( m_bFull )
+                return;
+
+            const DamageRect_t rOutput{ 0, 0, nWidth, nHeight };
+
+            uint32_t uCount = 0;
+            for ( uint32_t i = 0; i < m_uRectCount; i++ )
+            {
+                DamageRect_t rect = m_Rects[ i ].Intersect( rOutput );
+                if ( !rect.IsEmpty() )
+                    m_Rects[ uCount++ ] = rect;
+            }
+            m_uRectCount = uCount;
+
+            if ( Area() >= int64_t( flFullThreshold * float( rOutput.Area() ) ) )
+                MarkFull();
+        }
+
+    private:
+        static DamageRect_t SnapToTiles( const DamageRect_t &rect )
+        {
+            auto FloorTile = []( int32_t n ) { return n >= 0 ? n / k_nTileSize * k_nTileSize : -( ( -n + k_nTileSize - 1 ) / k_nTileSize * k_nTileSize ); };
+            auto CeilTile = [&]( int32_t n ) { return -FloorTile( -n ); };
+
+            return DamageRect_t{ FloorTile( rect.nX1 ), FloorTile( rect.nY1 ), CeilTile( rect.nX2 ), CeilTile( rect.nY2 ) };
+        }
+
+        // Merges the two rects whose bounding box wastes the least area.
+        void MergeCheapestPair()
+        {
+            uint32_t uBestA = 0, uBestB = 1;
+            int64_t lBestWaste = INT64_MAX;
+            for ( uint32_t a = 0; a < m_uRectCount; a++ )
+            {
+                for ( uint32_t b = a + 1; b < m_uRectCount; b++ )
+                {
+                    int64_t lWaste = m_Rects[ a ].Union( m_Rects[ b ] ).Area() - m_Rects[ a ].Area() - m_Rects[ b ].Area();
+                    if ( lWaste < lBestWaste )
+                    {
+                        lBestWaste = lWaste;
+                        uBestA = a;
+                        uBestB = b;
+                    }
+                }
+            }
+
+            DamageRect_t rMerged = m_Rects[ uBestA ].Union( m_Rects[ uBestB ] );
+            m_Rects[ uBestB ] = m_Rects[ --m_uRectCount ];
+            m_Rects[ uBestA ] = rMerged;
+        }
+
+        std::array<DamageRect_t, k_uMaxRects> m_Rects{};
+        uint32_t m_uRectCount = 0;
+        bool m_bFull = false;
+    };
+
+    // Buffer age tracking for a ring of output images: remembers the damage of
+    // the last few composited frames so an image can be brought up to date by
+    // recompositing everything that changed since it was last written.
+    class COutputDamageTracker
+    {
+    public:
+        static constexpr uint32_t k_uMaxImages = 4;
+        static constexpr uint32_t k_uHistoryLength = 4;
+
+        void Invalidate()
+        {
+            for ( ImageState_t &image : m_Images )
+                image.bValid = false;
+        }
+
+        void InvalidateImage( uint32_t uImage )
+        {
+            if ( uImage < k_uMaxImages )
+                m_Images[ uImage ].bValid = false;
+        }
+
+        // Records the damage of a new frame that is about to be composited
+        // into uImage, and returns what of uImage needs recompositing for it.
+        CDamageRegion Advance( uint32_t uImage, const CDamageRegion &frameDamage )
+        {
+            m_ulFrame++;
+            m_FrameDamage[ m_ulFrame % k_uHistoryLength ] = frameDamage;
+
+            if ( uImage >= k_uMaxImages )
+                return CDamageRegion::Full();
+
+            ImageState_t &image = m_Images[ uImage ];
+
+            CDamageRegion region;
+            if ( !image.bValid || m_ulFrame - image.ulFrame > k_uHistoryLength )
+            {
+                region.MarkFull();
+            }
+            else
+            {
+                for ( uint64_t ulFrame = image.ulFrame + 1; ulFrame <= m_ulFrame; ulFrame++ )
+                    region.Add( m_FrameDamage[ ulFrame % k_uHistoryLength ] );
+            }
+
+            image.bValid = true;
+            image.ulFrame = m_ulFrame;
+
+            return region;
+        }
+
+    private:
+        struct ImageState_t
+        {
+            bool bValid = false;
+            uint64_t ulFrame = 0;
+        };
+        std::array<ImageState_t, k_uMaxImages> m_Images{};
+        std::array<CDamageRegion, k_uHistoryLength> m_FrameDamage{};
+        uint64_t m_ulFrame = 0;
+    };
+}
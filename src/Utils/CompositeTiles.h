@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "CompositeDamage.h"
+
+namespace gamescope
+{
+    // Where a composite layer shows up on the output.
+    struct CompositeTileLayer_t
+    {
+        // Every output pixel the layer can sample something other than
+        // transparent black for. Empty if it's invisible.
+        DamageRect_t rVisible;
+        // Output pixels the layer covers with fully opaque samples, hiding
+        // everything below it.
+        DamageRect_t rOpaque;
+    };
+
+    // Which layers contribute to each tile of the output, so the composite
+    // shaders can skip sampling the ones that are hidden or not there.
+    // Tiles line up with CDamageRegion's, and masks are a byte per tile,
+    // packed four to a uint32_t after the number of columns, which is what
+    // the shaders read.
+    class CCompositeTileMasks
+    {
+    public:
+        static constexpr int32_t k_nTileSize = CDamageRegion::k_nTileSize;
+        static constexpr uint32_t k_uMaxLayers = 8;
+
+        // Layers go bottom to top, the way they get blended.
+        void Classify( std::span<const CompositeTileLayer_t> layers, int32_t nWidth, int32_t nHeight )
+        {
+            assert( layers.size() <= k_uMaxLayers );
+
+            m_uColumns = uint32_t( std::max( nWidth, 0 ) + k_nTileSize - 1 ) / k_nTileSize;
+            m_uRows = uint32_t( std::max( nHeight, 0 ) + k_nTileSize - 1 ) / k_nTileSize;
+            m_uLayerCount = uint32_t( layers.size() );
+            m_ulLayerTiles = 0;
+
+            const uint32_t uTileCount = m_uColumns * m_uRows;
+            m_Buffer.assign( 1 + ( uTileCount + 3 ) / 4, 0 );
+            m_Buffer[ 0 ] = m_uColumns;
+
+            const DamageRect_t rOutput{ 0, 0, nWidth, nHeight };
+            for ( uint32_t uRow = 0; uRow < m_uRows; uRow++ )
+            {
+                for ( uint32_t uColumn = 0; uColumn < m_uColumns; uColumn++ )
+                {
+                    const int32_t nX = int32_t( uColumn ) * k_nTileSize;
+                    const int32_t nY = int32_t( uRow ) * k_nTileSize;
+                    const DamageRect_t rTile = DamageRect_t{ nX, nY, nX + k_nTileSize, nY + k_nTileSize }.Intersect( rOutput );
+
+                    uint32_t uMask = 0;
+                    for ( int32_t i = int32_t( layers.size() ) - 1; i >= 0; i-- )
+                    {
+                        if ( layers[ i ].rVisible.Intersect( rTile ).IsEmpty() )
+                            continue;
+
+                        uMask |= 1u << i;
+
+                        if ( layers[ i ].rOpaque.Intersect( rTile ) == rTile )
+                            break;
+                    }
+
+                    const uint32_t uTile = uRow * m_uColumns + uColumn;
+                    m_Buffer[ 1 + uTile / 4 ] |= uMask << ( ( uTile % 4 ) * 8 );
+                    m_ulLayerTiles += std::popcount( uMask );
+                }
+            }
+        }
+
+        uint32_t Columns() const { return m_uColumns; }
+        uint32_t Rows() const { return m_uRows; }
+
+        uint32_t Mask( uint32_t uColumn, uint32_t uRow ) const
+        {
+            const uint32_t uTile = uRow * m_uColumns + uColumn;
+            return ( m_Buffer[ 1 + uTile / 4 ] >> ( ( uTile % 4 ) * 8 ) ) & 0xff;
+        }
+
+        std::span<const uint32_t> Buffer() const { return m_Buffer; }
+
+        // How many layers get sampled over all tiles, out of how many would be without the masks.
+        uint64_t LayerTiles() const { return m_ulLayerTiles; }
+        uint64_t TotalLayerTiles() const { return uint64_t( m_uColumns ) * m_uRows * m_uLayerCount; }
+
+    private:
+        uint32_t m_uColumns = 0;
+        uint32_t m_uRows = 0;
+        uint32_t m_uLayerCount = 0;
+        uint64_t m_ulLayerTiles = 0;
+        std::vector<uint32_t> m_Buffer;
+    };
+}
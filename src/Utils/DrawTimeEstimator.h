@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace gamescope
+{
+    // The vblank timer's original draw time estimate.
+    //
+    // This is a rolling average when ulDrawTime < ulRollingMaxDrawTime,
+    // and a maximum when ulDrawTime > ulRollingMaxDrawTime.
+    //
+    // This allows us to deal with spikes in the draw buffer time very easily.
+    // eg. if we suddenly spike up (eg. because of test commits taking a stupid long time),
+    // we will then be able to deal with spikes in the long term, even if several commits after
+    // we get back into a good state and then regress again.
+    inline uint64_t CalcRollingMaxDrawTime( uint64_t ulRollingMaxDrawTime, uint64_t ulDrawTime, uint64_t ulRedZone, uint64_t ulDecayAlpha, uint64_t ulDecayMax )
+    {
+        // If we go over half of our deadzone, be more defensive about things and
+        // spike up back to our current drawtime (sawtooth).
+        if ( int64_t( ulDrawTime ) - int64_t( ulRedZone / 2 ) > int64_t( ulRollingMaxDrawTime ) )
+            return ulDrawTime;
+
+        return ( ( ulDecayAlpha * ulRollingMaxDrawTime ) + ( ulDecayMax - ulDecayAlpha ) * ulDrawTime ) / ulDecayMax;
+    }
+
+    // Histogram of the last k_uWindow draw times, for picking a draw time
+    // that a given fraction of recent frames fit into.
+    class CDrawTimeHistogram
+    {
+    public:
+        static constexpr uint64_t k_ulBucketWidth = 50'000; // 0.05ms
+        static constexpr uint32_t k_uBucketCount = 512;     // Up to 25.6ms, anything longer lands in the last bucket.
+        static constexpr uint32_t k_uWindow = 256;
+
+        void AddSample( uint64_t ulDrawTime )
+        {
+            uint16_t uBucket = uint16_t( std::min<uint64_t>( ulDrawTime / k_ulBucketWidth, k_uBucketCount - 1 ) );
+
+            if ( m_uSampleCount == k_uWindow )
+                m_uBuckets[ m_uSamples[ m_uNextSample ] ]--;
+            else
+                m_uSampleCount++;
+
+            m_uSamples[ m_uNextSample ] = uBucket;
+            m_uBuckets[ uBucket ]++;
+            m_uNextSample = ( m_uNextSample + 1 ) % k_uWindow;
+        }
+
+        uint32_t SampleCount() const { return m_uSampleCount; }
+
+        // Smallest draw time (rounded up to a bucket) that at least flPercentile
+        // percent of the window fits into. 0 if there are no samples.
+        uint64_t GetPercentile( float flPercentile ) const
+        {
+            if ( !m_uSampleCount )
+                return 0;
+
+            uint32_t uWanted = uint32_t( std::clamp( flPercentile, 0.0f, 100.0f ) * m_uSampleCount / 100.0f + 0.999f );
+            uWanted = std::clamp<uint32_t>( uWanted, 1, m_uSampleCount );
+
+            uint32_t uSeen = 0;
+            for ( uint32_t i = 0; i < k_uBucketCount; i++ )
+            {
+                uSeen += m_uBuckets[ i ];
+                if ( uSeen >= uWanted )
+                    return ( i + 1 ) * k_ulBucketWidth;
+            }
+
+            return k_uBucketCount * k_ulBucketWidth;
+        }
+
+        void Reset()
+        {
+            m_uBuckets = {};
+            m_uSampleCount = 0;
+            m_uNextSample = 0;
+        }
+
+    private:
+        std::array<uint16_t, k_uBucketCount> m_uBuckets{};
+        std::array<uint16_t, k_uWindow> m_uSamples{};
+        uint32_t m_uSampleCount = 0;
+        uint32_t m_uNextSample = 0;
+    };
+}
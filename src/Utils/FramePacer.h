@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+namespace gamescope
+{
+    // Frame limiting on a fixed refresh display.
+    //
+    // Spreads uTargetRate frames evenly over every uRefreshRate vblanks, Bresenham style,
+    // so every frame lands within one vblank of where it would at the exact target rate.
+    // eg. 48 on 120Hz alternates between 3 and 2 vblank intervals instead of
+    // falling back to the nearest integer divisor (60).
+    // When the refresh rate is a multiple of the target this is the same as
+    // vblank_idx % divisor == 0.
+    //
+    // This is stateless on purpose, it gets asked once per window for the same vblank.
+    inline bool FramePacerShouldLatch( uint64_t ulVBlankIdx, uint32_t uRefreshRate, uint32_t uTargetRate )
+    {
+        if ( !uTargetRate || uTargetRate >= uRefreshRate )
+            return true;
+
+        return ( ulVBlankIdx % uRefreshRate ) * uTargetRate % uRefreshRate < uTargetRate;
+    }
+
+    // Average time between latched frames.
+    inline uint64_t FramePacerAverageCycle( uint64_t ulRefreshCycle, uint32_t uRefreshRate, uint32_t uTargetRate )
+    {
+        if ( !uTargetRate || uTargetRate >= uRefreshRate )
+            return ulRefreshCycle;
+
+        return ulRefreshCycle * uRefreshRate / uTargetRate;
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "MPSCQueue.h"
+#include "NonCopyable.h"
+
+namespace gamescope
+{
+    enum class InputEventType : uint8_t
+    {
+        None,
+        RelativeMotion,
+        AbsoluteMotion,
+        Button,
+        Key,
+        Wheel,
+    };
+
+    struct InputEvent_t
+    {
+        InputEventType eType = InputEventType::None;
+        // Button or key code.
+        uint32_t uCode = 0;
+        // Pressed for buttons and keys, synthetic for absolute motion.
+        bool bFlag = false;
+        uint32_t uTime = 0;
+        double flX = 0.0;
+        double flY = 0.0;
+        // When it got queued, in get_time_in_nanos time.
+        uint64_t ulQueueTime = 0;
+    };
+
+    struct InputEventQueueStats_t
+    {
+        uint64_t ulEvents = 0;
+        uint64_t ulRelativeMotionEvents = 0;
+        uint64_t ulMotionNotifies = 0;
+        uint64_t ulWakeups = 0;
+        uint64_t ulDrains = 0;
+    };
+
+    // Pointer and keyboard events from the input threads (libinput, libeis and the
+    // nested backends) to the Wayland thread, so they don't have to take the wlserver
+    // lock for every event and stall behind whoever holds it.
+    //
+    // Draining coalesces each run of relative motion between other events into a
+    // single pointer motion, while still handing every individual delta out for the
+    // relative pointer protocol. Everything else comes out in order, after the motion
+    // that was queued before it.
+    template <size_t Capacity>
+    class CInputEventQueue : public NonCopyable
+    {
+    public:
+        // Returns whether the consumer needs waking up, ie. whether this is the
+        // first event since it last started draining.
+        bool Push( const InputEvent_t &event )
+        {
+            InputEvent_t queued = event;
+            m_Queue.Push( std::move( queued ) );
+            m_ulEvents.fetch_add( 1, std::memory_order_relaxed );
+
+            // Pairs with the exchange in Drain: either it sees this event,
+            // or we see it cleared the flag and wake it again.
+            if ( m_bWakePending.exchange( true, std::memory_order_acq_rel ) )
+                return false;
+
+            m_ulWakeups.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+
+        // fnRelative( const InputEvent_t & ) gets every relative motion event,
+        // fnMotion( dx, dy, uTime ) the sum of each run of them, after the last
+        // one of the run and before fnEvent( const InputEvent_t & ) gets the next
+        // non-motion event.
+        // Only one thread may drain at a time.
+        template <typename FnRelative, typename FnMotion, typename FnEvent>
+        void Drain( FnRelative &&fnRelative, FnMotion &&fnMotion, FnEvent &&fnEvent )
+        {
+            if ( !m_bWakePending.exchange( false, std::memory_order_acq_rel ) )
+                return;
+
+            m_ulDrains.fetch_add( 1, std::memory_order_relaxed );
+
+            bool bMotionPending = false;
+            double flDx = 0.0;
+            double flDy = 0.0;
+            uint32_t uMotionTime = 0;
+
+            auto FlushMotion = [&]()
+            {
+                if ( !bMotionPending )
+                    return;
+
+                fnMotion( flDx, flDy, uMotionTime );
+                m_ulMotionNotifies.fetch_add( 1, std::memory_order_relaxed );
+
+                bMotionPending = false;
+                flDx = 0.0;
+                flDy = 0.0;
+            };
+
+            uint64_t ulRelativeMotionEvents = 0;
+            m_Queue.Drain( [&]( InputEvent_t &event )
+            {
+                if ( event.eType == InputEventType::RelativeMotion )
+                {
+                    fnRelative( event );
+                    ulRelativeMotionEvents++;
+
+                    bMotionPending = true;
+                    flDx += event.flX;
+                    flDy += event.flY;
+                    uMotionTime = event.uTime;
+                    return;
+                }
+
+                FlushMotion();
+                fnEvent( event );
+            });
+            FlushMotion();
+
+            m_ulRelativeMotionEvents.fetch_add( ulRelativeMotionEvents, std::memory_order_relaxed );
+        }
+
+        InputEventQueueStats_t GetStats() const
+        {
+            return InputEventQueueStats_t
+            {
+                .ulEvents = m_ulEvents.load( std::memory_order_relaxed ),
+                .ulRelativeMotionEvents = m_ulRelativeMotionEvents.load( std::memory_order_relaxed ),
+                .ulMotionNotifies = m_ulMotionNotifies.load( std::memory_order_relaxed ),
+                .ulWakeups = m_ulWakeups.load( std::memory_order_relaxed ),
+                .ulDrains = m_ulDrains.load( std::memory_order_relaxed ),
+            };
+        }
+
+    private:
+        MPSCQueue<InputEvent_t, Capacity> m_Queue;
+        std::atomic<bool> m_bWakePending = { false };
+
+        std::atomic<uint64_t> m_ulEvents = { 0 };
+        std::atomic<uint64_t> m_ulRelativeMotionEvents = { 0 };
+        std::atomic<uint64_t> m_ulMotionNotifies = { 0 };
+        std::atomic<uint64_t> m_ulWakeups = { 0 };
+        std::atomic<uint64_t> m_ulDrains = { 0 };
+    };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "NonCopyable.h"
+
+namespace gamescope
+{
+    // Bounded multi-producer, single-consumer queue of preallocated cells.
+    //
+    // Producers claim a cell with a CAS on the tail and publish it through the
+    // cell's sequence number, so pushing never takes a lock or allocates.
+    //
+    // If the ring is ever full, producers spill into a mutex protected overflow
+    // list instead of blocking or dropping the entry. Once anything has spilled, all
+    // pushes go to the overflow until the consumer has emptied the ring and taken the
+    // overflow, which keeps every producer's entries in the order it pushed them.
+    template <typename T, size_t Capacity>
+    class MPSCQueue : public NonCopyable
+    {
+        static_assert( Capacity >= 2 && ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of two." );
+    public:
+        MPSCQueue()
+        {
+            for ( size_t i = 0; i < Capacity; i++ )
+                m_Cells[i].ulSequence.store( i, std::memory_order_relaxed );
+        }
+
+        void Push( T &&value )
+        {
+            if ( !m_bOverflowing.load( std::memory_order_acquire ) && TryPushRing( value ) )
+                return;
+
+            std::scoped_lock lock( m_OverflowMutex );
+            m_bOverflowing.store( true, std::memory_order_release );
+            m_Overflow.emplace_back( std::move( value ) );
+        }
+
+        // Calls fn( T& ) for every entry, in push order per producer.
+        // Only one thread may drain at a time.
+        template <typename Fn>
+        void Drain( Fn &&fn )
+        {
+            std::scoped_lock consumerLock( m_ConsumerMutex );
+
+            while ( TryPopRing( m_Scratch ) )
+            {
+                fn( m_Scratch );
+                m_Scratch = T{};
+            }
+
+            if ( !m_bOverflowing.load( std::memory_order_acquire ) )
+                return;
+
+            // A producer may have claimed a cell but not published it yet,
+            // that entry is older than anything it spilled, so wait for it.
+            if ( m_ulTail.load( std::memory_order_acquire ) != m_ulHead )
+                return;
+
+            {
+                std::scoped_lock lock( m_OverflowMutex );
+                m_OverflowScratch.swap( m_Overflow );
+                m_bOverflowing.store( false, std::memory_order_release );
+            }
+
+            for ( T &value : m_OverflowScratch )
+                fn( value );
+            m_OverflowScratch.clear();
+        }
+
+        void Clear()
+        {
+            Drain( []( T & ) {} );
+        }
+
+    private:
+        bool TryPushRing( T &value )
+        {
+            uint64_t ulPos = m_ulTail.load( std::memory_order_relaxed );
+            for ( ;; )
+            {
+                Cell_t &cell = m_Cells[ ulPos & ( Capacity - 1 ) ];
+                const uint64_t ulSequence = cell.ulSequence.load( std::memory_order_acquire );
+                const int64_t nDiff = int64_t( ulSequence ) - int64_t( ulPos );
+
+                if ( nDiff == 0 )
+                {
+                    if ( m_ulTail.compare_exchange_weak( ulPos, ulPos + 1, std::memory_order_relaxed ) )
+                    {
+                        cell.value = std::move( value );
+                        cell.ulSequence.store( ulPos + 1, std::memory_order_release );
+                        return true;
+                    }
+                }
+                else if ( nDiff < 0 )
+                {
+                    // Full, the consumer hasn't freed this cell yet.
+                    return false;
+                }
+                else
+                {
+                    ulPos = m_ulTail.load( std::memory_order_relaxed );
+                }
+            }
+        }
+
+        bool TryPopRing( T &out )
+        {
+            Cell_t &cell = m_Cells[ m_ulHead & ( Capacity - 1 ) ];
+            if ( cell.ulSequence.load( std::memory_order_acquire ) != m_ulHead + 1 )
+                return false;
+
+            out = std::move( cell.value );
+            // Don't keep references alive in the cell until it gets reused.
+            cell.value = T{};
+            cell.ulSequence.store( m_ulHead + Capacity, std::memory_order_release );
+            m_ulHead++;
+            return true;
+        }
+
+        struct alignas( 64 ) Cell_t
+        {
+            std::atomic<uint64_t> ulSequence;
+            T value;
+        };
+
+        Cell_t m_Cells[ Capacity ];
+
+        alignas( 64 ) std::atomic<uint64_t> m_ulTail = { 0 };
+
+        // Consumer only.
+        alignas( 64 ) uint64_t m_ulHead = 0;
+        std::mutex m_ConsumerMutex;
+        T m_Scratch{};
+        std::vector<T> m_OverflowScratch;
+
+        std::atomic<bool> m_bOverflowing = { false };
+        std::mutex m_OverflowMutex;
+        std::vector<T> m_Overflow;
+    };
+}
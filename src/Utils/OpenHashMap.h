@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace gamescope
+{
+    // Flat hash map with linear probing, for small trivially copyable keys
+    // (X11 IDs, pointers) that get looked up a lot more often than they change.
+    // EmptyKey marks free slots and can't be inserted.
+    // Erasing shifts later entries of the probe sequence back, so there are no
+    // tombstones and lookups never get slower over time.
+    template <typename Key, typename Value, Key EmptyKey = Key{}>
+    class COpenHashMap
+    {
+        static_assert( std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value> );
+        static_assert( sizeof( Key ) <= sizeof( uint64_t ) );
+
+    public:
+        static constexpr size_t k_zMinCapacity = 64;
+
+        Value *Find( Key key )
+        {
+            if ( key == EmptyKey || m_Slots.empty() )
+                return nullptr;
+
+            for ( size_t i = Hash( key ) & Mask(); ; i = ( i + 1 ) & Mask() )
+            {
+                if ( m_Slots[i].key == key )
+                    return &m_Slots[i].value;
+                if ( m_Slots[i].key == EmptyKey )
+                    return nullptr;
+            }
+        }
+
+        const Value *Find( Key key ) const
+        {
+            return const_cast<COpenHashMap *>( this )->Find( key );
+        }
+
+        // Inserts or replaces.
+        void Insert( Key key, Value value )
+        {
+            if ( key == EmptyKey )
+                return;
+
+            // Keep it at most half full.
+            if ( ( m_zSize + 1 ) * 2 > m_Slots.size() )
+                Rehash( std::max( k_zMinCapacity, m_Slots.size() * 2 ) );
+
+            size_t i = Hash( key ) & Mask();
+            while ( m_Slots[i].key != EmptyKey && m_Slots[i].key != key )
+                i = ( i + 1 ) & Mask();
+
+            if ( m_Slots[i].key == EmptyKey )
+                m_zSize++;
+
+            m_Slots[i] = Slot_t{ key, value };
+        }
+
+        bool Erase( Key key )
+        {
+            if ( key == EmptyKey || m_Slots.empty() )
+                return false;
+
+            size_t i = Hash( key ) & Mask();
+            while ( m_Slots[i].key != key )
+            {
+                if ( m_Slots[i].key == EmptyKey )
+                    return false;
+                i = ( i + 1 ) & Mask();
+            }
+
+            EraseSlot( i );
+            return true;
+        }
+
+        // Erases every entry fn( key, value ) returns true for.
+        template <typename Fn>
+        size_t EraseIf( Fn fn )
+        {
+            size_t zErased = 0;
+            for ( size_t i = 0; i < m_Slots.size(); )
+            {
+                if ( m_Slots[i].key != EmptyKey && fn( m_Slots[i].key, m_Slots[i].value ) )
+                {
+                    // Something else may have shifted into this slot, look at it again.
+                    EraseSlot( i );
+                    zErased++;
+                    continue;
+                }
+                i++;
+            }
+            return zErased;
+        }
+
+        void Clear()
+        {
+            m_Slots.clear();
+            m_zSize = 0;
+        }
+
+        size_t Size() const { return m_zSize; }
+        size_t Capacity() const { return m_Slots.size(); }
+
+    private:
+        struct Slot_t
+        {
+            Key key = EmptyKey;
+            Value value{};
+        };
+
+        size_t Mask() const { return m_Slots.size() - 1; }
+
+        static size_t Hash( Key key )
+        {
+            uint64_t ulKey;
+            if constexpr ( std::is_pointer_v<Key> )
+                ulKey = uint64_t( reinterpret_cast<uintptr_t>( key ) );
+            else
+                ulKey = uint64_t( key );
+
+            // murmur3's fmix64, X11 IDs and pointers are far from uniform in the low bits.
+            ulKey ^= ulKey >> 33;
+            ulKey *= 0xff51afd7ed558ccdull;
+            ulKey ^= ulKey >> 33;
+            ulKey *= 0xc4ceb9fe1a85ec53ull;
+            ulKey ^= ulKey >> 33;
+            return size_t( ulKey );
+        }
+
+        void EraseSlot( size_t i )
+        {
+            // Move back anything after i that would no longer be
+            // reachable from its home slot with i empty.
+            for ( size_t j = ( i + 1 ) & Mask(); m_Slots[j].key != EmptyKey; j = ( j + 1 ) & Mask() )
+            {
+                const size_t zHome = Hash( m_Slots[j].key ) & Mask();
+                const bool bReachable = i <= j
+                    ? ( i < zHome && zHome <= j )
+                    : ( i < zHome || zHome <= j );
+                if ( bReachable )
+                    continue;
+
+                m_Slots[i] = m_Slots[j];
+                i = j;
+            }
+
+            m_Slots[i] = Slot_t{};
+            m_zSize--;
+        }
+
+        void Rehash( size_t zCapacity )
+        {
+            std::vector<Slot_t> oldSlots = std::move( m_Slots );
+            m_Slots.assign( std::bit_ceil( zCapacity ), Slot_t{} );
+            m_zSize = 0;
+
+            for ( const Slot_t &slot : oldSlots )
+            {
+                if ( slot.key != EmptyKey )
+                    Insert( slot.key, slot.value );
+            }
+        }
+
+        std::vector<Slot_t> m_Slots;
+        size_t m_zSize = 0;
+    };
+}
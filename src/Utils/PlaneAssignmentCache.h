@@ -0,0 +1,377 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace gamescope
+{
+    // A plane property and the value we want for it. Names are string literals.
+    struct PlanePropertyValue_t
+    {
+        const char *pszName = nullptr;
+        uint64_t ulValue = 0;
+    };
+
+    static inline bool PropertyNamesEqual( const char *pszA, const char *pszB )
+    {
+        return pszA == pszB || strcmp( pszA, pszB ) == 0;
+    }
+
+    // Mirrors the properties set on a liftoff layer, which stick around until
+    // they're changed or unset, just like liftoff's own.
+    class CLayerProperties
+    {
+    public:
+        static constexpr size_t k_zMaxProperties = 32;
+
+        void Set( const char *pszName, uint64_t ulValue )
+        {
+            for ( size_t i = 0; i < m_zCount; i++ )
+            {
+                if ( PropertyNamesEqual( m_Values[i].pszName, pszName ) )
+                {
+                    m_Values[i].ulValue = ulValue;
+                    return;
+                }
+            }
+
+            if ( m_zCount < k_zMaxProperties )
+                m_Values[ m_zCount++ ] = PlanePropertyValue_t{ pszName, ulValue };
+        }
+
+        void Unset( const char *pszName )
+        {
+            for ( size_t i = 0; i < m_zCount; i++ )
+            {
+                if ( PropertyNamesEqual( m_Values[i].pszName, pszName ) )
+                {
+                    m_Values[i] = m_Values[ --m_zCount ];
+                    return;
+                }
+            }
+        }
+
+        void Clear() { m_zCount = 0; }
+
+        std::span<const PlanePropertyValue_t> Get() const { return std::span<const PlanePropertyValue_t>{ m_Values.data(), m_zCount }; }
+
+    private:
+        std::array<PlanePropertyValue_t, k_zMaxProperties> m_Values;
+        size_t m_zCount = 0;
+    };
+
+    // The bits of KMS replaying a plane assignment needs, so tests can fake them.
+    class IKMSPlaneProperties
+    {
+    public:
+        virtual ~IKMSPlaneProperties() {}
+
+        // 0 if the plane doesn't have the property.
+        virtual uint32_t GetPlanePropertyId( uint32_t uPlaneId, const char *pszName ) = 0;
+
+        // Operate on the pending atomic request.
+        virtual int GetRequestCursor() = 0;
+        virtual void SetRequestCursor( int nCursor ) = 0;
+        virtual bool AddProperty( uint32_t uObjectId, uint32_t uPropertyId, uint64_t ulValue ) = 0;
+        // TEST_ONLY commit of the request, 0 or -errno.
+        virtual int TestCommit() = 0;
+    };
+
+    struct PlaneAssignmentCacheStats_t
+    {
+        uint64_t ulHits = 0;
+        uint64_t ulMisses = 0;
+        uint64_t ulUnsupportedHits = 0;
+        uint64_t ulReplayFailures = 0;
+        uint64_t ulTestCommits = 0;
+        uint64_t ulEvictions = 0;
+        uint64_t ulEntries = 0;
+    };
+
+    // Remembers what liftoff made of layer configurations: for the ones that
+    // worked, which plane each layer ended up on, for the others that they don't.
+    //
+    // Finding a working plane assignment can take liftoff lots of test commits.
+    // A known one is replayed straight into the request instead, the way liftoff
+    // would have written it, and checked with a single test commit. If the
+    // kernel doesn't take it anymore, the request is rolled back and the entry
+    // dropped, so liftoff gets to try again.
+    //
+    // Only the least recently used MaxEntries configurations are kept.
+    template <typename Key, typename KeyHash, size_t MaxLayers>
+    class CPlaneAssignmentCache
+    {
+    public:
+        static constexpr uint32_t k_uDefaultMaxEntries = 64;
+
+        enum class Lookup_t
+        {
+            Miss,
+            Unsupported,
+            Supported,
+        };
+
+        // Lets us find out about known unsupported configurations before
+        // setting up any layers.
+        Lookup_t Find( const Key &key )
+        {
+            auto iter = m_Index.find( key );
+            if ( iter == m_Index.end() )
+                return Lookup_t::Miss;
+
+            m_Entries.splice( m_Entries.begin(), m_Entries, iter->second );
+            if ( !iter->second->second.bSupported )
+            {
+                m_ulUnsupportedHits.fetch_add( 1, std::memory_order_relaxed );
+                return Lookup_t::Unsupported;
+            }
+
+            return Lookup_t::Supported;
+        }
+
+        // Writes the known assignment for key into the request with the layers'
+        // current properties and tests it. Returns false, with the request as
+        // it was, if there's no assignment or it doesn't work (anymore).
+        bool TryReplay( const Key &key, std::span<const CLayerProperties> layers, uint32_t uCRTCId, IKMSPlaneProperties *pKMS )
+        {
+            auto iter = m_Index.find( key );
+            if ( iter == m_Index.end() || !iter->second->second.bSupported )
+            {
+                m_ulMisses.fetch_add( 1, std::memory_order_relaxed );
+                return false;
+            }
+
+            Entry_t &entry = iter->second->second;
+
+            const int nCursor = pKMS->GetRequestCursor();
+            if ( !WriteAssignment( entry, layers, uCRTCId, pKMS ) )
+            {
+                pKMS->SetRequestCursor( nCursor );
+                DropReplayFailure( iter );
+                return false;
+            }
+
+            m_ulTestCommits.fetch_add( 1, std::memory_order_relaxed );
+            if ( pKMS->TestCommit() != 0 )
+            {
+                pKMS->SetRequestCursor( nCursor );
+                DropReplayFailure( iter );
+                return false;
+            }
+
+            m_Entries.splice( m_Entries.begin(), m_Entries, iter->second );
+            m_ulHits.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+
+        // planeIds[i] is the plane layer i got. unusedPlaneIds are all the other
+        // planes liftoff turns off.
+        void RecordSupported( const Key &key, std::span<const uint32_t> planeIds, std::span<const uint32_t> unusedPlaneIds )
+        {
+            if ( planeIds.size() > MaxLayers )
+                return;
+
+            Entry_t entry;
+            entry.bSupported = true;
+            entry.uLayerCount = uint32_t( planeIds.size() );
+            for ( size_t i = 0; i < planeIds.size(); i++ )
+                entry.layers[i].uPlaneId = planeIds[i];
+            for ( uint32_t uPlaneId : unusedPlaneIds )
+                entry.unusedPlanes.push_back( UnusedPlane_t{ .uPlaneId = uPlaneId } );
+
+            Insert( key, std::move( entry ) );
+        }
+
+        void RecordUnsupported( const Key &key )
+        {
+            Insert( key, Entry_t{} );
+        }
+
+        void Clear()
+        {
+            m_Index.clear();
+            m_Entries.clear();
+            m_ulEntries.store( 0, std::memory_order_relaxed );
+        }
+
+        void SetMaxEntries( uint32_t uMaxEntries )
+        {
+            m_uMaxEntries = uMaxEntries ? uMaxEntries : 1;
+            Evict();
+        }
+
+        PlaneAssignmentCacheStats_t GetStats() const
+        {
+            return PlaneAssignmentCacheStats_t
+            {
+                .ulHits = m_ulHits.load( std::memory_order_relaxed ),
+                .ulMisses = m_ulMisses.load( std::memory_order_relaxed ),
+                .ulUnsupportedHits = m_ulUnsupportedHits.load( std::memory_order_relaxed ),
+                .ulReplayFailures = m_ulReplayFailures.load( std::memory_order_relaxed ),
+                .ulTestCommits = m_ulTestCommits.load( std::memory_order_relaxed ),
+                .ulEvictions = m_ulEvictions.load( std::memory_order_relaxed ),
+                .ulEntries = m_ulEntries.load( std::memory_order_relaxed ),
+            };
+        }
+
+    private:
+        struct ResolvedProperty_t
+        {
+            const char *pszName = nullptr;
+            uint32_t uPropertyId = 0;
+        };
+
+        struct LayerPlane_t
+        {
+            uint32_t uPlaneId = 0;
+            uint32_t uCRTCIdPropertyId = 0;
+            // Property IDs on this plane, looked up the first time they're needed.
+            std::vector<ResolvedProperty_t> resolved;
+        };
+
+        struct UnusedPlane_t
+        {
+            uint32_t uPlaneId = 0;
+            uint32_t uFbIdPropertyId = 0;
+            uint32_t uCRTCIdPropertyId = 0;
+        };
+
+        struct Entry_t
+        {
+            bool bSupported = false;
+            uint32_t uLayerCount = 0;
+            std::array<LayerPlane_t, MaxLayers> layers;
+            std::vector<UnusedPlane_t> unusedPlanes;
+        };
+
+        using EntryList = std::list<std::pair<Key, Entry_t>>;
+
+        static uint32_t ResolveProperty( LayerPlane_t &plane, const char *pszName, IKMSPlaneProperties *pKMS )
+        {
+            for ( const ResolvedProperty_t &property : plane.resolved )
+            {
+                if ( PropertyNamesEqual( property.pszName, pszName ) )
+                    return property.uPropertyId;
+            }
+
+            const uint32_t uPropertyId = pKMS->GetPlanePropertyId( plane.uPlaneId, pszName );
+            plane.resolved.push_back( ResolvedProperty_t{ pszName, uPropertyId } );
+            return uPropertyId;
+        }
+
+        // Same as what liftoff writes for an output: the layer properties on the
+        // planes they were assigned, and every other plane turned off.
+        static bool WriteAssignment( Entry_t &entry, std::span<const CLayerProperties> layers, uint32_t uCRTCId, IKMSPlaneProperties *pKMS )
+        {
+            if ( layers.size() < entry.uLayerCount )
+                return false;
+
+            for ( uint32_t i = 0; i < entry.uLayerCount; i++ )
+            {
+                LayerPlane_t &plane = entry.layers[i];
+
+                if ( !plane.uCRTCIdPropertyId )
+                    plane.uCRTCIdPropertyId = pKMS->GetPlanePropertyId( plane.uPlaneId, "CRTC_ID" );
+                if ( !plane.uCRTCIdPropertyId || !pKMS->AddProperty( plane.uPlaneId, plane.uCRTCIdPropertyId, uCRTCId ) )
+                    return false;
+
+                for ( const PlanePropertyValue_t &value : layers[i].Get() )
+                {
+                    // liftoff only uses zpos to order the planes, it never sets it.
+                    if ( PropertyNamesEqual( value.pszName, "zpos" ) )
+                        continue;
+
+                    const uint32_t uPropertyId = ResolveProperty( plane, value.pszName, pKMS );
+                    if ( !uPropertyId )
+                    {
+                        // Planes can do without these when they're at their defaults, like liftoff allows.
+                        if ( PropertyNamesEqual( value.pszName, "alpha" ) && value.ulValue == 0xFFFF )
+                            continue;
+                        if ( PropertyNamesEqual( value.pszName, "rotation" ) && value.ulValue == k_ulRotate0 )
+                            continue;
+                        return false;
+                    }
+
+                    if ( !pKMS->AddProperty( plane.uPlaneId, uPropertyId, value.ulValue ) )
+                        return false;
+                }
+            }
+
+            for ( UnusedPlane_t &plane : entry.unusedPlanes )
+            {
+                if ( !plane.uFbIdPropertyId )
+                {
+                    plane.uFbIdPropertyId = pKMS->GetPlanePropertyId( plane.uPlaneId, "FB_ID" );
+                    plane.uCRTCIdPropertyId = pKMS->GetPlanePropertyId( plane.uPlaneId, "CRTC_ID" );
+                }
+
+                if ( !plane.uFbIdPropertyId || !plane.uCRTCIdPropertyId ||
+                     !pKMS->AddProperty( plane.uPlaneId, plane.uFbIdPropertyId, 0 ) ||
+                     !pKMS->AddProperty( plane.uPlaneId, plane.uCRTCIdPropertyId, 0 ) )
+                    return false;
+            }
+
+            return true;
+        }
+
+        void DropReplayFailure( typename std::unordered_map<Key, typename EntryList::iterator, KeyHash>::iterator iter )
+        {
+            m_ulReplayFailures.fetch_add( 1, std::memory_order_relaxed );
+            m_ulMisses.fetch_add( 1, std::memory_order_relaxed );
+
+            m_Entries.erase( iter->second );
+            m_Index.erase( iter );
+            m_ulEntries.store( m_Index.size(), std::memory_order_relaxed );
+        }
+
+        void Insert( const Key &key, Entry_t &&entry )
+        {
+            auto iter = m_Index.find( key );
+            if ( iter != m_Index.end() )
+            {
+                iter->second->second = std::move( entry );
+                m_Entries.splice( m_Entries.begin(), m_Entries, iter->second );
+                return;
+            }
+
+            m_Entries.emplace_front( key, std::move( entry ) );
+            m_Index.emplace( key, m_Entries.begin() );
+            Evict();
+        }
+
+        void Evict()
+        {
+            while ( m_Index.size() > m_uMaxEntries )
+            {
+                m_Index.erase( m_Entries.back().first );
+                m_Entries.pop_back();
+                m_ulEvictions.fetch_add( 1, std::memory_order_relaxed );
+            }
+            m_ulEntries.store( m_Index.size(), std::memory_order_relaxed );
+        }
+
+        // DRM_MODE_ROTATE_0
+        static constexpr uint64_t k_ulRotate0 = 1;
+
+        // Most recently used first.
+        EntryList m_Entries;
+        std::unordered_map<Key, typename EntryList::iterator, KeyHash> m_Index;
+        uint32_t m_uMaxEntries = k_uDefaultMaxEntries;
+
+        std::atomic<uint64_t> m_ulHits = { 0 };
+        std::atomic<uint64_t> m_ulMisses = { 0 };
+        std::atomic<uint64_t> m_ulUnsupportedHits = { 0 };
+        std::atomic<uint64_t> m_ulReplayFailures = { 0 };
+        std::atomic<uint64_t> m_ulTestCommits = { 0 };
+        std::atomic<uint64_t> m_ulEvictions = { 0 };
+        std::atomic<uint64_t> m_ulEntries = { 0 };
+    };
+}
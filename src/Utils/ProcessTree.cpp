@@ -0,0 +1,293 @@
+#include "ProcessTree.h"
+
+#include <charconv>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace gamescope
+{
+    std::optional<ProcStat_t> ParseProcStat( std::string_view svStat )
+    {
+        const size_t zNameStart = svStat.find( '(' );
+        const size_t zNameEnd = svStat.rfind( ')' );
+        if ( zNameStart == std::string_view::npos || zNameEnd == std::string_view::npos || zNameEnd < zNameStart )
+            return std::nullopt;
+
+        // ") <state> <ppid> ..."
+        std::string_view svRest = svStat.substr( zNameEnd + 1 );
+        const size_t zState = svRest.find_first_not_of( ' ' );
+        if ( zState == std::string_view::npos )
+            return std::nullopt;
+
+        const size_t zParentStart = svRest.find_first_not_of( ' ', zState + 1 );
+        if ( zParentStart == std::string_view::npos )
+            return std::nullopt;
+
+        ProcStat_t stat;
+        stat.svComm = svStat.substr( zNameStart + 1, zNameEnd - zNameStart - 1 );
+        if ( std::from_chars( svRest.data() + zParentStart, svRest.data() + svRest.size(), stat.nParentPid ).ec != std::errc{} )
+            return std::nullopt;
+
+        return stat;
+    }
+
+    uint32_t ParseSteamLaunchAppId( std::string_view svCmdline )
+    {
+        bool bSteamLaunch = false;
+        uint32_t uFoundAppId = 0;
+
+        // The first argument is the reaper itself.
+        size_t zArg = svCmdline.find( '\0' );
+        while ( zArg != std::string_view::npos && zArg + 1 < svCmdline.size() )
+        {
+            const size_t zArgStart = zArg + 1;
+            zArg = svCmdline.find( '\0', zArgStart );
+            std::string_view svArg = svCmdline.substr( zArgStart, zArg == std::string_view::npos ? std::string_view::npos : zArg - zArgStart );
+
+            if ( svArg == "SteamLaunch" )
+            {
+                bSteamLaunch = true;
+            }
+            else if ( svArg.starts_with( "AppId=" ) )
+            {
+                uint32_t uAppId = 0;
+                std::from_chars( svArg.data() + 6, svArg.data() + svArg.size(), uAppId );
+                if ( uAppId != 0 && bSteamLaunch )
+                    uFoundAppId = uAppId;
+            }
+            else if ( svArg == "--" )
+            {
+                // The game's own arguments start here.
+                break;
+            }
+        }
+
+        return uFoundAppId;
+    }
+
+    static bool ReadFile( const char *pszPath, std::string &sContents )
+    {
+        int nFd = open( pszPath, O_RDONLY | O_CLOEXEC );
+        if ( nFd < 0 )
+            return false;
+
+        sContents.clear();
+
+        char szBuffer[4096];
+        ssize_t nRead;
+        while ( ( nRead = read( nFd, szBuffer, sizeof( szBuffer ) ) ) > 0 )
+            sContents.append( szBuffer, size_t( nRead ) );
+
+        close( nFd );
+        return nRead == 0;
+    }
+
+    static int OpenPidFd( pid_t nPid )
+    {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        return int( syscall( SYS_pidfd_open, nPid, 0 ) );
+#else
+        return -1;
+#endif
+    }
+
+    CProcessTreeCache::~CProcessTreeCache()
+    {
+        Clear();
+    }
+
+    uint32_t CProcessTreeCache::GetAppId( pid_t nPid )
+    {
+        std::scoped_lock lock( m_Mutex );
+
+        m_ulLookups++;
+
+        // The depth limit is just in case a racing exit and pid reuse make a loop.
+        static constexpr uint32_t k_uMaxDepth = 256;
+
+        uint32_t uFoundAppId = 0;
+        // The process we came from, and whether its parent pid came from the cache.
+        pid_t nChildPid = 0;
+        bool bChildCached = false;
+        for ( uint32_t uDepth = 0; nPid > 0 && uDepth < k_uMaxDepth; uDepth++ )
+        {
+            bool bCached = false;
+            std::optional<Entry_t> oEntry = LookupProcess( nPid, &bCached );
+
+            auto childIter = nChildPid > 0 ? m_Entries.find( nChildPid ) : m_Entries.end();
+            if ( bChildCached && childIter != m_Entries.end() &&
+                 ( !oEntry || childIter->second.ulParentSerial != oEntry->ulSerial ) )
+            {
+                // The parent we had for it exited since, so it got reparented,
+                // and its old parent's pid may well be someone else's now.
+                m_ulInvalidations++;
+                Erase( nChildPid );
+
+                std::optional<Entry_t> oChild = LookupProcess( nChildPid );
+                if ( !oChild )
+                    break;
+
+                nPid = oChild->nParentPid;
+                if ( nPid <= 0 )
+                    break;
+
+                oEntry = LookupProcess( nPid, &bCached );
+                childIter = m_Entries.find( nChildPid );
+            }
+
+            if ( !oEntry )
+                break;
+
+            if ( childIter != m_Entries.end() )
+                childIter->second.ulParentSerial = oEntry->ulSerial;
+
+            // Keep going, the outermost one wins.
+            if ( oEntry->uAppId != 0 )
+                uFoundAppId = oEntry->uAppId;
+
+            nChildPid = nPid;
+            bChildCached = bCached;
+            nPid = oEntry->nParentPid;
+        }
+
+        return uFoundAppId;
+    }
+
+    void CProcessTreeCache::Clear()
+    {
+        std::scoped_lock lock( m_Mutex );
+
+        for ( auto &[ nPid, entry ] : m_Entries )
+            close( entry.nPidFd );
+        m_Entries.clear();
+    }
+
+    ProcessTreeCacheStats_t CProcessTreeCache::GetStats()
+    {
+        std::scoped_lock lock( m_Mutex );
+
+        return ProcessTreeCacheStats_t
+        {
+            .ulLookups = m_ulLookups,
+            .ulCachedProcesses = m_ulCachedProcesses,
+            .ulProcReads = m_ulProcReads,
+            .ulInvalidations = m_ulInvalidations,
+            .ulEntries = m_Entries.size(),
+        };
+    }
+
+    std::optional<CProcessTreeCache::Entry_t> CProcessTreeCache::ReadProcess( pid_t nPid )
+    {
+        m_ulProcReads++;
+
+        // Open the pidfd first: if the pid gets reused after that, it's still
+        // the process we read below and we'll see it exit.
+        Entry_t entry;
+        entry.nPidFd = OpenPidFd( nPid );
+
+        char szPath[64];
+        snprintf( szPath, sizeof( szPath ), "/proc/%d/stat", int( nPid ) );
+
+        std::string sStat;
+        std::optional<ProcStat_t> oStat;
+        if ( ReadFile( szPath, sStat ) )
+            oStat = ParseProcStat( sStat );
+
+        if ( !oStat )
+        {
+            if ( entry.nPidFd >= 0 )
+                close( entry.nPidFd );
+            return std::nullopt;
+        }
+
+        entry.nParentPid = oStat->nParentPid;
+
+        // Steam's reaper is what launches games, with their AppId on its command line.
+        if ( oStat->svComm == "reaper" )
+        {
+            snprintf( szPath, sizeof( szPath ), "/proc/%d/cmdline", int( nPid ) );
+
+            std::string sCmdline;
+            if ( ReadFile( szPath, sCmdline ) )
+                entry.uAppId = ParseSteamLaunchAppId( sCmdline );
+        }
+
+        return entry;
+    }
+
+    std::optional<CProcessTreeCache::Entry_t> CProcessTreeCache::LookupProcess( pid_t nPid, bool *pbCached )
+    {
+        if ( pbCached )
+            *pbCached = false;
+
+        auto iter = m_Entries.find( nPid );
+        if ( iter != m_Entries.end() )
+        {
+            if ( !HasExited( iter->second ) )
+            {
+                m_ulCachedProcesses++;
+                if ( pbCached )
+                    *pbCached = true;
+                return iter->second;
+            }
+
+            m_ulInvalidations++;
+            Erase( nPid );
+        }
+
+        std::optional<Entry_t> oEntry = ReadProcess( nPid );
+        if ( !oEntry || oEntry->nPidFd < 0 )
+            return oEntry;
+
+        if ( m_Entries.size() >= k_uMaxEntries )
+            PruneExited();
+
+        if ( m_Entries.size() >= k_uMaxEntries )
+        {
+            // Everything is still alive, just start over rather than tracking
+            // what got used when.
+            for ( auto &[ nOtherPid, entry ] : m_Entries )
+                close( entry.nPidFd );
+            m_Entries.clear();
+        }
+
+        oEntry->ulSerial = ++m_ulNextSerial;
+        m_Entries[ nPid ] = *oEntry;
+        return oEntry;
+    }
+
+    bool CProcessTreeCache::HasExited( const Entry_t &entry )
+    {
+        pollfd pollFd = { .fd = entry.nPidFd, .events = POLLIN, .revents = 0 };
+        return poll( &pollFd, 1, 0 ) != 0;
+    }
+
+    void CProcessTreeCache::Erase( pid_t nPid )
+    {
+        auto iter = m_Entries.find( nPid );
+        if ( iter == m_Entries.end() )
+            return;
+
+        close( iter->second.nPidFd );
+        m_Entries.erase( iter );
+    }
+
+    void CProcessTreeCache::PruneExited()
+    {
+        std::erase_if( m_Entries, [this]( auto &pair )
+        {
+            if ( !HasExited( pair.second ) )
+                return false;
+
+            m_ulInvalidations++;
+            close( pair.second.nPidFd );
+            return true;
+        });
+    }
+}
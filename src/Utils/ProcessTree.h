@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace gamescope
+{
+    struct ProcStat_t
+    {
+        std::string_view svComm;
+        pid_t nParentPid = 0;
+    };
+
+    // Parses the start of /proc/<pid>/stat. The name is in parens and can
+    // contain anything, parens and spaces included, so it ends at the last ')'.
+    std::optional<ProcStat_t> ParseProcStat( std::string_view svStat );
+
+    // AppId of a Steam reaper's NUL separated command line
+    // ("reaper SteamLaunch AppId=<id> -- <game>..."), 0 if it isn't launching one.
+    uint32_t ParseSteamLaunchAppId( std::string_view svCmdline );
+
+    struct ProcessTreeCacheStats_t
+    {
+        uint64_t ulLookups = 0;
+        uint64_t ulCachedProcesses = 0;
+        uint64_t ulProcReads = 0;
+        uint64_t ulInvalidations = 0;
+        uint64_t ulEntries = 0;
+    };
+
+    // Remembers the parent and Steam AppId of processes we've looked at, so
+    // finding the AppId of a window's process doesn't mean reading /proc for
+    // every one of its ancestors (Proton's process trees are deep) each time.
+    //
+    // Each cached process holds a pidfd, which becomes readable when the process
+    // exits; entries get dropped then, so a reused pid is never mistaken for the
+    // process that had it before. A process whose parent exits gets reparented,
+    // so its cached parent is only trusted while that parent's entry is the one
+    // it was linked to. Without pidfds (old kernels, other OSes) nothing is
+    // cached.
+    class CProcessTreeCache
+    {
+    public:
+        static constexpr uint32_t k_uMaxEntries = 1024;
+
+        CProcessTreeCache() = default;
+        ~CProcessTreeCache();
+
+        // AppId of the outermost "reaper SteamLaunch" ancestor of nPid
+        // (nPid included), 0 if there isn't one.
+        uint32_t GetAppId( pid_t nPid );
+
+        void Clear();
+
+        ProcessTreeCacheStats_t GetStats();
+
+    private:
+        struct Entry_t
+        {
+            pid_t nParentPid = 0;
+            // Only set for reapers.
+            uint32_t uAppId = 0;
+            int nPidFd = -1;
+            // Tells this entry apart from whatever gets cached for the same pid later.
+            uint64_t ulSerial = 0;
+            // ulSerial of the parent's entry when we last walked from here to it, 0 if we haven't.
+            uint64_t ulParentSerial = 0;
+        };
+
+        // nullopt if the process isn't there (anymore).
+        std::optional<Entry_t> ReadProcess( pid_t nPid );
+        std::optional<Entry_t> LookupProcess( pid_t nPid, bool *pbCached = nullptr );
+        bool HasExited( const Entry_t &entry );
+        void Erase( pid_t nPid );
+        void PruneExited();
+
+        std::mutex m_Mutex;
+        std::unordered_map<pid_t, Entry_t> m_Entries;
+
+        uint64_t m_ulLookups = 0;
+        uint64_t m_ulCachedProcesses = 0;
+        uint64_t m_ulProcReads = 0;
+        uint64_t m_ulInvalidations = 0;
+        uint64_t m_ulNextSerial = 0;
+    };
+}
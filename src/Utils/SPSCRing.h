@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+#include "NonCopyable.h"
+
+namespace gamescope
+{
+    // Bounded single-producer, single-consumer ring of trivially copyable records.
+    //
+    // Pushing never locks or allocates. When the ring is full the new record is
+    // dropped and counted, so a slow (or absent) consumer can never stall the producer.
+    template <typename T, size_t Capacity>
+    class SPSCRing : public NonCopyable
+    {
+        static_assert( Capacity >= 2 && ( Capacity & ( Capacity - 1 ) ) == 0, "Capacity must be a power of two." );
+        static_assert( std::is_trivially_copyable_v<T>, "SPSCRing records must be trivially copyable." );
+    public:
+        // Producer only.
+        bool TryPush( const T &value )
+        {
+            const uint64_t ulTail = m_ulTail.load( std::memory_order_relaxed );
+            if ( ulTail - m_ulCachedHead >= Capacity )
+            {
+                m_ulCachedHead = m_ulHead.load( std::memory_order_acquire );
+                if ( ulTail - m_ulCachedHead >= Capacity )
+                {
+                    m_ulDropped.fetch_add( 1, std::memory_order_relaxed );
+                    return false;
+                }
+            }
+
+            m_Records[ ulTail & ( Capacity - 1 ) ] = value;
+            m_ulTail.store( ulTail + 1, std::memory_order_release );
+            return true;
+        }
+
+        // Consumer only.
+        std::optional<T> TryPop()
+        {
+            const uint64_t ulHead = m_ulHead.load( std::memory_order_relaxed );
+            if ( ulHead == m_ulCachedTail )
+            {
+                m_ulCachedTail = m_ulTail.load( std::memory_order_acquire );
+                if ( ulHead == m_ulCachedTail )
+                    return std::nullopt;
+            }
+
+            T value = m_Records[ ulHead & ( Capacity - 1 ) ];
+            m_ulHead.store( ulHead + 1, std::memory_order_release );
+            return value;
+        }
+
+        bool IsEmpty() const
+        {
+            return m_ulHead.load( std::memory_order_acquire ) == m_ulTail.load( std::memory_order_acquire );
+        }
+
+        // Total number of records dropped because the ring was full.
+        uint64_t GetDroppedCount() const { return m_ulDropped.load( std::memory_order_relaxed ); }
+
+    private:
+        T m_Records[ Capacity ];
+
+        alignas( 64 ) std::atomic<uint64_t> m_ulTail = { 0 };
+        uint64_t m_ulCachedHead = 0;
+        std::atomic<uint64_t> m_ulDropped = { 0 };
+
+        alignas( 64 ) std::atomic<uint64_t> m_ulHead = { 0 };
+        uint64_t m_ulCachedTail = 0;
+    };
+}
@@ -0,0 +1,373 @@
+#include "ScreenshotEncode.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <zlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gamescope
+{
+    // Runs fn( uStripe ) for every stripe, one thread each, the calling thread included.
+    static void ParallelForStripes( uint32_t uStripeCount, const std::function<void( uint32_t )> &fn )
+    {
+        std::vector<std::thread> threads;
+        for ( uint32_t i = 1; i < uStripeCount; i++ )
+            threads.emplace_back( fn, i );
+
+        fn( 0 );
+
+        for ( std::thread &thread : threads )
+            thread.join();
+    }
+
+    static uint32_t DefaultThreadCount()
+    {
+        return std::clamp( std::thread::hardware_concurrency() / 2, 1u, 8u );
+    }
+
+    void ParallelForRows( uint32_t uRows, uint32_t uThreadCount, const std::function<void( uint32_t, uint32_t )> &fn )
+    {
+        if ( uThreadCount == 0 )
+            uThreadCount = DefaultThreadCount();
+        uThreadCount = std::clamp( uThreadCount, 1u, std::max( uRows, 1u ) );
+
+        ParallelForStripes( uThreadCount, [&]( uint32_t uStripe )
+        {
+            fn( uint32_t( uint64_t( uRows ) * uStripe / uThreadCount ), uint32_t( uint64_t( uRows ) * ( uStripe + 1 ) / uThreadCount ) );
+        });
+    }
+
+    void SwizzleBGRXToRGBA( uint8_t *pDst, size_t zDstPitch, const uint8_t *pSrc, size_t zSrcPitch, uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow )
+    {
+        for ( uint32_t y = uFirstRow; y < uEndRow; y++ )
+        {
+            const uint8_t *pSrcRow = pSrc + y * zSrcPitch;
+            uint8_t *pDstRow = pDst + y * zDstPitch;
+
+            uint32_t x = 0;
+#if defined(__SSE2__)
+            const __m128i green = _mm_set1_epi32( 0x0000FF00 );
+            const __m128i low = _mm_set1_epi32( 0x000000FF );
+            const __m128i alpha = _mm_set1_epi32( int32_t( 0xFF000000 ) );
+            for ( ; x + 4 <= uWidth; x += 4 )
+            {
+                __m128i bgrx = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrcRow + x * 4 ) );
+                __m128i rgba = _mm_or_si128(
+                    _mm_or_si128( _mm_and_si128( bgrx, green ), alpha ),
+                    _mm_or_si128( _mm_and_si128( _mm_srli_epi32( bgrx, 16 ), low ), _mm_slli_epi32( _mm_and_si128( bgrx, low ), 16 ) ) );
+                _mm_storeu_si128( reinterpret_cast<__m128i *>( pDstRow + x * 4 ), rgba );
+            }
+#endif
+            for ( ; x < uWidth; x++ )
+            {
+                pDstRow[x * 4 + 0] = pSrcRow[x * 4 + 2];
+                pDstRow[x * 4 + 1] = pSrcRow[x * 4 + 1];
+                pDstRow[x * 4 + 2] = pSrcRow[x * 4 + 0];
+                pDstRow[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    void UnpackX2RGB10ToPlanes(
+        uint16_t *pR, size_t zRPitch, uint16_t *pG, size_t zGPitch, uint16_t *pB, size_t zBPitch,
+        const uint8_t *pSrc, size_t zSrcPitch, uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow )
+    {
+        for ( uint32_t y = uFirstRow; y < uEndRow; y++ )
+        {
+            const uint32_t *pSrcRow = reinterpret_cast<const uint32_t *>( pSrc + y * zSrcPitch );
+            uint16_t *pRRow = reinterpret_cast<uint16_t *>( reinterpret_cast<uint8_t *>( pR ) + y * zRPitch );
+            uint16_t *pGRow = reinterpret_cast<uint16_t *>( reinterpret_cast<uint8_t *>( pG ) + y * zGPitch );
+            uint16_t *pBRow = reinterpret_cast<uint16_t *>( reinterpret_cast<uint8_t *>( pB ) + y * zBPitch );
+
+            uint32_t x = 0;
+#if defined(__SSE2__)
+            const __m128i mask = _mm_set1_epi32( 0x3FF );
+            for ( ; x + 8 <= uWidth; x += 8 )
+            {
+                __m128i lo = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrcRow + x ) );
+                __m128i hi = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrcRow + x + 4 ) );
+
+                // 10-bit values, so the signed saturation never kicks in.
+                __m128i r = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( lo, 20 ), mask ), _mm_and_si128( _mm_srli_epi32( hi, 20 ), mask ) );
+                __m128i g = _mm_packs_epi32( _mm_and_si128( _mm_srli_epi32( lo, 10 ), mask ), _mm_and_si128( _mm_srli_epi32( hi, 10 ), mask ) );
+                __m128i b = _mm_packs_epi32( _mm_and_si128( lo, mask ), _mm_and_si128( hi, mask ) );
+
+                _mm_storeu_si128( reinterpret_cast<__m128i *>( pRRow + x ), r );
+                _mm_storeu_si128( reinterpret_cast<__m128i *>( pGRow + x ), g );
+                _mm_storeu_si128( reinterpret_cast<__m128i *>( pBRow + x ), b );
+            }
+#endif
+            for ( ; x < uWidth; x++ )
+            {
+                const uint32_t uPixel = pSrcRow[x];
+                pRRow[x] = uint16_t( ( uPixel >> 20 ) & 0x3FF );
+                pGRow[x] = uint16_t( ( uPixel >> 10 ) & 0x3FF );
+                pBRow[x] = uint16_t( ( uPixel >>  0 ) & 0x3FF );
+            }
+        }
+    }
+
+    void ConvertNV12ToRGBA(
+        uint8_t *pDst, size_t zDstPitch,
+        const uint8_t *pLuma, size_t zLumaPitch, const uint8_t *pChroma, size_t zChromaPitch,
+        YCbCrMatrix eMatrix, bool bFullRange,
+        uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow )
+    {
+        const double flKr = eMatrix == YCbCrMatrix::BT709 ? 0.2126 : 0.299;
+        const double flKb = eMatrix == YCbCrMatrix::BT709 ? 0.0722 : 0.114;
+        const double flKg = 1.0 - flKr - flKb;
+        const double flYScale = bFullRange ? 1.0 : 255.0 / 219.0;
+        const double flCScale = bFullRange ? 1.0 : 255.0 / 224.0;
+        const int32_t nYOffset = bFullRange ? 0 : 16;
+
+        // 14 bits of fraction, everything stays well inside 32 bits.
+        constexpr int32_t k_nShift = 14;
+        auto fixed = []( double flValue ) { return int32_t( flValue * ( 1 << k_nShift ) + ( flValue < 0 ? -0.5 : 0.5 ) ); };
+        const int32_t nY   = fixed( flYScale );
+        const int32_t nCrR = fixed( flCScale * 2.0 * ( 1.0 - flKr ) );
+        const int32_t nCbB = fixed( flCScale * 2.0 * ( 1.0 - flKb ) );
+        const int32_t nCbG = fixed( flCScale * 2.0 * flKb * ( 1.0 - flKb ) / flKg );
+        const int32_t nCrG = fixed( flCScale * 2.0 * flKr * ( 1.0 - flKr ) / flKg );
+
+        auto clamp8 = []( int32_t nValue ) { return uint8_t( std::clamp( ( nValue + ( 1 << ( k_nShift - 1 ) ) ) >> k_nShift, 0, 255 ) ); };
+
+        for ( uint32_t y = uFirstRow; y < uEndRow; y++ )
+        {
+            const uint8_t *pLumaRow = pLuma + y * zLumaPitch;
+            const uint8_t *pChromaRow = pChroma + ( y / 2 ) * zChromaPitch;
+            uint8_t *pDstRow = pDst + y * zDstPitch;
+
+            for ( uint32_t x = 0; x < uWidth; x++ )
+            {
+                const int32_t nLuma = nY * ( int32_t( pLumaRow[x] ) - nYOffset );
+                const int32_t nCb = int32_t( pChromaRow[( x & ~1u ) + 0] ) - 128;
+                const int32_t nCr = int32_t( pChromaRow[( x & ~1u ) + 1] ) - 128;
+
+                pDstRow[x * 4 + 0] = clamp8( nLuma + nCrR * nCr );
+                pDstRow[x * 4 + 1] = clamp8( nLuma - nCbG * nCb - nCrG * nCr );
+                pDstRow[x * 4 + 2] = clamp8( nLuma + nCbB * nCb );
+                pDstRow[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    //
+    // PNG
+    //
+
+    static uint8_t PaethPredictor( int a, int b, int c )
+    {
+        int p = a + b - c;
+        int pa = abs( p - a ), pb = abs( p - b ), pc = abs( p - c );
+        if ( pa <= pb && pa <= pc )
+            return uint8_t( a );
+        if ( pb <= pc )
+            return uint8_t( b );
+        return uint8_t( c );
+    }
+
+    // Writes the filter type byte + filtered row, trying every filter and keeping the
+    // one with the smallest sum of absolute values, the usual heuristic (and stb's).
+    static void FilterRow( uint8_t *pOut, std::vector<uint8_t> &scratch, const uint8_t *pRow, const uint8_t *pPrevRow, size_t zRowBytes, uint32_t uBpp )
+    {
+        scratch.resize( zRowBytes );
+        uint8_t *pScratch = scratch.data();
+
+        auto score = []( const uint8_t *pData, size_t zSize )
+        {
+            uint64_t ulScore = 0;
+            for ( size_t i = 0; i < zSize; i++ )
+                ulScore += uint64_t( abs( int8_t( pData[i] ) ) );
+            return ulScore;
+        };
+
+        // None
+        pOut[0] = 0;
+        memcpy( pOut + 1, pRow, zRowBytes );
+        uint64_t ulBestScore = score( pRow, zRowBytes );
+
+        auto consider = [&]( uint8_t uFilter )
+        {
+            uint64_t ulScore = score( pScratch, zRowBytes );
+            if ( ulScore < ulBestScore )
+            {
+                ulBestScore = ulScore;
+                pOut[0] = uFilter;
+                memcpy( pOut + 1, pScratch, zRowBytes );
+            }
+        };
+
+        // Sub
+        for ( size_t i = 0; i < zRowBytes; i++ )
+            pScratch[i] = uint8_t( pRow[i] - ( i >= uBpp ? pRow[i - uBpp] : 0 ) );
+        consider( 1 );
+
+        if ( pPrevRow )
+        {
+            // Up
+            for ( size_t i = 0; i < zRowBytes; i++ )
+                pScratch[i] = uint8_t( pRow[i] - pPrevRow[i] );
+            consider( 2 );
+
+            // Average
+            for ( size_t i = 0; i < zRowBytes; i++ )
+                pScratch[i] = uint8_t( pRow[i] - ( ( ( i >= uBpp ? pRow[i - uBpp] : 0 ) + pPrevRow[i] ) >> 1 ) );
+            consider( 3 );
+
+            // Paeth
+            for ( size_t i = 0; i < zRowBytes; i++ )
+            {
+                const int a = i >= uBpp ? pRow[i - uBpp] : 0;
+                const int c = i >= uBpp ? pPrevRow[i - uBpp] : 0;
+                pScratch[i] = uint8_t( pRow[i] - PaethPredictor( a, pPrevRow[i], c ) );
+            }
+            consider( 4 );
+        }
+    }
+
+    struct PNGStripe_t
+    {
+        std::vector<uint8_t> deflated;
+        uLong ulAdler = 1;
+        size_t zFilteredSize = 0;
+        bool bOk = false;
+    };
+
+    static void EncodePNGStripe( const PNGEncodeDesc_t &desc, uint32_t uFirstRow, uint32_t uEndRow, bool bLast, PNGStripe_t *pStripe )
+    {
+        const size_t zRowBytes = size_t( desc.uWidth ) * desc.uChannels;
+
+        std::vector<uint8_t> filtered( ( zRowBytes + 1 ) * ( uEndRow - uFirstRow ) );
+        std::vector<uint8_t> scratch;
+        for ( uint32_t y = uFirstRow; y < uEndRow; y++ )
+        {
+            const uint8_t *pRow = desc.pPixels + y * desc.zPitch;
+            const uint8_t *pPrevRow = y ? pRow - desc.zPitch : nullptr;
+            FilterRow( &filtered[( y - uFirstRow ) * ( zRowBytes + 1 )], scratch, pRow, pPrevRow, zRowBytes, desc.uChannels );
+        }
+
+        pStripe->zFilteredSize = filtered.size();
+        pStripe->ulAdler = adler32( 1, filtered.data(), uInt( filtered.size() ) );
+
+        // Raw deflate, each stripe ends on a byte boundary (sync flush) so they can just be
+        // concatenated, only the last one finishes the stream.
+        z_stream stream = {};
+        if ( deflateInit2( &stream, desc.nCompressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+            return;
+
+        pStripe->deflated.resize( deflateBound( &stream, uLong( filtered.size() ) ) + 16 );
+        stream.next_in = filtered.data();
+        stream.avail_in = uInt( filtered.size() );
+
+        int nRet;
+        do
+        {
+            if ( stream.total_out == pStripe->deflated.size() )
+                pStripe->deflated.resize( pStripe->deflated.size() * 2 );
+
+            stream.next_out = pStripe->deflated.data() + stream.total_out;
+            stream.avail_out = uInt( pStripe->deflated.size() - stream.total_out );
+            nRet = deflate( &stream, bLast ? Z_FINISH : Z_SYNC_FLUSH );
+        } while ( bLast ? nRet == Z_OK : ( nRet == Z_OK && stream.avail_out == 0 ) );
+
+        pStripe->bOk = bLast ? nRet == Z_STREAM_END : nRet == Z_OK;
+        pStripe->deflated.resize( stream.total_out );
+        deflateEnd( &stream );
+    }
+
+    static void AppendBE32( std::vector<uint8_t> &out, uint32_t uValue )
+    {
+        out.push_back( uint8_t( uValue >> 24 ) );
+        out.push_back( uint8_t( uValue >> 16 ) );
+        out.push_back( uint8_t( uValue >> 8 ) );
+        out.push_back( uint8_t( uValue ) );
+    }
+
+    static void AppendChunk( std::vector<uint8_t> &out, const char *pszType, const uint8_t *pData, size_t zSize )
+    {
+        AppendBE32( out, uint32_t( zSize ) );
+        const size_t zTypeOffset = out.size();
+        out.insert( out.end(), pszType, pszType + 4 );
+        if ( zSize )
+            out.insert( out.end(), pData, pData + zSize );
+        AppendBE32( out, uint32_t( crc32( 0, out.data() + zTypeOffset, uInt( 4 + zSize ) ) ) );
+    }
+
+    std::vector<uint8_t> EncodePNG( const PNGEncodeDesc_t &desc )
+    {
+        if ( !desc.pPixels || !desc.uWidth || !desc.uHeight || ( desc.uChannels != 3 && desc.uChannels != 4 ) )
+            return {};
+
+        // Don't bother splitting tiny images, and keep stripes big enough to compress well.
+        static constexpr uint32_t k_uMinRowsPerStripe = 64;
+        const uint32_t uStripeCount = std::clamp( desc.uHeight / k_uMinRowsPerStripe, 1u, desc.uThreadCount ? desc.uThreadCount : DefaultThreadCount() );
+
+        std::vector<PNGStripe_t> stripes( uStripeCount );
+        ParallelForStripes( uStripeCount, [&]( uint32_t uStripe )
+        {
+            const uint32_t uFirstRow = uint32_t( uint64_t( desc.uHeight ) * uStripe / uStripeCount );
+            const uint32_t uEndRow = uint32_t( uint64_t( desc.uHeight ) * ( uStripe + 1 ) / uStripeCount );
+            EncodePNGStripe( desc, uFirstRow, uEndRow, uStripe == uStripeCount - 1, &stripes[uStripe] );
+        });
+
+        size_t zIDATSize = 2 + 4;
+        for ( const PNGStripe_t &stripe : stripes )
+        {
+            if ( !stripe.bOk )
+                return {};
+            zIDATSize += stripe.deflated.size();
+        }
+
+        // zlib wrapper around the concatenated raw deflate data.
+        std::vector<uint8_t> idat;
+        idat.reserve( zIDATSize );
+        idat.push_back( 0x78 );
+        idat.push_back( 0x9C );
+        uLong ulAdler = stripes[0].ulAdler;
+        for ( size_t i = 0; i < stripes.size(); i++ )
+        {
+            idat.insert( idat.end(), stripes[i].deflated.begin(), stripes[i].deflated.end() );
+            if ( i )
+                ulAdler = adler32_combine( ulAdler, stripes[i].ulAdler, z_off_t( stripes[i].zFilteredSize ) );
+        }
+        AppendBE32( idat, uint32_t( ulAdler ) );
+
+        std::vector<uint8_t> png;
+        png.reserve( idat.size() + 64 );
+
+        static constexpr uint8_t k_PNGSignature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        png.insert( png.end(), std::begin( k_PNGSignature ), std::end( k_PNGSignature ) );
+
+        std::vector<uint8_t> ihdr;
+        AppendBE32( ihdr, desc.uWidth );
+        AppendBE32( ihdr, desc.uHeight );
+        ihdr.push_back( 8 );                           // Bit depth
+        ihdr.push_back( desc.uChannels == 4 ? 6 : 2 ); // RGBA or RGB
+        ihdr.push_back( 0 );                           // Deflate
+        ihdr.push_back( 0 );                           // Adaptive filtering
+        ihdr.push_back( 0 );                           // No interlace
+        AppendChunk( png, "IHDR", ihdr.data(), ihdr.size() );
+        AppendChunk( png, "IDAT", idat.data(), idat.size() );
+        AppendChunk( png, "IEND", nullptr, 0 );
+
+        return png;
+    }
+
+    bool WriteFile( const char *pszPath, const std::vector<uint8_t> &data )
+    {
+        FILE *pFile = fopen( pszPath, "wb" );
+        if ( !pFile )
+            return false;
+
+        bool bOk = fwrite( data.data(), 1, data.size(), pFile ) == data.size();
+        bOk = fclose( pFile ) == 0 && bOk;
+        return bOk;
+    }
+}
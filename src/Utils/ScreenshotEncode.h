@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gamescope
+{
+    // Runs fn( uFirstRow, uEndRow ) over [0, uRows) split into one stripe per thread,
+    // the calling thread included. 0 threads picks a count from the machine.
+    void ParallelForRows( uint32_t uRows, uint32_t uThreadCount, const std::function<void( uint32_t, uint32_t )> &fn );
+
+    // B8G8R8A8 in memory -> R8G8B8A8 with opaque alpha.
+    void SwizzleBGRXToRGBA( uint8_t *pDst, size_t zDstPitch, const uint8_t *pSrc, size_t zSrcPitch, uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow );
+
+    // A2R10G10B10 -> one 16-bit plane per channel, alpha is dropped.
+    void UnpackX2RGB10ToPlanes(
+        uint16_t *pR, size_t zRPitch, uint16_t *pG, size_t zGPitch, uint16_t *pB, size_t zBPitch,
+        const uint8_t *pSrc, size_t zSrcPitch, uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow );
+
+    enum class YCbCrMatrix : uint32_t
+    {
+        BT601,
+        BT709,
+    };
+
+    // NV12 -> R8G8B8A8 with opaque alpha. Chroma is upsampled by replicating each sample.
+    void ConvertNV12ToRGBA(
+        uint8_t *pDst, size_t zDstPitch,
+        const uint8_t *pLuma, size_t zLumaPitch, const uint8_t *pChroma, size_t zChromaPitch,
+        YCbCrMatrix eMatrix, bool bFullRange,
+        uint32_t uWidth, uint32_t uFirstRow, uint32_t uEndRow );
+
+    struct PNGEncodeDesc_t
+    {
+        const uint8_t *pPixels = nullptr;
+        size_t zPitch = 0;
+        uint32_t uWidth = 0;
+        uint32_t uHeight = 0;
+        uint32_t uChannels = 4; // 8-bit RGB or RGBA.
+        int nCompressionLevel = 4; // zlib level
+        uint32_t uThreadCount = 0;
+    };
+
+    // Filters and deflates stripes of rows in parallel, then stitches them into one zlib stream.
+    // Returns an empty vector on failure.
+    std::vector<uint8_t> EncodePNG( const PNGEncodeDesc_t &desc );
+
+    bool WriteFile( const char *pszPath, const std::vector<uint8_t> &data );
+}
@@ -0,0 +1,100 @@
+#include "StridedCopy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gamescope
+{
+    static void CopyRowNonTemporal( uint8_t *pDst, const uint8_t *pSrc, size_t zBytes )
+    {
+#if defined(__SSE2__)
+        // Get the destination to 16 byte alignment for the streaming stores.
+        size_t zHead = std::min<size_t>( zBytes, ( 16 - ( uintptr_t( pDst ) & 15 ) ) & 15 );
+        memcpy( pDst, pSrc, zHead );
+        pDst += zHead;
+        pSrc += zHead;
+        zBytes -= zHead;
+
+        for ( ; zBytes >= 64; zBytes -= 64, pDst += 64, pSrc += 64 )
+        {
+            __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrc ) + 0 );
+            __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrc ) + 1 );
+            __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrc ) + 2 );
+            __m128i d = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrc ) + 3 );
+            _mm_stream_si128( reinterpret_cast<__m128i *>( pDst ) + 0, a );
+            _mm_stream_si128( reinterpret_cast<__m128i *>( pDst ) + 1, b );
+            _mm_stream_si128( reinterpret_cast<__m128i *>( pDst ) + 2, c );
+            _mm_stream_si128( reinterpret_cast<__m128i *>( pDst ) + 3, d );
+        }
+
+        for ( ; zBytes >= 16; zBytes -= 16, pDst += 16, pSrc += 16 )
+            _mm_stream_si128( reinterpret_cast<__m128i *>( pDst ), _mm_loadu_si128( reinterpret_cast<const __m128i *>( pSrc ) ) );
+#endif
+        memcpy( pDst, pSrc, zBytes );
+    }
+
+    static void CopyPlaneRows( const StridedPlaneCopy_t &plane, uint32_t uFirstRow, uint32_t uEndRow, StridedCopyKernel eKernel )
+    {
+        // Tightly packed on both sides, one big copy.
+        if ( eKernel == StridedCopyKernel::Memcpy && plane.zDstStride == plane.zRowBytes && plane.zSrcStride == plane.zRowBytes )
+        {
+            memcpy( plane.pDst + uFirstRow * plane.zDstStride, plane.pSrc + uFirstRow * plane.zSrcStride, ( uEndRow - uFirstRow ) * plane.zRowBytes );
+            return;
+        }
+
+        for ( uint32_t uRow = uFirstRow; uRow < uEndRow; uRow++ )
+        {
+            uint8_t *pDst = plane.pDst + uRow * plane.zDstStride;
+            const uint8_t *pSrc = plane.pSrc + uRow * plane.zSrcStride;
+
+            if ( eKernel == StridedCopyKernel::NonTemporal )
+                CopyRowNonTemporal( pDst, pSrc, plane.zRowBytes );
+            else
+                memcpy( pDst, pSrc, plane.zRowBytes );
+        }
+    }
+
+    void CopyStridedPlanes( std::span<const StridedPlaneCopy_t> planes, StridedCopyKernel eKernel, uint32_t uThreadCount )
+    {
+        size_t zTotalBytes = 0;
+        for ( const StridedPlaneCopy_t &plane : planes )
+            zTotalBytes += plane.zRowBytes * plane.uRows;
+
+        if ( uThreadCount == 0 )
+        {
+            // Below ~2MB spinning up threads costs more than it saves.
+            static constexpr size_t k_zBytesPerThread = 2 * 1024 * 1024;
+            uThreadCount = std::clamp<uint32_t>( zTotalBytes / k_zBytesPerThread, 1u, std::clamp( std::thread::hardware_concurrency() / 2, 1u, 4u ) );
+        }
+
+        // Every thread takes the same slice of rows out of each plane.
+        auto worker = [&]( uint32_t uSlice )
+        {
+            for ( const StridedPlaneCopy_t &plane : planes )
+            {
+                uint32_t uFirstRow = uint32_t( uint64_t( plane.uRows ) * uSlice / uThreadCount );
+                uint32_t uEndRow = uint32_t( uint64_t( plane.uRows ) * ( uSlice + 1 ) / uThreadCount );
+                CopyPlaneRows( plane, uFirstRow, uEndRow, eKernel );
+            }
+#if defined(__SSE2__)
+            if ( eKernel == StridedCopyKernel::NonTemporal )
+                _mm_sfence();
+#endif
+        };
+
+        std::vector<std::thread> threads;
+        for ( uint32_t i = 1; i < uThreadCount; i++ )
+            threads.emplace_back( worker, i );
+
+        worker( 0 );
+
+        for ( std::thread &thread : threads )
+            thread.join();
+    }
+}
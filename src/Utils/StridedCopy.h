@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace gamescope
+{
+    struct StridedPlaneCopy_t
+    {
+        uint8_t *pDst = nullptr;
+        size_t zDstStride = 0;
+        const uint8_t *pSrc = nullptr;
+        size_t zSrcStride = 0;
+        size_t zRowBytes = 0;
+        uint32_t uRows = 0;
+    };
+
+    enum class StridedCopyKernel : uint32_t
+    {
+        Memcpy,      // memcpy per row.
+        NonTemporal, // Streaming stores where available, the destination is
+                     // only read by another process, so don't pull it into our cache.
+    };
+
+    // Copies every plane row by row.
+    // Rows are split between uThreadCount threads (the calling thread included),
+    // 0 picks a thread count based on the amount of data.
+    void CopyStridedPlanes( std::span<const StridedPlaneCopy_t> planes, StridedCopyKernel eKernel = StridedCopyKernel::NonTemporal, uint32_t uThreadCount = 0 );
+}
@@ -78,6 +78,28 @@ static void BenchmarkCalcColorTransforms(benchmark::State &state)
 }
 BENCHMARK(BenchmarkCalcColorTransforms);
 
+// Kernel comparisons: range(0) = EColorTransformKernel, range(1) = thread count (0 = automatic).
+static void BenchmarkCalcColorTransformKernel(benchmark::State &state)
+{
+    EColorTransformKernel eOldKernel = g_eColorTransformKernel;
+    uint32_t uOldThreads = g_uColorTransformThreads;
+
+    g_eColorTransformKernel = static_cast<EColorTransformKernel>( state.range(0) );
+    g_uColorTransformThreads = static_cast<uint32_t>( state.range(1) );
+
+    BenchmarkCalcColorTransform(EOTF_PQ, state);
+
+    g_eColorTransformKernel = eOldKernel;
+    g_uColorTransformThreads = uOldThreads;
+}
+BENCHMARK(BenchmarkCalcColorTransformKernel)
+    ->ArgNames({"kernel", "threads"})
+    ->Args({k_EColorTransformKernel_Scalar, 1})
+    ->Args({k_EColorTransformKernel_Vectorized, 1})
+    ->Args({k_EColorTransformKernel_Scalar, 0})
+    ->Args({k_EColorTransformKernel_Vectorized, 0})
+    ->UseRealTime();
+
 static constexpr uint32_t k_uFindTestValueCountLarge = 524288;
 static constexpr uint32_t k_uFindTestValueCountMedium = 16;
 static constexpr uint32_t k_uFindTestValueCountSmall = 5;
@@ -2,10 +2,14 @@
 #include "color_helpers_impl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cmath>
 #include <fstream>
+#include <limits>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
@@ -670,6 +674,245 @@ inline T applyShaper( const T & input, EOTF source, EOTF dest, const tonemapping
 
 bool g_bHuePreservationWhenClipping = false;
 
+EColorTransformKernel g_eColorTransformKernel = k_EColorTransformKernel_Vectorized;
+uint32_t g_uColorTransformThreads = 0;
+
+// Everything needed to evaluate one texel of the 3D LUT, shared by both kernels.
+struct ColorTransform3DParams_t
+{
+    int nLutEdgeSize3d;
+    EOTF sourceEOTF;
+    EOTF destEOTF;
+    glm::mat3 dest_from_source;
+    glm::vec3 vMultLinear;
+    glm::mat3 whitePointDestAdaptation;
+    const colormapping_t *pMapping;
+    const tonemapping_t *pTonemapping;
+    const lut3d_t *pLook;
+    const glm::vec3 *pSourceColorEOTFEncodedEdge;
+    // Only valid without a look, as then EOTF -> linear is separable per channel.
+    const glm::vec3 *pSourceColorLinearEdge;
+    lut3d_t *pLut3d;
+};
+
+static void calcColorTransformPlane_Scalar( const ColorTransform3DParams_t &params, int nBlue )
+{
+    const int nLutEdgeSize3d = params.nLutEdgeSize3d;
+    const colormapping_t &mapping = *params.pMapping;
+    const tonemapping_t &tonemapping = *params.pTonemapping;
+
+    for ( int nGreen=0; nGreen<nLutEdgeSize3d; ++nGreen )
+    {
+        for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
+        {
+            glm::vec3 sourceColorEOTFEncoded = glm::vec3( params.pSourceColorEOTFEncodedEdge[nRed].r, params.pSourceColorEOTFEncodedEdge[nGreen].g, params.pSourceColorEOTFEncodedEdge[nBlue].b );
+
+            if ( params.pLook )
+            {
+                sourceColorEOTFEncoded = ApplyLut3D_Tetrahedral( *params.pLook, sourceColorEOTFEncoded );
+            }
+
+            // Convert to linearized display referred for source colorimetry
+            glm::vec3 sourceColorLinear = calcEOTFToLinear( sourceColorEOTFEncoded, params.sourceEOTF, tonemapping );
+
+            // Convert to dest colorimetry (linearized display referred)
+            glm::vec3 destColorLinear = params.dest_from_source * sourceColorLinear;
+
+            // Do a naive blending with native gamut based on saturation
+            // ( A very simplified form of gamut mapping )
+            // float colorSaturation = rgb_to_hsv( sourceColor ).y;
+            float colorSaturation = rgb_to_hsv( sourceColorLinear ).y;
+            float amount = cfit( colorSaturation, mapping.blendEnableMinSat, mapping.blendEnableMaxSat, mapping.blendAmountMin, mapping.blendAmountMax );
+            destColorLinear = glm::mix( destColorLinear, sourceColorLinear, amount );
+
+            // Apply linear Mult
+            destColorLinear = params.vMultLinear * destColorLinear;
+
+            // Apply destination virtual white point mapping
+            destColorLinear = params.whitePointDestAdaptation * destColorLinear;
+
+            // Apply tonemapping
+            destColorLinear = tonemapping.apply( destColorLinear );
+
+            // Hue preservation
+            if ( g_bHuePreservationWhenClipping )
+            {
+                float flMax = std::max( std::max( destColorLinear.r, destColorLinear.g ), destColorLinear.b );
+                // TODO: Don't use g22_luminance here or in tonemapping, use whatever maxContentLightLevel is for the connector.
+                if ( flMax > tonemapping.g22_luminance + 1.0f )
+                {
+                    destColorLinear /= flMax;
+                    destColorLinear *= tonemapping.g22_luminance;
+                }
+            }
+
+            // Apply dest EOTF
+            glm::vec3 destColorEOTFEncoded = calcLinearToEOTF( destColorLinear, params.destEOTF, tonemapping );
+
+            // Write LUT
+            params.pLut3d->data[GetLut3DIndexRedFastRGB( nRed, nGreen, nBlue, nLutEdgeSize3d )] = destColorEOTFEncoded;
+        }
+    }
+}
+
+// One row of red values for a fixed green/blue, as structure-of-arrays so
+// the per-texel math below auto-vectorizes.
+static constexpr int k_nMaxLutEdgeSize3d = 64;
+struct ColorTransformRow_t
+{
+    alignas( 32 ) float r[ k_nMaxLutEdgeSize3d ];
+    alignas( 32 ) float g[ k_nMaxLutEdgeSize3d ];
+    alignas( 32 ) float b[ k_nMaxLutEdgeSize3d ];
+};
+
+// Dispatch to AVX2 at runtime where available, SSE2/NEON are the baseline otherwise.
+#if defined(__x86_64__) && defined(__GNUC__)
+#define COLOR_TRANSFORM_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define COLOR_TRANSFORM_TARGET_CLONES
+#endif
+
+// Source linear -> dest linear, gamut blend, linear mult and white point adaptation.
+// Mirrors the glm math in calcColorTransformPlane_Scalar term for term.
+COLOR_TRANSFORM_TARGET_CLONES
+static void calcColorTransformRow_Linear( const ColorTransform3DParams_t &params, int nCount, const ColorTransformRow_t &source, ColorTransformRow_t &dest )
+{
+    const glm::mat3 &m = params.dest_from_source;
+    const glm::mat3 &w = params.whitePointDestAdaptation;
+    const glm::vec3 mult = params.vMultLinear;
+    const colormapping_t &mapping = *params.pMapping;
+
+    for ( int i = 0; i < nCount; i++ )
+    {
+        const float sr = source.r[i];
+        const float sg = source.g[i];
+        const float sb = source.b[i];
+
+        float dr = m[0][0] * sr + m[1][0] * sg + m[2][0] * sb;
+        float dg = m[0][1] * sr + m[1][1] * sg + m[2][1] * sb;
+        float db = m[0][2] * sr + m[1][2] * sg + m[2][2] * sb;
+
+        const float flMax = std::max( std::max( sr, sg ), sb );
+        const float flMin = std::min( std::min( sr, sg ), sb );
+        const float colorSaturation = ( fabsf( flMax ) < std::numeric_limits<float>::min() ) ? 0.f : ( flMax - flMin ) / flMax;
+        const float amount = cfit( colorSaturation, mapping.blendEnableMinSat, mapping.blendEnableMaxSat, mapping.blendAmountMin, mapping.blendAmountMax );
+
+        dr = dr * ( 1.f - amount ) + sr * amount;
+        dg = dg * ( 1.f - amount ) + sg * amount;
+        db = db * ( 1.f - amount ) + sb * amount;
+
+        dr *= mult.r;
+        dg *= mult.g;
+        db *= mult.b;
+
+        dest.r[i] = w[0][0] * dr + w[1][0] * dg + w[2][0] * db;
+        dest.g[i] = w[0][1] * dr + w[1][1] * dg + w[2][1] * db;
+        dest.b[i] = w[0][2] * dr + w[1][2] * dg + w[2][2] * db;
+    }
+}
+
+COLOR_TRANSFORM_TARGET_CLONES
+static void calcColorTransformRow_HuePreservation( float flLuminance, int nCount, ColorTransformRow_t &row )
+{
+    for ( int i = 0; i < nCount; i++ )
+    {
+        const float flMax = std::max( std::max( row.r[i], row.g[i] ), row.b[i] );
+        const float flScale = flMax > flLuminance + 1.0f ? flLuminance / flMax : 1.f;
+        row.r[i] *= flScale;
+        row.g[i] *= flScale;
+        row.b[i] *= flScale;
+    }
+}
+
+static void calcColorTransformPlane_Vectorized( const ColorTransform3DParams_t &params, int nBlue )
+{
+    const int nLutEdgeSize3d = params.nLutEdgeSize3d;
+    const tonemapping_t &tonemapping = *params.pTonemapping;
+
+    ColorTransformRow_t source;
+    ColorTransformRow_t dest;
+
+    for ( int nGreen=0; nGreen<nLutEdgeSize3d; ++nGreen )
+    {
+        // Gather source linear colors for the row
+        if ( params.pSourceColorLinearEdge )
+        {
+            const float flGreen = params.pSourceColorLinearEdge[nGreen].g;
+            const float flBlue = params.pSourceColorLinearEdge[nBlue].b;
+            for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
+            {
+                source.r[nRed] = params.pSourceColorLinearEdge[nRed].r;
+                source.g[nRed] = flGreen;
+                source.b[nRed] = flBlue;
+            }
+        }
+        else
+        {
+            for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
+            {
+                glm::vec3 sourceColorEOTFEncoded = glm::vec3( params.pSourceColorEOTFEncodedEdge[nRed].r, params.pSourceColorEOTFEncodedEdge[nGreen].g, params.pSourceColorEOTFEncodedEdge[nBlue].b );
+                sourceColorEOTFEncoded = ApplyLut3D_Tetrahedral( *params.pLook, sourceColorEOTFEncoded );
+                glm::vec3 sourceColorLinear = calcEOTFToLinear( sourceColorEOTFEncoded, params.sourceEOTF, tonemapping );
+                source.r[nRed] = sourceColorLinear.r;
+                source.g[nRed] = sourceColorLinear.g;
+                source.b[nRed] = sourceColorLinear.b;
+            }
+        }
+
+        calcColorTransformRow_Linear( params, nLutEdgeSize3d, source, dest );
+
+        // Tonemapping operators mix channels, leave those scalar.
+        if ( tonemapping.eOperator != ETonemapOperator_None )
+        {
+            for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
+            {
+                glm::vec3 destColorLinear = tonemapping.apply( glm::vec3( dest.r[nRed], dest.g[nRed], dest.b[nRed] ) );
+                dest.r[nRed] = destColorLinear.r;
+                dest.g[nRed] = destColorLinear.g;
+                dest.b[nRed] = destColorLinear.b;
+            }
+        }
+
+        if ( g_bHuePreservationWhenClipping )
+            calcColorTransformRow_HuePreservation( tonemapping.g22_luminance, nLutEdgeSize3d, dest );
+
+        glm::vec3 *pOutput = &params.pLut3d->data[GetLut3DIndexRedFastRGB( 0, nGreen, nBlue, nLutEdgeSize3d )];
+        for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
+        {
+            pOutput[nRed] = glm::vec3(
+                calcLinearToEOTF( dest.r[nRed], params.destEOTF, tonemapping ),
+                calcLinearToEOTF( dest.g[nRed], params.destEOTF, tonemapping ),
+                calcLinearToEOTF( dest.b[nRed], params.destEOTF, tonemapping ) );
+        }
+    }
+}
+
+// Blue planes are independent of each other, hand them out to a few threads.
+template <typename Func>
+static void ForEachPlaneParallel( int nPlaneCount, Func func )
+{
+    uint32_t uThreadCount = g_uColorTransformThreads;
+    if ( uThreadCount == 0 )
+        uThreadCount = std::clamp( std::thread::hardware_concurrency(), 1u, 4u );
+    uThreadCount = std::min<uint32_t>( uThreadCount, nPlaneCount );
+
+    std::atomic<int> nNextPlane = { 0 };
+    auto worker = [&]()
+    {
+        for ( int nPlane = nNextPlane++; nPlane < nPlaneCount; nPlane = nNextPlane++ )
+            func( nPlane );
+    };
+
+    std::vector<std::thread> threads;
+    for ( uint32_t i = 1; i < uThreadCount; i++ )
+        threads.emplace_back( worker );
+
+    worker();
+
+    for ( std::thread &thread : threads )
+        thread.join();
+}
+
 template <uint32_t lutEdgeSize3d>
 void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
 	lut3d_t * pLut3d,
@@ -686,6 +929,7 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
     // when applying both.  I.e., you can put ANY transform in here, and it should work.
 
     static constexpr int32_t nLutEdgeSize3d = static_cast<int32_t>(lutEdgeSize3d);
+    static_assert( nLutEdgeSize3d <= k_nMaxLutEdgeSize3d );
     if ( pShaper )
     {
         float flScale = 1.f / ( (float) nLutSize1d - 1.f );
@@ -740,8 +984,11 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
             }
         }
 
+        const bool bHasLook = pLook && !pLook->data.empty();
+
         // Precalculate source color EOTF encoded per-edge.
         glm::vec3 vSourceColorEOTFEncodedEdge[nLutEdgeSize3d];
+        glm::vec3 vSourceColorLinearEdge[nLutEdgeSize3d];
         float flEdgeScale = 1.f / ( (float) nLutEdgeSize3d - 1.f );
         for ( int nIndex = 0; nIndex < nLutEdgeSize3d; ++nIndex )
         {
@@ -750,65 +997,35 @@ void calcColorTransform( lut1d_t * pShaper, int nLutSize1d,
             {
                 vSourceColorEOTFEncodedEdge[nIndex] = ApplyLut1D_Inverse_Linear( *pShaper, vSourceColorEOTFEncodedEdge[nIndex] );
             }
+            vSourceColorLinearEdge[nIndex] = calcEOTFToLinear( vSourceColorEOTFEncodedEdge[nIndex], sourceEOTF, tonemapping );
         }
 
         pLut3d->resize( nLutEdgeSize3d );
-    
-        for ( int nBlue=0; nBlue<nLutEdgeSize3d; ++nBlue )
+
+        const ColorTransform3DParams_t params =
         {
-            for ( int nGreen=0; nGreen<nLutEdgeSize3d; ++nGreen )
-            {
-                for ( int nRed=0; nRed<nLutEdgeSize3d; ++nRed )
-                {
-                    glm::vec3 sourceColorEOTFEncoded = glm::vec3( vSourceColorEOTFEncodedEdge[nRed].r, vSourceColorEOTFEncodedEdge[nGreen].g, vSourceColorEOTFEncodedEdge[nBlue].b );
-
-                    if ( pLook && !pLook->data.empty() )
-                    {
-                        sourceColorEOTFEncoded = ApplyLut3D_Tetrahedral( *pLook, sourceColorEOTFEncoded );
-                    }
-
-                    // Convert to linearized display referred for source colorimetry
-                    glm::vec3 sourceColorLinear = calcEOTFToLinear( sourceColorEOTFEncoded, sourceEOTF, tonemapping );
-
-                    // Convert to dest colorimetry (linearized display referred)
-                    glm::vec3 destColorLinear = dest_from_source * sourceColorLinear;
-
-                    // Do a naive blending with native gamut based on saturation
-                    // ( A very simplified form of gamut mapping )
-                    // float colorSaturation = rgb_to_hsv( sourceColor ).y;
-                    float colorSaturation = rgb_to_hsv( sourceColorLinear ).y;
-                    float amount = cfit( colorSaturation, mapping.blendEnableMinSat, mapping.blendEnableMaxSat, mapping.blendAmountMin, mapping.blendAmountMax );
-                    destColorLinear = glm::mix( destColorLinear, sourceColorLinear, amount );
-
-                    // Apply linear Mult
-                    destColorLinear = vMultLinear * destColorLinear;
-
-                    // Apply destination virtual white point mapping
-                    destColorLinear = whitePointDestAdaptation * destColorLinear;
-
-                    // Apply tonemapping
-                    destColorLinear = tonemapping.apply( destColorLinear );
-
-                    // Hue preservation
-                    if ( g_bHuePreservationWhenClipping )
-                    {
-                        float flMax = std::max( std::max( destColorLinear.r, destColorLinear.g ), destColorLinear.b );
-                        // TODO: Don't use g22_luminance here or in tonemapping, use whatever maxContentLightLevel is for the connector.
-                        if ( flMax > tonemapping.g22_luminance + 1.0f )
-                        {
-                            destColorLinear /= flMax;
-                            destColorLinear *= tonemapping.g22_luminance;
-                        }
-                    }
-
-                    // Apply dest EOTF
-                    glm::vec3 destColorEOTFEncoded = calcLinearToEOTF( destColorLinear, destEOTF, tonemapping );
-
-                    // Write LUT
-                    pLut3d->data[GetLut3DIndexRedFastRGB( nRed, nGreen, nBlue, nLutEdgeSize3d )] = destColorEOTFEncoded;
-                }
-            }
-        }
+            .nLutEdgeSize3d = nLutEdgeSize3d,
+            .sourceEOTF = sourceEOTF,
+            .destEOTF = destEOTF,
+            .dest_from_source = dest_from_source,
+            .vMultLinear = vMultLinear,
+            .whitePointDestAdaptation = whitePointDestAdaptation,
+            .pMapping = &mapping,
+            .pTonemapping = &tonemapping,
+            .pLook = bHasLook ? pLook : nullptr,
+            .pSourceColorEOTFEncodedEdge = vSourceColorEOTFEncodedEdge,
+            .pSourceColorLinearEdge = bHasLook ? nullptr : vSourceColorLinearEdge,
+            .pLut3d = pLut3d,
+        };
+
+        const EColorTransformKernel eKernel = g_eColorTransformKernel;
+        ForEachPlaneParallel( nLutEdgeSize3d, [&]( int nBlue )
+        {
+            if ( eKernel == k_EColorTransformKernel_Vectorized )
+                calcColorTransformPlane_Vectorized( params, nBlue );
+            else
+                calcColorTransformPlane_Scalar( params, nBlue );
+        });
     }
 }
 
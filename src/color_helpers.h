@@ -354,6 +354,23 @@ struct lut3d_t
 
 bool LoadCubeLut( lut3d_t * lut3d, const char * filename );
 
+// How calcColorTransform evaluates the 3D LUT.
+// The scalar kernel is the reference implementation, the vectorized one works on
+// structure-of-arrays rows of red values and is checked against it in color_tests.
+enum EColorTransformKernel
+{
+	k_EColorTransformKernel_Scalar = 0,
+	k_EColorTransformKernel_Vectorized = 1,
+};
+extern EColorTransformKernel g_eColorTransformKernel;
+
+// Number of threads the 3D LUT blue planes are spread across. 0 = automatic.
+extern uint32_t g_uColorTransformThreads;
+
+// Debug knobs that change what calcColorTransform generates.
+extern bool g_bUseSourceEOTFForShaper;
+extern bool g_bHuePreservationWhenClipping;
+
 // Generate a color transform from the source colorspace, to the dest colorspace,
 // nLutSize1d is the number of color entries in the shaper lut
 // I.e., for a shaper lut with 256 input colors  nLutSize1d = 256, countof(pRgbxData1d) = 1024
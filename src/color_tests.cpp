@@ -1,6 +1,8 @@
-#include "color_helpers.h"
+#include "color_helpers_impl.h"
 #include <cstdio>
 
+#include <glm/common.hpp>
+
 //#include <glm/ext.hpp>
 #include <glm/gtx/string_cast.hpp>
 
@@ -230,10 +232,132 @@ void test_eetf2390_mono()
     }
 }
 
+// Compare the vectorized 3D LUT kernel against the scalar reference
+// for a handful of representative configurations.
+int test_color_transform_kernels()
+{
+    printf("%s\n", __func__  );
+
+    using ns_color_tests::nLutEdgeSize3d;
+    const int nLutSize1d = 4096;
+
+    const primaries_t primaries = { { 0.602f, 0.355f }, { 0.340f, 0.574f }, { 0.164f, 0.121f } };
+    const glm::vec2 white = { 0.3070f, 0.3220f };
+
+    displaycolorimetry_t nativeColorimetry{};
+    nativeColorimetry.primaries = primaries;
+    nativeColorimetry.white = white;
+
+    displaycolorimetry_t inputColorimetry{};
+    colormapping_t colorMapping{};
+    buildSDRColorimetry( &inputColorimetry, &colorMapping, 0.5f, nativeColorimetry );
+
+    struct TestCase_t
+    {
+        const char *pszName;
+        EOTF inputEOTF;
+        EOTF outputEOTF;
+        ETonemapOperator eOperator;
+        nightmode_t nightmode;
+        glm::vec2 destVirtualWhite;
+        bool bHuePreservation;
+        bool bLook;
+    };
+
+    // A look that mixes channels and bends the curve, so it can't be mistaken
+    // for something separable, and whose vertices don't line up with the
+    // output LUT's.
+    const int nLookEdgeSize = 17;
+    lut3d_t look;
+    look.resize( nLookEdgeSize );
+    for ( int nBlue = 0; nBlue < nLookEdgeSize; nBlue++ )
+    {
+        for ( int nGreen = 0; nGreen < nLookEdgeSize; nGreen++ )
+        {
+            for ( int nRed = 0; nRed < nLookEdgeSize; nRed++ )
+            {
+                glm::vec3 color = glm::vec3( nRed, nGreen, nBlue ) / float( nLookEdgeSize - 1 );
+                glm::vec3 tinted = glm::vec3( 0.9f * color.r + 0.1f * color.g, color.g, 0.8f * color.b + 0.15f * color.r );
+                look.data[ nRed + nGreen * nLookEdgeSize + nBlue * nLookEdgeSize * nLookEdgeSize ] =
+                    glm::clamp( tinted * tinted * ( 3.f - 2.f * tinted ), 0.f, 1.f );
+            }
+        }
+    }
+
+    const TestCase_t testCases[] =
+    {
+        { "g22->g22",                  EOTF_Gamma22, EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.f, 0.f },         false, false },
+        { "pq->g22",                   EOTF_PQ,      EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.f, 0.f },         false, false },
+        { "g22->pq",                   EOTF_Gamma22, EOTF_PQ,      ETonemapOperator_None,            {},                    { 0.f, 0.f },         false, false },
+        { "g22->g22 nightmode",        EOTF_Gamma22, EOTF_Gamma22, ETonemapOperator_None,            { 0.5f, 0.083f, 1.f }, { 0.f, 0.f },         false, false },
+        { "g22->g22 virtual white",    EOTF_Gamma22, EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.3457f, 0.3585f }, false, false },
+        { "pq->pq eetf2390 luma",      EOTF_PQ,      EOTF_PQ,      ETonemapOperator_EETF2390_Luma,   {},                    { 0.f, 0.f },         false, false },
+        { "pq->g22 hue preservation",  EOTF_PQ,      EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.f, 0.f },         true, false },
+        { "g22->g22 look",             EOTF_Gamma22, EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.f, 0.f },         false, true },
+        { "pq->g22 look",              EOTF_PQ,      EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.f, 0.f },         false, true },
+        { "g22->pq look nightmode",    EOTF_Gamma22, EOTF_PQ,      ETonemapOperator_None,            { 0.5f, 0.083f, 1.f }, { 0.f, 0.f },         false, true },
+        { "pq->pq eetf2390 luma look", EOTF_PQ,      EOTF_PQ,      ETonemapOperator_EETF2390_Luma,   {},                    { 0.f, 0.f },         false, true },
+        { "pq->g22 hue pres. look",    EOTF_PQ,      EOTF_Gamma22, ETonemapOperator_None,            {},                    { 0.3457f, 0.3585f }, true,  true },
+    };
+
+    const float flTolerance = 1e-4f;
+    int nFailures = 0;
+
+    for ( const TestCase_t &test : testCases )
+    {
+        tonemapping_t tonemapping{};
+        tonemapping.bUseShaper = true;
+        tonemapping.g22_luminance = test.outputEOTF == EOTF_PQ ? 203.f : 1.f;
+        tonemapping.eOperator = test.eOperator;
+        if ( test.eOperator != ETonemapOperator_None )
+            tonemapping.eetf2390.init_pq( nits_to_pq( 0.005f ), nits_to_pq( 4000.f ), nits_to_pq( 0.1f ), nits_to_pq( 1000.f ) );
+
+        g_bHuePreservationWhenClipping = test.bHuePreservation;
+
+        lut1d_t shaperScalar, shaperVectorized;
+        lut3d_t lutScalar, lutVectorized;
+
+        const lut3d_t *pLook = test.bLook ? &look : nullptr;
+
+        g_eColorTransformKernel = k_EColorTransformKernel_Scalar;
+        g_uColorTransformThreads = 1;
+        calcColorTransform<nLutEdgeSize3d>( &shaperScalar, nLutSize1d, &lutScalar, inputColorimetry, test.inputEOTF,
+            nativeColorimetry, test.outputEOTF, test.destVirtualWhite, k_EChromaticAdapatationMethod_Bradford,
+            colorMapping, test.nightmode, tonemapping, pLook, 1.f );
+
+        // Always spread over several threads, even on a machine with one core.
+        g_eColorTransformKernel = k_EColorTransformKernel_Vectorized;
+        g_uColorTransformThreads = 4;
+        calcColorTransform<nLutEdgeSize3d>( &shaperVectorized, nLutSize1d, &lutVectorized, inputColorimetry, test.inputEOTF,
+            nativeColorimetry, test.outputEOTF, test.destVirtualWhite, k_EChromaticAdapatationMethod_Bradford,
+            colorMapping, test.nightmode, tonemapping, pLook, 1.f );
+
+        float flMaxError = 0.f;
+        for ( size_t i = 0; i < lutScalar.data.size(); i++ )
+        {
+            glm::vec3 diff = glm::abs( lutScalar.data[i] - lutVectorized.data[i] );
+            flMaxError = std::max( flMaxError, std::max( std::max( diff.r, diff.g ), diff.b ) );
+        }
+
+        bool bPass = flMaxError <= flTolerance;
+        printf( "  %-28s max error %g %s\n", test.pszName, flMaxError, bPass ? "PASS" : "FAIL" );
+        if ( !bPass )
+            nFailures++;
+    }
+
+    g_bHuePreservationWhenClipping = false;
+    g_eColorTransformKernel = k_EColorTransformKernel_Vectorized;
+    g_uColorTransformThreads = 0;
+
+    return nFailures;
+}
+
 int main(int argc, char* argv[])
 {
     printf("color_tests\n");
     // test_eetf2390_mono();
     color_tests();
+    if ( test_color_transform_kernels() != 0 )
+        return 1;
     return 0;
 }
\ No newline at end of file
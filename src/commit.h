@@ -59,6 +59,8 @@ struct commit_t final : public gamescope::RcObject, public gamescope::IWaitable,
 	}
 
 	uint64_t commitID = 0;
+	// Buffer damage relative to the surface's previous commits.
+	gamescope::CCommitDamageHistory damageHistory;
 	bool done = false;
 	bool async = false;
 	bool fifo = false;
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Utils/MPSCQueue.h"
+
+// Stress test for the commit queue between the wayland thread(s) and steamcompmgr.
+// Several fake surfaces commit from their own threads while the consumer drains
+// periodically, checking that nothing is lost or reordered per surface, and
+// reporting how long commits sat in the queue before being latched.
+
+using Clock = std::chrono::steady_clock;
+
+struct FakeCommit_t
+{
+    uint32_t uSurface = 0;
+    uint64_t ulSeq = 0;
+    Clock::time_point enqueueTime{};
+    // Stand-ins for the feedback/timeline point refs a real ResListEntry_t carries.
+    std::shared_ptr<int> pRef;
+    std::vector<int> presentationFeedbacks;
+};
+
+template <size_t Capacity>
+static int test_commit_queue( const char *pszName, uint32_t uSurfaceCount, uint64_t ulCommitsPerSurface,
+    std::chrono::microseconds commitInterval, std::chrono::microseconds drainInterval )
+{
+    auto pQueue = std::make_unique<gamescope::MPSCQueue<FakeCommit_t, Capacity>>();
+
+    std::atomic<uint32_t> uProducersDone = { 0 };
+    std::vector<std::thread> producers;
+    for ( uint32_t uSurface = 0; uSurface < uSurfaceCount; uSurface++ )
+    {
+        producers.emplace_back( [&, uSurface]()
+        {
+            auto pRef = std::make_shared<int>( uSurface );
+            for ( uint64_t ulSeq = 0; ulSeq < ulCommitsPerSurface; ulSeq++ )
+            {
+                pQueue->Push( FakeCommit_t
+                {
+                    .uSurface = uSurface,
+                    .ulSeq = ulSeq,
+                    .enqueueTime = Clock::now(),
+                    .pRef = pRef,
+                    .presentationFeedbacks = {},
+                });
+
+                if ( commitInterval.count() )
+                    std::this_thread::sleep_for( commitInterval );
+            }
+            uProducersDone++;
+        });
+    }
+
+    std::vector<uint64_t> nextSeq( uSurfaceCount, 0 );
+    std::vector<double> latenciesUs;
+    latenciesUs.reserve( uSurfaceCount * ulCommitsPerSurface );
+    uint32_t uErrors = 0;
+
+    auto fnLatch = [&]( FakeCommit_t &commit )
+    {
+        latenciesUs.push_back( std::chrono::duration<double, std::micro>( Clock::now() - commit.enqueueTime ).count() );
+
+        if ( commit.ulSeq != nextSeq[ commit.uSurface ] )
+        {
+            if ( uErrors++ < 10 )
+                fprintf( stderr, "  surface %u: expected commit %lu, got %lu\n", commit.uSurface,
+                    (unsigned long)nextSeq[ commit.uSurface ], (unsigned long)commit.ulSeq );
+        }
+        nextSeq[ commit.uSurface ] = commit.ulSeq + 1;
+
+        if ( !commit.pRef || *commit.pRef != int( commit.uSurface ) )
+            uErrors++;
+    };
+
+    const auto startTime = Clock::now();
+    while ( uProducersDone != uSurfaceCount )
+    {
+        pQueue->Drain( fnLatch );
+        std::this_thread::sleep_for( drainInterval );
+    }
+    for ( std::thread &producer : producers )
+        producer.join();
+
+    // Anything left in the ring goes first, then whatever spilled.
+    pQueue->Drain( fnLatch );
+    pQueue->Drain( fnLatch );
+    const double flElapsedMs = std::chrono::duration<double, std::milli>( Clock::now() - startTime ).count();
+
+    const uint64_t ulExpected = uSurfaceCount * ulCommitsPerSurface;
+    if ( latenciesUs.size() != ulExpected )
+    {
+        fprintf( stderr, "  expected %lu commits, latched %zu\n", (unsigned long)ulExpected, latenciesUs.size() );
+        uErrors++;
+    }
+
+    std::sort( latenciesUs.begin(), latenciesUs.end() );
+    auto percentile = [&]( double flPercentile ) -> double
+    {
+        if ( latenciesUs.empty() )
+            return 0.0;
+        return latenciesUs[ std::min<size_t>( latenciesUs.size() - 1, size_t( flPercentile * latenciesUs.size() ) ) ];
+    };
+
+    printf( "%s: %u surfaces, %lu commits in %.1fms, enqueue->latch p50 %.1fus p99 %.1fus max %.1fus %s\n",
+        pszName, uSurfaceCount, (unsigned long)ulExpected, flElapsedMs,
+        percentile( 0.50 ), percentile( 0.99 ), latenciesUs.empty() ? 0.0 : latenciesUs.back(),
+        uErrors ? "FAILED" : "ok" );
+
+    return uErrors ? 1 : 0;
+}
+
+int main()
+{
+    printf( "commit_queue_tests\n" );
+
+    int nResult = 0;
+    // A few surfaces committing at ~1000Hz, consumer polling often. Latency is mostly the poll interval.
+    nResult |= test_commit_queue<256>( "paced", 4, 2000, std::chrono::microseconds( 1000 ), std::chrono::microseconds( 100 ) );
+    // Producers flat out, so the ring is always close to full.
+    nResult |= test_commit_queue<256>( "flood", 4, 20000, std::chrono::microseconds( 0 ), std::chrono::microseconds( 100 ) );
+    // Tiny ring with a slow consumer so producers constantly spill into the overflow.
+    nResult |= test_commit_queue<8>( "overflow", 8, 20000, std::chrono::microseconds( 0 ), std::chrono::microseconds( 1000 ) );
+    // Consumer spinning.
+    nResult |= test_commit_queue<256>( "busy drain", 2, 200000, std::chrono::microseconds( 0 ), std::chrono::microseconds( 0 ) );
+
+    return nResult;
+}
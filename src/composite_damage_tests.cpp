@@ -0,0 +1,246 @@
+#include <cstdio>
+
+#include "Utils/CompositeDamage.h"
+#include "Utils/CompositeTiles.h"
+
+// Checks the damage bookkeeping behind partial composition: commit damage
+// chaining, mapping it onto the output, tile merging and output image buffer age,
+// and the per-tile layer masks that let the blit skip hidden layers.
+
+using gamescope::CCommitDamageHistory;
+using gamescope::CCompositeTileMasks;
+using gamescope::CDamageRegion;
+using gamescope::CompositeTileLayer_t;
+using gamescope::COutputDamageTracker;
+using gamescope::DamageRect_t;
+
+static int s_nFailures = 0;
+
+#define EXPECT( cond ) \
+    do { if ( !( cond ) ) { fprintf( stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond ); s_nFailures++; } } while ( 0 )
+
+static bool RegionCovers( const CDamageRegion &region, const DamageRect_t &rect )
+{
+    if ( region.IsFull() )
+        return true;
+
+    // Every pixel of rect must be in some rect of the region.
+    for ( int32_t y = rect.nY1; y < rect.nY2; y++ )
+    {
+        for ( int32_t x = rect.nX1; x < rect.nX2; x++ )
+        {
+            bool bCovered = false;
+            for ( const DamageRect_t &r : region.Rects() )
+                bCovered |= x >= r.nX1 && x < r.nX2 && y >= r.nY1 && y < r.nY2;
+            if ( !bCovered )
+                return false;
+        }
+    }
+    return true;
+}
+
+static void test_commit_damage_history()
+{
+    CCommitDamageHistory first;
+    EXPECT( !first.DamageSince( 1 ) );
+
+    CCommitDamageHistory second;
+    second.Chain( first, 1, DamageRect_t{ 0, 0, 10, 10 } );
+    EXPECT( second.DamageSince( 1 ) == ( DamageRect_t{ 0, 0, 10, 10 } ) );
+
+    CCommitDamageHistory third;
+    third.Chain( second, 2, DamageRect_t{ 20, 20, 30, 30 } );
+    EXPECT( third.DamageSince( 2 ) == ( DamageRect_t{ 20, 20, 30, 30 } ) );
+    EXPECT( third.DamageSince( 1 ) == ( DamageRect_t{ 0, 0, 30, 30 } ) );
+    EXPECT( !third.DamageSince( 7 ) );
+
+    // No damage at all is still known damage.
+    CCommitDamageHistory fourth;
+    fourth.Chain( third, 3, DamageRect_t{} );
+    EXPECT( fourth.DamageSince( 3 ) && fourth.DamageSince( 3 )->IsEmpty() );
+
+    // Only the last few commits are remembered.
+    CCommitDamageHistory history = fourth;
+    for ( uint64_t ulCommit = 4; ulCommit < 4 + CCommitDamageHistory::k_uMaxEntries; ulCommit++ )
+    {
+        CCommitDamageHistory next;
+        next.Chain( history, ulCommit, DamageRect_t{ 0, 0, 1, 1 } );
+        history = next;
+    }
+    EXPECT( !history.DamageSince( 1 ) );
+    EXPECT( history.DamageSince( 4 ) );
+}
+
+static void test_texture_damage_to_output()
+{
+    // 1:1, offset by 100px: output = texture - offset.
+    DamageRect_t rOutput = gamescope::TextureDamageToOutput( DamageRect_t{ 10, 10, 20, 20 }, -100.0f + 0.5f, -50.0f + 0.5f, 1.0f, 1.0f );
+    EXPECT( rOutput.nX1 <= 110 && rOutput.nX2 >= 120 && rOutput.nY1 <= 60 && rOutput.nY2 >= 70 );
+    EXPECT( rOutput.nX1 >= 105 && rOutput.nX2 <= 125 );
+
+    // 720p upscaled to 1440p: scale = 0.5, each texel covers two output pixels.
+    rOutput = gamescope::TextureDamageToOutput( DamageRect_t{ 100, 100, 101, 101 }, 0.5f * 0.5f, 0.5f * 0.5f, 0.5f, 0.5f );
+    EXPECT( rOutput.nX1 <= 200 && rOutput.nX2 >= 202 );
+    EXPECT( rOutput.Area() < 10 * 10 );
+
+    EXPECT( gamescope::TextureDamageToOutput( DamageRect_t{}, 0.0f, 0.0f, 1.0f, 1.0f ).IsEmpty() );
+}
+
+static void test_damage_region()
+{
+    CDamageRegion region;
+    EXPECT( region.IsEmpty() );
+
+    region.Add( DamageRect_t{ 5, 5, 6, 6 } );
+    EXPECT( region.Rects().size() == 1 );
+    EXPECT( region.Rects()[0] == ( DamageRect_t{ 0, 0, 32, 32 } ) );
+
+    // Overlapping rects get merged.
+    region.Add( DamageRect_t{ 20, 20, 40, 40 } );
+    EXPECT( region.Rects().size() == 1 );
+    EXPECT( RegionCovers( region, DamageRect_t{ 5, 5, 40, 40 } ) );
+
+    // Far apart ones don't.
+    region.Add( DamageRect_t{ 1000, 1000, 1010, 1010 } );
+    EXPECT( region.Rects().size() == 2 );
+
+    // Too many get merged down, but still cover everything.
+    CDamageRegion many;
+    for ( int32_t i = 0; i < 20; i++ )
+        many.Add( DamageRect_t{ i * 100, i * 50, i * 100 + 4, i * 50 + 4 } );
+    EXPECT( many.Rects().size() <= CDamageRegion::k_uMaxRects );
+    for ( int32_t i = 0; i < 20; i++ )
+        EXPECT( RegionCovers( many, DamageRect_t{ i * 100, i * 50, i * 100 + 4, i * 50 + 4 } ) );
+
+    // Clipping drops what's off screen and goes full past the threshold.
+    CDamageRegion offscreen;
+    offscreen.Add( DamageRect_t{ -100, -100, -40, -40 } );
+    offscreen.Add( DamageRect_t{ 10, 10, 20, 20 } );
+    offscreen.Clip( 1920, 1080 );
+    EXPECT( offscreen.Rects().size() == 1 );
+    EXPECT( offscreen.Rects()[0].nX1 >= 0 && offscreen.Rects()[0].nY1 >= 0 );
+
+    CDamageRegion big;
+    big.Add( DamageRect_t{ 0, 0, 1900, 1000 } );
+    big.Clip( 1920, 1080 );
+    EXPECT( big.IsFull() );
+}
+
+static void test_output_damage_tracker()
+{
+    COutputDamageTracker tracker;
+
+    CDamageRegion small;
+    small.Add( DamageRect_t{ 64, 64, 96, 96 } );
+    CDamageRegion other;
+    other.Add( DamageRect_t{ 512, 512, 544, 544 } );
+
+    // Nothing in any image yet.
+    EXPECT( tracker.Advance( 0, small ).IsFull() );
+    EXPECT( tracker.Advance( 1, small ).IsFull() );
+    EXPECT( tracker.Advance( 2, other ).IsFull() );
+
+    // Image 0 was last written 3 frames ago, it needs the last 3 frames' damage.
+    CDamageRegion region = tracker.Advance( 0, small );
+    EXPECT( !region.IsFull() );
+    EXPECT( RegionCovers( region, DamageRect_t{ 64, 64, 96, 96 } ) );
+    EXPECT( RegionCovers( region, DamageRect_t{ 512, 512, 544, 544 } ) );
+
+    // A full frame damages the next few images completely.
+    EXPECT( tracker.Advance( 1, CDamageRegion::Full() ).IsFull() );
+    EXPECT( tracker.Advance( 2, small ).IsFull() );
+    EXPECT( tracker.Advance( 0, small ).IsFull() );
+    EXPECT( !tracker.Advance( 1, small ).IsFull() );
+
+    // Nothing changed, nothing to do.
+    EXPECT( tracker.Advance( 2, CDamageRegion{} ).Area() == small.Area() );
+    EXPECT( tracker.Advance( 0, CDamageRegion{} ).Area() == small.Area() );
+    EXPECT( tracker.Advance( 1, CDamageRegion{} ).IsEmpty() );
+
+    // Images that got overwritten behind our back start over.
+    tracker.InvalidateImage( 2 );
+    EXPECT( tracker.Advance( 2, small ).IsFull() );
+    EXPECT( !tracker.Advance( 0, small ).IsFull() );
+
+    // Images we haven't used in too long, too.
+    for ( uint32_t i = 0; i < COutputDamageTracker::k_uHistoryLength; i++ )
+        tracker.Advance( 1, small );
+    EXPECT( tracker.Advance( 2, small ).IsFull() );
+
+    tracker.Invalidate();
+    EXPECT( tracker.Advance( 1, small ).IsFull() );
+}
+
+static void test_composite_tile_masks()
+{
+    // Fullscreen opaque game, a translucent overlay in the corner and a cursor
+    // that's mostly off screen.
+    const CompositeTileLayer_t layers[] =
+    {
+        { DamageRect_t{ 0, 0, 1280, 800 }, DamageRect_t{ 0, 0, 1280, 800 } },
+        { DamageRect_t{ 1000, 20, 1270, 100 }, DamageRect_t{} },
+        { DamageRect_t{ 1270, 790, 1300, 820 }, DamageRect_t{} },
+    };
+
+    CCompositeTileMasks masks;
+    masks.Classify( layers, 1280, 800 );
+    EXPECT( masks.Columns() == 40 );
+    EXPECT( masks.Rows() == 25 );
+    EXPECT( masks.Buffer()[0] == 40 );
+    EXPECT( masks.Buffer().size() == 1 + ( 40 * 25 + 3 ) / 4 );
+
+    EXPECT( masks.Mask( 0, 0 ) == 0b001 );
+    EXPECT( masks.Mask( 20, 12 ) == 0b001 );
+    EXPECT( masks.Mask( 1000 / 32, 20 / 32 ) == 0b011 );
+    EXPECT( masks.Mask( 1269 / 32, 99 / 32 ) == 0b011 );
+    EXPECT( masks.Mask( 999 / 32 - 1, 0 ) == 0b001 );
+    EXPECT( masks.Mask( 39, 24 ) == 0b101 );
+
+    // Most tiles only need the game.
+    EXPECT( masks.LayerTiles() < masks.TotalLayerTiles() / 2 );
+
+    // Opaque layers hide what's below them, but only for tiles they fully cover.
+    const CompositeTileLayer_t occluded[] =
+    {
+        { DamageRect_t{ 0, 0, 256, 256 }, DamageRect_t{ 0, 0, 256, 256 } },
+        { DamageRect_t{ 0, 0, 256, 256 }, DamageRect_t{} },
+        { DamageRect_t{ 0, 0, 128, 128 }, DamageRect_t{ 0, 0, 112, 128 } },
+    };
+    masks.Classify( occluded, 256, 256 );
+    EXPECT( masks.Mask( 0, 0 ) == 0b100 );
+    EXPECT( masks.Mask( 2, 3 ) == 0b100 );
+    EXPECT( masks.Mask( 3, 3 ) == 0b111 );
+    EXPECT( masks.Mask( 4, 4 ) == 0b011 );
+
+    // Invisible layers don't show up anywhere, and tiles with nothing in them are empty.
+    const CompositeTileLayer_t empty[] =
+    {
+        { DamageRect_t{}, DamageRect_t{} },
+        { DamageRect_t{ 0, 0, 10, 10 }, DamageRect_t{} },
+    };
+    masks.Classify( empty, 100, 50 );
+    EXPECT( masks.Columns() == 4 && masks.Rows() == 2 );
+    EXPECT( masks.Mask( 0, 0 ) == 0b10 );
+    EXPECT( masks.Mask( 3, 1 ) == 0 );
+
+    // Partial tiles at the output's edges only need to be covered up to the edge.
+    const CompositeTileLayer_t edge[] =
+    {
+        { DamageRect_t{ 0, 0, 100, 50 }, DamageRect_t{} },
+        { DamageRect_t{ 0, 0, 100, 50 }, DamageRect_t{ 0, 0, 100, 50 } },
+    };
+    masks.Classify( edge, 100, 50 );
+    EXPECT( masks.Mask( 3, 1 ) == 0b10 );
+}
+
+int main()
+{
+    test_commit_damage_history();
+    test_texture_damage_to_output();
+    test_damage_region();
+    test_output_damage_tracker();
+    test_composite_tile_masks();
+
+    printf( "%s\n", s_nFailures ? "FAILED" : "PASSED" );
+    return s_nFailures ? 1 : 0;
+}
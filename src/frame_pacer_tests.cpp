@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "Utils/FramePacer.h"
+
+// Runs the fixed refresh frame limiter against a fake vblank clock for a range
+// of refresh/target combinations and reports the achieved rate, the frame time
+// spread and how far each frame strays from where it would land at the exact
+// target rate. The old integer divisor limiter is shown alongside for comparison.
+
+static constexpr uint32_t k_uSimulatedSeconds = 60;
+
+struct PacingStats_t
+{
+    double flAchievedFPS = 0.0;
+    double flMeanFrameTimeMs = 0.0;
+    double flStdDevFrameTimeMs = 0.0;
+    uint32_t uMinInterval = 0;
+    uint32_t uMaxInterval = 0;
+    // Worst distance between a frame's vblank and its ideal time, in vblanks.
+    double flMaxPhaseErrorVBlanks = 0.0;
+};
+
+template <typename ShouldLatch>
+static PacingStats_t SimulatePacing( uint32_t uRefreshHz, uint32_t uTargetFPS, ShouldLatch shouldLatch )
+{
+    const double flRefreshCycleMs = 1000.0 / uRefreshHz;
+    const uint64_t ulVBlankCount = uint64_t( uRefreshHz ) * k_uSimulatedSeconds;
+
+    std::vector<uint64_t> latchedVBlanks;
+    for ( uint64_t ulVBlankIdx = 0; ulVBlankIdx < ulVBlankCount; ulVBlankIdx++ )
+    {
+        if ( shouldLatch( ulVBlankIdx ) )
+            latchedVBlanks.push_back( ulVBlankIdx );
+    }
+
+    PacingStats_t stats;
+    if ( latchedVBlanks.size() < 2 )
+        return stats;
+
+    stats.flAchievedFPS = double( latchedVBlanks.size() ) / k_uSimulatedSeconds;
+    stats.uMinInterval = ~0u;
+
+    double flSum = 0.0, flSumSq = 0.0;
+    for ( size_t i = 1; i < latchedVBlanks.size(); i++ )
+    {
+        uint32_t uInterval = uint32_t( latchedVBlanks[i] - latchedVBlanks[i - 1] );
+        stats.uMinInterval = std::min( stats.uMinInterval, uInterval );
+        stats.uMaxInterval = std::max( stats.uMaxInterval, uInterval );
+
+        double flFrameTimeMs = uInterval * flRefreshCycleMs;
+        flSum += flFrameTimeMs;
+        flSumSq += flFrameTimeMs * flFrameTimeMs;
+    }
+
+    const double flCount = double( latchedVBlanks.size() - 1 );
+    stats.flMeanFrameTimeMs = flSum / flCount;
+    stats.flStdDevFrameTimeMs = std::sqrt( std::max( 0.0, flSumSq / flCount - stats.flMeanFrameTimeMs * stats.flMeanFrameTimeMs ) );
+
+    const double flIdealInterval = double( uRefreshHz ) / uTargetFPS;
+    for ( size_t i = 0; i < latchedVBlanks.size(); i++ )
+    {
+        double flError = std::abs( double( latchedVBlanks[i] ) - double( i ) * flIdealInterval );
+        stats.flMaxPhaseErrorVBlanks = std::max( stats.flMaxPhaseErrorVBlanks, flError );
+    }
+
+    return stats;
+}
+
+static int test_frame_pacer( uint32_t uRefreshHz, uint32_t uTargetFPS )
+{
+    PacingStats_t paced = SimulatePacing( uRefreshHz, uTargetFPS, [&]( uint64_t ulVBlankIdx )
+    {
+        return gamescope::FramePacerShouldLatch( ulVBlankIdx, uRefreshHz, uTargetFPS );
+    });
+
+    PacingStats_t divisor = SimulatePacing( uRefreshHz, uTargetFPS, [&]( uint64_t ulVBlankIdx )
+    {
+        return ulVBlankIdx % ( uRefreshHz / uTargetFPS ) == 0;
+    });
+
+    printf( "%4u Hz %4u FPS | paced: %7.2f FPS, %6.2f ms +- %5.2f ms, intervals %u-%u, phase error %.2f vblanks | divisor: %7.2f FPS, %6.2f ms +- %5.2f ms\n",
+        uRefreshHz, uTargetFPS,
+        paced.flAchievedFPS, paced.flMeanFrameTimeMs, paced.flStdDevFrameTimeMs, paced.uMinInterval, paced.uMaxInterval, paced.flMaxPhaseErrorVBlanks,
+        divisor.flAchievedFPS, divisor.flMeanFrameTimeMs, divisor.flStdDevFrameTimeMs );
+
+    uint32_t uErrors = 0;
+
+    if ( std::abs( paced.flAchievedFPS - uTargetFPS ) > 1.0 / k_uSimulatedSeconds )
+    {
+        fprintf( stderr, "  FAIL: achieved %.3f FPS, wanted %u\n", paced.flAchievedFPS, uTargetFPS );
+        uErrors++;
+    }
+
+    // Every interval must be the floor or ceiling of the ideal one.
+    const uint32_t uFloorInterval = uRefreshHz / uTargetFPS;
+    const uint32_t uCeilInterval = ( uRefreshHz + uTargetFPS - 1 ) / uTargetFPS;
+    if ( paced.uMinInterval < uFloorInterval || paced.uMaxInterval > uCeilInterval )
+    {
+        fprintf( stderr, "  FAIL: intervals %u-%u, wanted %u-%u\n", paced.uMinInterval, paced.uMaxInterval, uFloorInterval, uCeilInterval );
+        uErrors++;
+    }
+
+    if ( paced.flMaxPhaseErrorVBlanks >= 1.0 )
+    {
+        fprintf( stderr, "  FAIL: frame strayed %.2f vblanks from its ideal time\n", paced.flMaxPhaseErrorVBlanks );
+        uErrors++;
+    }
+
+    // Where the divisor already worked, pacing must pick exactly the same vblanks.
+    if ( uRefreshHz % uTargetFPS == 0 )
+    {
+        for ( uint64_t ulVBlankIdx = 0; ulVBlankIdx < uint64_t( uRefreshHz ) * k_uSimulatedSeconds; ulVBlankIdx++ )
+        {
+            if ( gamescope::FramePacerShouldLatch( ulVBlankIdx, uRefreshHz, uTargetFPS ) != ( ulVBlankIdx % uFloorInterval == 0 ) )
+            {
+                fprintf( stderr, "  FAIL: differs from divisor at vblank %lu\n", (unsigned long)ulVBlankIdx );
+                uErrors++;
+                break;
+            }
+        }
+    }
+
+    return uErrors ? 1 : 0;
+}
+
+int main()
+{
+    static constexpr uint32_t k_uRefreshRates[] = { 60, 90, 100, 120, 144, 165, 240 };
+    static constexpr uint32_t k_uTargetRates[] = { 24, 30, 36, 40, 45, 48, 50, 60, 72, 90, 120 };
+
+    int nResult = 0;
+    for ( uint32_t uRefreshHz : k_uRefreshRates )
+    {
+        for ( uint32_t uTargetFPS : k_uTargetRates )
+        {
+            // Not limited at all, nothing to pace.
+            if ( uTargetFPS >= uRefreshHz )
+                continue;
+
+            nResult |= test_frame_pacer( uRefreshHz, uTargetFPS );
+        }
+    }
+
+    // Huge vblank indices must still latch the right number of frames.
+    {
+        const uint64_t ulFirstVBlank = ( ~0ull / 120 - 2 ) * 120;
+        uint32_t uLatched = 0;
+        for ( uint64_t ulVBlankIdx = ulFirstVBlank; ulVBlankIdx < ulFirstVBlank + 120; ulVBlankIdx++ )
+            uLatched += gamescope::FramePacerShouldLatch( ulVBlankIdx, 120, 48 ) ? 1 : 0;
+
+        if ( uLatched != 48 )
+        {
+            fprintf( stderr, "FAIL: latched %u frames in a second at vblank %lu, wanted 48\n", uLatched, (unsigned long)ulFirstVBlank );
+            nResult = 1;
+        }
+    }
+
+    printf( "%s\n", nResult ? "FAILED" : "PASSED" );
+    return nResult;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+// Per-frame timing channel for overlays (mangoapp etc.)
+//
+// gamescope exposes a memfd with a header followed by a ring of records.
+// The path to open it (read-only) is in $GAMESCOPE_FRAME_TIMING_PATH, which
+// is /proc/<gamescope pid>/fd/<n>. mmap it with PROT_READ and MAP_SHARED.
+//
+// Every record has its own sequence number: odd while gamescope is writing it,
+// (frame_index + 1) * 2 once it is complete. Readers never make a syscall and
+// never block the compositor, they just retry (or skip) a record that was
+// being overwritten while they copied it.
+
+static constexpr uint32_t k_uGamescopeFrameTimingMagic = 0x54464347; // "GCFT"
+static constexpr uint32_t k_uGamescopeFrameTimingVersion = 1;
+static constexpr uint32_t k_uGamescopeFrameTimingRecordCount = 256;
+
+enum
+{
+    GAMESCOPE_FRAME_TIMING_COMPOSITED = ( 1u << 0 ), // Went through a Vulkan composite rather than direct scanout.
+    GAMESCOPE_FRAME_TIMING_FIFO       = ( 1u << 1 ), // The base plane commit was FIFO.
+};
+
+struct gamescope_frame_timing_record
+{
+    std::atomic<uint64_t> seq;
+
+    uint64_t frame_index;
+    uint64_t commit_id;         // Commit ID of the base plane, 0 if none.
+    uint64_t app_frametime_ns;  // Time between the last two commits of the focused app, ~0 if unknown.
+    uint64_t latch_time_ns;     // When gamescope woke up to latch commits for this frame. (CLOCK_MONOTONIC)
+    uint64_t present_time_ns;   // When the frame was handed to the backend. (CLOCK_MONOTONIC)
+    uint64_t vblank_time_ns;    // The vblank the frame was scheduled for. (CLOCK_MONOTONIC)
+    uint32_t flags;             // GAMESCOPE_FRAME_TIMING_*
+    uint32_t upscaler;          // GamescopeUpscaleFilter
+};
+static_assert( sizeof( gamescope_frame_timing_record ) == 64 );
+static_assert( std::atomic<uint64_t>::is_always_lock_free );
+
+struct gamescope_frame_timing_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t record_count;
+    // Number of frames written so far, the latest is ( frame_count - 1 ) % record_count.
+    std::atomic<uint64_t> frame_count;
+    uint8_t reserved[40];
+};
+static_assert( sizeof( gamescope_frame_timing_header ) == 64 );
+
+struct gamescope_frame_timing_shm
+{
+    gamescope_frame_timing_header header;
+    gamescope_frame_timing_record records[ k_uGamescopeFrameTimingRecordCount ];
+};
+
+// Copies the record for frame_index out of the ring.
+// Returns false if it has not been written yet, or has already been overwritten.
+static inline bool gamescope_frame_timing_read( const gamescope_frame_timing_shm *shm, uint64_t frame_index, gamescope_frame_timing_record *out )
+{
+    const gamescope_frame_timing_record *record = &shm->records[ frame_index % k_uGamescopeFrameTimingRecordCount ];
+    const uint64_t expected_seq = ( frame_index + 1 ) * 2;
+
+    const uint64_t seq_begin = record->seq.load( std::memory_order_acquire );
+    if ( seq_begin != expected_seq )
+        return false;
+
+    // Copy everything after the sequence number.
+    constexpr size_t offset = sizeof( std::atomic<uint64_t> );
+    memcpy( reinterpret_cast<uint8_t *>( out ) + offset, reinterpret_cast<const uint8_t *>( record ) + offset, sizeof( *record ) - offset );
+
+    std::atomic_thread_fence( std::memory_order_acquire );
+    if ( record->seq.load( std::memory_order_relaxed ) != seq_begin )
+        return false;
+
+    out->seq.store( seq_begin, std::memory_order_relaxed );
+    return true;
+}
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Utils/InputEventQueue.h"
+
+// Feeds a synthetic 8 kHz mouse through the two ways input reaches the Wayland
+// thread: taking the wlserver lock for every event, like the input threads
+// used to, and the input queue, with relative motion coalesced into one pointer
+// motion per drain. A third thread stands in for steamcompmgr and whoever else
+// holds the wlserver lock for a while now and then.
+//
+// Reports how long the input thread spends per event, how long the lock gets held
+// for input, and the latency from an event coming in to its relative motion and
+// pointer motion going out to the client.
+//
+// Usage: gamescope_input_queue_bench [seconds per run]
+
+using gamescope::CInputEventQueue;
+using gamescope::InputEvent_t;
+using gamescope::InputEventType;
+
+static constexpr uint64_t k_ulEventInterval = 125'000; // 8 kHz
+static constexpr uint32_t k_uButtonInterval = 256;
+
+// Rough costs of what wlserver does with the lock held, per event.
+static constexpr uint64_t k_ulRelativeMotionCost = 300;
+static constexpr uint64_t k_ulPointerMotionCost = 3'000;
+static constexpr uint64_t k_ulButtonCost = 2'000;
+
+static uint64_t GetTime()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return uint64_t( ts.tv_sec ) * 1'000'000'000ull + uint64_t( ts.tv_nsec );
+}
+
+static void SpinFor( uint64_t ulNanos )
+{
+    const uint64_t ulEnd = GetTime() + ulNanos;
+    while ( GetTime() < ulEnd )
+        continue;
+}
+
+static void SleepUntil( uint64_t ulTime )
+{
+    timespec ts =
+    {
+        .tv_sec = time_t( ulTime / 1'000'000'000ull ),
+        .tv_nsec = long( ulTime % 1'000'000'000ull ),
+    };
+    while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr ) != 0 )
+        continue;
+}
+
+struct ContentionConfig_t
+{
+    const char *pszName = nullptr;
+    // Someone else holds the lock for this long, this often.
+    uint64_t ulHoldTime = 0;
+    uint64_t ulHoldInterval = 0;
+};
+
+struct RunResults_t
+{
+    std::vector<uint64_t> inputThreadTimes;
+    std::vector<uint64_t> lockHoldTimes;
+    std::vector<uint64_t> relativeLatencies;
+    std::vector<uint64_t> pointerLatencies;
+    uint64_t ulPointerMotions = 0;
+    uint64_t ulDuration = 0;
+};
+
+static uint64_t Percentile( std::vector<uint64_t> &values, double flPercentile )
+{
+    if ( values.empty() )
+        return 0;
+
+    const size_t zIndex = std::min( values.size() - 1, size_t( values.size() * flPercentile / 100.0 ) );
+    std::nth_element( values.begin(), values.begin() + zIndex, values.end() );
+    return values[ zIndex ];
+}
+
+static uint64_t Sum( const std::vector<uint64_t> &values )
+{
+    uint64_t ulSum = 0;
+    for ( uint64_t ulValue : values )
+        ulSum += ulValue;
+    return ulSum;
+}
+
+class CContender
+{
+public:
+    CContender( std::mutex &lock, const ContentionConfig_t &config )
+    {
+        if ( !config.ulHoldInterval )
+            return;
+
+        m_Thread = std::thread( [ this, &lock, config ]()
+        {
+            uint64_t ulNext = GetTime() + config.ulHoldInterval;
+            while ( !m_bStop.load( std::memory_order_relaxed ) )
+            {
+                SleepUntil( ulNext );
+                ulNext += config.ulHoldInterval;
+
+                // Sleeps rather than spins, so this doesn't also measure
+                // how many cores there are to go around.
+                std::scoped_lock guard( lock );
+                SleepUntil( GetTime() + config.ulHoldTime );
+            }
+        });
+    }
+
+    ~CContender()
+    {
+        m_bStop = true;
+        if ( m_Thread.joinable() )
+            m_Thread.join();
+    }
+
+private:
+    std::atomic<bool> m_bStop = { false };
+    std::thread m_Thread;
+};
+
+// Makes the event to send at a given index: relative motion, with a button
+// press or release every so often.
+static InputEvent_t MakeEvent( uint32_t uIndex )
+{
+    if ( uIndex % k_uButtonInterval == k_uButtonInterval - 1 )
+        return InputEvent_t{ .eType = InputEventType::Button, .uCode = 0x110, .bFlag = ( uIndex / k_uButtonInterval ) % 2 == 0, .uTime = uIndex };
+
+    return InputEvent_t{ .eType = InputEventType::RelativeMotion, .uTime = uIndex, .flX = 1.0, .flY = -0.5 };
+}
+
+static RunResults_t RunLocked( const ContentionConfig_t &config, uint32_t uEventCount )
+{
+    RunResults_t results;
+    std::mutex lock;
+    CContender contender( lock, config );
+
+    const uint64_t ulStart = GetTime();
+    for ( uint32_t i = 0; i < uEventCount; i++ )
+    {
+        SleepUntil( ulStart + i * k_ulEventInterval );
+
+        const InputEvent_t event = MakeEvent( i );
+
+        // The event comes in whenever we actually wake up.
+        const uint64_t ulEventTime = GetTime();
+        const uint64_t ulBefore = ulEventTime;
+        {
+            std::scoped_lock guard( lock );
+            const uint64_t ulLocked = GetTime();
+
+            if ( event.eType == InputEventType::RelativeMotion )
+            {
+                SpinFor( k_ulRelativeMotionCost );
+                results.relativeLatencies.push_back( GetTime() - ulEventTime );
+
+                SpinFor( k_ulPointerMotionCost );
+                results.pointerLatencies.push_back( GetTime() - ulEventTime );
+                results.ulPointerMotions++;
+            }
+            else
+            {
+                SpinFor( k_ulButtonCost );
+            }
+
+            results.lockHoldTimes.push_back( GetTime() - ulLocked );
+        }
+        results.inputThreadTimes.push_back( GetTime() - ulBefore );
+    }
+    results.ulDuration = GetTime() - ulStart;
+
+    return results;
+}
+
+static RunResults_t RunQueued( const ContentionConfig_t &config, uint32_t uEventCount )
+{
+    RunResults_t results;
+    std::mutex lock;
+    CContender contender( lock, config );
+
+    static CInputEventQueue<1024> s_Queue;
+
+    int nNudgePipe[2];
+    if ( pipe2( nNudgePipe, O_CLOEXEC | O_NONBLOCK ) != 0 )
+    {
+        perror( "pipe2" );
+        exit( 1 );
+    }
+
+    // The Wayland thread.
+    std::atomic<bool> bStop = { false };
+    std::atomic<uint32_t> uHandledEvents = { 0 };
+    std::thread consumer( [&]()
+    {
+        std::vector<uint64_t> pendingQueueTimes;
+
+        pollfd pollFd = { .fd = nNudgePipe[0], .events = POLLIN, .revents = 0 };
+        while ( !bStop.load( std::memory_order_relaxed ) )
+        {
+            if ( poll( &pollFd, 1, 10 ) <= 0 )
+                continue;
+
+            char buf[64];
+            while ( read( nNudgePipe[0], buf, sizeof( buf ) ) > 0 )
+                continue;
+
+            std::scoped_lock guard( lock );
+            const uint64_t ulLocked = GetTime();
+
+            s_Queue.Drain(
+                [&]( const InputEvent_t &event )
+                {
+                    SpinFor( k_ulRelativeMotionCost );
+                    results.relativeLatencies.push_back( GetTime() - event.ulQueueTime );
+                    pendingQueueTimes.push_back( event.ulQueueTime );
+                    uHandledEvents.fetch_add( 1, std::memory_order_release );
+                },
+                [&]( double, double, uint32_t )
+                {
+                    SpinFor( k_ulPointerMotionCost );
+                    const uint64_t ulNow = GetTime();
+                    for ( uint64_t ulQueueTime : pendingQueueTimes )
+                        results.pointerLatencies.push_back( ulNow - ulQueueTime );
+                    pendingQueueTimes.clear();
+                    results.ulPointerMotions++;
+                },
+                [&]( const InputEvent_t & )
+                {
+                    SpinFor( k_ulButtonCost );
+                    uHandledEvents.fetch_add( 1, std::memory_order_release );
+                } );
+
+            results.lockHoldTimes.push_back( GetTime() - ulLocked );
+        }
+    });
+
+    const uint64_t ulStart = GetTime();
+    for ( uint32_t i = 0; i < uEventCount; i++ )
+    {
+        SleepUntil( ulStart + i * k_ulEventInterval );
+
+        InputEvent_t event = MakeEvent( i );
+
+        const uint64_t ulBefore = GetTime();
+        event.ulQueueTime = ulBefore;
+        if ( s_Queue.Push( event ) )
+        {
+            if ( write( nNudgePipe[1], "\n", 1 ) < 0 )
+                continue;
+        }
+        results.inputThreadTimes.push_back( GetTime() - ulBefore );
+    }
+
+    // Let the last batch through.
+    while ( uHandledEvents.load( std::memory_order_acquire ) < uEventCount )
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    results.ulDuration = GetTime() - ulStart;
+
+    bStop = true;
+    consumer.join();
+
+    close( nNudgePipe[0] );
+    close( nNudgePipe[1] );
+
+    return results;
+}
+
+static void PrintResults( const ContentionConfig_t &config, const char *pszMode, RunResults_t &results )
+{
+    const double flSeconds = results.ulDuration / 1'000'000'000.0;
+
+    printf( "%-12s %-7s %8.2f %8.2f %8.1f %9.2f%% %8.2f %8.2f %8.2f %8.2f %8.2f %9.0f\n",
+        config.pszName, pszMode,
+        Percentile( results.inputThreadTimes, 50.0 ) / 1'000.0,
+        Percentile( results.inputThreadTimes, 99.0 ) / 1'000.0,
+        results.lockHoldTimes.size() / flSeconds,
+        Sum( results.lockHoldTimes ) / double( results.ulDuration ) * 100.0,
+        Percentile( results.lockHoldTimes, 99.0 ) / 1'000.0,
+        Percentile( results.relativeLatencies, 50.0 ) / 1'000.0,
+        Percentile( results.relativeLatencies, 99.0 ) / 1'000.0,
+        Percentile( results.pointerLatencies, 50.0 ) / 1'000.0,
+        Percentile( results.pointerLatencies, 99.0 ) / 1'000.0,
+        results.ulPointerMotions / flSeconds );
+}
+
+int main( int argc, char **argv )
+{
+    double flSeconds = 2.0;
+    if ( argc > 1 )
+        flSeconds = std::max( 0.1, atof( argv[1] ) );
+
+    const uint32_t uEventCount = uint32_t( flSeconds * 1'000'000'000.0 / k_ulEventInterval );
+
+    static constexpr ContentionConfig_t k_Configs[] =
+    {
+        { .pszName = "idle",      .ulHoldTime = 0,         .ulHoldInterval = 0 },
+        { .pszName = "contended", .ulHoldTime = 500'000,   .ulHoldInterval = 4'000'000 },
+        { .pszName = "heavy",     .ulHoldTime = 2'000'000, .ulHoldInterval = 8'000'000 },
+    };
+
+    printf( "%u events at 8 kHz per run, all times in us\n", uEventCount );
+    printf( "%-12s %-7s %8s %8s %8s %10s %8s %8s %8s %8s %8s %9s\n",
+        "contention", "mode", "in p50", "in p99", "locks/s", "locked", "hold p99", "rel p50", "rel p99", "ptr p50", "ptr p99", "motions/s" );
+
+    for ( const ContentionConfig_t &config : k_Configs )
+    {
+        RunResults_t lockedResults = RunLocked( config, uEventCount );
+        PrintResults( config, "locked", lockedResults );
+
+        RunResults_t queuedResults = RunQueued( config, uEventCount );
+        PrintResults( config, "queued", queuedResults );
+    }
+
+    return 0;
+}
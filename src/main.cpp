@@ -121,6 +121,7 @@ const struct option *gamescope_options = (struct option[]){
 	{ "virtual-connector-strategy", required_argument, nullptr, 0 },
 	{ "ready-fd", required_argument, nullptr, 'R' },
 	{ "stats-path", required_argument, nullptr, 'T' },
+	{ "stats-format", required_argument, nullptr, 0 },
 	{ "hide-cursor-delay", required_argument, nullptr, 'C' },
 	{ "debug-focus", no_argument, nullptr, 0 },
 	{ "synchronous-x11", no_argument, nullptr, 0 },
@@ -189,6 +190,10 @@ const char usage[] =
 	"  -R, --ready-fd                 notify FD when ready\n"
 	"  --rt                           Use realtime scheduling\n"
 	"  -T, --stats-path               write statistics to path\n"
+	"  --stats-format                 format of the statistics written to --stats-path\n"
+	"                                     text => key=value lines (default)\n"
+	"                                     json => one JSON object per line\n"
+	"                                     binary => 16 byte records (u64 time, u32 type, u32/f32 value)\n"
 	"  -C, --hide-cursor-delay        hide cursor image after delay\n"
 	"  -e, --steam                    enable Steam integration\n"
 	"  --xwayland-count               create N xwayland servers\n"
@@ -675,6 +680,9 @@ static void UpdateCompatEnvVars()
 			gamescope::Process::CloseFd( nLimiterFd );
 		}
 	}
+
+	// Sets GAMESCOPE_FRAME_TIMING_PATH for overlays we launch.
+	init_frame_timing_channel();
 }
 
 int g_nPreferredOutputWidth = 0;
@@ -1,11 +1,21 @@
 #include <sys/ipc.h>
 #include <unistd.h>
 #include <sys/msg.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <atomic>
 #include <cstring>
 
 #include "steamcompmgr.hpp"
 #include "refresh_rate.h"
 #include "main.hpp"
+#include "convar.h"
+#include "log.hpp"
+#include "frame_timing_shared.h"
+
+static LogScope frame_timing_log("frame_timing");
+
+gamescope::ConVar<bool> cv_mangoapp_legacy_msg_queue{ "mangoapp_legacy_msg_queue", true, "Also send frame times over the old SysV message queue, for mangoapp versions that don't map the frame timing channel." };
 
 static bool inited = false;
 static int msgid = 0;
@@ -46,7 +56,88 @@ void init_mangoapp(){
     inited = true;
 }
 
+static int s_nFrameTimingFd = -1;
+static gamescope_frame_timing_shm *s_pFrameTimingShm = nullptr;
+static uint64_t s_ulFrameTimingCount = 0;
+static std::atomic<uint64_t> s_ulLastAppFrametime = { ~0ull };
+
+void init_frame_timing_channel()
+{
+    if ( s_pFrameTimingShm )
+        return;
+
+    int nFd = memfd_create( "gamescope-frame-timing", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if ( nFd < 0 )
+    {
+        frame_timing_log.errorf_errno( "Failed to create frame timing memfd" );
+        return;
+    }
+
+    if ( ftruncate( nFd, sizeof( gamescope_frame_timing_shm ) ) != 0 )
+    {
+        frame_timing_log.errorf_errno( "Failed to size frame timing memfd" );
+        close( nFd );
+        return;
+    }
+
+    // Readers may rely on the size never changing under them.
+    fcntl( nFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL );
+
+    void *pMapping = mmap( nullptr, sizeof( gamescope_frame_timing_shm ), PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0 );
+    if ( pMapping == MAP_FAILED )
+    {
+        frame_timing_log.errorf_errno( "Failed to map frame timing memfd" );
+        close( nFd );
+        return;
+    }
+
+    // Fresh memfd pages are zeroed, so every record starts out with seq 0 (never written).
+    s_pFrameTimingShm = reinterpret_cast<gamescope_frame_timing_shm *>( pMapping );
+    s_pFrameTimingShm->header.magic = k_uGamescopeFrameTimingMagic;
+    s_pFrameTimingShm->header.version = k_uGamescopeFrameTimingVersion;
+    s_pFrameTimingShm->header.record_size = sizeof( gamescope_frame_timing_record );
+    s_pFrameTimingShm->header.record_count = k_uGamescopeFrameTimingRecordCount;
+    s_nFrameTimingFd = nFd;
+
+    char szPath[ 64 ];
+    snprintf( szPath, sizeof( szPath ), "/proc/%d/fd/%d", getpid(), nFd );
+    setenv( "GAMESCOPE_FRAME_TIMING_PATH", szPath, 1 );
+}
+
+// Only called from the steamcompmgr thread, which makes it the single writer.
+void frame_timing_record_frame( uint64_t ulCommitID, uint64_t ulLatchTime, uint64_t ulPresentTime, uint64_t ulVBlankTime,
+    bool bComposited, bool bFifo, GamescopeUpscaleFilter eUpscaler )
+{
+    if ( !s_pFrameTimingShm )
+        return;
+
+    const uint64_t ulFrameIndex = s_ulFrameTimingCount++;
+    gamescope_frame_timing_record *pRecord = &s_pFrameTimingShm->records[ ulFrameIndex % k_uGamescopeFrameTimingRecordCount ];
+
+    pRecord->seq.store( ulFrameIndex * 2 + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+
+    pRecord->frame_index      = ulFrameIndex;
+    pRecord->commit_id        = ulCommitID;
+    pRecord->app_frametime_ns = s_ulLastAppFrametime.load( std::memory_order_relaxed );
+    pRecord->latch_time_ns    = ulLatchTime;
+    pRecord->present_time_ns  = ulPresentTime;
+    pRecord->vblank_time_ns   = ulVBlankTime;
+    pRecord->flags            = ( bComposited ? GAMESCOPE_FRAME_TIMING_COMPOSITED : 0 ) |
+                                ( bFifo ? GAMESCOPE_FRAME_TIMING_FIFO : 0 );
+    pRecord->upscaler         = uint32_t( eUpscaler );
+
+    pRecord->seq.store( ( ulFrameIndex + 1 ) * 2, std::memory_order_release );
+    s_pFrameTimingShm->header.frame_count.store( ulFrameIndex + 1, std::memory_order_release );
+}
+
 void mangoapp_update( uint64_t visible_frametime, uint64_t app_frametime_ns, uint64_t latency_ns ) {
+    if ( app_frametime_ns != uint64_t(~0ull) )
+        s_ulLastAppFrametime.store( app_frametime_ns, std::memory_order_relaxed );
+
+    if ( !cv_mangoapp_legacy_msg_queue )
+        return;
+
     if (!inited)
         init_mangoapp();
 
@@ -13,11 +13,17 @@
 #include "main.hpp"
 #include "pipewire.hpp"
 #include "log.hpp"
+#include "convar.h"
+#include "Utils/StridedCopy.h"
 
 #include <spa/debug/format.h>
 
 static LogScope pwr_log("pipewire");
 
+gamescope::ConVar<bool> cv_pipewire_zero_copy{ "pipewire_zero_copy", true, "Import PipeWire SHM buffers into Vulkan (VK_EXT_external_memory_host) and render straight into them, instead of copying every frame. Applies to newly allocated buffers." };
+gamescope::ConVar<uint32_t> cv_pipewire_copy_kernel{ "pipewire_copy_kernel", (uint32_t)gamescope::StridedCopyKernel::NonTemporal, "How to copy frames into PipeWire SHM buffers when zero-copy isn't possible. 0 = memcpy, 1 = non-temporal stores." };
+gamescope::ConVar<uint32_t> cv_pipewire_copy_threads{ "pipewire_copy_threads", 1, "Threads to split PipeWire SHM buffer copies between. 0 = pick based on the frame size." };
+
 static struct pipewire_state pipewire_state = { .stream_node_id = SPA_ID_INVALID };
 static int nudgePipe[2] = { -1, -1 };
 
@@ -40,11 +46,9 @@ static void destroy_buffer(struct pipewire_buffer *buffer) {
 	switch (buffer->type) {
 	case SPA_DATA_MemFd:
 	{
-		off_t size = buffer->shm.stride * buffer->video_info.size.height;
-		if (buffer->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-			size += buffer->shm.stride * ((buffer->video_info.size.height + 1) / 2);
-		}
-		munmap(buffer->shm.data, size);
+		// The texture may be bound to this memory, it has to go first.
+		buffer->texture = nullptr;
+		munmap(buffer->shm.data, buffer->shm.size);
 		close(buffer->shm.fd);
 		break;
 	}
@@ -218,35 +222,43 @@ static void copy_buffer(struct pipewire_state *state, struct pipewire_buffer *bu
 		}
 		chunk->stride = buffer->shm.stride;
 
-		if (!needs_reneg) {
+		if (!needs_reneg && !buffer->shm.zero_copy) {
 			uint8_t *pMappedData = tex->mappedData();
 
+			gamescope::StridedPlaneCopy_t planes[2];
+			uint32_t plane_count = 0;
 			if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
-				for (uint32_t i = 0; i < tex->height(); i++) {
-					const uint32_t lumaPwOffset = 0;
-					memcpy(
-						&buffer->shm.data[lumaPwOffset      + i * buffer->shm.stride],
-						&pMappedData     [tex->lumaOffset() + i * tex->lumaRowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->lumaRowPitch()));
-				}
-
-				for (uint32_t i = 0; i < (tex->height() + 1) / 2; i++) {
-					const uint32_t chromaPwOffset = tex->height() * buffer->shm.stride;
-					memcpy(
-						&buffer->shm.data[chromaPwOffset      + i * buffer->shm.stride],
-						&pMappedData     [tex->chromaOffset() + i * tex->chromaRowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->chromaRowPitch()));
-				}
+				planes[plane_count++] = {
+					.pDst       = buffer->shm.data,
+					.zDstStride = size_t(buffer->shm.stride),
+					.pSrc       = &pMappedData[tex->lumaOffset()],
+					.zSrcStride = tex->lumaRowPitch(),
+					.zRowBytes  = std::min<size_t>(buffer->shm.stride, tex->lumaRowPitch()),
+					.uRows      = tex->height(),
+				};
+				planes[plane_count++] = {
+					.pDst       = &buffer->shm.data[tex->height() * buffer->shm.stride],
+					.zDstStride = size_t(buffer->shm.stride),
+					.pSrc       = &pMappedData[tex->chromaOffset()],
+					.zSrcStride = tex->chromaRowPitch(),
+					.zRowBytes  = std::min<size_t>(buffer->shm.stride, tex->chromaRowPitch()),
+					.uRows      = (tex->height() + 1) / 2,
+				};
 			}
 			else
 			{
-				for (uint32_t i = 0; i < tex->height(); i++) {
-					memcpy(
-						&buffer->shm.data[i * buffer->shm.stride],
-						&pMappedData     [i * tex->rowPitch()],
-						std::min<size_t>(buffer->shm.stride, tex->rowPitch()));
-				}
+				planes[plane_count++] = {
+					.pDst       = buffer->shm.data,
+					.zDstStride = size_t(buffer->shm.stride),
+					.pSrc       = pMappedData,
+					.zSrcStride = tex->rowPitch(),
+					.zRowBytes  = std::min<size_t>(buffer->shm.stride, tex->rowPitch()),
+					.uRows      = tex->height(),
+				};
 			}
+
+			gamescope::CopyStridedPlanes(std::span(planes, plane_count),
+				gamescope::StridedCopyKernel(cv_pipewire_copy_kernel.Get()), cv_pipewire_copy_threads);
 		}
 		break;
 	case SPA_DATA_DmaBuf:
@@ -545,6 +557,14 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 		if (state->video_info.format == SPA_VIDEO_FORMAT_NV12) {
 			size += state->shm_stride * ((state->video_info.size.height + 1) / 2);
 		}
+
+		// Make room for binding the texture straight to the SHM, if we can.
+		bool try_zero_copy = cv_pipewire_zero_copy && g_device.supportsHostMemoryImport();
+		if (try_zero_copy) {
+			size_t alignment = std::max<size_t>(g_device.hostPointerAlignment(), sysconf(_SC_PAGESIZE));
+			size = align(std::max<size_t>(size, buffer->texture->totalSize()), alignment);
+		}
+
 		if (ftruncate(fd, size) != 0) {
 			pwr_log.errorf_errno("ftruncate failed");
 			close(fd);
@@ -561,7 +581,40 @@ static void stream_handle_add_buffer(void *user_data, struct pw_buffer *pw_buffe
 		buffer->type = SPA_DATA_MemFd;
 		buffer->shm.stride = state->shm_stride;
 		buffer->shm.data = (uint8_t *) data;
+		buffer->shm.size = size;
 		buffer->shm.fd = fd;
+		buffer->shm.zero_copy = false;
+
+		if (try_zero_copy) {
+			CVulkanTexture::hostMemory hostMemory = {
+				.pData = data,
+				.size = size_t(size),
+			};
+
+			CVulkanTexture::createFlags hostImageFlags = screenshotImageFlags;
+			hostImageFlags.bExportable = false;
+
+			gamescope::OwningRc<CVulkanTexture> hostTexture = new CVulkanTexture();
+			if (hostTexture->BInit(s_nCaptureWidth, s_nCaptureHeight, 1u, drmFormat, hostImageFlags, nullptr, 0, 0, nullptr, nullptr, &hostMemory)) {
+				// Consumers expect NV12 chroma to follow straight after the luma rows with the same stride.
+				bool layout_ok = hostTexture->isYcbcr()
+					? hostTexture->lumaOffset() == 0 &&
+					  hostTexture->chromaRowPitch() == hostTexture->lumaRowPitch() &&
+					  hostTexture->chromaOffset() == hostTexture->lumaRowPitch() * hostTexture->height()
+					: true;
+
+				if (layout_ok) {
+					hostTexture->setStreamColorspace(colorspace);
+					buffer->texture = std::move(hostTexture);
+					buffer->shm.stride = buffer->texture->isYcbcr() ? buffer->texture->lumaRowPitch() : buffer->texture->rowPitch();
+					buffer->shm.zero_copy = true;
+				} else {
+					pwr_log.debugf("imported SHM texture has an unexpected plane layout, copying instead");
+				}
+			} else {
+				pwr_log.debugf("failed to import SHM buffer into Vulkan, copying instead");
+			}
+		}
 
 		spa_data->type = SPA_DATA_MemFd;
 		spa_data->flags = SPA_DATA_FLAG_READABLE;
@@ -39,7 +39,11 @@ struct pipewire_buffer {
 	struct {
 		int stride;
 		uint8_t *data;
+		size_t size;
 		int fd;
+		// The texture is bound directly to this memory, so the GPU
+		// writes the frame into it and there is nothing to copy.
+		bool zero_copy;
 	} shm;
 
 	// The following fields are not thread-safe
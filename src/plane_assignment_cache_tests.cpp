@@ -0,0 +1,330 @@
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "Utils/PlaneAssignmentCache.h"
+
+// Runs the liftoff plane assignment cache against a fake KMS: checks what a
+// replay writes into the request, that it takes exactly one test commit, that
+// a failed one leaves the request as it was and forgets the assignment, and
+// that only the most recently used configurations are kept.
+
+static int s_nFailures = 0;
+
+#define EXPECT( cond ) \
+    do { if ( !( cond ) ) { fprintf( stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond ); s_nFailures++; } } while ( 0 )
+
+static constexpr size_t k_zMaxLayers = 4;
+
+struct TestKey_t
+{
+    uint32_t uConfig = 0;
+
+    bool operator == ( const TestKey_t &other ) const { return uConfig == other.uConfig; }
+};
+
+struct TestKeyHash
+{
+    size_t operator()( const TestKey_t &key ) const { return std::hash<uint32_t>{}( key.uConfig ); }
+};
+
+using CTestCache = gamescope::CPlaneAssignmentCache<TestKey_t, TestKeyHash, k_zMaxLayers>;
+
+class CFakeKMS final : public gamescope::IKMSPlaneProperties
+{
+public:
+    struct Write_t
+    {
+        uint32_t uObjectId;
+        uint32_t uPropertyId;
+        uint64_t ulValue;
+
+        bool operator == ( const Write_t &other ) const = default;
+    };
+
+    CFakeKMS()
+    {
+        // Planes 31-33, each with the same set of properties at their own IDs.
+        for ( uint32_t uPlaneId = 31; uPlaneId <= 33; uPlaneId++ )
+        {
+            uint32_t uPropertyId = uPlaneId * 100;
+            for ( const char *pszName : { "FB_ID", "CRTC_ID", "IN_FENCE_FD", "SRC_W", "SRC_H", "CRTC_W", "CRTC_H", "zpos", "alpha" } )
+                m_Properties[ { uPlaneId, pszName } ] = ++uPropertyId;
+        }
+        // The cursor plane can't do alpha.
+        m_Properties.erase( { 33, "alpha" } );
+    }
+
+    uint32_t GetPlanePropertyId( uint32_t uPlaneId, const char *pszName ) override
+    {
+        m_uPropertyLookups++;
+        auto iter = m_Properties.find( { uPlaneId, pszName } );
+        return iter != m_Properties.end() ? iter->second : 0;
+    }
+
+    int GetRequestCursor() override { return int( m_Request.size() ); }
+    void SetRequestCursor( int nCursor ) override { m_Request.resize( size_t( nCursor ) ); }
+
+    bool AddProperty( uint32_t uObjectId, uint32_t uPropertyId, uint64_t ulValue ) override
+    {
+        m_Request.push_back( Write_t{ uObjectId, uPropertyId, ulValue } );
+        return true;
+    }
+
+    int TestCommit() override
+    {
+        m_uTestCommits++;
+        return fnTest ? fnTest( m_Request ) : 0;
+    }
+
+    uint32_t PropertyId( uint32_t uPlaneId, const char *pszName ) const { return m_Properties.at( { uPlaneId, pszName } ); }
+
+    bool HasWrite( uint32_t uPlaneId, const char *pszName, uint64_t ulValue ) const
+    {
+        auto iter = m_Properties.find( { uPlaneId, pszName } );
+        if ( iter == m_Properties.end() )
+            return false;
+
+        for ( const Write_t &write : m_Request )
+        {
+            if ( write == Write_t{ uPlaneId, iter->second, ulValue } )
+                return true;
+        }
+        return false;
+    }
+
+    bool HasWriteTo( uint32_t uPlaneId, const char *pszName ) const
+    {
+        auto iter = m_Properties.find( { uPlaneId, pszName } );
+        if ( iter == m_Properties.end() )
+            return false;
+
+        for ( const Write_t &write : m_Request )
+        {
+            if ( write.uObjectId == uPlaneId && write.uPropertyId == iter->second )
+                return true;
+        }
+        return false;
+    }
+
+    std::vector<Write_t> m_Request;
+    uint32_t m_uTestCommits = 0;
+    uint32_t m_uPropertyLookups = 0;
+    std::function<int( const std::vector<Write_t> & )> fnTest;
+
+private:
+    std::map<std::tuple<uint32_t, std::string>, uint32_t> m_Properties;
+};
+
+static constexpr uint32_t k_uCRTCId = 50;
+
+static void SetupLayers( gamescope::CLayerProperties ( &layers )[ k_zMaxLayers ], uint32_t uFrame )
+{
+    for ( uint32_t i = 0; i < 2; i++ )
+    {
+        layers[i].Set( "FB_ID", 1000 + uFrame * 10 + i );
+        layers[i].Set( "IN_FENCE_FD", uint64_t( -1 ) );
+        layers[i].Set( "SRC_W", 1280 << 16 );
+        layers[i].Set( "SRC_H", 800 << 16 );
+        layers[i].Set( "CRTC_W", 1280 );
+        layers[i].Set( "CRTC_H", 800 );
+        layers[i].Set( "zpos", i );
+        layers[i].Set( "alpha", 0xFFFF );
+    }
+
+    layers[2].Set( "FB_ID", 0 );
+}
+
+static void test_layer_properties()
+{
+    gamescope::CLayerProperties layer;
+    layer.Set( "FB_ID", 1 );
+    layer.Set( "alpha", 2 );
+    layer.Set( "FB_ID", 3 );
+    EXPECT( layer.Get().size() == 2 );
+
+    layer.Unset( "FB_ID" );
+    EXPECT( layer.Get().size() == 1 && layer.Get()[0].ulValue == 2 );
+
+    // Compared by name, not by pointer.
+    std::string sAlpha = "alpha";
+    layer.Set( sAlpha.c_str(), 4 );
+    EXPECT( layer.Get().size() == 1 && layer.Get()[0].ulValue == 4 );
+}
+
+static void test_replay()
+{
+    CTestCache cache;
+    CFakeKMS kms;
+
+    gamescope::CLayerProperties layers[ k_zMaxLayers ];
+    SetupLayers( layers, 0 );
+
+    const TestKey_t key{ 1 };
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Miss );
+    EXPECT( !cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uTestCommits == 0 );
+    EXPECT( kms.m_Request.empty() );
+
+    // What liftoff came up with.
+    const uint32_t uPlaneIds[] = { 32, 31 };
+    const uint32_t uUnusedPlaneIds[] = { 33 };
+    cache.RecordSupported( key, uPlaneIds, uUnusedPlaneIds );
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Supported );
+
+    // Something from before the layers, eg. CRTC properties.
+    kms.AddProperty( k_uCRTCId, 1, 1 );
+
+    SetupLayers( layers, 1 );
+    EXPECT( cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uTestCommits == 1 );
+
+    EXPECT( kms.m_Request[0] == CFakeKMS::Write_t( k_uCRTCId, 1, 1 ) );
+    EXPECT( kms.HasWrite( 32, "CRTC_ID", k_uCRTCId ) );
+    EXPECT( kms.HasWrite( 31, "CRTC_ID", k_uCRTCId ) );
+    EXPECT( kms.HasWrite( 32, "FB_ID", 1010 ) );
+    EXPECT( kms.HasWrite( 31, "FB_ID", 1011 ) );
+    EXPECT( kms.HasWrite( 32, "SRC_W", 1280 << 16 ) );
+    EXPECT( kms.HasWrite( 31, "IN_FENCE_FD", uint64_t( -1 ) ) );
+    EXPECT( kms.HasWrite( 31, "alpha", 0xFFFF ) );
+    // Like liftoff, never zpos.
+    EXPECT( !kms.HasWriteTo( 31, "zpos" ) && !kms.HasWriteTo( 32, "zpos" ) );
+    // The plane nobody uses gets turned off.
+    EXPECT( kms.HasWrite( 33, "FB_ID", 0 ) );
+    EXPECT( kms.HasWrite( 33, "CRTC_ID", 0 ) );
+    // 1 + 2 * ( CRTC_ID + 7 properties ) + 2.
+    EXPECT( kms.m_Request.size() == 19 );
+
+    // Property IDs only get looked up once.
+    const uint32_t uLookups = kms.m_uPropertyLookups;
+    kms.m_Request.clear();
+    SetupLayers( layers, 2 );
+    EXPECT( cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uPropertyLookups == uLookups );
+    EXPECT( kms.HasWrite( 32, "FB_ID", 1020 ) );
+
+    const gamescope::PlaneAssignmentCacheStats_t stats = cache.GetStats();
+    EXPECT( stats.ulHits == 2 && stats.ulMisses == 1 && stats.ulTestCommits == 2 && stats.ulReplayFailures == 0 );
+}
+
+static void test_replay_failure()
+{
+    CTestCache cache;
+    CFakeKMS kms;
+
+    gamescope::CLayerProperties layers[ k_zMaxLayers ];
+    SetupLayers( layers, 0 );
+
+    const TestKey_t key{ 1 };
+    const uint32_t uPlaneIds[] = { 31, 32 };
+    const uint32_t uUnusedPlaneIds[] = { 33 };
+    cache.RecordSupported( key, uPlaneIds, uUnusedPlaneIds );
+
+    kms.AddProperty( k_uCRTCId, 1, 1 );
+    kms.fnTest = []( const std::vector<CFakeKMS::Write_t> & ) { return -22; };
+
+    EXPECT( !cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uTestCommits == 1 );
+    // Back to how it was.
+    EXPECT( kms.m_Request.size() == 1 );
+
+    // And it's forgotten, liftoff gets to have a go.
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Miss );
+    EXPECT( !cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uTestCommits == 1 );
+
+    const gamescope::PlaneAssignmentCacheStats_t stats = cache.GetStats();
+    EXPECT( stats.ulReplayFailures == 1 && stats.ulMisses == 2 && stats.ulHits == 0 && stats.ulEntries == 0 );
+}
+
+static void test_missing_property()
+{
+    CTestCache cache;
+    CFakeKMS kms;
+
+    gamescope::CLayerProperties layers[ k_zMaxLayers ];
+    SetupLayers( layers, 0 );
+
+    // Layer 1 on the cursor plane, which has no alpha.
+    const TestKey_t key{ 1 };
+    const uint32_t uPlaneIds[] = { 31, 33 };
+    const uint32_t uUnusedPlaneIds[] = { 32 };
+    cache.RecordSupported( key, uPlaneIds, uUnusedPlaneIds );
+
+    // Fine while it's opaque.
+    EXPECT( cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+
+    // Not once it isn't, without even testing.
+    kms.m_Request.clear();
+    layers[1].Set( "alpha", 0x8000 );
+    EXPECT( !cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_Request.empty() );
+    EXPECT( kms.m_uTestCommits == 1 );
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Miss );
+}
+
+static void test_unsupported()
+{
+    CTestCache cache;
+    CFakeKMS kms;
+
+    gamescope::CLayerProperties layers[ k_zMaxLayers ];
+    SetupLayers( layers, 0 );
+
+    const TestKey_t key{ 7 };
+    cache.RecordUnsupported( key );
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Unsupported );
+    EXPECT( !cache.TryReplay( key, layers, k_uCRTCId, &kms ) );
+    EXPECT( kms.m_uTestCommits == 0 );
+
+    // Works after all.
+    const uint32_t uPlaneIds[] = { 31, 32 };
+    cache.RecordSupported( key, uPlaneIds, {} );
+    EXPECT( cache.Find( key ) == CTestCache::Lookup_t::Supported );
+    EXPECT( cache.GetStats().ulEntries == 1 );
+}
+
+static void test_lru()
+{
+    CTestCache cache;
+    cache.SetMaxEntries( 2 );
+
+    const uint32_t uPlaneIds[] = { 31 };
+    cache.RecordSupported( TestKey_t{ 1 }, uPlaneIds, {} );
+    cache.RecordSupported( TestKey_t{ 2 }, uPlaneIds, {} );
+
+    // 1 was used more recently than 2, so 2 goes.
+    EXPECT( cache.Find( TestKey_t{ 1 } ) == CTestCache::Lookup_t::Supported );
+    cache.RecordUnsupported( TestKey_t{ 3 } );
+
+    EXPECT( cache.Find( TestKey_t{ 2 } ) == CTestCache::Lookup_t::Miss );
+    EXPECT( cache.Find( TestKey_t{ 1 } ) == CTestCache::Lookup_t::Supported );
+    EXPECT( cache.Find( TestKey_t{ 3 } ) == CTestCache::Lookup_t::Unsupported );
+    EXPECT( cache.GetStats().ulEvictions == 1 );
+    EXPECT( cache.GetStats().ulEntries == 2 );
+
+    cache.SetMaxEntries( 1 );
+    EXPECT( cache.Find( TestKey_t{ 3 } ) == CTestCache::Lookup_t::Unsupported );
+    EXPECT( cache.Find( TestKey_t{ 1 } ) == CTestCache::Lookup_t::Miss );
+
+    cache.Clear();
+    EXPECT( cache.Find( TestKey_t{ 3 } ) == CTestCache::Lookup_t::Miss );
+    EXPECT( cache.GetStats().ulEntries == 0 );
+}
+
+int main()
+{
+    test_layer_properties();
+    test_replay();
+    test_replay_failure();
+    test_missing_property();
+    test_unsupported();
+    test_lru();
+
+    printf( "%s\n", s_nFailures ? "FAILED" : "PASSED" );
+    return s_nFailures ? 1 : 0;
+}
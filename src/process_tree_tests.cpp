@@ -0,0 +1,269 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Utils/ProcessTree.h"
+
+// Checks the /proc parsing behind app ID resolution, and that the process tree
+// cache finds a Steam reaper's AppId, serves it from the cache the next time,
+// forgets the process once it's gone and follows a process that got reparented.
+
+using gamescope::CProcessTreeCache;
+
+static int s_nFailures = 0;
+
+#define EXPECT( cond ) \
+    do { if ( !( cond ) ) { fprintf( stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond ); s_nFailures++; } } while ( 0 )
+
+static void test_parse_proc_stat()
+{
+    auto oStat = gamescope::ParseProcStat( "1234 (reaper) S 1000 1234 1234 0 -1 4194560" );
+    EXPECT( oStat && oStat->svComm == "reaper" && oStat->nParentPid == 1000 );
+
+    // Names can have spaces and parens in them.
+    oStat = gamescope::ParseProcStat( "42 (Foo (Bar) baz) R 7 42 42 0" );
+    EXPECT( oStat && oStat->svComm == "Foo (Bar) baz" && oStat->nParentPid == 7 );
+
+    oStat = gamescope::ParseProcStat( "1 (systemd) S 0 1 1 0" );
+    EXPECT( oStat && oStat->nParentPid == 0 );
+
+    EXPECT( !gamescope::ParseProcStat( "" ) );
+    EXPECT( !gamescope::ParseProcStat( "1 (truncated" ) );
+    EXPECT( !gamescope::ParseProcStat( "1 (x) S" ) );
+}
+
+static void test_parse_steam_launch_app_id()
+{
+    using namespace std::string_view_literals;
+
+    EXPECT( gamescope::ParseSteamLaunchAppId( "reaper\0SteamLaunch\0AppId=480\0--\0game.exe\0"sv ) == 480 );
+    // Needs SteamLaunch first.
+    EXPECT( gamescope::ParseSteamLaunchAppId( "reaper\0AppId=480\0SteamLaunch\0--\0"sv ) == 0 );
+    // Anything after -- belongs to the game.
+    EXPECT( gamescope::ParseSteamLaunchAppId( "reaper\0SteamLaunch\0--\0AppId=480\0"sv ) == 0 );
+    EXPECT( gamescope::ParseSteamLaunchAppId( "reaper\0SteamLaunch\0AppId=0\0"sv ) == 0 );
+    EXPECT( gamescope::ParseSteamLaunchAppId( "reaper\0SteamLaunch\0AppId=1245620"sv ) == 1245620 );
+    EXPECT( gamescope::ParseSteamLaunchAppId( ""sv ) == 0 );
+}
+
+static bool WaitForComm( pid_t nPid, const char *pszComm )
+{
+    char szPath[64];
+    snprintf( szPath, sizeof( szPath ), "/proc/%d/comm", int( nPid ) );
+
+    for ( int i = 0; i < 200; i++ )
+    {
+        if ( FILE *pFile = fopen( szPath, "r" ) )
+        {
+            char szComm[64] = {};
+            bool bRead = fgets( szComm, sizeof( szComm ), pFile ) != nullptr;
+            fclose( pFile );
+            if ( bRead && strncmp( szComm, pszComm, strlen( pszComm ) ) == 0 )
+                return true;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    }
+    return false;
+}
+
+static void test_process_tree_cache()
+{
+    CProcessTreeCache cache;
+
+    // We aren't running under a Steam reaper.
+    EXPECT( cache.GetAppId( getpid() ) == 0 );
+    EXPECT( cache.GetAppId( 0 ) == 0 );
+
+    // Re-run ourselves looking like Steam launching a game.
+    pid_t nReaper = fork();
+    if ( nReaper == 0 )
+    {
+        execl( "/proc/self/exe", "reaper", "SteamLaunch", "AppId=480", "--", "game", nullptr );
+        _exit( 1 );
+    }
+    EXPECT( nReaper > 0 );
+    if ( nReaper <= 0 || !WaitForComm( nReaper, "reaper" ) )
+    {
+        fprintf( stderr, "FAIL: fake reaper didn't start\n" );
+        s_nFailures++;
+        if ( nReaper > 0 )
+        {
+            kill( nReaper, SIGKILL );
+            waitpid( nReaper, nullptr, 0 );
+        }
+        return;
+    }
+
+    EXPECT( cache.GetAppId( nReaper ) == 480 );
+    const gamescope::ProcessTreeCacheStats_t first = cache.GetStats();
+
+    // Everything up the tree is known now.
+    EXPECT( cache.GetAppId( nReaper ) == 480 );
+    const gamescope::ProcessTreeCacheStats_t second = cache.GetStats();
+    const bool bPidFds = first.ulEntries > 0;
+    if ( bPidFds )
+    {
+        EXPECT( second.ulProcReads == first.ulProcReads );
+        EXPECT( second.ulCachedProcesses > first.ulCachedProcesses );
+    }
+
+    kill( nReaper, SIGKILL );
+    waitpid( nReaper, nullptr, 0 );
+
+    // Gone, and not taken for whatever gets its pid next.
+    EXPECT( cache.GetAppId( nReaper ) == 0 );
+    if ( bPidFds )
+        EXPECT( cache.GetStats().ulInvalidations > second.ulInvalidations );
+}
+
+// The fake reaper from test_process_tree_reparent: a subreaper, like Steam's,
+// with a child that has a child of its own. Writes both pids to nFd.
+static int RunFakeReaperTree( int nFd )
+{
+    prctl( PR_SET_NAME, "reaper", 0, 0, 0 );
+    prctl( PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0 );
+
+    if ( fork() == 0 )
+    {
+        prctl( PR_SET_NAME, "middle", 0, 0, 0 );
+
+        pid_t nPids[2] = { getpid(), fork() };
+        if ( nPids[1] == 0 )
+        {
+            prctl( PR_SET_NAME, "leaf", 0, 0, 0 );
+            for ( ;; )
+                pause();
+        }
+
+        (void) !write( nFd, nPids, sizeof( nPids ) );
+        for ( ;; )
+            pause();
+    }
+    close( nFd );
+
+    // Reap the middle process once it's killed, and then the leaf.
+    for ( ;; )
+    {
+        if ( wait( nullptr ) < 0 && errno == ECHILD )
+            pause();
+    }
+}
+
+static bool WaitForParent( pid_t nPid, pid_t nParentPid )
+{
+    char szPath[64];
+    snprintf( szPath, sizeof( szPath ), "/proc/%d/stat", int( nPid ) );
+
+    for ( int i = 0; i < 200; i++ )
+    {
+        if ( FILE *pFile = fopen( szPath, "r" ) )
+        {
+            char szStat[512] = {};
+            bool bRead = fgets( szStat, sizeof( szStat ), pFile ) != nullptr;
+            fclose( pFile );
+
+            auto oStat = bRead ? gamescope::ParseProcStat( szStat ) : std::nullopt;
+            if ( oStat && oStat->nParentPid == nParentPid )
+                return true;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    }
+    return false;
+}
+
+static bool WaitForReaped( pid_t nPid )
+{
+    for ( int i = 0; i < 200; i++ )
+    {
+        if ( kill( nPid, 0 ) != 0 && errno == ESRCH )
+            return true;
+        std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    }
+    return false;
+}
+
+static void test_process_tree_reparent()
+{
+    CProcessTreeCache cache;
+
+    int nPipe[2];
+    EXPECT( pipe( nPipe ) == 0 );
+
+    pid_t nReaper = fork();
+    if ( nReaper == 0 )
+    {
+        close( nPipe[0] );
+        std::string sFd = std::to_string( nPipe[1] );
+        execl( "/proc/self/exe", "reaper", "SteamLaunch", "AppId=480", "--", "tree", sFd.c_str(), nullptr );
+        _exit( 1 );
+    }
+    close( nPipe[1] );
+
+    pid_t nPids[2] = {};
+    bool bStarted = nReaper > 0 && read( nPipe[0], nPids, sizeof( nPids ) ) == sizeof( nPids ) &&
+        WaitForComm( nPids[0], "middle" ) && WaitForComm( nPids[1], "leaf" );
+    close( nPipe[0] );
+
+    const pid_t nMiddle = nPids[0];
+    const pid_t nLeaf = nPids[1];
+
+    if ( bStarted )
+    {
+        // Caches leaf -> middle -> reaper.
+        EXPECT( cache.GetAppId( nLeaf ) == 480 );
+
+        // The leaf gets reparented to the reaper, and the middle's pid is free for anyone.
+        kill( nMiddle, SIGKILL );
+        bStarted = WaitForParent( nLeaf, nReaper ) && WaitForReaped( nMiddle );
+        EXPECT( bStarted );
+
+        if ( bStarted )
+            EXPECT( cache.GetAppId( nLeaf ) == 480 );
+    }
+    else
+    {
+        fprintf( stderr, "FAIL: fake reaper tree didn't start\n" );
+        s_nFailures++;
+    }
+
+    if ( nLeaf > 0 )
+        kill( nLeaf, SIGKILL );
+    if ( nMiddle > 0 )
+        kill( nMiddle, SIGKILL );
+    if ( nReaper > 0 )
+    {
+        kill( nReaper, SIGKILL );
+        waitpid( nReaper, nullptr, 0 );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    // The fake reapers from test_process_tree_cache and test_process_tree_reparent.
+    if ( argc > 5 && strcmp( argv[1], "SteamLaunch" ) == 0 && strcmp( argv[4], "tree" ) == 0 )
+        return RunFakeReaperTree( atoi( argv[5] ) );
+
+    if ( argc > 1 && strcmp( argv[1], "SteamLaunch" ) == 0 )
+    {
+        prctl( PR_SET_NAME, "reaper", 0, 0, 0 );
+        pause();
+        return 0;
+    }
+
+    test_parse_proc_stat();
+    test_parse_steam_launch_app_id();
+    test_process_tree_cache();
+    test_process_tree_reparent();
+
+    printf( "%s\n", s_nFailures ? "FAILED" : "PASSED" );
+    return s_nFailures ? 1 : 0;
+}
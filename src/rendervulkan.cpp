@@ -6,10 +6,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <algorithm>
 #include <array>
 #include <bitset>
 #include <thread>
+#include <filesystem>
 #include <dlfcn.h>
 #include "vulkan_include.h"
 #include "Utils/Algorithm.h"
@@ -37,6 +39,7 @@
 #include "steamcompmgr.hpp"
 #include "log.hpp"
 #include "Utils/Process.h"
+#include "Utils/CompositeTiles.h"
 
 #include "cs_composite_blit.h"
 #include "cs_composite_blur.h"
@@ -120,6 +123,109 @@ static VkResult vulkan_load_module()
 
 VulkanOutput_t g_output;
 
+// Buffer age of g_output.outputImages, for partial composition.
+static gamescope::COutputDamageTracker s_OutputDamageTracker;
+
+// What we remember about a composited layer to tell if it changed later on.
+// Textures are only identified, not kept alive, so the client's buffer and
+// our import of it can go as soon as nothing shows it anymore.
+struct CompositeLayerSnapshot_t
+{
+	uint64_t ulTexId;
+	uint32_t uTexWidth;
+	uint32_t uTexHeight;
+	VkFormat eTexFormat;
+
+	int zpos;
+	vec2_t offset;
+	vec2_t scale;
+	float opacity;
+	GamescopeUpscaleFilter filter;
+	bool blackBorder;
+	bool applyColorMgmt;
+
+	// Ours and small, so kept around for their addresses to stay unique.
+	std::shared_ptr<gamescope::BackendBlob> ctm;
+	std::shared_ptr<gamescope::BackendBlob> hdr_metadata_blob;
+
+	GamescopeAppTextureColorspace colorspace;
+	uint64_t commitID;
+};
+
+struct CompositeFrameSnapshot_t
+{
+	bool useFSRLayer0;
+	bool useNISLayer0;
+	BlurMode blurLayer0;
+	bool applyOutputColorMgmt;
+	EOTF outputEncodingEOTF;
+
+	uint64_t ulShaperLutIds[EOTF_Count];
+	uint64_t ulLut3DIds[EOTF_Count];
+
+	int layerCount;
+	CompositeLayerSnapshot_t layers[ k_nMaxLayers ];
+};
+
+static CompositeLayerSnapshot_t SnapshotCompositeLayer( const FrameInfo_t::Layer_t &layer )
+{
+	return CompositeLayerSnapshot_t
+	{
+		.ulTexId = layer.tex ? layer.tex->uniqueId() : 0,
+		.uTexWidth = layer.tex ? layer.tex->width() : 0,
+		.uTexHeight = layer.tex ? layer.tex->height() : 0,
+		.eTexFormat = layer.tex ? layer.tex->format() : VK_FORMAT_UNDEFINED,
+		.zpos = layer.zpos,
+		.offset = layer.offset,
+		.scale = layer.scale,
+		.opacity = layer.opacity,
+		.filter = layer.filter,
+		.blackBorder = layer.blackBorder,
+		.applyColorMgmt = layer.applyColorMgmt,
+		.ctm = layer.ctm,
+		.hdr_metadata_blob = layer.hdr_metadata_blob,
+		.colorspace = layer.colorspace,
+		.commitID = layer.commitID,
+	};
+}
+
+static CompositeFrameSnapshot_t SnapshotCompositeFrame( const struct FrameInfo_t *frameInfo )
+{
+	CompositeFrameSnapshot_t snapshot{};
+	snapshot.useFSRLayer0 = frameInfo->useFSRLayer0;
+	snapshot.useNISLayer0 = frameInfo->useNISLayer0;
+	snapshot.blurLayer0 = frameInfo->blurLayer0;
+	snapshot.applyOutputColorMgmt = frameInfo->applyOutputColorMgmt;
+	snapshot.outputEncodingEOTF = frameInfo->outputEncodingEOTF;
+
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		snapshot.ulShaperLutIds[i] = frameInfo->shaperLut[i] ? frameInfo->shaperLut[i]->uniqueId() : 0;
+		snapshot.ulLut3DIds[i] = frameInfo->lut3D[i] ? frameInfo->lut3D[i]->uniqueId() : 0;
+	}
+
+	snapshot.layerCount = frameInfo->layerCount;
+	for ( int i = 0; i < frameInfo->layerCount; i++ )
+		snapshot.layers[i] = SnapshotCompositeLayer( frameInfo->layers[i] );
+
+	return snapshot;
+}
+
+// The last scene composited into g_output.outputImages, so it can be presented
+// again as is when nothing changed.
+struct CompositeScene_t
+{
+	uint64_t ulFingerprint;
+	uint64_t ulSequence;
+	// Keeps the scene's blobs alive, so new ones can't show up
+	// at the same addresses and match the fingerprint.
+	CompositeFrameSnapshot_t snapshot;
+};
+static std::optional<CompositeScene_t> s_oLastCompositeScene;
+
+// Bumped whenever LUT textures get new contents, which happens in place.
+static uint64_t s_ulLutGeneration = 0;
+
 uint32_t g_uCompositeDebug = 0u;
 gamescope::ConVar<uint32_t> cv_composite_debug{ "composite_debug", 0, "Debug composition flags" };
 
@@ -295,6 +401,8 @@ bool CVulkanDevice::BInit(VkInstance instance, VkSurfaceKHR surface)
 		return false;
 	if (!createScratchResources())
 		return false;
+	if (!createPipelineCache())
+		return false;
 
 	m_bInitialized = true;
 
@@ -411,6 +519,7 @@ bool CVulkanDevice::createDevice()
 	bool hasDrmProps = false;
 	bool supportsForeignQueue = false;
 	bool supportsHDRMetadata = false;
+	bool supportsCreationFeedback = false;
 	for ( uint32_t i = 0; i < supportedExtensionCount; ++i )
 	{
 		if ( strcmp(supportedExts[i].extensionName,
@@ -428,8 +537,22 @@ bool CVulkanDevice::createDevice()
 		if ( strcmp(supportedExts[i].extensionName,
 			 VK_EXT_HDR_METADATA_EXTENSION_NAME) == 0 )
 			 supportsHDRMetadata = true;
+
+		if ( strcmp(supportedExts[i].extensionName,
+			 VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME) == 0 )
+			m_bSupportsHostMemoryImport = true;
+
+		if ( strcmp(supportedExts[i].extensionName,
+			 VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0 )
+			supportsCreationFeedback = true;
 	}
 
+	// Core in 1.3, but we take 1.2 devices too.
+	VkPhysicalDeviceProperties physDevProps;
+	vk.GetPhysicalDeviceProperties( physDev(), &physDevProps );
+	const bool bCoreCreationFeedback = physDevProps.apiVersion >= VK_API_VERSION_1_3;
+	m_bSupportsCreationFeedback = bCoreCreationFeedback || supportsCreationFeedback;
+
 	vk_log.infof( "physical device %s DRM format modifiers", m_bSupportsModifiers ? "supports" : "does not support" );
 
 	if ( !GetBackend()->ValidPhysicalDevice( physDev() ) )
@@ -505,6 +628,20 @@ bool CVulkanDevice::createDevice()
 		m_bSupportsFp16 = vulkan12Features.shaderFloat16 && features2.features.shaderInt16;
 	}
 
+	if ( m_bSupportsHostMemoryImport )
+	{
+		VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostMemoryProps = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+		};
+		VkPhysicalDeviceProperties2 props2 = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+			.pNext = &hostMemoryProps,
+		};
+		vk.GetPhysicalDeviceProperties2( physDev(), &props2 );
+
+		m_hostPointerAlignment = hostMemoryProps.minImportedHostPointerAlignment;
+	}
+
 	float queuePriorities = 1.0f;
 
 	VkDeviceQueueGlobalPriorityCreateInfoEXT queueCreateInfoEXT = {
@@ -561,6 +698,12 @@ bool CVulkanDevice::createDevice()
 	if ( supportsHDRMetadata )
 		enabledExtensions.push_back( VK_EXT_HDR_METADATA_EXTENSION_NAME );
 
+	if ( m_bSupportsHostMemoryImport )
+		enabledExtensions.push_back( VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME );
+
+	if ( supportsCreationFeedback && !bCoreCreationFeedback )
+		enabledExtensions.push_back( VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME );
+
 	for ( auto& extension : GetBackend()->GetDeviceExtensions( physDev() ) )
 		enabledExtensions.push_back( extension );
 
@@ -742,7 +885,7 @@ bool CVulkanDevice::createLayouts()
 	for (auto& sampler : ycbcrSamplers)
 		sampler = m_ycbcrSampler;
 
-	std::array<VkDescriptorSetLayoutBinding, 7 > layoutBindings = {
+	std::array<VkDescriptorSetLayoutBinding, 8 > layoutBindings = {
 		VkDescriptorSetLayoutBinding {
 			.binding = 0,
 			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
@@ -786,6 +929,12 @@ bool CVulkanDevice::createLayouts()
 			.descriptorCount = VKR_LUT3D_COUNT,
 			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
 		},
+		VkDescriptorSetLayoutBinding {
+			.binding = 7,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		},
 	};
 
 	VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo =
@@ -846,7 +995,7 @@ bool CVulkanDevice::createPools()
 		return false;
 	}
 
-	VkDescriptorPoolSize poolSizes[3] {
+	VkDescriptorPoolSize poolSizes[4] {
 		{
 			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 			uint32_t(m_descriptorSets.size()),
@@ -859,6 +1008,10 @@ bool CVulkanDevice::createPools()
 			VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 			uint32_t(m_descriptorSets.size()) * ((2 * VKR_SAMPLER_SLOTS) + (2 * VKR_LUT3D_COUNT)),
 		},
+		{
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			uint32_t(m_descriptorSets.size()),
+		},
 	};
 	
 	VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
@@ -875,6 +1028,34 @@ bool CVulkanDevice::createPools()
 		return false;
 	}
 
+	uint32_t queueFamilyCount = 0;
+	vk.GetPhysicalDeviceQueueFamilyProperties(physDev(), &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+	vk.GetPhysicalDeviceQueueFamilyProperties(physDev(), &queueFamilyCount, queueFamilyProperties.data());
+
+	VkPhysicalDeviceProperties props;
+	vk.GetPhysicalDeviceProperties(physDev(), &props);
+
+	m_uStorageBufferOffsetAlignment = std::max<uint32_t>( props.limits.minStorageBufferOffsetAlignment, 16 );
+
+	// Only used for measuring composites, so not having it is fine.
+	if ( m_queueFamily < queueFamilyCount && queueFamilyProperties[m_queueFamily].timestampValidBits != 0 && props.limits.timestampPeriod > 0.0f )
+	{
+		VkQueryPoolCreateInfo queryPoolCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = k_uCompositeTimestampSlots * 2,
+		};
+
+		res = vk.CreateQueryPool(device(), &queryPoolCreateInfo, nullptr, &m_compositeTimestampPool);
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkCreateQueryPool failed" );
+			m_compositeTimestampPool = VK_NULL_HANDLE;
+		}
+		m_flTimestampPeriod = props.limits.timestampPeriod;
+	}
+
 	return true;
 }
 
@@ -906,6 +1087,19 @@ bool CVulkanDevice::createShaders()
 	SHADER(RGB_TO_NV12, cs_rgb_to_nv12);
 #undef SHADER
 
+	// FNV-1a over all of our SPIR-V, used to invalidate the on-disk pipeline cache
+	// whenever the shaders change.
+	m_ulShaderHash = 0xcbf29ce484222325ull;
+	for (uint32_t i = 0; i < shaderInfos.size(); i++)
+	{
+		const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( shaderInfos[i].spirv );
+		for (uint32_t j = 0; j < shaderInfos[i].size; j++)
+		{
+			m_ulShaderHash ^= pBytes[j];
+			m_ulShaderHash *= 0x100000001b3ull;
+		}
+	}
+
 	for (uint32_t i = 0; i < shaderInfos.size(); i++)
 	{
 		VkShaderModuleCreateInfo shaderCreateInfo = {
@@ -948,7 +1142,7 @@ bool CVulkanDevice::createScratchResources()
 	VkBufferCreateInfo bufferCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.size = upload_buffer_size,
-		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 	};
 
 	res = vk.CreateBuffer( device(), &bufferCreateInfo, nullptr, &m_uploadBuffer );
@@ -1005,6 +1199,212 @@ bool CVulkanDevice::createScratchResources()
 	return true;
 }
 
+std::string_view GetHomeDir();
+
+static std::string GetPipelineCachePath()
+{
+	const char *pszCacheHome = getenv( "XDG_CACHE_HOME" );
+	if ( pszCacheHome && *pszCacheHome )
+		return std::string{ pszCacheHome } + "/gamescope/pipeline_cache.bin";
+
+	return std::string{ GetHomeDir() } + "/.cache/gamescope/pipeline_cache.bin";
+}
+
+static constexpr uint32_t k_unPipelineCacheMagic = 0x50435347; // 'GSCP'
+static constexpr uint32_t k_unPipelineCacheVersion = 1;
+
+// Prefixed to the driver's own blob so we never hand a cache from another
+// driver, device or shader build to vkCreatePipelineCache.
+struct PipelineCacheFileHeader_t
+{
+	uint32_t uMagic;
+	uint32_t uVersion;
+	uint32_t uVendorID;
+	uint32_t uDeviceID;
+	uint32_t uDriverVersion;
+	uint32_t uReserved;
+	uint8_t driverUUID[VK_UUID_SIZE];
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t ulShaderHash;
+	uint64_t ulDataSize;
+};
+
+static PipelineCacheFileHeader_t GetPipelineCacheFileHeader( CVulkanDevice *pDevice, uint64_t ulShaderHash )
+{
+	VkPhysicalDeviceIDProperties idProps = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES,
+	};
+	VkPhysicalDeviceProperties2 props2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &idProps,
+	};
+	pDevice->vk.GetPhysicalDeviceProperties2( pDevice->physDev(), &props2 );
+
+	PipelineCacheFileHeader_t header = {
+		.uMagic = k_unPipelineCacheMagic,
+		.uVersion = k_unPipelineCacheVersion,
+		.uVendorID = props2.properties.vendorID,
+		.uDeviceID = props2.properties.deviceID,
+		.uDriverVersion = props2.properties.driverVersion,
+		.ulShaderHash = ulShaderHash,
+	};
+	memcpy( header.driverUUID, idProps.driverUUID, VK_UUID_SIZE );
+	memcpy( header.pipelineCacheUUID, props2.properties.pipelineCacheUUID, VK_UUID_SIZE );
+	return header;
+}
+
+bool CVulkanDevice::createPipelineCache()
+{
+	const PipelineCacheFileHeader_t expectedHeader = GetPipelineCacheFileHeader( this, m_ulShaderHash );
+
+	std::vector<uint8_t> initialData;
+
+	std::string sPath = GetPipelineCachePath();
+	if ( FILE *pFile = fopen( sPath.c_str(), "rb" ) )
+	{
+		struct stat fileStat;
+		PipelineCacheFileHeader_t header;
+		if ( fstat( fileno( pFile ), &fileStat ) == 0 && fread( &header, sizeof( header ), 1, pFile ) == 1 )
+		{
+			const uint64_t ulFileDataSize = uint64_t( fileStat.st_size ) - sizeof( header );
+			if ( memcmp( &header, &expectedHeader, offsetof( PipelineCacheFileHeader_t, ulDataSize ) ) != 0 )
+			{
+				vk_log.infof( "pipeline cache %s is stale (driver or shaders changed), ignoring", sPath.c_str() );
+			}
+			else if ( header.ulDataSize > ulFileDataSize )
+			{
+				// Don't trust the header with an allocation size.
+				vk_log.infof( "pipeline cache %s is truncated, ignoring", sPath.c_str() );
+			}
+			else
+			{
+				initialData.resize( header.ulDataSize );
+				if ( fread( initialData.data(), 1, initialData.size(), pFile ) != initialData.size() )
+				{
+					vk_log.infof( "pipeline cache %s is truncated, ignoring", sPath.c_str() );
+					initialData.clear();
+				}
+			}
+		}
+		fclose( pFile );
+	}
+
+	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = initialData.size(),
+		.pInitialData = initialData.data(),
+	};
+
+	VkResult res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	if ( res != VK_SUCCESS && !initialData.empty() )
+	{
+		vk_errorf( res, "vkCreatePipelineCache failed with on-disk data, starting with an empty cache" );
+		pipelineCacheCreateInfo.initialDataSize = 0;
+		pipelineCacheCreateInfo.pInitialData = nullptr;
+		res = vk.CreatePipelineCache( device(), &pipelineCacheCreateInfo, nullptr, &m_pipelineCache );
+	}
+
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkCreatePipelineCache failed" );
+		return false;
+	}
+
+	vk_log.infof( "loaded %zu bytes of pipeline cache from %s", initialData.size(), sPath.c_str() );
+
+	return true;
+}
+
+void CVulkanDevice::savePipelineCache()
+{
+	if ( m_pipelineCache == VK_NULL_HANDLE )
+		return;
+
+	if ( !m_bPipelineCacheDirty.exchange( false ) )
+		return;
+
+	std::unique_lock lock( m_pipelineCacheMutex );
+
+	size_t uDataSize = 0;
+	VkResult res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uDataSize, nullptr );
+	if ( res != VK_SUCCESS )
+	{
+		vk_errorf( res, "vkGetPipelineCacheData failed" );
+		return;
+	}
+
+	std::vector<uint8_t> data( uDataSize );
+	res = vk.GetPipelineCacheData( device(), m_pipelineCache, &uDataSize, data.data() );
+	if ( res != VK_SUCCESS && res != VK_INCOMPLETE )
+	{
+		vk_errorf( res, "vkGetPipelineCacheData failed" );
+		return;
+	}
+	data.resize( uDataSize );
+
+	PipelineCacheFileHeader_t header = GetPipelineCacheFileHeader( this, m_ulShaderHash );
+	header.ulDataSize = data.size();
+
+	std::string sPath = GetPipelineCachePath();
+	std::filesystem::path cacheDir = std::filesystem::path( sPath ).parent_path();
+	std::error_code ec;
+	std::filesystem::create_directories( cacheDir, ec );
+
+	// Write to a temporary and rename over so a crash mid-write never leaves
+	// a truncated cache behind.
+	std::string sTempPath = sPath + ".tmp";
+	FILE *pFile = fopen( sTempPath.c_str(), "wb" );
+	if ( !pFile )
+	{
+		vk_log.errorf_errno( "failed to open %s for writing", sTempPath.c_str() );
+		return;
+	}
+
+	bool bWritten = fwrite( &header, sizeof( header ), 1, pFile ) == 1 &&
+		fwrite( data.data(), 1, data.size(), pFile ) == data.size();
+	fclose( pFile );
+
+	if ( !bWritten || rename( sTempPath.c_str(), sPath.c_str() ) != 0 )
+	{
+		vk_log.errorf_errno( "failed to write pipeline cache to %s", sPath.c_str() );
+		unlink( sTempPath.c_str() );
+		return;
+	}
+
+	vk_log.debugf( "wrote %zu bytes of pipeline cache to %s", data.size(), sPath.c_str() );
+}
+
+void CVulkanDevice::notePipelineCreationFeedback( const VkPipelineCreationFeedback &feedback )
+{
+	if ( !( feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT ) )
+		return;
+
+	if ( feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT )
+	{
+		m_uPipelineCacheHits++;
+	}
+	else
+	{
+		m_uPipelineCacheMisses++;
+		m_bPipelineCacheDirty = true;
+	}
+}
+
+void CVulkanDevice::printPipelineCacheStats()
+{
+	uint32_t uHits = m_uPipelineCacheHits;
+	uint32_t uMisses = m_uPipelineCacheMisses;
+	uint32_t uTotal = uHits + uMisses;
+	console_log.infof( "Pipeline cache: %u hits, %u misses (%.1f%% hit rate)",
+		uHits, uMisses, uTotal ? 100.0 * uHits / uTotal : 0.0 );
+}
+
+static gamescope::ConCommand cc_pipeline_cache_stats( "pipeline_cache_stats", "Print the persistent pipeline cache hit rate",
+[]( std::span<std::string_view> args )
+{
+	g_device.printPipelineCacheStats();
+});
+
 VkSampler CVulkanDevice::sampler( SamplerState key )
 {
 	if ( m_samplerCache.count(key) != 0 )
@@ -1030,9 +1430,9 @@ VkSampler CVulkanDevice::sampler( SamplerState key )
 	return ret;
 }
 
-VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
+VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable, bool tile_masks)
 {
-	const std::array<VkSpecializationMapEntry, 7> specializationEntries = {{
+	const std::array<VkSpecializationMapEntry, 8> specializationEntries = {{
 		{
 			.constantID = 0,
 			.offset     = sizeof(uint32_t) * 0,
@@ -1070,6 +1470,12 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 			.offset     = sizeof(uint32_t) * 6,
 			.size       = sizeof(uint32_t)
 		},
+
+		{
+			.constantID = 8,
+			.offset     = sizeof(uint32_t) * 7,
+			.size       = sizeof(uint32_t)
+		},
 	}};
 
 	struct {
@@ -1080,6 +1486,7 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 		uint32_t colorspace_mask;
 		uint32_t output_eotf;
 		uint32_t itm_enable;
+		uint32_t tile_masks;
 	} specializationData = {
 		.layerCount   = layerCount,
 		.ycbcrMask    = ycbcrMask,
@@ -1088,6 +1495,7 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 		.colorspace_mask = colorspace_mask,
 		.output_eotf = output_eotf,
 		.itm_enable = itm_enable,
+		.tile_masks = tile_masks,
 	};
 
 	VkSpecializationInfo specializationInfo = {
@@ -1097,8 +1505,15 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 		.pData		   = &specializationData,
 	};
 
+	VkPipelineCreationFeedback creationFeedback = {};
+	VkPipelineCreationFeedbackCreateInfo creationFeedbackInfo = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+		.pPipelineCreationFeedback = &creationFeedback,
+	};
+
 	VkComputePipelineCreateInfo computePipelineCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = m_bSupportsCreationFeedback ? &creationFeedbackInfo : nullptr,
 		.stage = {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
@@ -1111,131 +1526,323 @@ VkPipeline CVulkanDevice::compilePipeline(uint32_t layerCount, uint32_t ycbcrMas
 
 	VkPipeline result;
 
-	VkResult res = vk.CreateComputePipelines(device(), VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &result);
+	VkResult res = vk.CreateComputePipelines(device(), pipelineCache(), 1, &computePipelineCreateInfo, nullptr, &result);
 	if (res != VK_SUCCESS) {
 		vk_errorf( res, "vkCreateComputePipelines failed" );
 		return VK_NULL_HANDLE;
 	}
 
+	if ( m_bSupportsCreationFeedback )
+	{
+		notePipelineCreationFeedback( creationFeedback );
+	}
+	else
+	{
+		// No telling if it came from the cache, so save it to be sure.
+		m_bPipelineCacheDirty = true;
+	}
+
 	return result;
 }
 
-void CVulkanDevice::compileAllPipelines()
+static gamescope::ConVar<bool> cv_pipeline_async_compile{ "pipeline_async_compile", true, "On a pipeline cache miss for a tile-masked composite, draw with the same pipeline without tile masks for a few frames while the exact one compiles in the background instead of stalling the frame." };
+static gamescope::ConVar<bool> cv_composite_tile_masks{ "composite_tile_masks", true, "Work out which layers show up in each tile of the output before compositing, so the composite only samples those." };
+static gamescope::ConVar<uint32_t> cv_pipeline_compile_threads{ "pipeline_compile_threads", 0, "Number of threads used to precompile pipelines at startup. 0 = automatic." };
+
+struct PipelinePrecompileInfo_t
 {
-	pthread_setname_np( pthread_self(), "gamescope-shdr" );
+	ShaderType shaderType;
+	uint32_t maxLayerCount;
+	uint32_t maxYcbcrMask;
+	uint32_t minBlurLayers;
+	uint32_t maxBlurLayers;
+	// Whether this shader does colorspace conversion per layer, otherwise
+	// colorspaceMask + outputEOTF are fixed.
+	bool bColorMgmt;
+	uint32_t colorspaceMask;
+	uint32_t outputEOTF;
+	// Whether vulkan_composite uses it with tile masks.
+	bool bTileMasks;
+};
 
-	std::array<PipelineInfo_t, SHADER_TYPE_COUNT> pipelineInfos;
-#define SHADER(type, layer_count, max_ycbcr, blur_layers) pipelineInfos[SHADER_TYPE_##type] = {SHADER_TYPE_##type, layer_count, max_ycbcr, blur_layers}
-	SHADER(BLIT, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
-	SHADER(BLUR, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, k_nMaxBlurLayers);
-	SHADER(BLUR_COND, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, k_nMaxBlurLayers);
-	SHADER(BLUR_FIRST_PASS, 1, 2, 1);
-	SHADER(RCAS, k_nMaxLayers, k_nMaxYcbcrMask_ToPreCompile, 1);
-	SHADER(EASU, 1, 1, 1);
-	SHADER(NIS, 1, 1, 1);
-	SHADER(RGB_TO_NV12, 1, 1, 1);
-#undef SHADER
+// Mirrors the way vulkan_composite and friends actually call pipeline().
+static std::vector<PipelineInfo_t> GetPipelinesToPrecompile( EOTF ePreferredEOTF )
+{
+	static constexpr PipelinePrecompileInfo_t k_PrecompileInfos[] =
+	{
+		{ SHADER_TYPE_BLIT,            k_nMaxLayers,     k_nMaxYcbcrMask_ToPreCompile, 0, 0,                true, 0, 0, true },
+		// Screenshots and the NIS second pass don't do tile masks.
+		{ SHADER_TYPE_BLIT,            k_nMaxLayers,     k_nMaxYcbcrMask_ToPreCompile, 0, 0,                true },
+		{ SHADER_TYPE_BLUR,            k_nMaxLayers,     k_nMaxYcbcrMask_ToPreCompile, 1, k_nMaxBlurLayers, true },
+		{ SHADER_TYPE_BLUR_COND,       k_nMaxLayers,     k_nMaxYcbcrMask_ToPreCompile, 1, k_nMaxBlurLayers, true },
+		{ SHADER_TYPE_BLUR_FIRST_PASS, k_nMaxBlurLayers, k_nMaxYcbcrMask_ToPreCompile, 0, 0,                true },
+		{ SHADER_TYPE_RCAS,            k_nMaxLayers,     k_nMaxYcbcrMask_ToPreCompile, 0, 0,                true },
+		{ SHADER_TYPE_EASU,            1,                1,                            0, 0,                false, 0, EOTF_Gamma22 },
+		{ SHADER_TYPE_NIS,             1,                1,                            0, 0,                false, 0, EOTF_Gamma22 },
+		{ SHADER_TYPE_RGB_TO_NV12,     1,                1,                            0, 0,                false, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB, EOTF_Count },
+	};
 
-	for (auto& info : pipelineInfos) {
-		for (uint32_t layerCount = 1; layerCount <= info.layerCount; layerCount++) {
-			for (uint32_t ycbcrMask = 0; ycbcrMask < info.ycbcrMask; ycbcrMask++) {
-				for (uint32_t blur_layers = 1; blur_layers <= info.blurLayerCount; blur_layers++) {
-					if (ycbcrMask >= (1u << (layerCount + 1)))
+	std::vector<PipelineInfo_t> pipelines;
+	for ( const PipelinePrecompileInfo_t &info : k_PrecompileInfos )
+	{
+		// Otherwise it's the same as its entry without tile masks.
+		if ( info.bTileMasks && !cv_composite_tile_masks )
+			continue;
+
+		for ( uint32_t layerCount = 1; layerCount <= info.maxLayerCount; layerCount++ )
+		{
+			for ( uint32_t ycbcrMask = 0; ycbcrMask < info.maxYcbcrMask; ycbcrMask++ )
+			{
+				for ( uint32_t blurLayers = info.minBlurLayers; blurLayers <= info.maxBlurLayers; blurLayers++ )
+				{
+					if ( ycbcrMask >= ( 1u << ( layerCount + 1 ) ) )
 						continue;
-					if (blur_layers > layerCount)
+					if ( blurLayers > layerCount )
+						continue;
+
+					if ( !info.bColorMgmt )
+					{
+						pipelines.push_back( PipelineInfo_t{ info.shaderType, layerCount, ycbcrMask, blurLayers, 0, info.colorspaceMask, info.outputEOTF, false, false } );
 						continue;
+					}
 
-					VkPipeline newPipeline = compilePipeline(layerCount, ycbcrMask, info.shaderType, blur_layers, info.compositeDebug, info.colorspaceMask, info.outputEOTF, info.itmEnable);
+					// 8888 formats get sampled through sRGB views (LINEAR), everything else
+					// is typically SRGB. Mixed masks are rare enough to compile on demand.
+					for ( GamescopeAppTextureColorspace eColorspace : { GAMESCOPE_APP_TEXTURE_COLORSPACE_LINEAR, GAMESCOPE_APP_TEXTURE_COLORSPACE_SRGB } )
 					{
-						std::lock_guard<std::mutex> lock(m_pipelineMutex);
-						PipelineInfo_t key = {info.shaderType, layerCount, ycbcrMask, blur_layers, info.compositeDebug};
-						auto result = m_pipelineMap.emplace(std::make_pair(key, newPipeline));
-						if (!result.second)
-							vk.DestroyPipeline(device(), newPipeline, nullptr);
+						uint32_t colorspaceMask = 0;
+						for ( uint32_t i = 0; i < layerCount; i++ )
+							colorspaceMask |= eColorspace << ( i * GamescopeAppTextureColorspace_Bits );
+
+						for ( uint32_t outputEOTF = 0; outputEOTF < EOTF_Count; outputEOTF++ )
+							pipelines.push_back( PipelineInfo_t{ info.shaderType, layerCount, ycbcrMask, blurLayers, 0, colorspaceMask, outputEOTF, false, info.bTileMasks } );
 					}
 				}
 			}
 		}
 	}
-}
 
-extern bool g_bSteamIsActiveWindow;
+	// Compile what the current output is most likely to hit first, fewer layers
+	// being the more common case.
+	std::stable_sort( pipelines.begin(), pipelines.end(), [ ePreferredEOTF ]( const PipelineInfo_t &a, const PipelineInfo_t &b )
+	{
+		bool bPreferredA = a.outputEOTF == (uint32_t)ePreferredEOTF || a.outputEOTF == EOTF_Count;
+		bool bPreferredB = b.outputEOTF == (uint32_t)ePreferredEOTF || b.outputEOTF == EOTF_Count;
+		if ( bPreferredA != bPreferredB )
+			return bPreferredA;
 
-VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_t ycbcrMask, uint32_t blur_layers, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable)
-{
-	uint32_t effective_debug = g_uCompositeDebug;
-	if ( g_bSteamIsActiveWindow )
-		effective_debug &= ~(CompositeDebugFlag::Heatmap | CompositeDebugFlag::Heatmap_MSWCG | CompositeDebugFlag::Heatmap_Hard);
+		return a.layerCount < b.layerCount;
+	});
 
-	std::lock_guard<std::mutex> lock(m_pipelineMutex);
-	PipelineInfo_t key = {type, layerCount, ycbcrMask, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable};
-	auto search = m_pipelineMap.find(key);
-	if (search == m_pipelineMap.end())
+	return pipelines;
+}
+
+void CVulkanDevice::compileAndInsertPipeline( const PipelineInfo_t &key )
+{
 	{
-		VkPipeline result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable);
-		m_pipelineMap[key] = result;
-		return result;
+		std::lock_guard<std::mutex> lock(m_pipelineMutex);
+		if (m_pipelineMap.contains(key))
+		{
+			m_pendingPipelines.erase(key);
+			return;
+		}
 	}
-	else
+
+	VkPipeline newPipeline = compilePipeline(key.layerCount, key.ycbcrMask, key.shaderType, key.blurLayerCount, key.compositeDebug, key.colorspaceMask, key.outputEOTF, key.itmEnable, key.tileMasks);
+
+	std::lock_guard<std::mutex> lock(m_pipelineMutex);
+	m_pendingPipelines.erase(key);
+	if (m_pipelineMap.contains(key))
 	{
-		return search->second;
+		vk.DestroyPipeline(device(), newPipeline, nullptr);
+		return;
 	}
+	m_pipelineMap[key] = newPipeline;
 }
 
-
-int32_t CVulkanDevice::findMemoryType( VkMemoryPropertyFlags properties, uint32_t requiredTypeBits )
+// Must be called with m_pipelineMutex held.
+VkPipeline CVulkanDevice::findFallbackPipeline( const PipelineInfo_t &key )
 {
-	for ( uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++ )
-	{
-		if ( ( ( 1 << i ) & requiredTypeBits ) == 0 )
-			continue;
-		
-		if ( ( properties & m_memoryProperties.memoryTypes[ i ].propertyFlags ) != properties )
-			continue;
-		
-		return i;
-	}
-	
-	return -1;
+	// Only the tile mask specialization may differ from what was asked for:
+	// the colorspace mask picks each layer's input transfer function, and the
+	// output EOTF and ITM the output's, so any of those would flash the wrong
+	// one until the real pipeline is ready. Without tile masks every layer
+	// just gets sampled everywhere, so that always works.
+	if ( !key.tileMasks )
+		return VK_NULL_HANDLE;
+
+	PipelineInfo_t fallbackKey = key;
+	fallbackKey.tileMasks = false;
+
+	auto search = m_pipelineMap.find( fallbackKey );
+	if ( search == m_pipelineMap.end() )
+		return VK_NULL_HANDLE;
+
+	return search->second;
 }
 
-std::unique_ptr<CVulkanCmdBuffer> CVulkanDevice::commandBuffer()
+bool CVulkanDevice::compileNextPipeline( std::span<const PipelineInfo_t> precompileList, std::atomic<size_t> &nextPrecompile )
 {
-	std::unique_ptr<CVulkanCmdBuffer> cmdBuffer;
-	if (m_unusedCmdBufs.empty())
+	// Anything pipeline() is waiting on always goes before speculative work.
+	std::optional<PipelineInfo_t> oKey;
 	{
-		VkCommandBuffer rawCmdBuffer;
-		VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-			.commandPool = m_commandPool,
-			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			.commandBufferCount = 1
-		};
-
-		VkResult res = vk.AllocateCommandBuffers( device(), &commandBufferAllocateInfo, &rawCmdBuffer );
-		if ( res != VK_SUCCESS )
+		std::lock_guard<std::mutex> lock(m_pipelineMutex);
+		if (!m_requestedPipelines.empty())
 		{
-			vk_errorf( res, "vkAllocateCommandBuffers failed" );
-			return nullptr;
+			oKey = m_requestedPipelines.front();
+			m_requestedPipelines.pop_front();
 		}
-
-		cmdBuffer = std::make_unique<CVulkanCmdBuffer>(this, rawCmdBuffer, queue(), queueFamily());
 	}
-	else
+
+	if (!oKey)
 	{
-		cmdBuffer = std::move(m_unusedCmdBufs.back());
-		m_unusedCmdBufs.pop_back();
+		size_t idx = nextPrecompile++;
+		if (idx >= precompileList.size())
+			return false;
+		oKey = precompileList[idx];
 	}
 
-	cmdBuffer->begin();
-	return cmdBuffer;
+	compileAndInsertPipeline(*oKey);
+	return true;
 }
 
-uint64_t CVulkanDevice::submitInternal( CVulkanCmdBuffer* cmdBuffer )
+void CVulkanDevice::compileAllPipelines()
 {
-	cmdBuffer->end();
+	pthread_setname_np( pthread_self(), "gamescope-shdr" );
 
-	// The seq no of the last submission.
+	const std::vector<PipelineInfo_t> precompileList = GetPipelinesToPrecompile( g_ColorMgmt.pending.outputEncodingEOTF );
+	std::atomic<size_t> nextPrecompile = { 0 };
+
+	uint32_t uThreadCount = cv_pipeline_compile_threads;
+	if (uThreadCount == 0)
+		uThreadCount = std::clamp( std::thread::hardware_concurrency() / 2, 1u, 4u );
+
+	// Fan out over the permutation space, each thread claims the next
+	// entry in priority order until it runs dry.
+	std::vector<std::thread> helperThreads;
+	for (uint32_t i = 1; i < uThreadCount; i++)
+	{
+		helperThreads.emplace_back([&]()
+		{
+			pthread_setname_np( pthread_self(), "gamescope-shdr" );
+			while (compileNextPipeline(precompileList, nextPrecompile))
+				;
+		});
+	}
+
+	while (compileNextPipeline(precompileList, nextPrecompile))
+		;
+
+	for (std::thread &thread : helperThreads)
+		thread.join();
+
+	vk_log.infof( "precompiled %zu pipelines on %u threads", precompileList.size(), uThreadCount );
+
+	// Precompilation is done, flush anything new to disk while we're idle.
+	savePipelineCache();
+
+	// Stick around to service pipelines that pipeline() deferred.
+	for (;;)
+	{
+		PipelineInfo_t key;
+		{
+			std::unique_lock<std::mutex> lock(m_pipelineMutex);
+			m_pipelineRequestCV.wait(lock, [this]{ return !m_requestedPipelines.empty(); });
+			key = m_requestedPipelines.front();
+			m_requestedPipelines.pop_front();
+		}
+
+		compileAndInsertPipeline(key);
+	}
+}
+
+extern bool g_bSteamIsActiveWindow;
+
+VkPipeline CVulkanDevice::pipeline(ShaderType type, uint32_t layerCount, uint32_t ycbcrMask, uint32_t blur_layers, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable, bool tile_masks)
+{
+	uint32_t effective_debug = g_uCompositeDebug;
+	if ( g_bSteamIsActiveWindow )
+		effective_debug &= ~(CompositeDebugFlag::Heatmap | CompositeDebugFlag::Heatmap_MSWCG | CompositeDebugFlag::Heatmap_Hard);
+
+	std::lock_guard<std::mutex> lock(m_pipelineMutex);
+	PipelineInfo_t key = {type, layerCount, ycbcrMask, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable, tile_masks};
+	auto search = m_pipelineMap.find(key);
+	if (search != m_pipelineMap.end())
+		return search->second;
+
+	if ( cv_pipeline_async_compile )
+	{
+		VkPipeline fallback = findFallbackPipeline( key );
+		if ( fallback != VK_NULL_HANDLE )
+		{
+			if ( m_pendingPipelines.insert( key ).second )
+			{
+				m_requestedPipelines.push_back( key );
+				m_pipelineRequestCV.notify_one();
+			}
+			return fallback;
+		}
+	}
+
+	VkPipeline result = compilePipeline(layerCount, ycbcrMask, type, blur_layers, effective_debug, colorspace_mask, output_eotf, itm_enable, tile_masks);
+	m_pipelineMap[key] = result;
+	return result;
+}
+
+
+int32_t CVulkanDevice::findMemoryType( VkMemoryPropertyFlags properties, uint32_t requiredTypeBits )
+{
+	for ( uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++ )
+	{
+		if ( ( ( 1 << i ) & requiredTypeBits ) == 0 )
+			continue;
+		
+		if ( ( properties & m_memoryProperties.memoryTypes[ i ].propertyFlags ) != properties )
+			continue;
+		
+		return i;
+	}
+	
+	return -1;
+}
+
+std::unique_ptr<CVulkanCmdBuffer> CVulkanDevice::commandBuffer()
+{
+	std::unique_ptr<CVulkanCmdBuffer> cmdBuffer;
+	if (m_unusedCmdBufs.empty())
+	{
+		VkCommandBuffer rawCmdBuffer;
+		VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = m_commandPool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1
+		};
+
+		VkResult res = vk.AllocateCommandBuffers( device(), &commandBufferAllocateInfo, &rawCmdBuffer );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkAllocateCommandBuffers failed" );
+			return nullptr;
+		}
+
+		cmdBuffer = std::make_unique<CVulkanCmdBuffer>(this, rawCmdBuffer, queue(), queueFamily());
+	}
+	else
+	{
+		cmdBuffer = std::move(m_unusedCmdBufs.back());
+		m_unusedCmdBufs.pop_back();
+	}
+
+	cmdBuffer->begin();
+	return cmdBuffer;
+}
+
+uint64_t CVulkanDevice::submitInternal( CVulkanCmdBuffer* cmdBuffer )
+{
+	cmdBuffer->end();
+
+	// The seq no of the last submission.
 	const uint64_t lastSubmissionSeqNo = m_submissionSeqNo++;
 
 	// This is the seq no of the command buffer we are going to submit.
@@ -1433,9 +2040,6 @@ void CVulkanCmdBuffer::AddSignal( std::shared_ptr<VulkanTimelineSemaphore_t> pTi
 
 void CVulkanDevice::wait(uint64_t sequence, bool reset)
 {
-	if (m_submissionSeqNo == sequence)
-		m_uploadBufferOffset = 0;
-
 	VkSemaphoreWaitInfo waitInfo = {
 		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
 		.semaphoreCount = 1,
@@ -1445,6 +2049,11 @@ void CVulkanDevice::wait(uint64_t sequence, bool reset)
 
 	vk_check( vk.WaitSemaphores( device(), &waitInfo, ~0ull ) );
 
+	// Submissions that haven't been waited on (eg. async LUT uploads) may still be
+	// copying out of the upload buffer, only start over once all of them are done.
+	if (m_submissionSeqNo == sequence)
+		m_uploadBufferOffset = 0;
+
 	if (reset)
 		resetCmdBuffers(sequence);
 }
@@ -1454,6 +2063,14 @@ void CVulkanDevice::waitIdle(bool reset)
 	wait(m_submissionSeqNo, reset);
 }
 
+bool CVulkanDevice::isSequenceComplete(uint64_t sequence)
+{
+	uint64_t currentSeqNo;
+	vk_check( vk.GetSemaphoreCounterValue(device(), m_scratchTimelineSemaphore, &currentSeqNo) );
+
+	return currentSeqNo >= sequence;
+}
+
 void CVulkanDevice::resetCmdBuffers(uint64_t sequence)
 {
 	auto last = m_pendingCmdBufs.find(sequence);
@@ -1549,6 +2166,21 @@ void CVulkanCmdBuffer::bindTarget(gamescope::Rc<CVulkanTexture> target)
 		m_textureRefs.emplace_back(std::move(target));
 }
 
+void CVulkanCmdBuffer::bindTargetPreserved(gamescope::Rc<CVulkanTexture> target)
+{
+	// Prepare it ourselves so dispatch doesn't discard it, bringing it back from
+	// wherever the last command buffer that wrote it exported it to.
+	auto result = m_textureState.emplace(target.get(), TextureState());
+	if (result.second)
+	{
+		result.first->second.needsImport = target->externalImage();
+		result.first->second.needsExport = target->externalImage();
+		result.first->second.needsPresentLayout = target->outputImage();
+	}
+
+	bindTarget(std::move(target));
+}
+
 void CVulkanCmdBuffer::clearState()
 {
 	for (auto& texture : m_boundTextures)
@@ -1559,6 +2191,9 @@ void CVulkanCmdBuffer::clearState()
 
 	m_target = nullptr;
 	m_useSrgb.reset();
+
+	m_tileMaskOffset = 0;
+	m_tileMaskSize = 0;
 }
 
 template<class PushData, class... Args>
@@ -1571,6 +2206,16 @@ void CVulkanCmdBuffer::uploadConstants(Args&&... args)
 	memcpy(ptr, &data, sizeof(data));
 }
 
+void CVulkanCmdBuffer::uploadTileMasks(std::span<const uint32_t> buffer)
+{
+	uint32_t size = buffer.size_bytes();
+
+	void *ptr = m_device->uploadBufferData(size, m_device->storageBufferOffsetAlignment());
+	m_tileMaskOffset = m_device->m_uploadBufferOffset - size;
+	m_tileMaskSize = size;
+	memcpy(ptr, buffer.data(), size);
+}
+
 void CVulkanCmdBuffer::bindPipeline(VkPipeline pipeline)
 {
 	m_device->vk.CmdBindPipeline(m_cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
@@ -1589,13 +2234,14 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 
 	VkDescriptorSet descriptorSet = m_device->descriptorSet();
 
-	std::array<VkWriteDescriptorSet, 7> writeDescriptorSets;
+	std::array<VkWriteDescriptorSet, 8> writeDescriptorSets;
 	std::array<VkDescriptorImageInfo, VKR_SAMPLER_SLOTS> imageDescriptors = {};
 	std::array<VkDescriptorImageInfo, VKR_SAMPLER_SLOTS> ycbcrImageDescriptors = {};
 	std::array<VkDescriptorImageInfo, VKR_TARGET_SLOTS> targetDescriptors = {};
 	std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> shaperLutDescriptor = {};
 	std::array<VkDescriptorImageInfo, VKR_LUT3D_COUNT> lut3DDescriptor = {};
 	VkDescriptorBufferInfo scratchDescriptor = {};
+	VkDescriptorBufferInfo tileMaskDescriptor = {};
 
 	writeDescriptorSets[0] = {
 		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
@@ -1667,10 +2313,25 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 		.pImageInfo = lut3DDescriptor.data(),
 	};
 
+	writeDescriptorSets[7] = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = descriptorSet,
+		.dstBinding = 7,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pBufferInfo = &tileMaskDescriptor,
+	};
+
 	scratchDescriptor.buffer = m_device->m_uploadBuffer;
 	scratchDescriptor.offset = m_renderBufferOffset;
 	scratchDescriptor.range = VK_WHOLE_SIZE;
 
+	// Only read by pipelines with tile masks, anything else just needs something valid there.
+	tileMaskDescriptor.buffer = m_device->m_uploadBuffer;
+	tileMaskDescriptor.offset = m_tileMaskOffset;
+	tileMaskDescriptor.range = m_tileMaskSize ? m_tileMaskSize : 16;
+
 	for (uint32_t i = 0; i < VKR_SAMPLER_SLOTS; i++)
 	{
 		imageDescriptors[i].sampler = m_device->sampler(m_samplerState[i]);
@@ -1730,6 +2391,16 @@ void CVulkanCmdBuffer::dispatch(uint32_t x, uint32_t y, uint32_t z)
 	markDirty(m_target);
 }
 
+void CVulkanCmdBuffer::resetQueries(VkQueryPool pool, uint32_t firstQuery, uint32_t queryCount)
+{
+	m_device->vk.CmdResetQueryPool(m_cmdBuffer, pool, firstQuery, queryCount);
+}
+
+void CVulkanCmdBuffer::writeTimestamp(VkPipelineStageFlagBits stage, VkQueryPool pool, uint32_t query)
+{
+	m_device->vk.CmdWriteTimestamp(m_cmdBuffer, stage, pool, query);
+}
+
 void CVulkanCmdBuffer::copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst)
 {
 	assert(src->width() == dst->width());
@@ -1786,6 +2457,18 @@ void CVulkanCmdBuffer::copyBufferToImage(VkBuffer buffer, VkDeviceSize offset, u
 	m_textureRefs.emplace_back(std::move(dst));
 }
 
+void CVulkanCmdBuffer::copyBufferToImage(VkBuffer buffer, std::span<const VkBufferImageCopy> regions, gamescope::Rc<CVulkanTexture> dst)
+{
+	prepareDestImage(dst.get());
+	insertBarrier();
+
+	m_device->vk.CmdCopyBufferToImage(m_cmdBuffer, buffer, dst->vkImage(), VK_IMAGE_LAYOUT_GENERAL, uint32_t(regions.size()), regions.data());
+
+	markDirty(dst.get());
+
+	m_textureRefs.emplace_back(std::move(dst));
+}
+
 void CVulkanCmdBuffer::prepareSrcImage(CVulkanTexture *image)
 {
 	auto result = m_textureState.emplace(image, TextureState());
@@ -1950,6 +2633,39 @@ static VkResult getModifierProps( const VkImageCreateInfo *imageInfo, uint64_t m
 	return g_device.vk.GetPhysicalDeviceImageFormatProperties2(g_device.physDev(), &imageFormatInfo, &imageProps);
 }
 
+static VkResult getHostAllocationProps( const VkImageCreateInfo *imageInfo, VkExternalImageFormatProperties *externalFormatProps )
+{
+	VkPhysicalDeviceExternalImageFormatInfo externalImageFormatInfo = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO,
+		.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+	};
+
+	VkPhysicalDeviceImageFormatInfo2 imageFormatInfo = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+		.pNext = &externalImageFormatInfo,
+		.format = imageInfo->format,
+		.type = imageInfo->imageType,
+		.tiling = imageInfo->tiling,
+		.usage = imageInfo->usage,
+		.flags = imageInfo->flags,
+	};
+
+	const VkImageFormatListCreateInfo *readonlyList = pNextFind<VkImageFormatListCreateInfo>(imageInfo, VK_STRUCTURE_TYPE_IMAGE_FORMAT_LIST_CREATE_INFO);
+	VkImageFormatListCreateInfo formatList = {};
+	if ( readonlyList != nullptr )
+	{
+		formatList = *readonlyList;
+		formatList.pNext = std::exchange(imageFormatInfo.pNext, &formatList);
+	}
+
+	VkImageFormatProperties2 imageProps = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+		.pNext = externalFormatProps,
+	};
+
+	return g_device.vk.GetPhysicalDeviceImageFormatProperties2(g_device.physDev(), &imageFormatInfo, &imageProps);
+}
+
 static VkImageViewType VulkanImageTypeToViewType(VkImageType type)
 {
 	switch (type)
@@ -1961,7 +2677,7 @@ static VkImageViewType VulkanImageTypeToViewType(VkImageType type)
 	}
 }
 
-bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uint32_t drmFormat, createFlags flags, wlr_dmabuf_attributes *pDMA /* = nullptr */,  uint32_t contentWidth /* = 0 */, uint32_t contentHeight /* =  0 */, CVulkanTexture *pExistingImageToReuseMemory, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb )
+bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uint32_t drmFormat, createFlags flags, wlr_dmabuf_attributes *pDMA /* = nullptr */,  uint32_t contentWidth /* = 0 */, uint32_t contentHeight /* =  0 */, CVulkanTexture *pExistingImageToReuseMemory, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb, const hostMemory *pHostMemory /* = nullptr */ )
 {
 	m_pBackendFb = std::move( pBackendFb );
 	m_drmFormat = drmFormat;
@@ -2017,6 +2733,18 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 
 	m_bExternal = pDMA || flags.bExportable == true;
 
+	if ( pHostMemory != nullptr )
+	{
+		// Only makes sense for something we are going to map, and that
+		// nobody else is going to import through a DMA-BUF.
+		assert( flags.bMappable && !flags.bExportable && !flags.bFlippable && !pDMA && !pExistingImageToReuseMemory );
+
+		if ( !g_device.supportsHostMemoryImport() )
+			return false;
+
+		m_bHostMemory = true;
+	}
+
 	// Possible extensions for below
 	wsi_image_create_info wsiImageCreateInfo = {};
 	VkExternalMemoryImageCreateInfo externalImageCreateInfo = {};
@@ -2178,6 +2906,32 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
 		};
 	}
+	else if ( pHostMemory != nullptr )
+	{
+		// Not every format/tiling/usage can live in imported host memory,
+		// let the caller fall back to copying when this one can't.
+		VkExternalImageFormatProperties externalImageProperties = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
+		};
+		res = getHostAllocationProps( &imageInfo, &externalImageProperties );
+		if ( res == VK_ERROR_FORMAT_NOT_SUPPORTED ||
+		     ( res == VK_SUCCESS && !( externalImageProperties.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT ) ) )
+		{
+			vk_log.debugf( "format 0x%" PRIX32 " can't be imported from host memory", drmFormat );
+			return false;
+		}
+		else if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "getHostAllocationProps failed" );
+			return false;
+		}
+
+		externalImageCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+			.pNext = std::exchange(imageInfo.pNext, &externalImageCreateInfo),
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+		};
+	}
 
 	m_width = width;
 	m_height = height;
@@ -2215,7 +2969,53 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 
 	VkDeviceMemory memoryHandle = VK_NULL_HANDLE;
 
-	if ( pExistingImageToReuseMemory == nullptr )
+	if ( pHostMemory != nullptr )
+	{
+		VkMemoryHostPointerPropertiesEXT hostPointerProps = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+		};
+		res = g_device.vk.GetMemoryHostPointerPropertiesEXT( g_device.device(), VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, pHostMemory->pData, &hostPointerProps );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkGetMemoryHostPointerPropertiesEXT failed" );
+			return false;
+		}
+
+		if ( pHostMemory->size < memRequirements.size )
+		{
+			vk_log.errorf( "host memory too small for image (%zu < %zu)", pHostMemory->size, (size_t)memRequirements.size );
+			return false;
+		}
+
+		uint32_t memoryTypeBits = memRequirements.memoryTypeBits & hostPointerProps.memoryTypeBits;
+		int memoryType = g_device.findMemoryType( properties, memoryTypeBits );
+		if ( memoryType < 0 )
+			memoryType = g_device.findMemoryType( VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memoryTypeBits );
+		if ( memoryType < 0 )
+		{
+			vk_log.errorf( "no memory type to import host memory with" );
+			return false;
+		}
+
+		VkImportMemoryHostPointerInfoEXT importHostPointerInfo = {
+			.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+			.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+			.pHostPointer = pHostMemory->pData,
+		};
+		allocInfo.pNext = &importHostPointerInfo;
+		allocInfo.allocationSize = pHostMemory->size;
+		allocInfo.memoryTypeIndex = uint32_t( memoryType );
+
+		res = g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &memoryHandle );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkAllocateMemory failed" );
+			return false;
+		}
+
+		m_vkImageMemory = memoryHandle;
+	}
+	else if ( pExistingImageToReuseMemory == nullptr )
 	{
 		// Possible pNexts
 		VkImportMemoryFdInfoKHR importMemoryInfo = {};
@@ -2509,6 +3309,11 @@ bool CVulkanTexture::BInit( uint32_t width, uint32_t height, uint32_t depth, uin
 		{
 			m_pMappedData = pExistingImageToReuseMemory->m_pMappedData;
 		}
+		else if (pHostMemory)
+		{
+			// Already mapped, it's their memory.
+			m_pMappedData = (uint8_t*)pHostMemory->pData;
+		}
 		else
 		{
 			void *pData = nullptr;
@@ -2613,7 +3418,10 @@ bool CVulkanTexture::IsInUse()
 	return GetRefCount() != 0;
 }
 
+static std::atomic<uint64_t> s_ulNextTextureUniqueId{ 1 };
+
 CVulkanTexture::CVulkanTexture( void )
+	: m_ulUniqueId{ s_ulNextTextureUniqueId++ }
 {
 }
 
@@ -2621,7 +3429,7 @@ CVulkanTexture::~CVulkanTexture( void )
 {
 	wlr_dmabuf_attributes_finish( &m_dmabuf );
 
-	if ( m_pMappedData != nullptr && m_vkImageMemory )
+	if ( m_pMappedData != nullptr && m_vkImageMemory && !m_bHostMemory )
 	{
 		g_device.vk.UnmapMemory( g_device.device(), m_vkImageMemory );
 		m_pMappedData = nullptr;
@@ -3004,12 +3812,16 @@ gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t heig
 	return texture;
 }
 
-void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data)
+// Records the LUT upload and returns its sequence number without waiting on it.
+// The upload buffer region isn't handed out again before every submission up to
+// and including this one has completed.
+uint64_t vulkan_upload_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data)
 {
 	size_t lut1d_size = lut1d->width() * sizeof(uint16_t) * 4;
 	size_t lut3d_size = lut3d->width() * lut3d->height() * lut3d->depth() * sizeof(uint16_t) * 4;
 
 	void* base_dst = g_device.uploadBufferData(lut1d_size + lut3d_size);
+	s_ulLutGeneration++;
 
 	void* lut1d_dst = base_dst;
 	void *lut3d_dst = ((uint8_t*)base_dst) + lut1d_size;
@@ -3017,12 +3829,22 @@ void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamesc
 	memcpy(lut3d_dst, lut3d_data, lut3d_size);
 
 	auto cmdBuffer = g_device.commandBuffer();
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, lut1d);
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), lut1d_size, 0, lut3d);
-	g_device.submit(std::move(cmdBuffer));
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(lut1d_dst), 0, lut1d);
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(lut3d_dst), 0, lut3d);
+	return g_device.submit(std::move(cmdBuffer));
+}
+
+void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data)
+{
+	vulkan_upload_luts(lut1d, lut3d, lut1d_data, lut3d_data);
 	g_device.waitIdle(); // TODO: Sync this better
 }
 
+bool vulkan_is_sequence_complete( uint64_t ulSeqNo )
+{
+	return g_device.isSequenceComplete( ulSeqNo );
+}
+
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture()
 {
 	return g_output.temporaryHackyBlankImage.get();
@@ -3049,7 +3871,7 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_flat_texture( uint32_t width,
 	}
 
 	auto cmdBuffer = g_device.commandBuffer();
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, texture.get());
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(dst), 0, texture.get());
 	g_device.submit(std::move(cmdBuffer));
 	g_device.waitIdle();
 
@@ -3294,6 +4116,8 @@ bool vulkan_remake_output_images()
 	g_device.waitIdle();
 
 	pOutput->nOutImage = 0;
+	s_OutputDamageTracker.Invalidate();
+	s_oLastCompositeScene = std::nullopt;
 
 	// Delete screenshot image to be remade if needed
 	for (auto& pScreenshotImage : pOutput->pScreenshotImages)
@@ -3515,11 +4339,12 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_bits( uint32_t wi
 		return nullptr;
 
 	size_t size = width * height * DRMFormatGetBPP(drmFormat);
-	memcpy( g_device.uploadBufferData(size), bits, size );
+	void *dst = g_device.uploadBufferData(size);
+	memcpy( dst, bits, size );
 
 	auto cmdBuffer = g_device.commandBuffer();
 
-	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), 0, 0, pTex.get());
+	cmdBuffer->copyBufferToImage(g_device.uploadBuffer(), g_device.uploadBufferOffset(dst), 0, pTex.get());
 	// TODO: Sync this copyBufferToImage.
 
 	g_device.submit(std::move(cmdBuffer));
@@ -3530,9 +4355,17 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_bits( uint32_t wi
 
 static uint32_t s_frameId = 0;
 
+static void vulkan_collect_shm_pool_imports();
+
 void vulkan_garbage_collect( void )
 {
 	g_device.garbageCollect();
+	vulkan_collect_shm_pool_imports();
+}
+
+void vulkan_save_pipeline_cache( void )
+{
+	g_device.savePipelineCache();
 }
 
 gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width, uint32_t height, bool exportable, uint32_t drmFormat, EStreamColorspace colorspace)
@@ -3595,9 +4428,14 @@ struct BlitPushData_t
     float u_itmSdrNits; // unset
     float u_itmTargetNits; // unset
 
+	// Added to gl_GlobalInvocationID, for dispatching over part of the output.
+	uint32_t u_dispatchOffset[2];
+
 	explicit BlitPushData_t(const struct FrameInfo_t *frameInfo)
 	{
 		u_shaderFilter = 0;
+		u_dispatchOffset[0] = 0;
+		u_dispatchOffset[1] = 0;
 
 		for (int i = 0; i < frameInfo->layerCount; i++) {
 			const FrameInfo_t::Layer_t *layer = &frameInfo->layers[i];
@@ -3635,6 +4473,8 @@ struct BlitPushData_t
 	}
 
 	explicit BlitPushData_t(float blit_scale) {
+		u_dispatchOffset[0] = 0;
+		u_dispatchOffset[1] = 0;
 		scale[0] = { blit_scale, blit_scale };
 		offset[0] = { 0.5f, 0.5f };
 		opacity[0] = 1.0f;
@@ -3873,18 +4713,379 @@ extern uint32_t g_reshade_technique_idx;
 
 ReshadeEffectPipeline *g_pLastReshadeEffect = nullptr;
 
-std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pPipewireTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride, bool increment, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer )
+static gamescope::ConVar<bool> cv_composite_damage_tracking{ "composite_damage_tracking", true, "Only recomposite the parts of the output that changed since the output image was last composited to." };
+static gamescope::ConVar<bool> cv_composite_gpu_timing{ "composite_gpu_timing", false, "Measure the GPU time of composites with timestamp queries. See composite_damage_stats." };
+
+struct CompositeDamageStats_t
 {
-	EOTF outputTF = frameInfo->outputEncodingEOTF;
-	if (!frameInfo->applyOutputColorMgmt)
-		outputTF = EOTF_Count; //Disable blending stuff.
+	std::atomic<uint64_t> ulFullComposites = { 0 };
+	std::atomic<uint64_t> ulPartialComposites = { 0 };
+	std::atomic<uint64_t> ulPixelsComposited = { 0 };
+	std::atomic<uint64_t> ulPixelsTotal = { 0 };
+
+	// Only while composite_gpu_timing is on.
+	std::atomic<uint64_t> ulFullTimed = { 0 };
+	std::atomic<uint64_t> ulFullGPUTimeNs = { 0 };
+	std::atomic<uint64_t> ulPartialTimed = { 0 };
+	std::atomic<uint64_t> ulPartialGPUTimeNs = { 0 };
+
+	// Composites that presented the last output image again instead.
+	std::atomic<uint64_t> ulSkippedComposites = { 0 };
+
+	// Layers sampled per tile with composite_tile_masks, out of all of them.
+	std::atomic<uint64_t> ulTileLayersSampled = { 0 };
+	std::atomic<uint64_t> ulTileLayersTotal = { 0 };
+
+	void Reset()
+	{
+		ulFullComposites = 0;
+		ulPartialComposites = 0;
+		ulPixelsComposited = 0;
+		ulPixelsTotal = 0;
+		ulFullTimed = 0;
+		ulFullGPUTimeNs = 0;
+		ulPartialTimed = 0;
+		ulPartialGPUTimeNs = 0;
+		ulSkippedComposites = 0;
+		ulTileLayersSampled = 0;
+		ulTileLayersTotal = 0;
+	}
+};
+static CompositeDamageStats_t s_CompositeDamageStats;
 
-	g_pLastReshadeEffect = nullptr;
-	if (!g_reshade_effect.empty())
+// The last frame composited into the output image ring, and what we need to
+// know about the output to tell if it would still look the same.
+struct CompositeDamageFrame_t
+{
+	CompositeFrameSnapshot_t snapshot;
+	uint32_t uOutputWidth;
+	uint32_t uOutputHeight;
+	uint32_t uCompositeDebug;
+	float flLinearToNits;
+	float flItmSdrNits;
+	float flItmTargetNits;
+	uint64_t ulLutGeneration;
+};
+static std::optional<CompositeDamageFrame_t> s_oLastCompositeDamageFrame;
+
+struct CompositeTimestampSlot_t
+{
+	bool bPending = false;
+	bool bPartial = false;
+	uint64_t ulSequence = 0;
+};
+static std::array<CompositeTimestampSlot_t, CVulkanDevice::k_uCompositeTimestampSlots> s_CompositeTimestampSlots;
+static uint32_t s_uNextCompositeTimestampSlot = 0;
+
+static void vulkan_collect_composite_timestamps()
+{
+	for ( uint32_t i = 0; i < s_CompositeTimestampSlots.size(); i++ )
 	{
-		if (frameInfo->layers[0].tex)
+		CompositeTimestampSlot_t &slot = s_CompositeTimestampSlots[ i ];
+		if ( !slot.bPending || !g_device.isSequenceComplete( slot.ulSequence ) )
+			continue;
+
+		slot.bPending = false;
+
+		uint64_t ulTimestamps[2] = {};
+		VkResult res = g_device.vk.GetQueryPoolResults( g_device.device(), g_device.compositeTimestampPool(), i * 2, 2,
+			sizeof( ulTimestamps ), ulTimestamps, sizeof( uint64_t ), VK_QUERY_RESULT_64_BIT );
+		if ( res != VK_SUCCESS || ulTimestamps[1] < ulTimestamps[0] )
+			continue;
+
+		uint64_t ulTimeNs = uint64_t( ( ulTimestamps[1] - ulTimestamps[0] ) * double( g_device.timestampPeriod() ) );
+		if ( slot.bPartial )
 		{
-			ReshadeEffectKey key
+			s_CompositeDamageStats.ulPartialTimed++;
+			s_CompositeDamageStats.ulPartialGPUTimeNs += ulTimeNs;
+		}
+		else
+		{
+			s_CompositeDamageStats.ulFullTimed++;
+			s_CompositeDamageStats.ulFullGPUTimeNs += ulTimeNs;
+		}
+	}
+}
+
+static gamescope::DamageRect_t CompositeLayerOutputRect( const CompositeLayerSnapshot_t &layer )
+{
+	// Borders and the null texture cover everything.
+	if ( layer.blackBorder || !layer.ulTexId )
+		return gamescope::DamageRect_t{ 0, 0, int32_t( currentOutputWidth ), int32_t( currentOutputHeight ) };
+
+	float flOffsetX = layer.offset.x + 0.5f / layer.scale.x;
+	float flOffsetY = layer.offset.y + 0.5f / layer.scale.y;
+	gamescope::DamageRect_t rTexture{ 0, 0, int32_t( layer.uTexWidth ), int32_t( layer.uTexHeight ) };
+	return gamescope::TextureDamageToOutput( rTexture, flOffsetX, flOffsetY, layer.scale.x, layer.scale.y );
+}
+
+static gamescope::DamageRect_t CompositeLayerOutputRect( const FrameInfo_t *frameInfo, int nLayer )
+{
+	return CompositeLayerOutputRect( SnapshotCompositeLayer( frameInfo->layers[ nLayer ] ) );
+}
+
+// Whether a layer samples and blends the same way in both frames, regardless of
+// what's in its texture.
+static bool CompositeLayerParamsMatch( const CompositeLayerSnapshot_t &a, const CompositeLayerSnapshot_t &b )
+{
+	if ( !a.ulTexId != !b.ulTexId )
+		return false;
+
+	if ( a.ulTexId && ( a.uTexWidth != b.uTexWidth || a.uTexHeight != b.uTexHeight || a.eTexFormat != b.eTexFormat ) )
+		return false;
+
+	return a.offset.x == b.offset.x && a.offset.y == b.offset.y &&
+		   a.scale.x == b.scale.x && a.scale.y == b.scale.y &&
+		   a.opacity == b.opacity &&
+		   a.filter == b.filter &&
+		   a.blackBorder == b.blackBorder &&
+		   a.applyColorMgmt == b.applyColorMgmt &&
+		   a.ctm == b.ctm &&
+		   a.hdr_metadata_blob == b.hdr_metadata_blob &&
+		   a.colorspace == b.colorspace;
+}
+
+// What changed on the output since the last frame we composited into the output ring.
+// Anything but the plain blit path (upscaling, blur) is always fully damaged.
+static gamescope::CDamageRegion CalcCompositeFrameDamage( const struct FrameInfo_t *frameInfo, const CompositeFrameSnapshot_t &snapshot )
+{
+	if ( !s_oLastCompositeDamageFrame )
+		return gamescope::CDamageRegion::Full();
+
+	const CompositeDamageFrame_t &last = *s_oLastCompositeDamageFrame;
+	const CompositeFrameSnapshot_t &lastSnapshot = last.snapshot;
+
+	if ( snapshot.useFSRLayer0 || snapshot.useNISLayer0 || snapshot.blurLayer0 ||
+		 lastSnapshot.useFSRLayer0 || lastSnapshot.useNISLayer0 || lastSnapshot.blurLayer0 )
+		return gamescope::CDamageRegion::Full();
+
+	// The debug markers and heatmaps change every frame, and so can ReShade effects.
+	if ( g_uCompositeDebug || last.uCompositeDebug || g_pLastReshadeEffect )
+		return gamescope::CDamageRegion::Full();
+
+	if ( last.uOutputWidth != currentOutputWidth || last.uOutputHeight != currentOutputHeight ||
+		 last.flLinearToNits != g_flInternalDisplayBrightnessNits ||
+		 last.flItmSdrNits != g_flHDRItmSdrNits || last.flItmTargetNits != g_flHDRItmTargetNits ||
+		 last.ulLutGeneration != s_ulLutGeneration )
+		return gamescope::CDamageRegion::Full();
+
+	if ( lastSnapshot.layerCount != snapshot.layerCount ||
+		 lastSnapshot.applyOutputColorMgmt != snapshot.applyOutputColorMgmt ||
+		 lastSnapshot.outputEncodingEOTF != snapshot.outputEncodingEOTF )
+		return gamescope::CDamageRegion::Full();
+
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		if ( lastSnapshot.ulShaperLutIds[i] != snapshot.ulShaperLutIds[i] || lastSnapshot.ulLut3DIds[i] != snapshot.ulLut3DIds[i] )
+			return gamescope::CDamageRegion::Full();
+	}
+
+	gamescope::CDamageRegion damage;
+	for ( int i = 0; i < snapshot.layerCount; i++ )
+	{
+		const CompositeLayerSnapshot_t &lastLayer = lastSnapshot.layers[i];
+		const CompositeLayerSnapshot_t &layer = snapshot.layers[i];
+
+		// A different window in this slot.
+		if ( lastLayer.zpos != layer.zpos )
+			return gamescope::CDamageRegion::Full();
+
+		if ( !CompositeLayerParamsMatch( lastLayer, layer ) )
+		{
+			damage.Add( CompositeLayerOutputRect( lastLayer ) );
+			damage.Add( CompositeLayerOutputRect( layer ) );
+			continue;
+		}
+
+		if ( layer.commitID && layer.commitID == lastLayer.commitID && layer.ulTexId == lastLayer.ulTexId )
+			continue;
+
+		std::optional<gamescope::DamageRect_t> oTextureDamage;
+		if ( layer.commitID && lastLayer.commitID )
+			oTextureDamage = frameInfo->layers[i].damageHistory.DamageSince( lastLayer.commitID );
+
+		if ( oTextureDamage )
+		{
+			vec2_t offset = frameInfo->layers[i].offsetPixelCenter();
+			damage.Add( gamescope::TextureDamageToOutput( *oTextureDamage, offset.x, offset.y, layer.scale.x, layer.scale.y ) );
+		}
+		else
+		{
+			damage.Add( CompositeLayerOutputRect( layer ) );
+		}
+	}
+
+	damage.Clip( int32_t( currentOutputWidth ), int32_t( currentOutputHeight ) );
+	return damage;
+}
+
+static_assert( gamescope::CCompositeTileMasks::k_nTileSize == VKR_TILE_MASK_SIZE );
+static_assert( gamescope::CCompositeTileMasks::k_uMaxLayers >= k_nMaxLayers );
+
+// Which layers the blit needs to sample for each tile of the output: the ones
+// that are there and not behind something opaque that covers the whole tile.
+static void CalcCompositeTileMasks( const struct FrameInfo_t *frameInfo, gamescope::CCompositeTileMasks *pMasks )
+{
+	const gamescope::DamageRect_t rOutput{ 0, 0, int32_t( currentOutputWidth ), int32_t( currentOutputHeight ) };
+
+	std::array<gamescope::CompositeTileLayer_t, k_nMaxLayers> layers{};
+	for ( int i = 0; i < frameInfo->layerCount; i++ )
+	{
+		const FrameInfo_t::Layer_t &layer = frameInfo->layers[ i ];
+		if ( layer.opacity <= 0.0f )
+			continue;
+
+		layers[ i ].rVisible = CompositeLayerOutputRect( frameInfo, i );
+
+		// Views of formats without alpha always sample alpha as 1.
+		// Formats we don't know about might not be set up that way.
+		bool bOpaque = layer.tex && layer.opacity >= 1.0f && !layer.hasAlpha() &&
+			DRMFormatToVulkan( layer.tex->drmFormat(), false ) != VK_FORMAT_UNDEFINED;
+		if ( !bOpaque )
+			continue;
+
+		// Outside of the texture, borders are opaque black.
+		if ( layer.blackBorder )
+		{
+			layers[ i ].rOpaque = rOutput;
+			continue;
+		}
+
+		// Pixels that sample inside of the texture, less a pixel for rounding.
+		vec2_t offset = layer.offsetPixelCenter();
+		layers[ i ].rOpaque = gamescope::DamageRect_t
+		{
+			int32_t( std::ceil( -offset.x ) ) + 1,
+			int32_t( std::ceil( -offset.y ) ) + 1,
+			int32_t( std::floor( layer.tex->width() / layer.scale.x - offset.x ) ) - 1,
+			int32_t( std::floor( layer.tex->height() / layer.scale.y - offset.y ) ) - 1,
+		};
+	}
+
+	pMasks->Classify( std::span<const gamescope::CompositeTileLayer_t>( layers.data(), frameInfo->layerCount ), rOutput.nX2, rOutput.nY2 );
+}
+
+static gamescope::ConVar<bool> cv_composite_skip_unchanged{ "composite_skip_unchanged", true, "Present the last composite again instead of recompositing when nothing in the scene changed." };
+
+// FNV-1a over the values that go into a composite.
+class CCompositeFingerprint
+{
+public:
+	template <typename T>
+	void Add( const T &value )
+	{
+		static_assert( std::is_trivially_copyable_v<T> );
+
+		const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( &value );
+		for ( size_t i = 0; i < sizeof( T ); i++ )
+		{
+			m_ulHash ^= pBytes[i];
+			m_ulHash *= 0x100000001b3ull;
+		}
+	}
+
+	uint64_t Get() const { return m_ulHash; }
+
+private:
+	uint64_t m_ulHash = 0xcbf29ce484222325ull;
+};
+
+// Everything that decides what vulkan_composite draws, other than the debug
+// flags and ReShade, which are never skipped. Textures are told apart by their
+// address and the commit they came from, as that's when their contents change.
+static uint64_t CalcCompositeSceneFingerprint( const struct FrameInfo_t *frameInfo )
+{
+	CCompositeFingerprint fingerprint;
+
+	fingerprint.Add( currentOutputWidth );
+	fingerprint.Add( currentOutputHeight );
+	fingerprint.Add( g_flInternalDisplayBrightnessNits );
+	fingerprint.Add( g_flHDRItmSdrNits );
+	fingerprint.Add( g_flHDRItmTargetNits );
+	fingerprint.Add( g_upscaleFilterSharpness );
+	fingerprint.Add( s_ulLutGeneration );
+
+	fingerprint.Add( frameInfo->useFSRLayer0 );
+	fingerprint.Add( frameInfo->useNISLayer0 );
+	fingerprint.Add( frameInfo->blurLayer0 );
+	fingerprint.Add( frameInfo->blurRadius );
+	fingerprint.Add( frameInfo->applyOutputColorMgmt );
+	fingerprint.Add( frameInfo->outputEncodingEOTF );
+
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		fingerprint.Add( frameInfo->shaperLut[i] ? frameInfo->shaperLut[i]->uniqueId() : 0 );
+		fingerprint.Add( frameInfo->lut3D[i] ? frameInfo->lut3D[i]->uniqueId() : 0 );
+	}
+
+	fingerprint.Add( frameInfo->layerCount );
+	for ( int i = 0; i < frameInfo->layerCount; i++ )
+	{
+		const FrameInfo_t::Layer_t &layer = frameInfo->layers[i];
+
+		fingerprint.Add( layer.tex ? layer.tex->uniqueId() : 0 );
+		fingerprint.Add( layer.commitID );
+		fingerprint.Add( layer.zpos );
+		fingerprint.Add( layer.offset.x );
+		fingerprint.Add( layer.offset.y );
+		fingerprint.Add( layer.scale.x );
+		fingerprint.Add( layer.scale.y );
+		fingerprint.Add( layer.opacity );
+		fingerprint.Add( layer.filter );
+		fingerprint.Add( layer.blackBorder );
+		fingerprint.Add( layer.applyColorMgmt );
+		fingerprint.Add( layer.ctm.get() );
+		fingerprint.Add( layer.hdr_metadata_blob.get() );
+		fingerprint.Add( layer.colorspace );
+	}
+
+	return fingerprint.Get();
+}
+
+static gamescope::ConCommand cc_composite_damage_stats( "composite_damage_stats", "Print how much of the output composites re-rendered, and their GPU time if composite_gpu_timing is on. Args: [reset]",
+[]( std::span<std::string_view> args )
+{
+	if ( args.size() > 1 && args[1] == "reset" )
+	{
+		s_CompositeDamageStats.Reset();
+		return;
+	}
+
+	const CompositeDamageStats_t &stats = s_CompositeDamageStats;
+	uint64_t ulPixelsTotal = stats.ulPixelsTotal;
+	console_log.infof( "Composites: %lu full, %lu partial, %lu skipped as unchanged - %.1f%% of output pixels composited",
+		(unsigned long)stats.ulFullComposites.load(), (unsigned long)stats.ulPartialComposites.load(), (unsigned long)stats.ulSkippedComposites.load(),
+		ulPixelsTotal ? 100.0 * stats.ulPixelsComposited / ulPixelsTotal : 0.0 );
+
+	uint64_t ulFullTimed = stats.ulFullTimed;
+	uint64_t ulPartialTimed = stats.ulPartialTimed;
+	if ( ulFullTimed || ulPartialTimed )
+	{
+		console_log.infof( "GPU time: full %.3f ms avg (%lu timed), partial %.3f ms avg (%lu timed)",
+			ulFullTimed ? stats.ulFullGPUTimeNs / 1'000'000.0 / ulFullTimed : 0.0, (unsigned long)ulFullTimed,
+			ulPartialTimed ? stats.ulPartialGPUTimeNs / 1'000'000.0 / ulPartialTimed : 0.0, (unsigned long)ulPartialTimed );
+	}
+
+	uint64_t ulTileLayersTotal = stats.ulTileLayersTotal;
+	if ( ulTileLayersTotal )
+	{
+		console_log.infof( "Tile masks: %.1f%% of layers sampled per tile",
+			100.0 * stats.ulTileLayersSampled / ulTileLayersTotal );
+	}
+});
+
+std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pPipewireTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride, bool increment, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer )
+{
+	EOTF outputTF = frameInfo->outputEncodingEOTF;
+	if (!frameInfo->applyOutputColorMgmt)
+		outputTF = EOTF_Count; //Disable blending stuff.
+
+	g_pLastReshadeEffect = nullptr;
+	if (!g_reshade_effect.empty())
+	{
+		if (frameInfo->layers[0].tex)
+		{
+			ReshadeEffectKey key
 			{
 				.path             = g_reshade_effect,
 				.bufferWidth      = frameInfo->layers[0].tex->width(),
@@ -3909,14 +5110,100 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 		g_reshadeManager.clear();
 	}
 
+	// Only full composites into the output image ring can be presented again.
+	std::optional<uint64_t> oSceneFingerprint;
+	if ( cv_composite_skip_unchanged && !pOutputOverride && !pPipewireTexture && !pInCommandBuffer && increment && !partial &&
+		 !GetBackend()->UsesVulkanSwapchain() && !g_pLastReshadeEffect && !g_uCompositeDebug )
+	{
+		oSceneFingerprint = CalcCompositeSceneFingerprint( frameInfo );
+
+		// The last output image is still the one vulkan_get_last_output_image
+		// returns, as long as we don't move on to the next.
+		if ( s_oLastCompositeScene && s_oLastCompositeScene->ulFingerprint == *oSceneFingerprint )
+		{
+			s_CompositeDamageStats.ulSkippedComposites++;
+			return s_oLastCompositeScene->ulSequence;
+		}
+	}
+
 	gamescope::Rc<CVulkanTexture> compositeImage;
 	if ( pOutputOverride )
 		compositeImage = pOutputOverride;
 	else
 		compositeImage = partial ? g_output.outputImagesPartialOverlay[ g_output.nOutImage ] : g_output.outputImages[ g_output.nOutImage ];
 
+	// Only the output image ring keeps its contents around between composites,
+	// and only if nothing else touches them in between.
+	const bool bTrackDamage = !pOutputOverride &&
+		!GetBackend()->UsesVulkanSwapchain() &&
+		GetBackend()->GetPresentLayout() == VK_IMAGE_LAYOUT_GENERAL &&
+		g_output.nOutImage < gamescope::COutputDamageTracker::k_uMaxImages;
+
+	gamescope::CDamageRegion damage = gamescope::CDamageRegion::Full();
+	if ( bTrackDamage )
+	{
+		if ( partial || !cv_composite_damage_tracking )
+		{
+			// The partial overlay images alias the regular ones.
+			s_OutputDamageTracker.InvalidateImage( g_output.nOutImage );
+		}
+		else
+		{
+			CompositeFrameSnapshot_t snapshot = SnapshotCompositeFrame( frameInfo );
+			damage = s_OutputDamageTracker.Advance( g_output.nOutImage, CalcCompositeFrameDamage( frameInfo, snapshot ) );
+
+			s_oLastCompositeDamageFrame = CompositeDamageFrame_t
+			{
+				.snapshot = std::move( snapshot ),
+				.uOutputWidth = currentOutputWidth,
+				.uOutputHeight = currentOutputHeight,
+				.uCompositeDebug = g_uCompositeDebug,
+				.flLinearToNits = g_flInternalDisplayBrightnessNits,
+				.flItmSdrNits = g_flHDRItmSdrNits,
+				.flItmTargetNits = g_flHDRItmTargetNits,
+				.ulLutGeneration = s_ulLutGeneration,
+			};
+		}
+	}
+
+	if ( !cv_composite_damage_tracking )
+		s_oLastCompositeDamageFrame = std::nullopt;
+
+	// The partial dispatch only exists for the plain blit path.
+	const bool bPartialDispatch = !damage.IsFull() && !frameInfo->useFSRLayer0 && !frameInfo->useNISLayer0 && !frameInfo->blurLayer0;
+
+	const uint64_t ulOutputPixels = uint64_t( currentOutputWidth ) * currentOutputHeight;
+	s_CompositeDamageStats.ulPixelsTotal += ulOutputPixels;
+	if ( bPartialDispatch )
+	{
+		s_CompositeDamageStats.ulPartialComposites++;
+		s_CompositeDamageStats.ulPixelsComposited += uint64_t( damage.Area() );
+	}
+	else
+	{
+		s_CompositeDamageStats.ulFullComposites++;
+		s_CompositeDamageStats.ulPixelsComposited += ulOutputPixels;
+	}
+
 	auto cmdBuffer = pInCommandBuffer ? std::move( pInCommandBuffer ) : g_device.commandBuffer();
 
+	std::optional<uint32_t> oTimestampSlot;
+	if ( cv_composite_gpu_timing && g_device.compositeTimestampPool() != VK_NULL_HANDLE )
+	{
+		vulkan_collect_composite_timestamps();
+
+		// Skip timing this one rather than wait if we ran out of slots.
+		uint32_t uSlot = s_uNextCompositeTimestampSlot;
+		if ( !s_CompositeTimestampSlots[ uSlot ].bPending )
+		{
+			s_uNextCompositeTimestampSlot = ( uSlot + 1 ) % s_CompositeTimestampSlots.size();
+			oTimestampSlot = uSlot;
+
+			cmdBuffer->resetQueries( g_device.compositeTimestampPool(), uSlot * 2, 2 );
+			cmdBuffer->writeTimestamp( VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, g_device.compositeTimestampPool(), uSlot * 2 );
+		}
+	}
+
 	for (uint32_t i = 0; i < EOTF_Count; i++)
 		cmdBuffer->bindColorMgmtLuts(i, frameInfo->shaperLut[i], frameInfo->lut3D[i]);
 
@@ -4039,16 +5326,54 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 	}
 	else
 	{
-		cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF ));
+		const bool bTileMasks = cv_composite_tile_masks;
+
+		cmdBuffer->bindPipeline( g_device.pipeline(SHADER_TYPE_BLIT, frameInfo->layerCount, frameInfo->ycbcrMask(), 0u, frameInfo->colorspaceMask(), outputTF, false, bTileMasks ));
 		bind_all_layers(cmdBuffer.get(), frameInfo);
-		cmdBuffer->bindTarget(compositeImage);
-		cmdBuffer->uploadConstants<BlitPushData_t>(frameInfo);
+
+		if ( bTileMasks )
+		{
+			static gamescope::CCompositeTileMasks s_TileMasks;
+			CalcCompositeTileMasks( frameInfo, &s_TileMasks );
+			cmdBuffer->uploadTileMasks( s_TileMasks.Buffer() );
+
+			s_CompositeDamageStats.ulTileLayersSampled += s_TileMasks.LayerTiles();
+			s_CompositeDamageStats.ulTileLayersTotal += s_TileMasks.TotalLayerTiles();
+		}
+
+		BlitPushData_t pushData( frameInfo );
 
 		const int pixelsPerGroup = 8;
 
-		cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		if ( bPartialDispatch )
+		{
+			// Always touch a tile, even if nothing changed, so the image still
+			// goes through the usual acquire and release.
+			if ( damage.IsEmpty() )
+				damage.Add( gamescope::DamageRect_t{ 0, 0, 1, 1 } );
+
+			cmdBuffer->bindTargetPreserved(compositeImage);
+			for ( const gamescope::DamageRect_t &rect : damage.Rects() )
+			{
+				pushData.u_dispatchOffset[0] = uint32_t( rect.nX1 );
+				pushData.u_dispatchOffset[1] = uint32_t( rect.nY1 );
+				cmdBuffer->uploadConstants<BlitPushData_t>(pushData);
+
+				cmdBuffer->dispatch(div_roundup(rect.nX2 - rect.nX1, pixelsPerGroup), div_roundup(rect.nY2 - rect.nY1, pixelsPerGroup));
+			}
+		}
+		else
+		{
+			cmdBuffer->bindTarget(compositeImage);
+			cmdBuffer->uploadConstants<BlitPushData_t>(pushData);
+
+			cmdBuffer->dispatch(div_roundup(currentOutputWidth, pixelsPerGroup), div_roundup(currentOutputHeight, pixelsPerGroup));
+		}
 	}
 
+	if ( oTimestampSlot )
+		cmdBuffer->writeTimestamp( VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, g_device.compositeTimestampPool(), *oTimestampSlot * 2 + 1 );
+
 	if ( pPipewireTexture != nullptr )
 	{
 
@@ -4098,11 +5423,35 @@ std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamesco
 
 	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
 
+	if ( oTimestampSlot )
+	{
+		s_CompositeTimestampSlots[ *oTimestampSlot ] = CompositeTimestampSlot_t
+		{
+			.bPending = true,
+			.bPartial = bPartialDispatch,
+			.ulSequence = sequence,
+		};
+	}
+
 	if ( !GetBackend()->UsesVulkanSwapchain() && pOutputOverride == nullptr && increment )
 	{
 		g_output.nOutImage = ( g_output.nOutImage + 1 ) % 3;
 	}
 
+	if ( oSceneFingerprint )
+	{
+		s_oLastCompositeScene = CompositeScene_t
+		{
+			.ulFingerprint = *oSceneFingerprint,
+			.ulSequence = sequence,
+			.snapshot = SnapshotCompositeFrame( frameInfo ),
+		};
+	}
+	else if ( pOutputOverride == nullptr )
+	{
+		s_oLastCompositeScene = std::nullopt;
+	}
+
 	return sequence;
 }
 
@@ -4210,40 +5559,519 @@ struct wlr_renderer *vulkan_renderer_create( void )
 	return &renderer->base;
 }
 
-gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struct wlr_buffer *buf, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb )
+static gamescope::ConVar<uint32_t> cv_shm_upload_ring_size_mb{ "shm_upload_ring_size_mb", 64, "Size of the staging ring used to upload wl_shm buffers, in MiB. Buffers that don't fit take a slower path that waits for the upload." };
+
+// Staging memory for wl_shm (and other data ptr) buffers.
+//
+// One persistently mapped buffer used as a ring. Every upload takes the next
+// chunk and remembers the submission that reads from it. Chunks are free again
+// once the GPU is past that submission, so we only ever wait on the GPU here
+// if the whole ring is still in flight.
+class CShmStagingRing
 {
+public:
+	// Returns the offset of a chunk of ulSize bytes, or nullopt if it can never fit.
+	std::optional<VkDeviceSize> Alloc( VkDeviceSize ulSize )
+	{
+		Reclaim();
 
-	struct wlr_dmabuf_attributes dmabuf = {0};
-	if ( wlr_buffer_get_dmabuf( buf, &dmabuf ) )
+		if ( !BEnsureBuffer() )
+			return std::nullopt;
+
+		ulSize = align( ulSize, k_ulAlignment );
+		if ( ulSize > m_ulSize )
+			return std::nullopt;
+
+		for ( ;; )
+		{
+			if ( m_InFlight.empty() )
+				m_ulHead = 0;
+
+			if ( std::optional<VkDeviceSize> oulOffset = TryPlace( ulSize ) )
+			{
+				m_ulHead = *oulOffset + ulSize;
+				return oulOffset;
+			}
+
+			// Everything in front of us is still being copied from.
+			g_device.wait( m_InFlight.front().ulSequence );
+			Reclaim();
+		}
+	}
+
+	// The chunk at ulOffset is read by the submission ulSequence.
+	void Track( VkDeviceSize ulOffset, uint64_t ulSequence )
 	{
-		return vulkan_create_texture_from_dmabuf( &dmabuf, pBackendFb );
+		m_InFlight.push_back( InFlight_t{ ulOffset, ulSequence } );
 	}
 
-	VkResult result;
+	VkBuffer buffer() const { return m_buffer; }
+	uint8_t *data() const { return m_pData; }
 
-	void *src;
-	uint32_t drmFormat;
-	size_t stride;
-	if ( !wlr_buffer_begin_data_ptr_access( buf, WLR_BUFFER_DATA_PTR_ACCESS_READ, &src, &drmFormat, &stride ) )
+private:
+	static constexpr VkDeviceSize k_ulAlignment = 256;
+
+	struct InFlight_t
 	{
-		return nullptr;
+		VkDeviceSize ulOffset;
+		uint64_t ulSequence;
+	};
+
+	std::optional<VkDeviceSize> TryPlace( VkDeviceSize ulSize ) const
+	{
+		if ( m_InFlight.empty() )
+			return VkDeviceSize( 0 );
+
+		// Strictly less than the tail, head == tail would look empty.
+		const VkDeviceSize ulTail = m_InFlight.front().ulOffset;
+		if ( m_ulHead >= ulTail )
+		{
+			if ( m_ulHead + ulSize <= m_ulSize )
+				return m_ulHead;
+			if ( ulSize < ulTail )
+				return VkDeviceSize( 0 );
+		}
+		else if ( m_ulHead + ulSize < ulTail )
+		{
+			return m_ulHead;
+		}
+
+		return std::nullopt;
 	}
 
-	uint32_t width = buf->width;
-	uint32_t height = buf->height;
+	void Reclaim()
+	{
+		while ( !m_InFlight.empty() && g_device.isSequenceComplete( m_InFlight.front().ulSequence ) )
+			m_InFlight.pop_front();
+	}
+
+	bool BEnsureBuffer()
+	{
+		const VkDeviceSize ulWantedSize = VkDeviceSize( std::max<uint32_t>( cv_shm_upload_ring_size_mb, 1u ) ) * 1024 * 1024;
+		if ( m_buffer != VK_NULL_HANDLE && ( m_ulSize == ulWantedSize || !m_InFlight.empty() ) )
+			return true;
+
+		Destroy();
+
+		VkBufferCreateInfo bufferCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.size = ulWantedSize,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		};
+		VkResult result = g_device.vk.CreateBuffer( g_device.device(), &bufferCreateInfo, nullptr, &m_buffer );
+		if ( result != VK_SUCCESS )
+		{
+			vk_errorf( result, "vkCreateBuffer failed" );
+			m_buffer = VK_NULL_HANDLE;
+			return false;
+		}
+
+		VkMemoryRequirements memRequirements;
+		g_device.vk.GetBufferMemoryRequirements( g_device.device(), m_buffer, &memRequirements );
+
+		uint32_t memTypeIndex = g_device.findMemoryType( VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits );
+		if ( memTypeIndex == ~0u )
+		{
+			vk_log.errorf( "findMemoryType failed" );
+			Destroy();
+			return false;
+		}
+
+		VkMemoryAllocateInfo allocInfo = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = memRequirements.size,
+			.memoryTypeIndex = memTypeIndex,
+		};
+		result = g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &m_memory );
+		if ( result != VK_SUCCESS )
+		{
+			vk_errorf( result, "vkAllocateMemory failed" );
+			m_memory = VK_NULL_HANDLE;
+			Destroy();
+			return false;
+		}
+
+		result = g_device.vk.BindBufferMemory( g_device.device(), m_buffer, m_memory, 0 );
+		if ( result == VK_SUCCESS )
+			result = g_device.vk.MapMemory( g_device.device(), m_memory, 0, VK_WHOLE_SIZE, 0, (void **)&m_pData );
+		if ( result != VK_SUCCESS )
+		{
+			vk_errorf( result, "Failed to bind/map the SHM staging ring" );
+			m_pData = nullptr;
+			Destroy();
+			return false;
+		}
+
+		m_ulSize = ulWantedSize;
+		m_ulHead = 0;
+		return true;
+	}
+
+	void Destroy()
+	{
+		if ( m_pData )
+			g_device.vk.UnmapMemory( g_device.device(), m_memory );
+		if ( m_buffer != VK_NULL_HANDLE )
+			g_device.vk.DestroyBuffer( g_device.device(), m_buffer, nullptr );
+		if ( m_memory != VK_NULL_HANDLE )
+			g_device.vk.FreeMemory( g_device.device(), m_memory, nullptr );
+
+		m_pData = nullptr;
+		m_buffer = VK_NULL_HANDLE;
+		m_memory = VK_NULL_HANDLE;
+		m_ulSize = 0;
+		m_ulHead = 0;
+	}
+
+	VkBuffer m_buffer = VK_NULL_HANDLE;
+	VkDeviceMemory m_memory = VK_NULL_HANDLE;
+	uint8_t *m_pData = nullptr;
+	VkDeviceSize m_ulSize = 0;
+	VkDeviceSize m_ulHead = 0;
+
+	std::deque<InFlight_t> m_InFlight;
+};
+
+static CShmStagingRing s_ShmStagingRing;
+
+// Signalled by every SHM upload, commits wait on it like they would on a client's acquire point.
+static std::shared_ptr<gamescope::CTimeline> s_pShmUploadTimeline;
+static uint64_t s_ulShmUploadPoint = 0;
+
+// Bytes copied out of SHM buffers since the last vulkan_take_shm_upload_bytes.
+static uint64_t s_ulShmUploadBytes = 0;
+
+static gamescope::ConVar<bool> cv_shm_host_import{ "shm_host_import", true, "Copy wl_shm buffers straight out of the client's pool, imported with VK_EXT_external_memory_host, instead of through the staging ring." };
+
+// wl_shm pools imported as VkBuffers, so the GPU can copy out of them directly.
+//
+// We map the pool's fd ourselves rather than using the compositor's mapping,
+// so the imported range stays valid for as long as the GPU may read from it,
+// even if the client destroys the pool or shrinks its own mapping.
+class CShmPoolImportCache
+{
+public:
+	struct Import_t
+	{
+		dev_t dev = 0;
+		ino_t ino = 0;
+		bool bFailed = false; // Don't try this pool again.
+		// Keeps a failed pool's inode from being reused by an unrelated one while we
+		// remember it, imports have pMapping doing that for them.
+		int nFailedFd = -1;
+
+		void *pMapping = nullptr;
+		size_t zSize = 0;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+
+		uint64_t ulLastUseSequence = 0;
+		uint64_t ulLastUseTime = 0;
+	};
+
+	// Returns the import of the pool behind nFd, covering at least its first zNeeded bytes.
+	Import_t *Get( int nFd, size_t zNeeded )
+	{
+		Collect();
+
+		struct stat poolStat;
+		if ( fstat( nFd, &poolStat ) != 0 )
+			return nullptr;
+
+		// Only import whole alignment units that are backed by the file.
+		const size_t zAlignment = g_device.hostPointerAlignment();
+		const size_t zImportSize = size_t( poolStat.st_size ) & ~( zAlignment - 1 );
+
+		auto iter = std::find_if( m_Imports.begin(), m_Imports.end(), [&]( const std::unique_ptr<Import_t> &pImport )
+		{
+			return pImport->dev == poolStat.st_dev && pImport->ino == poolStat.st_ino;
+		});
+
+		if ( iter != m_Imports.end() )
+		{
+			Import_t *pImport = iter->get();
+			if ( pImport->bFailed )
+				return nullptr;
+
+			if ( pImport->zSize >= zNeeded )
+			{
+				pImport->ulLastUseTime = get_time_in_nanos();
+				return pImport;
+			}
+
+			// The buffer ends in the pool's last, partial alignment unit. A new
+			// import couldn't cover it either, so keep this one for the others.
+			if ( zImportSize < zNeeded )
+				return nullptr;
+
+			// The client grew the pool, import it again.
+			Retire( iter );
+		}
+
+		// Too small is usually just a pool that'll grow, don't give up on it
+		// for that or make room for it.
+		if ( zImportSize < zNeeded )
+			return nullptr;
+
+		if ( m_Imports.size() >= k_nMaxImports )
+		{
+			Retire( std::min_element( m_Imports.begin(), m_Imports.end(), []( const std::unique_ptr<Import_t> &a, const std::unique_ptr<Import_t> &b )
+			{
+				return a->ulLastUseTime < b->ulLastUseTime;
+			}));
+		}
+
+		std::unique_ptr<Import_t> pImport = std::make_unique<Import_t>();
+		pImport->dev = poolStat.st_dev;
+		pImport->ino = poolStat.st_ino;
+		pImport->ulLastUseTime = get_time_in_nanos();
+
+		if ( !BImport( nFd, zImportSize, pImport.get() ) )
+		{
+			pImport->bFailed = true;
+			pImport->nFailedFd = fcntl( nFd, F_DUPFD_CLOEXEC, 0 );
+			if ( pImport->nFailedFd < 0 )
+				return nullptr;
+		}
+
+		m_Imports.emplace_back( std::move( pImport ) );
+		return m_Imports.back()->bFailed ? nullptr : m_Imports.back().get();
+	}
+
+	void Use( Import_t *pImport, uint64_t ulSequence )
+	{
+		pImport->ulLastUseSequence = ulSequence;
+	}
+
+	// Drops imports nobody used in a while, and frees retired ones the GPU is done with.
+	// Runs every frame too, so a pool that stopped being committed (eg. its client
+	// destroyed it) doesn't stay mapped until the next SHM upload.
+	void Collect()
+	{
+		const uint64_t ulNow = get_time_in_nanos();
+		for ( auto iter = m_Imports.begin(); iter != m_Imports.end(); )
+		{
+			if ( ulNow - (*iter)->ulLastUseTime > k_ulIdleTimeout )
+			{
+				m_Retired.emplace_back( std::move( *iter ) );
+				iter = m_Imports.erase( iter );
+			}
+			else
+			{
+				iter++;
+			}
+		}
+
+		std::erase_if( m_Retired, [this]( std::unique_ptr<Import_t> &pImport )
+		{
+			if ( !g_device.isSequenceComplete( pImport->ulLastUseSequence ) )
+				return false;
+
+			Destroy( *pImport );
+			return true;
+		});
+	}
+
+private:
+	static constexpr size_t k_nMaxImports = 8;
+	static constexpr uint64_t k_ulIdleTimeout = 5'000'000'000ul;
+
+	bool BImport( int nFd, size_t zSize, Import_t *pImport )
+	{
+		// Same protection as libwayland's own mapping of the pool, some drivers can't pin read-only pages.
+		void *pMapping = mmap( nullptr, zSize, PROT_READ | PROT_WRITE, MAP_SHARED, nFd, 0 );
+		if ( pMapping == MAP_FAILED )
+			return false;
+
+		pImport->pMapping = pMapping;
+		pImport->zSize = zSize;
+
+		VkMemoryHostPointerPropertiesEXT hostPointerProps = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+		};
+		VkResult res = g_device.vk.GetMemoryHostPointerPropertiesEXT( g_device.device(), VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, pMapping, &hostPointerProps );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkGetMemoryHostPointerPropertiesEXT failed" );
+			Destroy( *pImport );
+			return false;
+		}
+
+		VkExternalMemoryBufferCreateInfo externalMemoryBufferInfo = {
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+		};
+		VkBufferCreateInfo bufferCreateInfo = {
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = &externalMemoryBufferInfo,
+			.size = zSize,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		};
+		res = g_device.vk.CreateBuffer( g_device.device(), &bufferCreateInfo, nullptr, &pImport->buffer );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkCreateBuffer failed" );
+			pImport->buffer = VK_NULL_HANDLE;
+			Destroy( *pImport );
+			return false;
+		}
+
+		VkMemoryRequirements memRequirements;
+		g_device.vk.GetBufferMemoryRequirements( g_device.device(), pImport->buffer, &memRequirements );
+
+		int memoryType = g_device.findMemoryType( VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits & hostPointerProps.memoryTypeBits );
+		if ( memoryType < 0 )
+		{
+			vk_log.errorf( "no memory type to import wl_shm pool with" );
+			Destroy( *pImport );
+			return false;
+		}
+
+		VkImportMemoryHostPointerInfoEXT importHostPointerInfo = {
+			.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+			.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+			.pHostPointer = pMapping,
+		};
+		VkMemoryAllocateInfo allocInfo = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = &importHostPointerInfo,
+			.allocationSize = zSize,
+			.memoryTypeIndex = uint32_t( memoryType ),
+		};
+		res = g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &pImport->memory );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkAllocateMemory failed" );
+			pImport->memory = VK_NULL_HANDLE;
+			Destroy( *pImport );
+			return false;
+		}
+
+		res = g_device.vk.BindBufferMemory( g_device.device(), pImport->buffer, pImport->memory, 0 );
+		if ( res != VK_SUCCESS )
+		{
+			vk_errorf( res, "vkBindBufferMemory failed" );
+			Destroy( *pImport );
+			return false;
+		}
+
+		return true;
+	}
+
+	void Retire( std::vector<std::unique_ptr<Import_t>>::iterator iter )
+	{
+		m_Retired.emplace_back( std::move( *iter ) );
+		m_Imports.erase( iter );
+	}
+
+	void Destroy( Import_t &import )
+	{
+		if ( import.buffer != VK_NULL_HANDLE )
+			g_device.vk.DestroyBuffer( g_device.device(), import.buffer, nullptr );
+		if ( import.memory != VK_NULL_HANDLE )
+			g_device.vk.FreeMemory( g_device.device(), import.memory, nullptr );
+		if ( import.pMapping )
+			munmap( import.pMapping, import.zSize );
+		if ( import.nFailedFd >= 0 )
+			close( import.nFailedFd );
+
+		import.buffer = VK_NULL_HANDLE;
+		import.memory = VK_NULL_HANDLE;
+		import.pMapping = nullptr;
+		import.zSize = 0;
+		import.nFailedFd = -1;
+	}
+
+	std::vector<std::unique_ptr<Import_t>> m_Imports;
+	std::vector<std::unique_ptr<Import_t>> m_Retired;
+};
+
+static CShmPoolImportCache s_ShmPoolImports;
+
+static void vulkan_collect_shm_pool_imports()
+{
+	s_ShmPoolImports.Collect();
+}
+
+// Copies the damaged rects of a wl_shm buffer (all of it if there are none) into pTex
+// straight out of the client's pool. Returns false if the pool can't be used that way.
+static bool vulkan_upload_shm_host_import( struct wlr_buffer *buf, const gamescope::Rc<CVulkanTexture> &pTex, std::span<const VkRect2D> damage )
+{
+	if ( !cv_shm_host_import || !g_device.supportsHostMemoryImport() )
+		return false;
+
+	if ( !s_pShmUploadTimeline )
+		s_pShmUploadTimeline = gamescope::CTimeline::Create();
+	if ( !s_pShmUploadTimeline )
+		return false;
+
+	struct wlr_shm_attributes shm;
+	if ( !wlr_buffer_get_shm( buf, &shm ) )
+		return false;
+
+	const uint32_t uBytesPerPixel = DRMFormatGetBPP( shm.format );
+	if ( shm.format != pTex->drmFormat() ||
+		 uint32_t( shm.width ) != pTex->width() || uint32_t( shm.height ) != pTex->height() ||
+		 shm.offset < 0 || shm.stride <= 0 ||
+		 shm.stride % uBytesPerPixel != 0 || shm.offset % std::max<uint32_t>( uBytesPerPixel, 4u ) != 0 )
+		return false;
+
+	const size_t zNeeded = size_t( shm.offset ) + size_t( shm.stride ) * size_t( shm.height );
+	CShmPoolImportCache::Import_t *pImport = s_ShmPoolImports.Get( shm.fd, zNeeded );
+	if ( !pImport )
+		return false;
+
+	const VkRect2D fullRect = { { 0, 0 }, { pTex->width(), pTex->height() } };
+	if ( damage.empty() )
+		damage = std::span<const VkRect2D>( &fullRect, 1 );
+
+	std::vector<VkBufferImageCopy> regions;
+	regions.reserve( damage.size() );
+
+	VkDeviceSize ulUploadSize = 0;
+	for ( const VkRect2D &rect : damage )
+	{
+		regions.push_back( VkBufferImageCopy
+		{
+			.bufferOffset = VkDeviceSize( shm.offset ) + VkDeviceSize( rect.offset.y ) * shm.stride + VkDeviceSize( rect.offset.x ) * uBytesPerPixel,
+			.bufferRowLength = uint32_t( shm.stride ) / uBytesPerPixel,
+			.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1 },
+			.imageOffset = { rect.offset.x, rect.offset.y, 0 },
+			.imageExtent = { rect.extent.width, rect.extent.height, 1 },
+		} );
+
+		ulUploadSize += VkDeviceSize( rect.extent.width ) * uBytesPerPixel * rect.extent.height;
+	}
+
+	const uint64_t ulUploadPoint = ++s_ulShmUploadPoint;
+
+	auto cmdBuffer = g_device.commandBuffer();
+	cmdBuffer->copyBufferToImage( pImport->buffer, regions, pTex );
+	cmdBuffer->AddSignal( s_pShmUploadTimeline->ToVkSemaphore(), ulUploadPoint );
+	const uint64_t ulSequence = g_device.submit( std::move( cmdBuffer ) );
+
+	s_ShmPoolImports.Use( pImport, ulSequence );
+	pTex->setUploadAcquirePoint( std::make_shared<gamescope::CAcquireTimelinePoint>( s_pShmUploadTimeline, ulUploadPoint ) );
+
+	s_ulShmUploadBytes += ulUploadSize;
+
+	return true;
+}
+
+// Old path for buffers bigger than the whole ring: a one-off staging buffer, waited on right away.
+static bool vulkan_upload_shm_oneoff( void *src, size_t stride, uint32_t drmFormat, const gamescope::Rc<CVulkanTexture> &pTex )
+{
+	VkResult result;
 
 	VkBufferCreateInfo bufferCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = stride * height,
+		.size = stride * pTex->height(),
 		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 	};
 	VkBuffer buffer;
 	result = g_device.vk.CreateBuffer( g_device.device(), &bufferCreateInfo, nullptr, &buffer );
 	if ( result != VK_SUCCESS )
-	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
-	}
+		return false;
 
 	VkMemoryRequirements memRequirements;
 	g_device.vk.GetBufferMemoryRequirements(g_device.device(), buffer, &memRequirements);
@@ -4251,8 +6079,8 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 	uint32_t memTypeIndex =  g_device.findMemoryType(VK_MEMORY_PROPERTY_HOST_COHERENT_BIT|VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, memRequirements.memoryTypeBits );
 	if ( memTypeIndex == ~0u )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
+		return false;
 	}
 
 	VkMemoryAllocateInfo allocInfo = {
@@ -4265,30 +6093,140 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 	result = g_device.vk.AllocateMemory( g_device.device(), &allocInfo, nullptr, &bufferMemory);
 	if ( result != VK_SUCCESS )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
+		return false;
 	}
 
+	void *dst = nullptr;
 	result = g_device.vk.BindBufferMemory( g_device.device(), buffer, bufferMemory, 0 );
+	if ( result == VK_SUCCESS )
+		result = g_device.vk.MapMemory( g_device.device(), bufferMemory, 0, VK_WHOLE_SIZE, 0, &dst );
 	if ( result != VK_SUCCESS )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
+		g_device.vk.FreeMemory(g_device.device(), bufferMemory, nullptr);
+		return false;
 	}
 
-	void *dst;
-	result = g_device.vk.MapMemory( g_device.device(), bufferMemory, 0, VK_WHOLE_SIZE, 0, &dst );
-	if ( result != VK_SUCCESS )
+	memcpy( dst, src, stride * pTex->height() );
+
+	g_device.vk.UnmapMemory( g_device.device(), bufferMemory );
+
+	auto cmdBuffer = g_device.commandBuffer();
+	cmdBuffer->copyBufferToImage( buffer, 0, stride / DRMFormatGetBPP(drmFormat), pTex );
+	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
+
+	g_device.wait(sequence);
+
+	g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
+	g_device.vk.FreeMemory(g_device.device(), bufferMemory, nullptr);
+
+	s_ulShmUploadBytes += stride * pTex->height();
+
+	return true;
+}
+
+// Copies the damaged rects of a data ptr buffer (all of it if there are none) into pTex
+// through the staging ring. The texture's upload acquire point is set to when the copy is done.
+static bool vulkan_upload_shm( void *src, size_t stride, uint32_t drmFormat, const gamescope::Rc<CVulkanTexture> &pTex, std::span<const VkRect2D> damage )
+{
+	if ( !s_pShmUploadTimeline )
+		s_pShmUploadTimeline = gamescope::CTimeline::Create();
+
+	const uint32_t uBytesPerPixel = DRMFormatGetBPP( drmFormat );
+
+	// Size the staging space first, rows of a damaged rect are packed tightly.
+	VkDeviceSize ulUploadSize = 0;
+	if ( damage.empty() )
 	{
-		wlr_buffer_end_data_ptr_access( buf );
-		return nullptr;
+		ulUploadSize = stride * pTex->height();
+	}
+	else
+	{
+		for ( const VkRect2D &rect : damage )
+			ulUploadSize = align( ulUploadSize, 16 ) + VkDeviceSize( rect.extent.width ) * uBytesPerPixel * rect.extent.height;
 	}
 
-	memcpy( dst, src, stride * height );
+	std::optional<VkDeviceSize> oulOffset = s_pShmUploadTimeline ? s_ShmStagingRing.Alloc( ulUploadSize ) : std::nullopt;
+	if ( !oulOffset )
+		return vulkan_upload_shm_oneoff( src, stride, drmFormat, pTex );
 
-	g_device.vk.UnmapMemory( g_device.device(), bufferMemory );
+	uint8_t *pStaging = s_ShmStagingRing.data() + *oulOffset;
 
-	wlr_buffer_end_data_ptr_access( buf );
+	std::vector<VkBufferImageCopy> regions;
+	if ( damage.empty() )
+	{
+		memcpy( pStaging, src, ulUploadSize );
+
+		regions.push_back( VkBufferImageCopy
+		{
+			.bufferOffset = *oulOffset,
+			.bufferRowLength = uint32_t( stride / uBytesPerPixel ),
+			.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1 },
+			.imageExtent = { pTex->width(), pTex->height(), 1 },
+		} );
+	}
+	else
+	{
+		regions.reserve( damage.size() );
+
+		VkDeviceSize ulRectOffset = 0;
+		for ( const VkRect2D &rect : damage )
+		{
+			ulRectOffset = align( ulRectOffset, 16 );
+
+			const size_t zRowBytes = size_t( rect.extent.width ) * uBytesPerPixel;
+			const uint8_t *pSrcRow = reinterpret_cast<const uint8_t *>( src ) + size_t( rect.offset.y ) * stride + size_t( rect.offset.x ) * uBytesPerPixel;
+			for ( uint32_t y = 0; y < rect.extent.height; y++ )
+				memcpy( pStaging + ulRectOffset + y * zRowBytes, pSrcRow + y * stride, zRowBytes );
+
+			regions.push_back( VkBufferImageCopy
+			{
+				.bufferOffset = *oulOffset + ulRectOffset,
+				.bufferRowLength = rect.extent.width,
+				.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1 },
+				.imageOffset = { rect.offset.x, rect.offset.y, 0 },
+				.imageExtent = { rect.extent.width, rect.extent.height, 1 },
+			} );
+
+			ulRectOffset += zRowBytes * rect.extent.height;
+		}
+	}
+
+	const uint64_t ulUploadPoint = ++s_ulShmUploadPoint;
+
+	auto cmdBuffer = g_device.commandBuffer();
+	cmdBuffer->copyBufferToImage( s_ShmStagingRing.buffer(), regions, pTex );
+	cmdBuffer->AddSignal( s_pShmUploadTimeline->ToVkSemaphore(), ulUploadPoint );
+	const uint64_t ulSequence = g_device.submit( std::move( cmdBuffer ) );
+
+	s_ShmStagingRing.Track( *oulOffset, ulSequence );
+	pTex->setUploadAcquirePoint( std::make_shared<gamescope::CAcquireTimelinePoint>( s_pShmUploadTimeline, ulUploadPoint ) );
+
+	s_ulShmUploadBytes += ulUploadSize;
+
+	return true;
+}
+
+gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struct wlr_buffer *buf, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb )
+{
+
+	struct wlr_dmabuf_attributes dmabuf = {0};
+	if ( wlr_buffer_get_dmabuf( buf, &dmabuf ) )
+	{
+		return vulkan_create_texture_from_dmabuf( &dmabuf, pBackendFb );
+	}
+
+	void *src;
+	uint32_t drmFormat;
+	size_t stride;
+	if ( !wlr_buffer_begin_data_ptr_access( buf, WLR_BUFFER_DATA_PTR_ACCESS_READ, &src, &drmFormat, &stride ) )
+	{
+		return nullptr;
+	}
+
+	uint32_t width = buf->width;
+	uint32_t height = buf->height;
 
 	gamescope::OwningRc<CVulkanTexture> pTex = new CVulkanTexture();
 	CVulkanTexture::createFlags texCreateFlags;
@@ -4296,19 +6234,44 @@ gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struc
 	texCreateFlags.bTransferDst = true;
 	texCreateFlags.bFlippable = true;
 	if ( pTex->BInit( width, height, 1u, drmFormat, texCreateFlags, nullptr, 0, 0, nullptr, pBackendFb ) == false )
+	{
+		wlr_buffer_end_data_ptr_access( buf );
 		return nullptr;
+	}
 
-	auto cmdBuffer = g_device.commandBuffer();
+	// Either the GPU copies straight out of the client's pool (which the commit keeps
+	// locked until the copy is done), or it has been copied into the staging ring.
+	bool bUploaded = vulkan_upload_shm_host_import( buf, pTex, {} ) || vulkan_upload_shm( src, stride, drmFormat, pTex, {} );
+	wlr_buffer_end_data_ptr_access( buf );
+	if ( !bUploaded )
+		return nullptr;
 
-	cmdBuffer->copyBufferToImage( buffer, 0, stride / DRMFormatGetBPP(drmFormat), pTex);
-	// TODO: Sync this copyBufferToImage
+	return pTex;
+}
 
-	uint64_t sequence = g_device.submit(std::move(cmdBuffer));
+bool vulkan_update_texture_from_wlr_buffer( const gamescope::Rc<CVulkanTexture> &pTex, struct wlr_buffer *buf, std::span<const VkRect2D> damage )
+{
+	if ( damage.empty() )
+		return true;
 
-	g_device.wait(sequence);
+	if ( vulkan_upload_shm_host_import( buf, pTex, damage ) )
+		return true;
 
-	g_device.vk.DestroyBuffer(g_device.device(), buffer, nullptr);
-	g_device.vk.FreeMemory(g_device.device(), bufferMemory, nullptr);
+	void *src;
+	uint32_t drmFormat;
+	size_t stride;
+	if ( !wlr_buffer_begin_data_ptr_access( buf, WLR_BUFFER_DATA_PTR_ACCESS_READ, &src, &drmFormat, &stride ) )
+		return false;
 
-	return pTex;
+	bool bUploaded = false;
+	if ( drmFormat == pTex->drmFormat() && uint32_t( buf->width ) == pTex->width() && uint32_t( buf->height ) == pTex->height() )
+		bUploaded = vulkan_upload_shm( src, stride, drmFormat, pTex, damage );
+
+	wlr_buffer_end_data_ptr_access( buf );
+	return bUploaded;
+}
+
+uint64_t vulkan_take_shm_upload_bytes()
+{
+	return std::exchange( s_ulShmUploadBytes, 0 );
 }
@@ -10,12 +10,17 @@
 #include <array>
 #include <bitset>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <optional>
+#include <span>
+#include <unordered_set>
 
 #include "main.hpp"
 
 #include "gamescope_shared.h"
 #include "backend.h"
+#include "Utils/CompositeDamage.h"
 
 #include "shaders/descriptor_set_constants.h"
 
@@ -157,7 +162,15 @@ public:
 		VkImageType imageType;
 	};
 
-	bool BInit( uint32_t width, uint32_t height, uint32_t depth, uint32_t drmFormat, createFlags flags, wlr_dmabuf_attributes *pDMA = nullptr, uint32_t contentWidth = 0, uint32_t contentHeight = 0, CVulkanTexture *pExistingImageToReuseMemory = nullptr, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb = nullptr );
+	// Host memory owned by someone else (eg. a PipeWire SHM buffer) to bind
+	// a mappable image to with VK_EXT_external_memory_host.
+	// Must be aligned to CVulkanDevice::hostPointerAlignment().
+	struct hostMemory {
+		void *pData = nullptr;
+		size_t size = 0;
+	};
+
+	bool BInit( uint32_t width, uint32_t height, uint32_t depth, uint32_t drmFormat, createFlags flags, wlr_dmabuf_attributes *pDMA = nullptr, uint32_t contentWidth = 0, uint32_t contentHeight = 0, CVulkanTexture *pExistingImageToReuseMemory = nullptr, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb = nullptr, const hostMemory *pHostMemory = nullptr );
 	bool BInitFromSwapchain( VkImage image, uint32_t width, uint32_t height, VkFormat format );
 
 	uint32_t IncRef();
@@ -183,8 +196,11 @@ public:
 	inline VkImage vkImage() { return m_vkImage; }
 	inline bool outputImage() { return m_bOutputImage; }
 	inline bool externalImage() { return m_bExternal; }
+	inline bool hostMemoryImage() { return m_bHostMemory; }
 	inline VkDeviceSize totalSize() const { return m_size; }
 	inline uint32_t drmFormat() const { return m_drmFormat; }
+	// Unlike the texture's address, never handed out again.
+	inline uint64_t uniqueId() const { return m_ulUniqueId; }
 
 	inline uint32_t lumaOffset() const { return m_lumaOffset; }
 	inline uint32_t lumaRowPitch() const { return m_lumaPitch; }
@@ -201,14 +217,21 @@ public:
 
 	int memoryFence();
 
+	// Set on textures filled from a SHM buffer, reached once the GPU copy into the image is done.
+	inline const std::shared_ptr<gamescope::CAcquireTimelinePoint> &uploadAcquirePoint() const { return m_pUploadAcquirePoint; }
+	inline void setUploadAcquirePoint( std::shared_ptr<gamescope::CAcquireTimelinePoint> pPoint ) { m_pUploadAcquirePoint = std::move( pPoint ); }
+
 	CVulkanTexture( void );
 	~CVulkanTexture( void );
 
 	uint32_t queueFamily = VK_QUEUE_FAMILY_IGNORED;
 
 private:
+	uint64_t m_ulUniqueId = 0;
+
 	bool m_bInitialized = false;
 	bool m_bExternal = false;
+	bool m_bHostMemory = false;
 	bool m_bOutputImage = false;
 
 	uint32_t m_drmFormat = DRM_FORMAT_INVALID;
@@ -247,6 +270,8 @@ private:
 	EStreamColorspace m_streamColorspace = k_EStreamColorspace_Unknown;
 
 	struct wlr_dmabuf_attributes m_dmabuf = {};
+
+	std::shared_ptr<gamescope::CAcquireTimelinePoint> m_pUploadAcquirePoint;
 };
 
 struct vec2_t
@@ -302,6 +327,12 @@ struct FrameInfo_t
 
 		GamescopeAppTextureColorspace colorspace;
 
+		// The commit tex came from, and what changed in it since the commits
+		// before it. 0 if tex isn't a commit's buffer, which is always treated
+		// as fully damaged.
+		uint64_t commitID = 0;
+		gamescope::CCommitDamageHistory damageHistory;
+
 		bool isYcbcr() const
 		{
 			if ( !tex )
@@ -394,6 +425,10 @@ bool vulkan_make_output();
 gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_dmabuf( struct wlr_dmabuf_attributes *pDMA, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb );
 gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_bits( uint32_t width, uint32_t height, uint32_t contentWidth, uint32_t contentHeight, uint32_t drmFormat, CVulkanTexture::createFlags texCreateFlags, void *bits );
 gamescope::OwningRc<CVulkanTexture> vulkan_create_texture_from_wlr_buffer( struct wlr_buffer *buf, gamescope::OwningRc<gamescope::IBackendFb> pBackendFb );
+// Re-uploads the damaged rects of a SHM buffer into the texture it was imported to.
+bool vulkan_update_texture_from_wlr_buffer( const gamescope::Rc<CVulkanTexture> &pTex, struct wlr_buffer *buf, std::span<const VkRect2D> damage );
+// Bytes of SHM buffer data uploaded since the last call.
+uint64_t vulkan_take_shm_upload_bytes();
 
 std::optional<uint64_t> vulkan_composite( struct FrameInfo_t *frameInfo, gamescope::Rc<CVulkanTexture> pScreenshotTexture, bool partial, gamescope::Rc<CVulkanTexture> pOutputOverride = nullptr, bool increment = true, std::unique_ptr<CVulkanCmdBuffer> pInCommandBuffer = nullptr );
 void vulkan_wait( uint64_t ulSeqNo, bool bReset );
@@ -403,6 +438,7 @@ gamescope::Rc<CVulkanTexture> vulkan_acquire_screenshot_texture(uint32_t width,
 void vulkan_present_to_window( void );
 
 void vulkan_garbage_collect( void );
+void vulkan_save_pipeline_cache( void );
 bool vulkan_remake_swapchain( void );
 bool vulkan_remake_output_images( void );
 bool acquire_next_image( void );
@@ -413,6 +449,8 @@ bool vulkan_supports_modifiers(void);
 gamescope::Rc<CVulkanTexture> vulkan_create_1d_lut(uint32_t size);
 gamescope::Rc<CVulkanTexture> vulkan_create_3d_lut(uint32_t width, uint32_t height, uint32_t depth);
 void vulkan_update_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data);
+uint64_t vulkan_upload_luts(const gamescope::Rc<CVulkanTexture>& lut1d, const gamescope::Rc<CVulkanTexture>& lut3d, void* lut1d_data, void* lut3d_data);
+bool vulkan_is_sequence_complete( uint64_t ulSeqNo );
 
 gamescope::Rc<CVulkanTexture> vulkan_get_hacky_blank_texture();
 
@@ -593,6 +631,7 @@ struct PipelineInfo_t
 	uint32_t colorspaceMask;
 	uint32_t outputEOTF;
 	bool itmEnable;
+	bool tileMasks;
 
 	bool operator==(const PipelineInfo_t& o) const {
 		return
@@ -603,7 +642,8 @@ struct PipelineInfo_t
 		compositeDebug == o.compositeDebug &&
 		colorspaceMask == o.colorspaceMask &&
 		outputEOTF == o.outputEOTF &&
-		itmEnable == o.itmEnable;
+		itmEnable == o.itmEnable &&
+		tileMasks == o.tileMasks;
 	}
 };
 
@@ -627,6 +667,7 @@ namespace std
 			hash = hash_combine(hash, k.colorspaceMask);
 			hash = hash_combine(hash, k.outputEOTF);
 			hash = hash_combine(hash, k.itmEnable);
+			hash = hash_combine(hash, k.tileMasks);
 			return hash;
 		}
 	};
@@ -674,6 +715,8 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CmdEndRendering) \
 	VK_FUNC(CmdPipelineBarrier) \
 	VK_FUNC(CmdPushConstants) \
+	VK_FUNC(CmdResetQueryPool) \
+	VK_FUNC(CmdWriteTimestamp) \
 	VK_FUNC(CreateBuffer) \
 	VK_FUNC(CreateCommandPool) \
 	VK_FUNC(CreateComputePipelines) \
@@ -683,7 +726,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(CreateGraphicsPipelines) \
 	VK_FUNC(CreateImage) \
 	VK_FUNC(CreateImageView) \
+	VK_FUNC(CreatePipelineCache) \
 	VK_FUNC(CreatePipelineLayout) \
+	VK_FUNC(CreateQueryPool) \
 	VK_FUNC(CreateSampler) \
 	VK_FUNC(CreateSamplerYcbcrConversion) \
 	VK_FUNC(CreateSemaphore) \
@@ -711,6 +756,9 @@ static inline uint32_t div_roundup(uint32_t x, uint32_t y)
 	VK_FUNC(GetImageMemoryRequirements) \
 	VK_FUNC(GetImageSubresourceLayout) \
 	VK_FUNC(GetMemoryFdKHR) \
+	VK_FUNC(GetMemoryHostPointerPropertiesEXT) \
+	VK_FUNC(GetPipelineCacheData) \
+	VK_FUNC(GetQueryPoolResults) \
 	VK_FUNC(GetSemaphoreCounterValue) \
 	VK_FUNC(GetSwapchainImagesKHR) \
 	VK_FUNC(MapMemory) \
@@ -755,13 +803,14 @@ public:
 	bool BInit(VkInstance instance, VkSurfaceKHR surface);
 
 	VkSampler sampler(SamplerState key);
-	VkPipeline pipeline(ShaderType type, uint32_t layerCount = 1, uint32_t ycbcrMask = 0, uint32_t blur_layers = 0, uint32_t colorspace_mask = 0, uint32_t output_eotf = EOTF_Gamma22, bool itm_enable = false);
+	VkPipeline pipeline(ShaderType type, uint32_t layerCount = 1, uint32_t ycbcrMask = 0, uint32_t blur_layers = 0, uint32_t colorspace_mask = 0, uint32_t output_eotf = EOTF_Gamma22, bool itm_enable = false, bool tile_masks = false);
 	int32_t findMemoryType( VkMemoryPropertyFlags properties, uint32_t requiredTypeBits );
 	std::unique_ptr<CVulkanCmdBuffer> commandBuffer();
 	uint64_t submit( std::unique_ptr<CVulkanCmdBuffer> cmdBuf);
 	uint64_t submitInternal( CVulkanCmdBuffer* cmdBuf );
 	void wait(uint64_t sequence, bool reset = true);
 	void waitIdle(bool reset = true);
+	bool isSequenceComplete(uint64_t sequence);
 	void garbageCollect();
 	inline VkDescriptorSet descriptorSet()
 	{
@@ -791,12 +840,27 @@ public:
 	inline bool hasDrmPrimaryDevId() {return m_bHasDrmPrimaryDevId;}
 	inline dev_t primaryDevId() {return m_drmPrimaryDevId;}
 	inline bool supportsFp16() {return m_bSupportsFp16;}
-
-	inline void *uploadBufferData(uint32_t size)
+	inline bool supportsHostMemoryImport() {return m_bSupportsHostMemoryImport;}
+	inline VkDeviceSize hostPointerAlignment() {return m_hostPointerAlignment;}
+	inline VkPipelineCache pipelineCache() {return m_pipelineCache;}
+	// VK_NULL_HANDLE if the queue can't do timestamps.
+	inline VkQueryPool compositeTimestampPool() {return m_compositeTimestampPool;}
+	inline float timestampPeriod() {return m_flTimestampPeriod;}
+	inline uint32_t storageBufferOffsetAlignment() {return m_uStorageBufferOffsetAlignment;}
+
+	// Pairs of begin/end timestamps in the composite timestamp pool.
+	static constexpr uint32_t k_uCompositeTimestampSlots = 8;
+
+	// Writes the pipeline cache back to disk if anything new was compiled into it.
+	void savePipelineCache();
+	void notePipelineCreationFeedback( const VkPipelineCreationFeedback &feedback );
+	void printPipelineCacheStats();
+
+	inline void *uploadBufferData(uint32_t size, uint32_t alignment = 16)
 	{
 		assert(size <= upload_buffer_size);
 
-		m_uploadBufferOffset = align(m_uploadBufferOffset, 16);
+		m_uploadBufferOffset = align(m_uploadBufferOffset, alignment);
 		if (m_uploadBufferOffset + size > upload_buffer_size)
 		{
 			fprintf(stderr, "Exceeded uploadBufferData\n");
@@ -808,6 +872,13 @@ public:
 		return ptr;
 	}
 
+	// Where memory from uploadBufferData lives in uploadBuffer(), for copies out of it.
+	// It stays put until the newest submission has been waited on.
+	inline uint32_t uploadBufferOffset(const void *ptr)
+	{
+		return (uint32_t)((const uint8_t*)ptr - (const uint8_t*)m_uploadBufferData);
+	}
+
 	#define VK_FUNC(x) PFN_vk##x x = nullptr;
 	struct
 	{
@@ -827,8 +898,12 @@ protected:
 	bool createPools();
 	bool createShaders();
 	bool createScratchResources();
-	VkPipeline compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable);
+	bool createPipelineCache();
+	VkPipeline compilePipeline(uint32_t layerCount, uint32_t ycbcrMask, ShaderType type, uint32_t blur_layer_count, uint32_t composite_debug, uint32_t colorspace_mask, uint32_t output_eotf, bool itm_enable, bool tile_masks);
 	void compileAllPipelines();
+	void compileAndInsertPipeline( const PipelineInfo_t &key );
+	VkPipeline findFallbackPipeline( const PipelineInfo_t &key );
+	bool compileNextPipeline( std::span<const PipelineInfo_t> precompileList, std::atomic<size_t> &nextPrecompile );
 
 	VkDevice m_device = nullptr;
 	VkPhysicalDevice m_physDev = nullptr;
@@ -842,6 +917,9 @@ protected:
 	VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
 	VkCommandPool m_commandPool = VK_NULL_HANDLE;
 	VkCommandPool m_generalCommandPool = VK_NULL_HANDLE;
+	VkQueryPool m_compositeTimestampPool = VK_NULL_HANDLE;
+	float m_flTimestampPeriod = 0.0f;
+	uint32_t m_uStorageBufferOffsetAlignment = 16;
 
 	uint32_t m_queueFamily = -1;
 	uint32_t m_generalQueueFamily = -1;
@@ -852,8 +930,12 @@ protected:
 	bool m_bSupportsFp16 = false;
 	bool m_bHasDrmPrimaryDevId = false;
 	bool m_bSupportsModifiers = false;
+	bool m_bSupportsHostMemoryImport = false;
+	bool m_bSupportsCreationFeedback = false;
 	bool m_bInitialized = false;
 
+	VkDeviceSize m_hostPointerAlignment = 0;
+
 
 	VkPhysicalDeviceMemoryProperties m_memoryProperties;
 
@@ -862,6 +944,20 @@ protected:
 	std::unordered_map<PipelineInfo_t, VkPipeline> m_pipelineMap;
 	std::mutex m_pipelineMutex;
 
+	// Pipelines that pipeline() substituted with a fallback and that are
+	// waiting to be compiled on the gamescope-shdr thread.
+	std::unordered_set<PipelineInfo_t> m_pendingPipelines;
+	std::deque<PipelineInfo_t> m_requestedPipelines;
+	std::condition_variable m_pipelineRequestCV;
+
+	// Persistent across runs, stored under $XDG_CACHE_HOME/gamescope.
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	uint64_t m_ulShaderHash = 0;
+	std::mutex m_pipelineCacheMutex;
+	std::atomic<bool> m_bPipelineCacheDirty = { false };
+	std::atomic<uint32_t> m_uPipelineCacheHits = { 0 };
+	std::atomic<uint32_t> m_uPipelineCacheMisses = { 0 };
+
 	// currently just one set, no need to double buffer because we
 	// vkQueueWaitIdle after each submit.
 	// should be moved to the output if we are going to support multiple outputs
@@ -918,13 +1014,20 @@ public:
 	void setSamplerNearest(uint32_t slot, bool nearest);
 	void setSamplerUnnormalized(uint32_t slot, bool unnormalized);
 	void bindTarget(gamescope::Rc<CVulkanTexture> target);
+	// Like bindTarget, but keeps what's in the image for dispatches that only cover part of it.
+	void bindTargetPreserved(gamescope::Rc<CVulkanTexture> target);
 	void clearState();
 	template<class PushData, class... Args>
 	void uploadConstants(Args&&... args);
+	// Per-tile layer masks for pipelines with tile_masks, see CCompositeTileMasks.
+	void uploadTileMasks(std::span<const uint32_t> buffer);
 	void bindPipeline(VkPipeline pipeline);
 	void dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1);
+	void resetQueries(VkQueryPool pool, uint32_t firstQuery, uint32_t queryCount);
+	void writeTimestamp(VkPipelineStageFlagBits stage, VkQueryPool pool, uint32_t query);
 	void copyImage(gamescope::Rc<CVulkanTexture> src, gamescope::Rc<CVulkanTexture> dst);
 	void copyBufferToImage(VkBuffer buffer, VkDeviceSize offset, uint32_t stride, gamescope::Rc<CVulkanTexture> dst);
+	void copyBufferToImage(VkBuffer buffer, std::span<const VkBufferImageCopy> regions, gamescope::Rc<CVulkanTexture> dst);
 
 
 	void prepareSrcImage(CVulkanTexture *image);
@@ -966,6 +1069,8 @@ private:
 	std::vector<VulkanTimelinePoint_t> m_ExternalSignals;
 
 	uint32_t m_renderBufferOffset = 0;
+	uint32_t m_tileMaskOffset = 0;
+	uint32_t m_tileMaskSize = 0;
 };
 
 uint32_t VulkanFormatToDRM( VkFormat vkFormat, std::optional<bool> obHasAlphaOverride = std::nullopt );
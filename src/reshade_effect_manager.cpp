@@ -1458,20 +1458,29 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
                 .pName = pass.cs_entry_point.c_str(),
             };
 
+            VkPipelineCreationFeedback creationFeedback = {};
+            VkPipelineCreationFeedbackCreateInfo creationFeedbackInfo =
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+                .pPipelineCreationFeedback = &creationFeedback,
+            };
+
 			VkComputePipelineCreateInfo pipelineInfo =
 			{
 				.sType  = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+                .pNext  = &creationFeedbackInfo,
                 .stage  = shaderStageCreateInfoCompute,
                 .layout = m_pipelineLayout,
 			};
 
 			VkPipeline pipeline = VK_NULL_HANDLE;
-			VkResult result = device->vk.CreateComputePipelines(device->device(), VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline);
+			VkResult result = device->vk.CreateComputePipelines(device->device(), device->pipelineCache(), 1, &pipelineInfo, nullptr, &pipeline);
 			if (result != VK_SUCCESS)
             {
 				reshade_log.errorf("Failed to CreateComputePipelines");
                 return false;
             }
+            device->notePipelineCreationFeedback(creationFeedback);
 
             m_pipelines.push_back(pipeline);
 		}
@@ -1513,9 +1522,16 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
                 attachmentBlendStates.push_back(colorBlendAttachment);
             }
 
+            VkPipelineCreationFeedback creationFeedback = {};
+            VkPipelineCreationFeedbackCreateInfo creationFeedbackInfo =
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+                .pPipelineCreationFeedback = &creationFeedback,
+            };
+
             VkPipelineRenderingCreateInfo renderingCreateInfo;
             renderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
-            renderingCreateInfo.pNext = nullptr;
+            renderingCreateInfo.pNext = &creationFeedbackInfo;
             renderingCreateInfo.viewMask = 0;
             renderingCreateInfo.colorAttachmentCount = colorFormats.size();
             renderingCreateInfo.pColorAttachmentFormats = colorFormats.data();
@@ -1684,12 +1700,13 @@ bool ReshadeEffectPipeline::init(CVulkanDevice *device, const ReshadeEffectKey &
             pipelineCreateInfo.basePipelineIndex   = -1;
 
 			VkPipeline pipeline = VK_NULL_HANDLE;
-			VkResult result = device->vk.CreateGraphicsPipelines(device->device(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &pipeline);
+			VkResult result = device->vk.CreateGraphicsPipelines(device->device(), device->pipelineCache(), 1, &pipelineCreateInfo, nullptr, &pipeline);
 			if (result != VK_SUCCESS)
             {
 				reshade_log.errorf("Failed to vkCreateGraphicsPipelines");
                 return false;
             }
+            device->notePipelineCreationFeedback(creationFeedback);
 
             m_pipelines.push_back(pipeline);
         }
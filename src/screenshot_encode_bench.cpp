@@ -0,0 +1,143 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Utils/ScreenshotEncode.h"
+
+// Screenshots are taken off the GPU and then converted and encoded on the
+// screenshot thread. This measures each stage at 1080p and 4K with the
+// driver's (padded) row pitch on the source side.
+
+static constexpr size_t k_zSourcePitchAlign = 256;
+
+static size_t AlignUp( size_t zValue, size_t zAlign )
+{
+    return ( zValue + zAlign - 1 ) & ~( zAlign - 1 );
+}
+
+static void GetResolution( int64_t nIndex, uint32_t *puWidth, uint32_t *puHeight )
+{
+    *puWidth = nIndex ? 3840 : 1920;
+    *puHeight = nIndex ? 2160 : 1080;
+}
+
+// Something that looks a bit like a desktop: smooth gradients with some noise,
+// so the deflate numbers aren't wildly optimistic or pessimistic.
+static std::vector<uint8_t> MakeSource( uint32_t uHeight, size_t zPitch )
+{
+    std::vector<uint8_t> source( zPitch * uHeight );
+    for ( uint32_t y = 0; y < uHeight; y++ )
+    {
+        uint8_t *pRow = source.data() + y * zPitch;
+        for ( size_t x = 0; x < zPitch; x++ )
+            pRow[x] = uint8_t( ( x / 4 + y ) / 8 + ( rand() & 3 ) );
+    }
+    return source;
+}
+
+// Args: 4K
+static void BenchmarkSwizzleBGRX( benchmark::State &state )
+{
+    uint32_t uWidth, uHeight;
+    GetResolution( state.range( 0 ), &uWidth, &uHeight );
+
+    const size_t zSrcPitch = AlignUp( uWidth * 4, k_zSourcePitchAlign );
+    std::vector<uint8_t> source = MakeSource( uHeight, zSrcPitch );
+    std::vector<uint8_t> dest( uWidth * 4 * uHeight );
+
+    for ( auto _ : state )
+    {
+        gamescope::SwizzleBGRXToRGBA( dest.data(), uWidth * 4, source.data(), zSrcPitch, uWidth, 0, uHeight );
+        benchmark::DoNotOptimize( dest.data() );
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( int64_t( state.iterations() ) * uWidth * 4 * uHeight );
+}
+BENCHMARK(BenchmarkSwizzleBGRX)->ArgNames({ "4k" })->Arg( 0 )->Arg( 1 );
+
+// Args: 4K
+static void BenchmarkUnpackX2RGB10( benchmark::State &state )
+{
+    uint32_t uWidth, uHeight;
+    GetResolution( state.range( 0 ), &uWidth, &uHeight );
+
+    const size_t zSrcPitch = AlignUp( uWidth * 4, k_zSourcePitchAlign );
+    std::vector<uint8_t> source = MakeSource( uHeight, zSrcPitch );
+    std::vector<uint16_t> r( uWidth * uHeight ), g( uWidth * uHeight ), b( uWidth * uHeight );
+
+    for ( auto _ : state )
+    {
+        gamescope::UnpackX2RGB10ToPlanes(
+            r.data(), uWidth * 2, g.data(), uWidth * 2, b.data(), uWidth * 2,
+            source.data(), zSrcPitch, uWidth, 0, uHeight );
+        benchmark::DoNotOptimize( r.data() );
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( int64_t( state.iterations() ) * uWidth * 4 * uHeight );
+}
+BENCHMARK(BenchmarkUnpackX2RGB10)->ArgNames({ "4k" })->Arg( 0 )->Arg( 1 );
+
+// Args: 4K
+static void BenchmarkConvertNV12( benchmark::State &state )
+{
+    uint32_t uWidth, uHeight;
+    GetResolution( state.range( 0 ), &uWidth, &uHeight );
+
+    const size_t zSrcPitch = AlignUp( uWidth, k_zSourcePitchAlign );
+    std::vector<uint8_t> source = MakeSource( uHeight + uHeight / 2, zSrcPitch );
+    std::vector<uint8_t> dest( uWidth * 4 * uHeight );
+
+    for ( auto _ : state )
+    {
+        gamescope::ConvertNV12ToRGBA(
+            dest.data(), uWidth * 4,
+            source.data(), zSrcPitch, source.data() + zSrcPitch * uHeight, zSrcPitch,
+            gamescope::YCbCrMatrix::BT709, false,
+            uWidth, 0, uHeight );
+        benchmark::DoNotOptimize( dest.data() );
+        benchmark::ClobberMemory();
+    }
+
+    state.SetBytesProcessed( int64_t( state.iterations() ) * uWidth * 4 * uHeight );
+}
+BENCHMARK(BenchmarkConvertNV12)->ArgNames({ "4k" })->Arg( 0 )->Arg( 1 );
+
+// Args: 4K, thread count
+static void BenchmarkEncodePNG( benchmark::State &state )
+{
+    uint32_t uWidth, uHeight;
+    GetResolution( state.range( 0 ), &uWidth, &uHeight );
+
+    std::vector<uint8_t> source = MakeSource( uHeight, uWidth * 4 );
+
+    gamescope::PNGEncodeDesc_t desc =
+    {
+        .pPixels = source.data(),
+        .zPitch = uWidth * 4,
+        .uWidth = uWidth,
+        .uHeight = uHeight,
+        .uThreadCount = uint32_t( state.range( 1 ) ),
+    };
+
+    size_t zEncoded = 0;
+    for ( auto _ : state )
+    {
+        std::vector<uint8_t> png = gamescope::EncodePNG( desc );
+        zEncoded = png.size();
+        benchmark::DoNotOptimize( png.data() );
+    }
+
+    state.counters["ratio"] = double( source.size() ) / double( zEncoded ? zEncoded : 1 );
+    state.SetBytesProcessed( int64_t( state.iterations() ) * source.size() );
+}
+BENCHMARK(BenchmarkEncodePNG)
+    ->ArgNames({ "4k", "threads" })
+    ->ArgsProduct({ { 0, 1 }, { 1, 2, 4, 8 } })
+    ->UseRealTime()
+    ->Unit( benchmark::kMillisecond );
+
+BENCHMARK_MAIN();
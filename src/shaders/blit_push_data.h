@@ -15,5 +15,7 @@ uniform layers_t {
     float u_nitsToLinear; // hdr -> sdr
     float u_itmSdrNits;
     float u_itmTargetNits;
+
+    uvec2 u_dispatchOffset;
 };
 
@@ -8,6 +8,7 @@ layout(constant_id = 3) const int  c_blur_layer_count = 0;
 layout(constant_id = 4) const uint c_colorspaceMask = 0;
 layout(constant_id = 5) const uint c_output_eotf = 0;
 layout(constant_id = 7) const bool c_itm_enable = false;
+layout(constant_id = 8) const bool c_tile_masks = false;
 
 const int colorspace_linear = 0;
 const int colorspace_sRGB = 1;
@@ -54,3 +55,19 @@ layout(binding = 4) uniform sampler2D s_ycbcr_samplers[VKR_SAMPLER_SLOTS];
 
 layout(binding = 5) uniform sampler1D s_shaperLut[VKR_LUT3D_COUNT];
 layout(binding = 6) uniform sampler3D s_lut3D[VKR_LUT3D_COUNT];
+
+// Which layers contribute to each VKR_TILE_MASK_SIZE tile of the output,
+// a byte per tile. Only valid with c_tile_masks.
+layout(binding = 7, std430) readonly buffer tile_masks_t {
+    uint u_tileColumns;
+    uint u_tileMasks[];
+};
+
+uint get_tile_layer_mask(uvec2 coord) {
+    if (!c_tile_masks)
+        return ~0u;
+
+    uvec2 tile = coord / VKR_TILE_MASK_SIZE;
+    uint tileIdx = tile.y * u_tileColumns + tile.x;
+    return bitfieldExtract(u_tileMasks[tileIdx / 4], int(tileIdx % 4) * 8, 8);
+}
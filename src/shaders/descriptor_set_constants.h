@@ -11,4 +11,6 @@
 
 #define VKR_LUT3D_COUNT 2 // Must match EOTF_Count
 
+#define VKR_TILE_MASK_SIZE 32u // Must match CCompositeTileMasks::k_nTileSize
+
 #endif
@@ -33,10 +33,13 @@
 #include "xwayland_ctx.hpp"
 #include <X11/X.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xcursor/Xcursor.h>
 #include <X11/extensions/xfixeswire.h>
 #include <X11/extensions/XInput2.h>
+#include <xcb/xcb.h>
 #include <cstdint>
+#include <cinttypes>
 #include <memory>
 #include <thread>
 #include <condition_variable>
@@ -93,8 +96,14 @@
 #include "commit.h"
 #include "reshade_effect_manager.hpp"
 #include "BufferMemo.h"
+#include "FrameTelemetry.h"
 #include "Utils/Process.h"
+#include "Utils/ProcessTree.h"
 #include "Utils/Algorithm.h"
+#include "Utils/SPSCRing.h"
+#include "Utils/ScreenshotEncode.h"
+#include "Utils/FramePacer.h"
+#include "GamescopeVersion.h"
 
 #include "wlr_begin.hpp"
 #include "wlr/types/wlr_pointer_constraints_v1.h"
@@ -111,9 +120,7 @@ static const int g_nBaseCursorScale = 36;
 #endif
 
 #define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image.h>
-#include <stb_image_write.h>
 #include <stb_image_resize.h>
 
 #define GPUVIS_TRACE_IMPLEMENTATION
@@ -212,9 +219,14 @@ gamescope::ConVar<bool> cv_adaptive_sync( "adaptive_sync", false, "Whether or no
 gamescope::ConVar<bool> cv_adaptive_sync_ignore_overlay( "adaptive_sync_ignore_overlay", false, "Whether or not to ignore overlay planes for pushing commits with adaptive sync." );
 gamescope::ConVar<int> cv_adaptive_sync_overlay_cycles( "adaptive_sync_overlay_cycles", 1, "Number of vblank cycles to ignore overlay repaints before forcing a commit with adaptive sync." );
 
+gamescope::ConVar<bool> cv_fps_limit_fractional( "fps_limit_fractional", true, "Pace FPS limits that don't divide the refresh rate by spreading frames across vblanks, rather than rounding to the nearest integer divisor." );
+
 gamescope::ConVar<bool> cv_upscale_preemptive( "upscale_preemptive", true, "Allow pre-emptive upscaling" );
 gamescope::ConVar<bool> cv_upscale_preemptive_debug_force_sync( "upscale_preemptive_debug_force_sync", false, "Force synchronize pre-emptive upscaling" );
 
+gamescope::ConVar<int> cv_screenshot_encode_threads( "screenshot_encode_threads", 0, "Threads used to convert and encode screenshots. 0 picks a count from the machine." );
+gamescope::ConVar<int> cv_screenshot_png_compression( "screenshot_png_compression", 4, "zlib level (0-9) for PNG screenshots." );
+
 uint64_t g_SteamCompMgrLimitedAppRefreshCycle = 16'666'666;
 uint64_t g_SteamCompMgrAppRefreshCycle = 16'666'666;
 
@@ -239,26 +251,341 @@ static const gamescope_color_mgmt_t k_ScreenshotColorMgmtHDR =
 //#define COLOR_MGMT_MICROBENCH
 // sudo cpupower frequency-set --governor performance
 
+///
+// Color mgmt LUT cache
+//
+// Users tend to flip between a handful of states (night mode, SDR/HDR, a few
+// brightness levels), so keep the quantized results of previous builds around
+// and skip calcColorTransform entirely when we have seen the inputs before.
+//
+
+gamescope::ConVar<uint32_t> cv_color_mgmt_lut_cache_size{ "color_mgmt_lut_cache_size", 32, "Number of per-EOTF color management LUT sets kept in the cache. 0 disables the cache." };
+gamescope::ConVar<bool> cv_color_mgmt_lut_cache_persist{ "color_mgmt_lut_cache_persist", false, "Load the color management LUT cache from disk on startup and write it back on exit." };
+
+static uint64_t g_ulColorMgmtLookHashes[ EOTF_Count ];
+
+// Only the inputs calc_color_mgmt_luts actually reads for the given input EOTF are filled in,
+// everything else is left zeroed so e.g. changing the SDR brightness doesn't miss on the PQ LUTs.
+// Compared and hashed bytewise, so it must not have any padding and must be zeroed before filling.
+struct ColorMgmtLutCacheKey_t
+{
+	uint32_t uInputEOTF;
+	uint32_t uOutputEncodingEOTF;
+	displaycolorimetry_t displayColorimetry;
+	displaycolorimetry_t outputEncodingColorimetry;
+	glm::vec2 outputVirtualWhite;
+	uint32_t uChromaticAdaptationMode;
+	nightmode_t nightmode;
+	float flSDRGamutWideness;
+	float flSDRInputGain;
+	float flSDROnHDRBrightness;
+	float flHDRInputGain;
+	float flInternalDisplayBrightness;
+	uint32_t uTonemapOperator;
+	tonemap_info_t hdrTonemapDisplayMetadata;
+	tonemap_info_t hdrTonemapSourceMetadata;
+	uint32_t uUseSourceEOTFForShaper;
+	uint32_t uHuePreservationWhenClipping;
+	uint64_t ulLookHash;
+};
+static_assert( sizeof( ColorMgmtLutCacheKey_t ) == 36 * sizeof( uint32_t ) + sizeof( uint64_t ), "ColorMgmtLutCacheKey_t must not contain padding" );
+
+struct ColorMgmtLutCacheEntry_t
+{
+	ColorMgmtLutCacheKey_t key;
+	uint64_t ulHash;
+	uint64_t ulLastUsed;
+	uint16_t lut3d[s_nLutEdgeSize3d*s_nLutEdgeSize3d*s_nLutEdgeSize3d*4];
+	uint16_t lut1d[s_nLutSize1d*4];
+};
+
+static std::mutex s_ColorMgmtLutCacheMutex;
+static std::vector<std::unique_ptr<ColorMgmtLutCacheEntry_t>> s_ColorMgmtLutCache;
+static uint64_t s_ulColorMgmtLutCacheTick = 0;
+static bool s_bColorMgmtLutCacheLoaded = false;
+static bool s_bColorMgmtLutCacheDirty = false;
+static std::atomic<uint64_t> s_ulColorMgmtLutCacheHits = { 0 };
+static std::atomic<uint64_t> s_ulColorMgmtLutCacheMisses = { 0 };
+
+static uint64_t hash_color_mgmt_bytes( const void *pData, size_t uSize, uint64_t ulHash = 0xcbf29ce484222325ull )
+{
+	// FNV-1a
+	const uint8_t *pBytes = reinterpret_cast<const uint8_t *>( pData );
+	for ( size_t i = 0; i < uSize; i++ )
+	{
+		ulHash ^= pBytes[i];
+		ulHash *= 0x100000001b3ull;
+	}
+	return ulHash;
+}
+
+static uint64_t hash_color_mgmt_look( const lut3d_t &look )
+{
+	if ( look.lutEdgeSize <= 0 )
+		return 0;
+
+	uint64_t ulHash = hash_color_mgmt_bytes( &look.lutEdgeSize, sizeof( look.lutEdgeSize ) );
+	return hash_color_mgmt_bytes( look.data.data(), look.data.size() * sizeof( look.data[0] ), ulHash );
+}
+
+static ColorMgmtLutCacheKey_t make_color_mgmt_lut_cache_key( const gamescope_color_mgmt_t &colorMgmt, EOTF inputEOTF, uint64_t ulLookHash )
+{
+	ColorMgmtLutCacheKey_t key;
+	memset( (void *)&key, 0, sizeof( key ) );
+
+	key.uInputEOTF = inputEOTF;
+	key.uOutputEncodingEOTF = colorMgmt.outputEncodingEOTF;
+	key.displayColorimetry = colorMgmt.displayColorimetry;
+	key.outputEncodingColorimetry = colorMgmt.outputEncodingColorimetry;
+	key.outputVirtualWhite = colorMgmt.outputVirtualWhite;
+	key.uChromaticAdaptationMode = colorMgmt.chromaticAdaptationMode;
+	key.nightmode = colorMgmt.nightmode;
+	key.uUseSourceEOTFForShaper = g_bUseSourceEOTFForShaper;
+	key.uHuePreservationWhenClipping = g_bHuePreservationWhenClipping;
+	key.ulLookHash = ulLookHash;
+
+	if ( inputEOTF == EOTF_Gamma22 )
+	{
+		key.flSDRGamutWideness = colorMgmt.sdrGamutWideness;
+		key.flSDRInputGain = colorMgmt.flSDRInputGain;
+		if ( colorMgmt.outputEncodingEOTF == EOTF_PQ )
+			key.flSDROnHDRBrightness = colorMgmt.flSDROnHDRBrightness;
+	}
+	else if ( inputEOTF == EOTF_PQ )
+	{
+		key.flHDRInputGain = colorMgmt.flHDRInputGain;
+		if ( colorMgmt.outputEncodingEOTF == EOTF_Gamma22 )
+		{
+			key.flInternalDisplayBrightness = colorMgmt.flInternalDisplayBrightness;
+			key.uTonemapOperator = colorMgmt.hdrTonemapOperator;
+			key.hdrTonemapDisplayMetadata = colorMgmt.hdrTonemapDisplayMetadata;
+			key.hdrTonemapSourceMetadata = colorMgmt.hdrTonemapSourceMetadata;
+		}
+	}
+
+	return key;
+}
+
+std::string_view GetHomeDir();
+
+static std::string GetColorMgmtLutCachePath()
+{
+	const char *pszCacheHome = getenv( "XDG_CACHE_HOME" );
+	if ( pszCacheHome && *pszCacheHome )
+		return std::string{ pszCacheHome } + "/gamescope/color_lut_cache.bin";
+
+	return std::string{ GetHomeDir() } + "/.cache/gamescope/color_lut_cache.bin";
+}
+
+static constexpr uint32_t k_unColorMgmtLutCacheMagic = 0x434c5347; // 'GSLC'
+static constexpr uint32_t k_unColorMgmtLutCacheVersion = 2;
+
+struct ColorMgmtLutCacheFileHeader_t
+{
+	uint32_t uMagic;
+	uint32_t uVersion;
+	uint32_t uKeySize;
+	uint32_t uEntryCount;
+	uint32_t uLut1dSize;
+	uint32_t uLut3dSize;
+	// Any change to the math invalidates the cache, so tie it to the build.
+	char szGamescopeVersion[128];
+};
+
+static ColorMgmtLutCacheFileHeader_t get_color_mgmt_lut_cache_file_header( uint32_t uEntryCount )
+{
+	ColorMgmtLutCacheFileHeader_t header;
+	memset( &header, 0, sizeof( header ) );
+	header.uMagic = k_unColorMgmtLutCacheMagic;
+	header.uVersion = k_unColorMgmtLutCacheVersion;
+	header.uKeySize = sizeof( ColorMgmtLutCacheKey_t );
+	header.uEntryCount = uEntryCount;
+	header.uLut1dSize = sizeof( ColorMgmtLutCacheEntry_t::lut1d );
+	header.uLut3dSize = sizeof( ColorMgmtLutCacheEntry_t::lut3d );
+	snprintf( header.szGamescopeVersion, sizeof( header.szGamescopeVersion ), "%s", gamescope::k_szGamescopeVersion );
+	return header;
+}
+
+// Called with s_ColorMgmtLutCacheMutex held.
+static void load_color_mgmt_lut_cache_locked()
+{
+	s_bColorMgmtLutCacheLoaded = true;
+
+	std::string sPath = GetColorMgmtLutCachePath();
+	FILE *pFile = fopen( sPath.c_str(), "rb" );
+	if ( !pFile )
+		return;
+	defer( fclose( pFile ) );
+
+	ColorMgmtLutCacheFileHeader_t header;
+	if ( fread( &header, sizeof( header ), 1, pFile ) != 1 )
+		return;
+
+	const ColorMgmtLutCacheFileHeader_t expectedHeader = get_color_mgmt_lut_cache_file_header( header.uEntryCount );
+	if ( memcmp( &header, &expectedHeader, sizeof( header ) ) != 0 )
+	{
+		xwm_log.infof( "color LUT cache %s is stale, ignoring", sPath.c_str() );
+		return;
+	}
+
+	uint32_t uEntryCount = std::min<uint32_t>( header.uEntryCount, cv_color_mgmt_lut_cache_size );
+	for ( uint32_t i = 0; i < uEntryCount; i++ )
+	{
+		auto pEntry = std::make_unique<ColorMgmtLutCacheEntry_t>();
+		if ( fread( &pEntry->key, sizeof( pEntry->key ), 1, pFile ) != 1 ||
+			 fread( pEntry->lut1d, sizeof( pEntry->lut1d ), 1, pFile ) != 1 ||
+			 fread( pEntry->lut3d, sizeof( pEntry->lut3d ), 1, pFile ) != 1 )
+		{
+			xwm_log.infof( "color LUT cache %s is truncated", sPath.c_str() );
+			break;
+		}
+
+		pEntry->ulHash = hash_color_mgmt_bytes( &pEntry->key, sizeof( pEntry->key ) );
+		pEntry->ulLastUsed = ++s_ulColorMgmtLutCacheTick;
+		s_ColorMgmtLutCache.emplace_back( std::move( pEntry ) );
+	}
+
+	xwm_log.infof( "loaded %zu color LUT sets from %s", s_ColorMgmtLutCache.size(), sPath.c_str() );
+}
+
+static bool lookup_color_mgmt_lut_cache( const ColorMgmtLutCacheKey_t &key, gamescope_color_mgmt_luts &outLuts )
+{
+	if ( cv_color_mgmt_lut_cache_size == 0 )
+		return false;
+
+	const uint64_t ulHash = hash_color_mgmt_bytes( &key, sizeof( key ) );
+
+	std::unique_lock lock( s_ColorMgmtLutCacheMutex );
+	if ( !s_bColorMgmtLutCacheLoaded && cv_color_mgmt_lut_cache_persist )
+		load_color_mgmt_lut_cache_locked();
+
+	for ( auto &pEntry : s_ColorMgmtLutCache )
+	{
+		if ( pEntry->ulHash != ulHash || memcmp( &pEntry->key, &key, sizeof( key ) ) != 0 )
+			continue;
+
+		pEntry->ulLastUsed = ++s_ulColorMgmtLutCacheTick;
+		memcpy( outLuts.lut1d, pEntry->lut1d, sizeof( outLuts.lut1d ) );
+		memcpy( outLuts.lut3d, pEntry->lut3d, sizeof( outLuts.lut3d ) );
+		s_ulColorMgmtLutCacheHits++;
+		return true;
+	}
+
+	s_ulColorMgmtLutCacheMisses++;
+	return false;
+}
+
+static void insert_color_mgmt_lut_cache( const ColorMgmtLutCacheKey_t &key, const gamescope_color_mgmt_luts &luts )
+{
+	const uint32_t uMaxEntries = cv_color_mgmt_lut_cache_size;
+	if ( uMaxEntries == 0 )
+		return;
+
+	auto pEntry = std::make_unique<ColorMgmtLutCacheEntry_t>();
+	pEntry->key = key;
+	pEntry->ulHash = hash_color_mgmt_bytes( &key, sizeof( key ) );
+	memcpy( pEntry->lut1d, luts.lut1d, sizeof( pEntry->lut1d ) );
+	memcpy( pEntry->lut3d, luts.lut3d, sizeof( pEntry->lut3d ) );
+
+	std::unique_lock lock( s_ColorMgmtLutCacheMutex );
+
+	// Evict least recently used.
+	while ( s_ColorMgmtLutCache.size() >= uMaxEntries )
+	{
+		auto iter = std::min_element( s_ColorMgmtLutCache.begin(), s_ColorMgmtLutCache.end(),
+			[]( const auto &a, const auto &b ) { return a->ulLastUsed < b->ulLastUsed; } );
+		s_ColorMgmtLutCache.erase( iter );
+	}
+
+	pEntry->ulLastUsed = ++s_ulColorMgmtLutCacheTick;
+	s_ColorMgmtLutCache.emplace_back( std::move( pEntry ) );
+	s_bColorMgmtLutCacheDirty = true;
+}
+
+static void save_color_mgmt_lut_cache()
+{
+	if ( !cv_color_mgmt_lut_cache_persist )
+		return;
+
+	std::unique_lock lock( s_ColorMgmtLutCacheMutex );
+	if ( !s_bColorMgmtLutCacheDirty )
+		return;
+	s_bColorMgmtLutCacheDirty = false;
+
+	std::string sPath = GetColorMgmtLutCachePath();
+	std::error_code ec;
+	std::filesystem::create_directories( std::filesystem::path( sPath ).parent_path(), ec );
+
+	std::string sTempPath = sPath + ".tmp";
+	FILE *pFile = fopen( sTempPath.c_str(), "wb" );
+	if ( !pFile )
+	{
+		xwm_log.errorf_errno( "failed to open %s for writing", sTempPath.c_str() );
+		return;
+	}
+
+	const ColorMgmtLutCacheFileHeader_t header = get_color_mgmt_lut_cache_file_header( s_ColorMgmtLutCache.size() );
+	bool bWritten = fwrite( &header, sizeof( header ), 1, pFile ) == 1;
+	for ( auto &pEntry : s_ColorMgmtLutCache )
+	{
+		bWritten = bWritten &&
+			fwrite( &pEntry->key, sizeof( pEntry->key ), 1, pFile ) == 1 &&
+			fwrite( pEntry->lut1d, sizeof( pEntry->lut1d ), 1, pFile ) == 1 &&
+			fwrite( pEntry->lut3d, sizeof( pEntry->lut3d ), 1, pFile ) == 1;
+	}
+	fclose( pFile );
+
+	if ( !bWritten || rename( sTempPath.c_str(), sPath.c_str() ) != 0 )
+	{
+		xwm_log.errorf_errno( "failed to write color LUT cache to %s", sPath.c_str() );
+		unlink( sTempPath.c_str() );
+	}
+}
+
+static gamescope::ConCommand cc_color_mgmt_lut_cache_stats( "color_mgmt_lut_cache_stats", "Print color management LUT cache statistics.",
+[]( std::span<std::string_view> args )
+{
+	uint64_t ulHits = s_ulColorMgmtLutCacheHits;
+	uint64_t ulMisses = s_ulColorMgmtLutCacheMisses;
+	size_t uEntries = 0;
+	{
+		std::unique_lock lock( s_ColorMgmtLutCacheMutex );
+		uEntries = s_ColorMgmtLutCache.size();
+	}
+
+	console_log.infof( "Color LUT cache: %zu/%u entries, %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)",
+		uEntries, (uint32_t)cv_color_mgmt_lut_cache_size, ulHits, ulMisses,
+		ulHits + ulMisses ? 100.0 * ulHits / ( ulHits + ulMisses ) : 0.0 );
+});
+
+static gamescope::ConCommand cc_color_mgmt_lut_cache_clear( "color_mgmt_lut_cache_clear", "Drop all cached color management LUTs.",
+[]( std::span<std::string_view> args )
+{
+	std::unique_lock lock( s_ColorMgmtLutCacheMutex );
+	s_ColorMgmtLutCache.clear();
+	s_bColorMgmtLutCacheDirty = true;
+});
+
+// Computes the quantized CPU side of the LUTs only, so it is safe to call
+// off the compositor thread as long as the inputs are not shared.
 static void
-create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+calc_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt,
+	const gamescope_color_mgmt_luts overrideLuts[ EOTF_Count ], const lut3d_t looks[ EOTF_Count ], const uint64_t lookHashes[ EOTF_Count ],
+	lut1d_t &tmpLut1d, lut3d_t &tmpLut3d,
+	gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
 {
 	const displaycolorimetry_t& displayColorimetry = newColorMgmt.displayColorimetry;
 	const displaycolorimetry_t& outputEncodingColorimetry = newColorMgmt.outputEncodingColorimetry;
 
 	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
 	{
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
-			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
-
-		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
-			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
-
-		if ( g_ColorMgmtLutsOverride[nInputEOTF].HasLuts() )
+		if ( overrideLuts[nInputEOTF].HasLuts() )
 		{
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut1d, g_ColorMgmtLutsOverride[nInputEOTF].lut1d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut1d));
-			memcpy(g_ColorMgmtLuts[nInputEOTF].lut3d, g_ColorMgmtLutsOverride[nInputEOTF].lut3d, sizeof(g_ColorMgmtLutsOverride[nInputEOTF].lut3d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut1d, overrideLuts[nInputEOTF].lut1d, sizeof(overrideLuts[nInputEOTF].lut1d));
+			memcpy(outColorMgmtLuts[nInputEOTF].lut3d, overrideLuts[nInputEOTF].lut3d, sizeof(overrideLuts[nInputEOTF].lut3d));
 		}
-		else
+		else if ( ColorMgmtLutCacheKey_t cacheKey = make_color_mgmt_lut_cache_key( newColorMgmt, static_cast<EOTF>( nInputEOTF ), lookHashes[nInputEOTF] );
+				  !lookup_color_mgmt_lut_cache( cacheKey, outColorMgmtLuts[nInputEOTF] ) )
 		{
 			displaycolorimetry_t inputColorimetry{};
 			colormapping_t colorMapping{};
@@ -268,7 +595,7 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 
 			EOTF inputEOTF = static_cast<EOTF>( nInputEOTF );
 			float flGain = 1.f;
-			lut3d_t * pLook = g_ColorMgmtLooks[nInputEOTF].lutEdgeSize > 0 ? &g_ColorMgmtLooks[nInputEOTF] : nullptr;
+			const lut3d_t * pLook = looks[nInputEOTF].lutEdgeSize > 0 ? &looks[nInputEOTF] : nullptr;
 
 			if ( inputEOTF == EOTF_Gamma22 )
 			{
@@ -337,36 +664,262 @@ create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_col
 				buildPQColorimetry( &inputColorimetry, &colorMapping, displayColorimetry );
 			}
 
-			calcColorTransform<s_nLutEdgeSize3d>( &g_tmpLut1d, s_nLutSize1d, &g_tmpLut3d, inputColorimetry, inputEOTF,
+			calcColorTransform<s_nLutEdgeSize3d>( &tmpLut1d, s_nLutSize1d, &tmpLut3d, inputColorimetry, inputEOTF,
 				outputEncodingColorimetry, newColorMgmt.outputEncodingEOTF,
 				newColorMgmt.outputVirtualWhite, newColorMgmt.chromaticAdaptationMode,
 				colorMapping, newColorMgmt.nightmode, tonemapping, pLook, flGain );
 
 			// Create quantized output luts
-			for ( size_t i=0, end = g_tmpLut1d.dataR.size(); i<end; ++i )
+			for ( size_t i=0, end = tmpLut1d.dataR.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( g_tmpLut1d.dataR[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( g_tmpLut1d.dataG[i] );
-				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( g_tmpLut1d.dataB[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+0] = quantize_lut_value_16bit( tmpLut1d.dataR[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+1] = quantize_lut_value_16bit( tmpLut1d.dataG[i] );
+				outColorMgmtLuts[nInputEOTF].lut1d[4*i+2] = quantize_lut_value_16bit( tmpLut1d.dataB[i] );
 				outColorMgmtLuts[nInputEOTF].lut1d[4*i+3] = 0;
 			}
 
-			for ( size_t i=0, end = g_tmpLut3d.data.size(); i<end; ++i )
+			for ( size_t i=0, end = tmpLut3d.data.size(); i<end; ++i )
 			{
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( g_tmpLut3d.data[i].r );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( g_tmpLut3d.data[i].g );
-				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( g_tmpLut3d.data[i].b );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+0] = quantize_lut_value_16bit( tmpLut3d.data[i].r );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+1] = quantize_lut_value_16bit( tmpLut3d.data[i].g );
+				outColorMgmtLuts[nInputEOTF].lut3d[4*i+2] = quantize_lut_value_16bit( tmpLut3d.data[i].b );
 				outColorMgmtLuts[nInputEOTF].lut3d[4*i+3] = 0;
 			}
+
+			insert_color_mgmt_lut_cache( cacheKey, outColorMgmtLuts[nInputEOTF] );
 		}
 
 		outColorMgmtLuts[nInputEOTF].bHasLut1D = true;
 		outColorMgmtLuts[nInputEOTF].bHasLut3D = true;
+	}
+}
+
+static void
+create_color_mgmt_luts(const gamescope_color_mgmt_t& newColorMgmt, gamescope_color_mgmt_luts outColorMgmtLuts[ EOTF_Count ])
+{
+	calc_color_mgmt_luts( newColorMgmt, g_ColorMgmtLutsOverride, g_ColorMgmtLooks, g_ulColorMgmtLookHashes, g_tmpLut1d, g_tmpLut3d, outColorMgmtLuts );
+
+	for ( uint32_t nInputEOTF = 0; nInputEOTF < EOTF_Count; nInputEOTF++ )
+	{
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut1d)
+			outColorMgmtLuts[nInputEOTF].vk_lut1d = vulkan_create_1d_lut(s_nLutSize1d);
+
+		if (!outColorMgmtLuts[nInputEOTF].vk_lut3d)
+			outColorMgmtLuts[nInputEOTF].vk_lut3d = vulkan_create_3d_lut(s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d);
 
 		vulkan_update_luts(outColorMgmtLuts[nInputEOTF].vk_lut1d, outColorMgmtLuts[nInputEOTF].vk_lut3d, outColorMgmtLuts[nInputEOTF].lut1d, outColorMgmtLuts[nInputEOTF].lut3d);
 	}
 }
 
+///
+// Async color mgmt LUT builds
+//
+// Slider drags (SDR on HDR brightness, night mode, ...) change g_ColorMgmt every frame,
+// so rather than rebuilding the LUTs inline in paint_all, the latest request is handed
+// to a worker thread. Intermediate requests are dropped. Once a generation is computed,
+// the compositor thread uploads it into the spare set of textures without waiting, and
+// only swaps it into g_ColorMgmtLuts once the upload has completed on the GPU.
+//
+
+gamescope::ConVar<bool> cv_color_mgmt_async_luts{ "color_mgmt_async_luts", true, "Rebuild color management LUTs on a background thread instead of stalling the frame." };
+
+struct ColorMgmtLutRequest_t
+{
+	uint64_t ulEpoch = 0;
+	gamescope_color_mgmt_t colorMgmt;
+	gamescope_color_mgmt_luts overrideLuts[ EOTF_Count ];
+	lut3d_t looks[ EOTF_Count ];
+	uint64_t lookHashes[ EOTF_Count ];
+};
+
+struct ColorMgmtLutGeneration_t
+{
+	uint64_t ulEpoch = 0;
+	gamescope_color_mgmt_t colorMgmt;
+	gamescope_color_mgmt_luts luts[ EOTF_Count ];
+};
+
+static std::mutex s_ColorMgmtLutMutex;
+static std::condition_variable s_ColorMgmtLutCV;
+static std::unique_ptr<ColorMgmtLutRequest_t> s_pColorMgmtLutRequest;
+static std::unique_ptr<ColorMgmtLutGeneration_t> s_pColorMgmtLutComputed;
+
+// Compositor thread only.
+static uint64_t s_ulColorMgmtLutEpoch = 0;
+static std::optional<gamescope_color_mgmt_t> s_oColorMgmtLutRequested;
+static std::unique_ptr<ColorMgmtLutGeneration_t> s_pColorMgmtLutUploading;
+static uint64_t s_ulColorMgmtLutUploadSeq = 0;
+static gamescope::Rc<CVulkanTexture> s_ColorMgmtSpareLut1d[ EOTF_Count ];
+static gamescope::Rc<CVulkanTexture> s_ColorMgmtSpareLut3d[ EOTF_Count ];
+
+extern std::atomic<bool> hasRepaint;
+
+static void color_mgmt_lut_thread()
+{
+	pthread_setname_np( pthread_self(), "gamescope-lut" );
+
+	lut1d_t tmpLut1d;
+	lut3d_t tmpLut3d;
+
+	for ( ;; )
+	{
+		std::unique_ptr<ColorMgmtLutRequest_t> pRequest;
+		{
+			std::unique_lock lock( s_ColorMgmtLutMutex );
+			s_ColorMgmtLutCV.wait( lock, []{ return s_pColorMgmtLutRequest != nullptr; } );
+			pRequest = std::move( s_pColorMgmtLutRequest );
+		}
+
+		auto pGeneration = std::make_unique<ColorMgmtLutGeneration_t>();
+		pGeneration->ulEpoch = pRequest->ulEpoch;
+		pGeneration->colorMgmt = pRequest->colorMgmt;
+		calc_color_mgmt_luts( pRequest->colorMgmt, pRequest->overrideLuts, pRequest->looks, pRequest->lookHashes, tmpLut1d, tmpLut3d, pGeneration->luts );
+
+		{
+			std::unique_lock lock( s_ColorMgmtLutMutex );
+			s_pColorMgmtLutComputed = std::move( pGeneration );
+		}
+
+		hasRepaint = true;
+		nudge_steamcompmgr();
+	}
+}
+
+static void request_color_mgmt_luts( const gamescope_color_mgmt_t &colorMgmt )
+{
+	if ( s_oColorMgmtLutRequested && *s_oColorMgmtLutRequested == colorMgmt )
+		return;
+
+	static std::thread s_LutThread;
+	if ( !s_LutThread.joinable() )
+	{
+		s_LutThread = std::thread( color_mgmt_lut_thread );
+		s_LutThread.detach();
+	}
+
+	// Snapshot everything the worker reads, the overrides and looks can be
+	// replaced from the compositor thread at any time.
+	auto pRequest = std::make_unique<ColorMgmtLutRequest_t>();
+	pRequest->ulEpoch = s_ulColorMgmtLutEpoch;
+	pRequest->colorMgmt = colorMgmt;
+	// Not needed to build the LUTs, and we don't want the worker to be the last owner of the blob.
+	pRequest->colorMgmt.appHDRMetadata = nullptr;
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		pRequest->overrideLuts[i].bHasLut1D = g_ColorMgmtLutsOverride[i].bHasLut1D;
+		pRequest->overrideLuts[i].bHasLut3D = g_ColorMgmtLutsOverride[i].bHasLut3D;
+		if ( g_ColorMgmtLutsOverride[i].HasLuts() )
+		{
+			memcpy( pRequest->overrideLuts[i].lut1d, g_ColorMgmtLutsOverride[i].lut1d, sizeof( g_ColorMgmtLutsOverride[i].lut1d ) );
+			memcpy( pRequest->overrideLuts[i].lut3d, g_ColorMgmtLutsOverride[i].lut3d, sizeof( g_ColorMgmtLutsOverride[i].lut3d ) );
+		}
+		pRequest->looks[i] = g_ColorMgmtLooks[i];
+		pRequest->lookHashes[i] = g_ulColorMgmtLookHashes[i];
+	}
+
+	{
+		std::unique_lock lock( s_ColorMgmtLutMutex );
+		// Replaces any request the worker has not picked up yet.
+		s_pColorMgmtLutRequest = std::move( pRequest );
+	}
+	s_ColorMgmtLutCV.notify_one();
+
+	s_oColorMgmtLutRequested = colorMgmt;
+}
+
+// Drops anything in flight, used when the LUTs get rebuilt synchronously.
+static void invalidate_color_mgmt_luts_requests()
+{
+	s_ulColorMgmtLutEpoch++;
+	s_oColorMgmtLutRequested = std::nullopt;
+}
+
+static gamescope::Rc<CVulkanTexture> take_spare_lut( gamescope::Rc<CVulkanTexture> &pSpare, bool b3D )
+{
+	// If anything other than us still holds a ref, an in-flight frame might be sampling it.
+	if ( pSpare && pSpare->GetRefCount() == 1 )
+		return std::move( pSpare );
+
+	pSpare = nullptr;
+	return b3D
+		? vulkan_create_3d_lut( s_nLutEdgeSize3d, s_nLutEdgeSize3d, s_nLutEdgeSize3d )
+		: vulkan_create_1d_lut( s_nLutSize1d );
+}
+
+static uint32_t s_NextColorMgmtSerial = 0;
+
+static void swap_color_mgmt_luts( ColorMgmtLutGeneration_t &generation )
+{
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		gamescope_color_mgmt_luts &luts = g_ColorMgmtLuts[i];
+
+		if ( luts.vk_lut1d )
+			s_ColorMgmtSpareLut1d[i] = std::move( luts.vk_lut1d );
+		if ( luts.vk_lut3d )
+			s_ColorMgmtSpareLut3d[i] = std::move( luts.vk_lut3d );
+
+		memcpy( luts.lut1d, generation.luts[i].lut1d, sizeof( luts.lut1d ) );
+		memcpy( luts.lut3d, generation.luts[i].lut3d, sizeof( luts.lut3d ) );
+		luts.bHasLut1D = generation.luts[i].bHasLut1D;
+		luts.bHasLut3D = generation.luts[i].bHasLut3D;
+		luts.vk_lut1d = std::move( generation.luts[i].vk_lut1d );
+		luts.vk_lut3d = std::move( generation.luts[i].vk_lut3d );
+	}
+
+	g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
+	g_ColorMgmt.current = generation.colorMgmt;
+	// The worker never sees the metadata blob, it doesn't affect the LUTs.
+	g_ColorMgmt.current.appHDRMetadata = g_ColorMgmt.pending.appHDRMetadata;
+}
+
+static bool poll_color_mgmt_luts()
+{
+	if ( s_pColorMgmtLutUploading )
+	{
+		if ( !vulkan_is_sequence_complete( s_ulColorMgmtLutUploadSeq ) )
+			return false;
+
+		std::unique_ptr<ColorMgmtLutGeneration_t> pGeneration = std::move( s_pColorMgmtLutUploading );
+		if ( pGeneration->ulEpoch != s_ulColorMgmtLutEpoch )
+			return false;
+
+		swap_color_mgmt_luts( *pGeneration );
+		return true;
+	}
+
+	std::unique_ptr<ColorMgmtLutGeneration_t> pGeneration;
+	{
+		std::unique_lock lock( s_ColorMgmtLutMutex );
+		pGeneration = std::move( s_pColorMgmtLutComputed );
+	}
+
+	if ( !pGeneration || pGeneration->ulEpoch != s_ulColorMgmtLutEpoch )
+		return false;
+
+	uint64_t ulSeq = 0;
+	for ( uint32_t i = 0; i < EOTF_Count; i++ )
+	{
+		gamescope_color_mgmt_luts &luts = pGeneration->luts[i];
+		luts.vk_lut1d = take_spare_lut( s_ColorMgmtSpareLut1d[i], false );
+		luts.vk_lut3d = take_spare_lut( s_ColorMgmtSpareLut3d[i], true );
+		ulSeq = vulkan_upload_luts( luts.vk_lut1d, luts.vk_lut3d, luts.lut1d, luts.lut3d );
+	}
+
+	s_pColorMgmtLutUploading = std::move( pGeneration );
+	s_ulColorMgmtLutUploadSeq = ulSeq;
+	return false;
+}
+
+static bool color_mgmt_luts_pending()
+{
+	if ( s_pColorMgmtLutUploading )
+		return true;
+
+	std::unique_lock lock( s_ColorMgmtLutMutex );
+	return s_pColorMgmtLutComputed != nullptr;
+}
+
 gamescope::ConVar<bool> cv_tearing_enabled{ "tearing_enabled", false, "Whether or not tearing is enabled." };
 int g_nSteamMaxHeight = 0;
 bool g_bVRRCapable_CachedValue = false;
@@ -391,14 +944,26 @@ update_color_mgmt()
 	g_ColorMgmt.pending.flInternalDisplayBrightness =
 		GetBackend()->GetCurrentConnector()->GetHDRInfo().uMaxContentLightLevel;
 
+	poll_color_mgmt_luts();
+
 #ifdef COLOR_MGMT_MICROBENCH
 	struct timespec t0, t1;
 #else
 	// check if any part of our color mgmt stack is dirty
 	if ( g_ColorMgmt.pending == g_ColorMgmt.current && g_ColorMgmt.serial != 0 )
 		return;
+
+	// The first build stays synchronous so we never present without LUTs,
+	// and disabling color mgmt is just a reset.
+	if ( cv_color_mgmt_async_luts && g_ColorMgmt.serial != 0 && g_ColorMgmt.pending.enabled )
+	{
+		request_color_mgmt_luts( g_ColorMgmt.pending );
+		return;
+	}
 #endif
 
+	invalidate_color_mgmt_luts_requests();
+
 #ifdef COLOR_MGMT_MICROBENCH
 	clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
 #endif
@@ -435,8 +1000,6 @@ update_color_mgmt()
 	}
 #endif
 
-	static uint32_t s_NextColorMgmtSerial = 0;
-
 	g_ColorMgmt.serial = ++s_NextColorMgmtSerial;
 	g_ColorMgmt.current = g_ColorMgmt.pending;
 }
@@ -689,6 +1252,7 @@ bool set_color_shaperlut_override(const char *path)
 bool set_color_look_pq(const char *path)
 {
 	LoadCubeLut( &g_ColorMgmtLooks[EOTF_PQ], path );
+	g_ulColorMgmtLookHashes[EOTF_PQ] = hash_color_mgmt_look( g_ColorMgmtLooks[EOTF_PQ] );
 	g_ColorMgmt.pending.externalDirtyCtr++;
 	return true;
 }
@@ -696,6 +1260,7 @@ bool set_color_look_pq(const char *path)
 bool set_color_look_g22(const char *path)
 {
 	LoadCubeLut( &g_ColorMgmtLooks[EOTF_Gamma22], path );
+	g_ulColorMgmtLookHashes[EOTF_Gamma22] = hash_color_mgmt_look( g_ColorMgmtLooks[EOTF_Gamma22] );
 	g_ColorMgmt.pending.externalDirtyCtr++;
 	return true;
 }
@@ -1067,41 +1632,85 @@ static std::atomic<bool> g_bForceRepaint{false};
 
 extern int g_nCursorScaleHeight;
 
-// poor man's semaphore
-class sem
+enum StatsRecordType_t : uint32_t
 {
-public:
-	void wait( void )
-	{
-		std::unique_lock<std::mutex> lock(mtx);
-
-		while(count == 0){
-			cv.wait(lock);
-		}
-		count--;
-	}
+	STATS_RECORD_FPS         = 0, // flValue: frames per second
+	STATS_RECORD_FOCUS_STEAM = 1,
+	STATS_RECORD_FOCUS_APP   = 2, // uValue: app id, 0 if none
+	STATS_RECORD_DROPPED     = 3, // uValue: records dropped since the last one of these
+	STATS_RECORD_SHM_UPLOAD  = 4, // uValue: bytes of SHM buffers uploaded for this frame
+};
 
-	void signal( void )
+// This is also exactly what gets written out with --stats-format binary (native endian).
+struct StatsRecord_t
+{
+	uint64_t ulTime = 0;
+	uint32_t eType = 0;
+	union
 	{
-		std::unique_lock<std::mutex> lock(mtx);
-		count++;
-		cv.notify_one();
-	}
+		float flValue = 0.0f;
+		uint32_t uValue;
+	};
+};
+static_assert( sizeof( StatsRecord_t ) == 16 );
 
-private:
-	std::mutex mtx;
-	std::condition_variable cv;
-	int count = 0;
+enum class StatsFormat
+{
+	Text,
+	JSON,
+	Binary,
 };
 
-sem statsThreadSem;
-std::mutex statsEventQueueLock;
-std::vector< std::string > statsEventQueue;
+// Filled by the paint loop only, drained by the stats thread.
+static gamescope::SPSCRing<StatsRecord_t, 256> s_StatsRing;
+static std::atomic<uint32_t> s_uStatsDoorbell = { 0 };
 
 std::string statsThreadPath;
 int			statsPipeFD = -1;
+static StatsFormat s_eStatsFormat = StatsFormat::Text;
+
+std::atomic<bool> statsThreadRun = { false };
 
-bool statsThreadRun;
+static void stats_write_record( const StatsRecord_t &record )
+{
+	switch ( s_eStatsFormat )
+	{
+		case StatsFormat::Text:
+			switch ( record.eType )
+			{
+				case STATS_RECORD_FPS:         dprintf( statsPipeFD, "fps=%f\n", record.flValue ); break;
+				case STATS_RECORD_FOCUS_STEAM: dprintf( statsPipeFD, "focus=steam\n" ); break;
+				case STATS_RECORD_FOCUS_APP:   dprintf( statsPipeFD, "focus=%u\n", record.uValue ); break;
+				case STATS_RECORD_DROPPED:     dprintf( statsPipeFD, "dropped=%u\n", record.uValue ); break;
+				case STATS_RECORD_SHM_UPLOAD:  dprintf( statsPipeFD, "shm_upload_bytes=%u\n", record.uValue ); break;
+			}
+			break;
+		case StatsFormat::JSON:
+			switch ( record.eType )
+			{
+				case STATS_RECORD_FPS:
+					dprintf( statsPipeFD, "{\"time\":%" PRIu64 ",\"fps\":%f}\n", record.ulTime, record.flValue );
+					break;
+				case STATS_RECORD_FOCUS_STEAM:
+					dprintf( statsPipeFD, "{\"time\":%" PRIu64 ",\"focus\":\"steam\"}\n", record.ulTime );
+					break;
+				case STATS_RECORD_FOCUS_APP:
+					dprintf( statsPipeFD, "{\"time\":%" PRIu64 ",\"focus\":%u}\n", record.ulTime, record.uValue );
+					break;
+				case STATS_RECORD_DROPPED:
+					dprintf( statsPipeFD, "{\"time\":%" PRIu64 ",\"dropped\":%u}\n", record.ulTime, record.uValue );
+					break;
+				case STATS_RECORD_SHM_UPLOAD:
+					dprintf( statsPipeFD, "{\"time\":%" PRIu64 ",\"shm_upload_bytes\":%u}\n", record.ulTime, record.uValue );
+					break;
+			}
+			break;
+		case StatsFormat::Binary:
+			// Short writes/EPIPE are ignored, same as dprintf.
+			(void) !write( statsPipeFD, &record, sizeof( record ) );
+			break;
+	}
+}
 
 void statsThreadMain( void )
 {
@@ -1118,62 +1727,71 @@ void statsThreadMain( void )
 		}
 	}
 
-wait:
-	statsThreadSem.wait();
-
-	if ( statsThreadRun == false )
+	uint64_t ulReportedDropped = 0;
+	while ( statsThreadRun )
 	{
-		return;
-	}
+		uint32_t uDoorbell = s_uStatsDoorbell.load( std::memory_order_acquire );
 
-	std::string event;
+		while ( std::optional<StatsRecord_t> oRecord = s_StatsRing.TryPop() )
+			stats_write_record( *oRecord );
 
-retry:
-	{
-		std::unique_lock< std::mutex > lock( statsEventQueueLock );
-
-		if( statsEventQueue.empty() )
+		uint64_t ulDropped = s_StatsRing.GetDroppedCount();
+		if ( ulDropped != ulReportedDropped )
 		{
-			goto wait;
+			stats_write_record( StatsRecord_t
+			{
+				.ulTime = get_time_in_nanos(),
+				.eType  = STATS_RECORD_DROPPED,
+				.uValue = uint32_t( std::min<uint64_t>( ulDropped - ulReportedDropped, UINT32_MAX ) ),
+			} );
+			ulReportedDropped = ulDropped;
 		}
 
-		event = statsEventQueue[ 0 ];
-		statsEventQueue.erase( statsEventQueue.begin() );
+		s_uStatsDoorbell.wait( uDoorbell, std::memory_order_acquire );
 	}
+}
 
-	dprintf( statsPipeFD, "%s", event.c_str() );
-
-	goto retry;
+static void stats_wake_thread()
+{
+	s_uStatsDoorbell.fetch_add( 1, std::memory_order_release );
+	s_uStatsDoorbell.notify_one();
 }
 
-static inline void stats_printf( const char* format, ...)
+static inline void stats_push( StatsRecord_t record )
 {
-	static char buffer[256];
-	static std::string eventstr;
+	if ( !statsThreadRun.load( std::memory_order_relaxed ) )
+		return;
 
-	va_list args;
-	va_start(args, format);
-	vsprintf(buffer,format, args);
-	va_end(args);
+	record.ulTime = get_time_in_nanos();
+	if ( s_StatsRing.TryPush( record ) )
+		stats_wake_thread();
+}
 
-	eventstr = buffer;
+static std::optional<StatsFormat> parse_stats_format( std::string_view svFormat )
+{
+	if ( svFormat == "text" )
+		return StatsFormat::Text;
+	else if ( svFormat == "json" )
+		return StatsFormat::JSON;
+	else if ( svFormat == "binary" )
+		return StatsFormat::Binary;
+	return std::nullopt;
+}
 
+static gamescope::ConCommand cc_stats_info( "stats_info", "Print the state of the --stats-path writer.",
+[]( std::span<std::string_view> args )
+{
+	if ( !statsThreadRun )
 	{
-		{
-			std::unique_lock< std::mutex > lock( statsEventQueueLock );
-
-			if( statsEventQueue.size() > 50 )
-			{
-				// overflow, drop event
-				return;
-			}
-
-			statsEventQueue.push_back( eventstr );
-
-			statsThreadSem.signal();
-		}
+		console_log.infof( "Stats writer is not running." );
+		return;
 	}
-}
+
+	static constexpr const char *k_pszFormats[] = { "text", "json", "binary" };
+	console_log.infof( "Stats writer: path %s (%s), format %s, %" PRIu64 " records dropped",
+		statsThreadPath.c_str(), statsPipeFD == -1 ? "not opened yet" : "open",
+		k_pszFormats[ (uint32_t)s_eStatsFormat ], s_StatsRing.GetDroppedCount() );
+});
 
 uint64_t get_time_in_nanos()
 {
@@ -1210,58 +1828,114 @@ bool xwayland_ctx_t::HasQueuedEvents()
 	return XEventsQueued( dpy, QueuedAlready ) != 0;
 }
 
+// Window or child window we already know the toplevel of, without asking the server.
 static steamcompmgr_win_t *
-find_win(xwayland_ctx_t *ctx, Window id, bool find_children = true)
+find_known_win(xwayland_ctx_t *ctx, Window id)
 {
-	steamcompmgr_win_t	*w;
+	if ( steamcompmgr_win_t **ppWindow = ctx->windowsById.Find( id ) )
+		return *ppWindow;
 
-	if (id == None)
+	if ( Window *pToplevel = ctx->toplevelByChild.Find( id ) )
 	{
-		return NULL;
+		if ( steamcompmgr_win_t **ppWindow = ctx->windowsById.Find( *pToplevel ) )
+			return *ppWindow;
 	}
 
-	for (w = ctx->list; w; w = w->xwayland().next)
+	return nullptr;
+}
+
+// Walks up from a child window we know nothing about until we hit one we do.
+static steamcompmgr_win_t *
+find_win_query_parents(xwayland_ctx_t *ctx, Window id)
+{
+	Window child = id;
+	for (;;)
 	{
-		if (w->xwayland().id == id)
+		Window root = None;
+		Window parent = None;
+		Window *children = NULL;
+		unsigned int childrenCount;
+		XQueryTree(ctx->dpy, child, &root, &parent, &children, &childrenCount);
+		if (children)
+			XFree(children);
+
+		if (root == parent || parent == None)
 		{
-			return w;
+			return NULL;
 		}
+
+		if ( steamcompmgr_win_t *w = find_known_win( ctx, parent ) )
+			return w;
+
+		child = parent;
+	}
+}
+
+static steamcompmgr_win_t *
+find_win(xwayland_ctx_t *ctx, Window id, bool find_children = true)
+{
+	if (id == None)
+	{
+		return NULL;
 	}
 
 	if ( !find_children )
-		return nullptr;
+	{
+		steamcompmgr_win_t **ppWindow = ctx->windowsById.Find( id );
+		return ppWindow ? *ppWindow : nullptr;
+	}
 
-	// Didn't find, must be a children somewhere; try again with parent.
-	Window root = None;
-	Window parent = None;
-	Window *children = NULL;
-	unsigned int childrenCount;
-	XQueryTree(ctx->dpy, id, &root, &parent, &children, &childrenCount);
-	if (children)
-		XFree(children);
+	if ( steamcompmgr_win_t *w = find_known_win( ctx, id ) )
+		return w;
 
-	if (root == parent || parent == None)
+	// Didn't find, must be a child somewhere we haven't been told about
+	// (eg. a grandchild of a toplevel); ask once and remember the answer.
+	steamcompmgr_win_t *w = find_win_query_parents( ctx, id );
+	if ( w )
 	{
-		return NULL;
+		std::unique_lock lock( ctx->list_mutex );
+		ctx->toplevelByChild.Insert( id, w->xwayland().id );
 	}
 
-	return find_win(ctx, parent);
+	return w;
 }
 
 static steamcompmgr_win_t * find_win( xwayland_ctx_t *ctx, struct wlr_surface *surf )
 {
+	steamcompmgr_win_t **ppCached = ctx->windowsBySurface.Find( surf );
+	if ( ppCached )
+	{
+		steamcompmgr_win_t *w = *ppCached;
+		if ( w->xwayland().surface.main_surface == surf || w->xwayland().surface.override_surface == surf )
+			return w;
+	}
+
 	steamcompmgr_win_t	*w = nullptr;
 
 	for (w = ctx->list; w; w = w->xwayland().next)
 	{
-		if ( w->xwayland().surface.main_surface == surf )
-			return w;
+		if ( w->xwayland().surface.main_surface == surf || w->xwayland().surface.override_surface == surf )
+			break;
+	}
 
-		if ( w->xwayland().surface.override_surface == surf )
-			return w;
+	if ( w || ppCached )
+	{
+		std::unique_lock lock( ctx->list_mutex );
+		if ( w )
+			ctx->windowsBySurface.Insert( surf, w );
+		else
+			ctx->windowsBySurface.Erase( surf );
 	}
 
-	return nullptr;
+	return w;
+}
+
+// The toplevel a window is, or is in, if we know it.
+static Window
+find_known_toplevel(xwayland_ctx_t *ctx, Window id)
+{
+	steamcompmgr_win_t *w = find_known_win( ctx, id );
+	return w ? w->xwayland().id : None;
 }
 
 static gamescope::CBufferMemoizer s_BufferMemos;
@@ -1277,7 +1951,8 @@ import_commit (
 	std::vector<struct wl_resource*> presentation_feedbacks,
 	std::optional<uint32_t> present_id,
 	uint64_t desired_present_time,
-	bool fifo )
+	bool fifo,
+	const std::optional<std::vector<pixman_box32_t>> &oBufferDamage )
 {
 	gamescope::Rc<commit_t> commit = new commit_t;
 
@@ -1293,10 +1968,58 @@ import_commit (
 	commit->present_id = present_id;
 	commit->desired_present_time = desired_present_time;
 
+	// Chain the buffer damage onto the surface's previous commit, for partial composition.
+	if ( oBufferDamage )
+	{
+		for ( auto iter = w->commit_queue.rbegin(); iter != w->commit_queue.rend(); iter++ )
+		{
+			const gamescope::Rc<commit_t> &pPrevCommit = *iter;
+			if ( pPrevCommit->surf != surf )
+				continue;
+
+			gamescope::DamageRect_t rDamage;
+			for ( const pixman_box32_t &box : *oBufferDamage )
+				rDamage = rDamage.Union( gamescope::DamageRect_t{ box.x1, box.y1, box.x2, box.y2 } );
+
+			commit->damageHistory.Chain( pPrevCommit->damageHistory, pPrevCommit->commitID, rDamage );
+			break;
+		}
+	}
+
 	if ( gamescope::OwningRc<CVulkanTexture> pTexture = s_BufferMemos.LookupVulkanTexture( buf ) )
 	{
 		// Going from OwningRc -> Rc now.
 		commit->vulkanTex = pTexture;
+
+		// A SHM buffer the client drew into again, copy over only what changed
+		// since we last did, which may have been several commits ago.
+		struct wlr_dmabuf_attributes dmabuf = {0};
+		if ( !wlr_buffer_get_dmabuf( buf, &dmabuf ) )
+		{
+			std::optional<std::vector<pixman_box32_t>> oTextureDamage = s_BufferMemos.TakeBufferDamage( buf, surf );
+
+			std::vector<VkRect2D> damage;
+			if ( oTextureDamage )
+			{
+				const int32_t nWidth = int32_t( pTexture->width() );
+				const int32_t nHeight = int32_t( pTexture->height() );
+				for ( const pixman_box32_t &box : *oTextureDamage )
+				{
+					int32_t x1 = std::clamp( box.x1, 0, nWidth ), y1 = std::clamp( box.y1, 0, nHeight );
+					int32_t x2 = std::clamp( box.x2, 0, nWidth ), y2 = std::clamp( box.y2, 0, nHeight );
+					if ( x2 > x1 && y2 > y1 )
+						damage.push_back( VkRect2D{ { x1, y1 }, { uint32_t( x2 - x1 ), uint32_t( y2 - y1 ) } } );
+				}
+			}
+			else
+			{
+				damage.push_back( VkRect2D{ { 0, 0 }, { pTexture->width(), pTexture->height() } } );
+			}
+
+			if ( !vulkan_update_texture_from_wlr_buffer( commit->vulkanTex, buf, damage ) )
+				xwm_log.errorf( "Failed to update texture from SHM buffer" );
+		}
+
 		return commit;
 	}
 
@@ -1310,7 +2033,7 @@ import_commit (
 	gamescope::OwningRc<CVulkanTexture> pOwnedTexture = vulkan_create_texture_from_wlr_buffer( buf, std::move( pBackendFb ) );
 	commit->vulkanTex = pOwnedTexture;
 
-	s_BufferMemos.MemoizeBuffer( buf, std::move( pOwnedTexture ) );
+	s_BufferMemos.MemoizeBuffer( buf, std::move( pOwnedTexture ), surf );
 
 	return commit;
 }
@@ -1979,6 +2702,13 @@ paint_window_commit( const gamescope::Rc<commit_t> &lastCommit, steamcompmgr_win
 
 	layer->tex = lastCommit->GetTexture( layer->filter, g_upscaleScaler, layer->colorspace );
 
+	// Preemptively upscaled textures don't line up with the commit's damage.
+	if ( layer->tex == lastCommit->vulkanTex )
+	{
+		layer->commitID = lastCommit->commitID;
+		layer->damageHistory = lastCommit->damageHistory;
+	}
+
 	if ( flags & PaintWindowFlag::NoScale )
 	{
 		sourceWidth = currentOutputWidth;
@@ -2320,6 +3050,8 @@ paint_all( global_focus_t *pFocus, bool async )
 
 	paintID++;
 	gpuvis_trace_begin_ctx_printf( paintID, "paint_all" );
+
+	gamescope::CFrameTelemetry::Get().BeginFrame( g_SteamCompMgrVBlankTime );
 	steamcompmgr_win_t	*w;
 	steamcompmgr_win_t	*overlay;
 	steamcompmgr_win_t *externalOverlay;
@@ -2343,18 +3075,23 @@ paint_all( global_focus_t *pFocus, bool async )
 		lastSampledFrameTime = currentTime;
 		frameCounter = 0;
 
-		stats_printf( "fps=%f\n", currentFrameRate );
+		stats_push( StatsRecord_t{ .eType = STATS_RECORD_FPS, .flValue = currentFrameRate } );
 
 		if ( window_is_steam( w ) )
 		{
-			stats_printf( "focus=steam\n" );
+			stats_push( StatsRecord_t{ .eType = STATS_RECORD_FOCUS_STEAM } );
 		}
 		else
 		{
-			stats_printf( "focus=%i\n", w ? w->appID : 0 );
+			stats_push( StatsRecord_t{ .eType = STATS_RECORD_FOCUS_APP, .uValue = w ? w->appID : 0 } );
 		}
 	}
 
+	if ( uint64_t ulShmUploadBytes = vulkan_take_shm_upload_bytes() )
+	{
+		stats_push( StatsRecord_t{ .eType = STATS_RECORD_SHM_UPLOAD, .uValue = uint32_t( std::min<uint64_t>( ulShmUploadBytes, UINT32_MAX ) ) } );
+	}
+
 	struct FrameInfo_t frameInfo = {};
 	frameInfo.applyOutputColorMgmt = g_ColorMgmt.pending.enabled;
 	frameInfo.outputEncodingEOTF = g_ColorMgmt.pending.outputEncodingEOTF;
@@ -2636,6 +3373,23 @@ paint_all( global_focus_t *pFocus, bool async )
 		return;
 	}
 
+	{
+		GamescopeUpscaleFilter eUpscaler = frameInfo.layerCount ? frameInfo.layers[0].filter : GamescopeUpscaleFilter::LINEAR;
+		if ( frameInfo.useFSRLayer0 )
+			eUpscaler = GamescopeUpscaleFilter::FSR;
+		else if ( frameInfo.useNISLayer0 )
+			eUpscaler = GamescopeUpscaleFilter::NIS;
+
+		frame_timing_record_frame( g_uCurrentBasePlaneCommitID, g_SteamCompMgrVBlankTime.ulWakeupTime, get_time_in_nanos(),
+			g_SteamCompMgrVBlankTime.schedule.ulTargetVBlank, GetVBlankTimer().WasCompositing(), g_bCurrentBasePlaneIsFifo, eUpscaler );
+	}
+
+	{
+		gamescope::FrameTelemetryRecord_t telemetryRecord =
+			gamescope::CFrameTelemetry::Get().EndFrame( GetVBlankTimer().WasCompositing(), g_SteamCompMgrAppRefreshCycle );
+		wlserver_send_frame_timing( telemetryRecord );
+	}
+
 	std::optional<gamescope::GamescopeScreenshotInfo> oScreenshotInfo =
 		gamescope::CScreenshotManager::Get().ProcessPendingScreenshot();
 
@@ -2766,37 +3520,23 @@ paint_all( global_focus_t *pFocus, bool async )
 				}
 			}
 
-			std::thread screenshotThread = std::thread([=] {
+			std::thread screenshotThread = std::thread([=]() mutable {
 				pthread_setname_np( pthread_self(), "gamescope-scrsh" );
 
 				const uint8_t *mappedData = pScreenshotTexture->mappedData();
+				const uint32_t uWidth = pScreenshotTexture->width();
+				const uint32_t uHeight = pScreenshotTexture->height();
+				const uint32_t uEncodeThreads = uint32_t( std::max( cv_screenshot_encode_threads.Get(), 0 ) );
 
 				bool bScreenshotSuccess = false;
 
 				if ( pScreenshotTexture->format() == VK_FORMAT_A2R10G10B10_UNORM_PACK32 )
 				{
-					// Make our own copy of the image to remove the alpha channel.
-					constexpr uint32_t kCompCnt = 3;
-					auto imageData = std::vector<uint16_t>( g_nOutputWidth * g_nOutputHeight * kCompCnt );
-
-					for (uint32_t y = 0; y < g_nOutputHeight; y++)
-					{
-						for (uint32_t x = 0; x < g_nOutputWidth; x++)
-						{
-							uint32_t *pInPixel = (uint32_t *)&mappedData[(y * pScreenshotTexture->rowPitch()) + x * (32 / 8)];
-							uint32_t uInPixel = *pInPixel;
-
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 0] = (uInPixel & (0b1111111111 << 20)) >> 20;
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 1] = (uInPixel & (0b1111111111 << 10)) >> 10;
-							imageData[y * g_nOutputWidth * kCompCnt + x * kCompCnt + 2] = (uInPixel & (0b1111111111 << 0))  >> 0;
-						}
-					}
-
 					assert( HAVE_AVIF );
 #if HAVE_AVIF
 					avifResult avifResult = AVIF_RESULT_OK;
 
-					avifImage *pAvifImage = avifImageCreate( g_nOutputWidth, g_nOutputHeight, 10, AVIF_PIXEL_FORMAT_YUV444 );
+					avifImage *pAvifImage = avifImageCreate( uWidth, uHeight, 10, AVIF_PIXEL_FORMAT_YUV444 );
 					defer( avifImageDestroy( pAvifImage ) );
 					pAvifImage->yuvRange = AVIF_RANGE_FULL;
 					pAvifImage->colorPrimaries = bHDRScreenshot ? AVIF_COLOR_PRIMARIES_BT2020 : AVIF_COLOR_PRIMARIES_BT709;
@@ -2820,25 +3560,36 @@ paint_all( global_focus_t *pFocus, bool async )
 						pAvifImage->clli.maxPALL = maxFALLNits;
 					}
 
-					avifRGBImage rgbAvifImage{};
-					avifRGBImageSetDefaults( &rgbAvifImage, pAvifImage );
-					rgbAvifImage.format = AVIF_RGB_FORMAT_RGB;
-					rgbAvifImage.ignoreAlpha = AVIF_TRUE;
-
-					rgbAvifImage.pixels = (uint8_t *)imageData.data();
-					rgbAvifImage.rowBytes = g_nOutputWidth * kCompCnt * sizeof( uint16_t );
-
-					if ( ( avifResult = avifImageRGBToYUV( pAvifImage, &rgbAvifImage ) ) != AVIF_RESULT_OK ) // Not really! See Matrix Coefficients IDENTITY above.
+					if ( ( avifResult = avifImageAllocatePlanes( pAvifImage, AVIF_PLANES_YUV ) ) != AVIF_RESULT_OK )
 					{
-						xwm_log.errorf( "Failed to convert RGB to YUV: %u", avifResult );
+						xwm_log.errorf( "Failed to allocate avif planes: %u", avifResult );
 						return;
 					}
 
+					// With IDENTITY coefficients the planes are just G, B, R, so unpack
+					// straight into them rather than going through avifImageRGBToYUV.
+					const uint32_t uRowPitch = pScreenshotTexture->rowPitch();
+					gamescope::ParallelForRows( uHeight, uEncodeThreads, [&]( uint32_t uFirstRow, uint32_t uEndRow )
+					{
+						gamescope::UnpackX2RGB10ToPlanes(
+							reinterpret_cast<uint16_t *>( pAvifImage->yuvPlanes[AVIF_CHAN_V] ), pAvifImage->yuvRowBytes[AVIF_CHAN_V],
+							reinterpret_cast<uint16_t *>( pAvifImage->yuvPlanes[AVIF_CHAN_Y] ), pAvifImage->yuvRowBytes[AVIF_CHAN_Y],
+							reinterpret_cast<uint16_t *>( pAvifImage->yuvPlanes[AVIF_CHAN_U] ), pAvifImage->yuvRowBytes[AVIF_CHAN_U],
+							mappedData, uRowPitch, uWidth, uFirstRow, uEndRow );
+					});
+
+					// Give the image back to the pool before the slow part.
+					pScreenshotTexture = nullptr;
+					mappedData = nullptr;
+
 					avifEncoder *pEncoder = avifEncoderCreate();
 					defer( avifEncoderDestroy( pEncoder ) );
 					pEncoder->quality = AVIF_QUALITY_LOSSLESS;
 					pEncoder->qualityAlpha = AVIF_QUALITY_LOSSLESS;
 					pEncoder->speed = AVIF_SPEED_FASTEST;
+					pEncoder->maxThreads = uEncodeThreads ? int( uEncodeThreads ) : int( std::clamp( std::thread::hardware_concurrency(), 1u, 8u ) );
+					// Lets the codec split the frame into tiles it can encode on those threads.
+					pEncoder->autoTiling = AVIF_TRUE;
 
 					if ( ( avifResult = avifEncoderAddImage( pEncoder, pAvifImage, 1, AVIF_ADD_IMAGE_FLAG_SINGLE ) ) != AVIF_RESULT_OK )
 					{
@@ -2871,21 +3622,28 @@ paint_all( global_focus_t *pFocus, bool async )
 				else if (pScreenshotTexture->format() == VK_FORMAT_B8G8R8A8_UNORM)
 				{
 					// Make our own copy of the image to remove the alpha channel.
-					auto imageData = std::vector<uint8_t>(currentOutputWidth * currentOutputHeight * 4);
-					const uint32_t comp = 4;
-					const uint32_t pitch = currentOutputWidth * comp;
-					for (uint32_t y = 0; y < currentOutputHeight; y++)
+					const uint32_t pitch = uWidth * 4;
+					auto imageData = std::vector<uint8_t>( pitch * uHeight );
+					const uint32_t uRowPitch = pScreenshotTexture->rowPitch();
+					gamescope::ParallelForRows( uHeight, uEncodeThreads, [&]( uint32_t uFirstRow, uint32_t uEndRow )
 					{
-						for (uint32_t x = 0; x < currentOutputWidth; x++)
-						{
-							// BGR...
-							imageData[y * pitch + x * comp + 0] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 2];
-							imageData[y * pitch + x * comp + 1] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 1];
-							imageData[y * pitch + x * comp + 2] = mappedData[y * pScreenshotTexture->rowPitch() + x * comp + 0];
-							imageData[y * pitch + x * comp + 3] = 255;
-						}
-					}
-					if ( stbi_write_png( oScreenshotInfo->szScreenshotPath.c_str(), currentOutputWidth, currentOutputHeight, 4, imageData.data(), pitch ) )
+						gamescope::SwizzleBGRXToRGBA( imageData.data(), pitch, mappedData, uRowPitch, uWidth, uFirstRow, uEndRow );
+					});
+
+					pScreenshotTexture = nullptr;
+					mappedData = nullptr;
+
+					std::vector<uint8_t> png = gamescope::EncodePNG( gamescope::PNGEncodeDesc_t
+					{
+						.pPixels = imageData.data(),
+						.zPitch = pitch,
+						.uWidth = uWidth,
+						.uHeight = uHeight,
+						.nCompressionLevel = std::clamp<int>( cv_screenshot_png_compression, 0, 9 ),
+						.uThreadCount = uEncodeThreads,
+					});
+
+					if ( !png.empty() && gamescope::WriteFile( oScreenshotInfo->szScreenshotPath.c_str(), png ) )
 					{
 						xwm_log.infof( "Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str() );
 						bScreenshotSuccess = true;
@@ -2903,129 +3661,342 @@ paint_all( global_focus_t *pFocus, bool async )
 						fwrite(mappedData, 1, pScreenshotTexture->totalSize(), file );
 						fclose(file);
 
-						char cmd[4096];
-						sprintf(cmd, "ffmpeg -f rawvideo -pixel_format nv12 -video_size %dx%d -i %s %s_encoded.png", pScreenshotTexture->width(), pScreenshotTexture->height(), oScreenshotInfo->szScreenshotPath.c_str(), oScreenshotInfo->szScreenshotPath.c_str() );
+						// Also write out something that can be looked at without ffmpeg.
+						EStreamColorspace eColorspace = pScreenshotTexture->streamColorspace();
+						gamescope::YCbCrMatrix eMatrix = ( eColorspace == k_EStreamColorspace_BT709 || eColorspace == k_EStreamColorspace_BT709_Full )
+							? gamescope::YCbCrMatrix::BT709
+							: gamescope::YCbCrMatrix::BT601;
+						bool bFullRange = eColorspace == k_EStreamColorspace_BT601_Full || eColorspace == k_EStreamColorspace_BT709_Full;
+
+						const uint32_t pitch = uWidth * 4;
+						auto imageData = std::vector<uint8_t>( pitch * uHeight );
+						const uint8_t *pLuma = mappedData + pScreenshotTexture->lumaOffset();
+						const uint8_t *pChroma = mappedData + pScreenshotTexture->chromaOffset();
+						const uint32_t uLumaPitch = pScreenshotTexture->lumaRowPitch();
+						const uint32_t uChromaPitch = pScreenshotTexture->chromaRowPitch();
+						gamescope::ParallelForRows( uHeight, uEncodeThreads, [&]( uint32_t uFirstRow, uint32_t uEndRow )
+						{
+							gamescope::ConvertNV12ToRGBA( imageData.data(), pitch, pLuma, uLumaPitch, pChroma, uChromaPitch, eMatrix, bFullRange, uWidth, uFirstRow, uEndRow );
+						});
+
+						pScreenshotTexture = nullptr;
+						mappedData = nullptr;
+
+						std::vector<uint8_t> png = gamescope::EncodePNG( gamescope::PNGEncodeDesc_t
+						{
+							.pPixels = imageData.data(),
+							.zPitch = pitch,
+							.uWidth = uWidth,
+							.uHeight = uHeight,
+							.nCompressionLevel = std::clamp<int>( cv_screenshot_png_compression, 0, 9 ),
+							.uThreadCount = uEncodeThreads,
+						});
+
+						std::string szEncodedPath = oScreenshotInfo->szScreenshotPath + "_encoded.png";
+						if ( !png.empty() && gamescope::WriteFile( szEncodedPath.c_str(), png ) )
+						{
+							xwm_log.infof("Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str());
+							bScreenshotSuccess = true;
+						}
+						else
+						{
+							xwm_log.errorf( "Failed to save screenshot to %s", szEncodedPath.c_str() );
+						}
+					}
+					else
+					{
+						xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
+					}
+				}
+
+				if ( oScreenshotInfo->bX11PropertyRequested )
+				{
+					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
+					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+				}
+
+				if ( bScreenshotSuccess && oScreenshotInfo->bWaylandRequested )
+				{
+						wlserver_lock();
+						for ( const auto &control : wlserver.gamescope_controls )
+						{
+							gamescope_control_send_screenshot_taken( control, oScreenshotInfo->szScreenshotPath.c_str() );
+						}
+						wlserver_unlock();
+				}
+			});
+
+			screenshotThread.detach();
+		}
+		else
+		{
+			xwm_log.errorf( "Oh no, we ran out of screenshot images. Not actually writing a screenshot." );
+			if ( oScreenshotInfo->bX11PropertyRequested )
+			{
+				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
+				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
+			}
+		}
+	}
+
+
+	gpuvis_trace_end_ctx_printf( paintID, "paint_all" );
+	gpuvis_trace_printf( "paint_all %i layers", (int)frameInfo.layerCount );
+}
+
+// How often we wait on the X server for window properties, see xwayland_property_stats.
+struct XPropertyStats_t
+{
+	std::atomic<uint64_t> ulRoundTrips = { 0 };
+	std::atomic<uint64_t> ulPropertiesFetched = { 0 };
+	std::atomic<uint64_t> ulPrefetchedRoundTrips = { 0 };
+	std::atomic<uint64_t> ulPropertyNotifies = { 0 };
+	std::atomic<uint64_t> ulPropertyNotifiesCoalesced = { 0 };
+};
+static XPropertyStats_t s_XPropertyStats;
+
+// Enough for anything, the server clamps it to what's there.
+static constexpr uint32_t k_uMaxPropertyLength = UINT32_MAX / 4;
+
+// A window property as the server sent it. Cheap to copy.
+class CXProperty
+{
+public:
+	CXProperty() = default;
+	explicit CXProperty( xcb_get_property_reply_t *pReply )
+		: m_pReply( pReply, free )
+	{
+	}
+
+	bool Exists() const { return m_pReply && m_pReply->type != XCB_NONE; }
+	Atom Type() const { return m_pReply ? m_pReply->type : None; }
+
+	// Empty if the property isn't there, has a different type (unless AnyPropertyType)
+	// or format.
+	std::span<const uint32_t> Values32( Atom type = AnyPropertyType ) const
+	{
+		if ( !Matches( type, 32 ) )
+			return {};
+
+		return std::span<const uint32_t>{ reinterpret_cast<const uint32_t *>( xcb_get_property_value( m_pReply.get() ) ), m_pReply->value_len };
+	}
+
+	std::string_view Bytes( Atom type = AnyPropertyType ) const
+	{
+		if ( !Matches( type, 8 ) )
+			return {};
+
+		return std::string_view{ reinterpret_cast<const char *>( xcb_get_property_value( m_pReply.get() ) ), m_pReply->value_len };
+	}
+
+private:
+	bool Matches( Atom type, uint8_t uFormat ) const
+	{
+		return Exists() && m_pReply->format == uFormat && ( type == AnyPropertyType || m_pReply->type == type );
+	}
+
+	std::shared_ptr<xcb_get_property_reply_t> m_pReply;
+};
+
+// Sends the requests for a bunch of window properties at once and waits for
+// all of the replies together, so fetching them costs one round-trip rather
+// than one each.
+// While it's alive, the property getters below use what it fetched for
+// those windows and properties instead of asking the server again.
+class CXPropertyPrefetch
+{
+public:
+	explicit CXPropertyPrefetch( xwayland_ctx_t *ctx )
+		: m_pCtx( ctx )
+		, m_pConnection( XGetXCBConnection( ctx->dpy ) )
+		, m_pPrevious( ctx->pPropertyPrefetch )
+	{
+		ctx->pPropertyPrefetch = this;
+	}
+
+	~CXPropertyPrefetch()
+	{
+		for ( Entry_t &entry : m_Entries )
+		{
+			if ( !entry.bResolved )
+				xcb_discard_reply( m_pConnection, entry.cookie.sequence );
+		}
+
+		m_pCtx->pPropertyPrefetch = m_pPrevious;
+	}
 
-						int ret = system(cmd);
+	void Request( Window win, Atom prop )
+	{
+		if ( win == None || Find( win, prop ) )
+			return;
 
-						/* Above call may fail, ffmpeg returns 0 on success */
-						if (ret) {
-							xwm_log.infof("Ffmpeg call return status %i", ret);
-							xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-						} else {
-							xwm_log.infof("Screenshot saved to %s", oScreenshotInfo->szScreenshotPath.c_str());
-							bScreenshotSuccess = true;
-						}
-					}
-					else
-					{
-						xwm_log.errorf( "Failed to save screenshot to %s", oScreenshotInfo->szScreenshotPath.c_str() );
-					}
-				}
+		m_Entries.push_back( Entry_t
+		{
+			.win = win,
+			.prop = prop,
+			.cookie = xcb_get_property( m_pConnection, 0, win, prop, XCB_GET_PROPERTY_TYPE_ANY, 0, k_uMaxPropertyLength ),
+		} );
+	}
 
-				if ( oScreenshotInfo->bX11PropertyRequested )
-				{
-					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
-					XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
-				}
+	// nullptr if neither this nor an outer prefetch requested it.
+	const CXProperty *Get( Window win, Atom prop )
+	{
+		Entry_t *pEntry = Find( win, prop );
+		if ( !pEntry )
+			return m_pPrevious ? m_pPrevious->Get( win, prop ) : nullptr;
 
-				if ( bScreenshotSuccess && oScreenshotInfo->bWaylandRequested )
-				{
-						wlserver_lock();
-						for ( const auto &control : wlserver.gamescope_controls )
-						{
-							gamescope_control_send_screenshot_taken( control, oScreenshotInfo->szScreenshotPath.c_str() );
-						}
-						wlserver_unlock();
-				}
-			});
+		if ( !pEntry->bResolved )
+			Resolve();
 
-			screenshotThread.detach();
+		return &pEntry->value;
+	}
+
+private:
+	struct Entry_t
+	{
+		Window win;
+		Atom prop;
+		xcb_get_property_cookie_t cookie;
+		CXProperty value;
+		bool bResolved = false;
+	};
+
+	Entry_t *Find( Window win, Atom prop )
+	{
+		for ( Entry_t &entry : m_Entries )
+		{
+			if ( entry.win == win && entry.prop == prop )
+				return &entry;
 		}
-		else
+		return nullptr;
+	}
+
+	void Resolve()
+	{
+		uint32_t uResolved = 0;
+		for ( Entry_t &entry : m_Entries )
 		{
-			xwm_log.errorf( "Oh no, we ran out of screenshot images. Not actually writing a screenshot." );
-			if ( oScreenshotInfo->bX11PropertyRequested )
-			{
-				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeScreenShotAtom );
-				XDeleteProperty( root_ctx->dpy, root_ctx->root, root_ctx->atoms.gamescopeDebugScreenShotAtom );
-			}
+			if ( entry.bResolved )
+				continue;
+
+			// Errors (eg. the window is gone already) come back here instead
+			// of going to the error handler, it's just not there then.
+			xcb_generic_error_t *pError = nullptr;
+			entry.value = CXProperty{ xcb_get_property_reply( m_pConnection, entry.cookie, &pError ) };
+			entry.bResolved = true;
+			free( pError );
+			uResolved++;
+		}
+
+		if ( uResolved )
+		{
+			s_XPropertyStats.ulRoundTrips++;
+			s_XPropertyStats.ulPrefetchedRoundTrips++;
+			s_XPropertyStats.ulPropertiesFetched += uResolved;
 		}
 	}
 
+	xwayland_ctx_t *m_pCtx = nullptr;
+	xcb_connection_t *m_pConnection = nullptr;
+	CXPropertyPrefetch *m_pPrevious = nullptr;
+	std::vector<Entry_t> m_Entries;
+};
 
-	gpuvis_trace_end_ctx_printf( paintID, "paint_all" );
-	gpuvis_trace_printf( "paint_all %i layers", (int)frameInfo.layerCount );
+static CXProperty
+fetch_prop( xwayland_ctx_t *ctx, Window win, Atom prop, uint32_t uMaxLength = k_uMaxPropertyLength )
+{
+	if ( ctx->pPropertyPrefetch )
+	{
+		if ( const CXProperty *pProperty = ctx->pPropertyPrefetch->Get( win, prop ) )
+			return *pProperty;
+	}
+
+	xcb_connection_t *pConnection = XGetXCBConnection( ctx->dpy );
+	xcb_get_property_cookie_t cookie = xcb_get_property( pConnection, 0, win, prop, XCB_GET_PROPERTY_TYPE_ANY, 0, uMaxLength );
+
+	xcb_generic_error_t *pError = nullptr;
+	CXProperty property{ xcb_get_property_reply( pConnection, cookie, &pError ) };
+	free( pError );
+
+	s_XPropertyStats.ulRoundTrips++;
+	s_XPropertyStats.ulPropertiesFetched++;
+
+	return property;
 }
 
+static gamescope::ConCommand cc_xwayland_property_stats( "xwayland_property_stats", "Print how many round-trips to the X servers fetching window properties took, overall and per second since the last time. Args: [reset]",
+[]( std::span<std::string_view> args )
+{
+	static uint64_t s_ulLastTime = 0;
+	static uint64_t s_ulLastRoundTrips = 0;
+
+	if ( args.size() > 1 && args[1] == "reset" )
+	{
+		s_XPropertyStats.ulRoundTrips = 0;
+		s_XPropertyStats.ulPropertiesFetched = 0;
+		s_XPropertyStats.ulPrefetchedRoundTrips = 0;
+		s_XPropertyStats.ulPropertyNotifies = 0;
+		s_XPropertyStats.ulPropertyNotifiesCoalesced = 0;
+		s_ulLastTime = 0;
+		s_ulLastRoundTrips = 0;
+		return;
+	}
+
+	const uint64_t ulNow = get_time_in_nanos();
+	const uint64_t ulRoundTrips = s_XPropertyStats.ulRoundTrips;
+
+	console_log.infof( "Property round-trips: %" PRIu64 " (%" PRIu64 " batched) for %" PRIu64 " properties",
+		ulRoundTrips, s_XPropertyStats.ulPrefetchedRoundTrips.load(), s_XPropertyStats.ulPropertiesFetched.load() );
+	console_log.infof( "PropertyNotify: %" PRIu64 " events, %" PRIu64 " coalesced away",
+		s_XPropertyStats.ulPropertyNotifies.load(), s_XPropertyStats.ulPropertyNotifiesCoalesced.load() );
+
+	if ( s_ulLastTime && ulNow > s_ulLastTime )
+	{
+		const double flSeconds = ( ulNow - s_ulLastTime ) / 1'000'000'000.0;
+		console_log.infof( "%.1f round-trips/s over the last %.1fs", ( ulRoundTrips - s_ulLastRoundTrips ) / flSeconds, flSeconds );
+	}
+
+	s_ulLastTime = ulNow;
+	s_ulLastRoundTrips = ulRoundTrips;
+});
+
 /* Get prop from window
  *   not found: default
  *   otherwise the value
  */
-__attribute__((__no_sanitize_address__)) // x11 broken, returns format 32 even when it only malloc'ed one byte. :(
 static unsigned int
 get_prop(xwayland_ctx_t *ctx, Window win, Atom prop, unsigned int def, bool *found = nullptr )
 {
-	Atom actual;
-	int format;
-	unsigned long n, left;
+	CXProperty property = fetch_prop( ctx, win, prop, 1 );
+	std::span<const uint32_t> values = property.Values32( XA_CARDINAL );
 
-	unsigned char *data;
-	int result = XGetWindowProperty(ctx->dpy, win, prop, 0L, 1L, false,
-									XA_CARDINAL, &actual, &format,
-								 &n, &left, &data);
-	if (result == Success && data != NULL)
-	{
-		unsigned int i;
-		memcpy(&i, data, sizeof(unsigned int));
-		XFree((void *) data);
-		if ( found != nullptr )
-		{
-			*found = true;
-		}
-		return i;
-	}
 	if ( found != nullptr )
 	{
-		*found = false;
+		*found = !values.empty();
 	}
-	return def;
+
+	return !values.empty() ? values[ 0 ] : def;
 }
 
 // vectored version, return value is whether anything was found
-__attribute__((__no_sanitize_address__)) // x11 broken :(
 bool get_prop( xwayland_ctx_t *ctx, Window win, Atom prop, std::vector< uint32_t > &vecResult )
 {
-	Atom actual;
-	int format;
-	unsigned long n, left;
+	CXProperty property = fetch_prop( ctx, win, prop );
 
-	vecResult.clear();
-	uint64_t *data;
-	int result = XGetWindowProperty(ctx->dpy, win, prop, 0L, ~0UL, false,
-									XA_CARDINAL, &actual, &format,
-									&n, &left, ( unsigned char** )&data);
-	if (result == Success && data != NULL)
-	{
-		for ( uint32_t i = 0; i < n; i++ )
-		{
-			vecResult.push_back( data[ i ] );
-		}
-		XFree((void *) data);
-		return true;
-	}
-	return false;
+	std::span<const uint32_t> values = property.Values32( XA_CARDINAL );
+	vecResult.assign( values.begin(), values.end() );
+
+	// Like XGetWindowProperty, a property of another type is still there, just empty.
+	return property.Exists();
 }
 
 std::string get_string_prop( xwayland_ctx_t *ctx, Window win, Atom prop )
 {
-	XTextProperty tp;
-	if ( !XGetTextProperty( ctx->dpy, win, &tp, prop ) )
-		return "";
+	CXProperty property = fetch_prop( ctx, win, prop );
 
-	std::string value = reinterpret_cast<const char *>( tp.value );
-	XFree( tp.value );
-	return value;
+	// Up to the first NUL, like the string XGetTextProperty gives us.
+	std::string_view value = property.Bytes();
+	return std::string{ value.substr( 0, value.find( '\0' ) ) };
 }
 
 void set_string_prop( xwayland_ctx_t *ctx, Atom prop, const std::string &value )
@@ -4121,13 +5092,71 @@ get_win_type(xwayland_ctx_t *ctx, steamcompmgr_win_t *w)
 	}
 }
 
+// Same as XGetWMNormalHints, but goes through fetch_prop.
+static bool
+get_wm_normal_hints(xwayland_ctx_t *ctx, Window win, XSizeHints *hints, long *supplied)
+{
+	// Clients from before ICCCM 1 leave off the base size and gravity.
+	static constexpr size_t k_zOldSizeHintsCount = 15;
+	static constexpr size_t k_zSizeHintsCount = 18;
+
+	*supplied = 0;
+
+	CXProperty property = fetch_prop( ctx, win, XA_WM_NORMAL_HINTS );
+	std::span<const uint32_t> values = property.Values32( XA_WM_SIZE_HINTS );
+	if ( values.size() < k_zOldSizeHintsCount )
+		return false;
+
+	*hints = XSizeHints{};
+	hints->flags = values[0] & ( USPosition | USSize | PAllHints );
+	hints->x = int32_t( values[1] );
+	hints->y = int32_t( values[2] );
+	hints->width = int32_t( values[3] );
+	hints->height = int32_t( values[4] );
+	hints->min_width = int32_t( values[5] );
+	hints->min_height = int32_t( values[6] );
+	hints->max_width = int32_t( values[7] );
+	hints->max_height = int32_t( values[8] );
+	hints->width_inc = int32_t( values[9] );
+	hints->height_inc = int32_t( values[10] );
+	hints->min_aspect.x = int32_t( values[11] );
+	hints->min_aspect.y = int32_t( values[12] );
+	hints->max_aspect.x = int32_t( values[13] );
+	hints->max_aspect.y = int32_t( values[14] );
+	*supplied = USPosition | USSize | PAllHints;
+
+	if ( values.size() >= k_zSizeHintsCount )
+	{
+		hints->base_width = int32_t( values[15] );
+		hints->base_height = int32_t( values[16] );
+		hints->win_gravity = int32_t( values[17] );
+		hints->flags |= values[0] & ( PBaseSize | PWinGravity );
+		*supplied |= PBaseSize | PWinGravity;
+	}
+
+	return true;
+}
+
+// Same as XGetTransientForHint, but goes through fetch_prop.
+static bool
+get_transient_for(xwayland_ctx_t *ctx, Window win, Window *transientFor)
+{
+	CXProperty property = fetch_prop( ctx, win, XA_WM_TRANSIENT_FOR );
+	std::span<const uint32_t> values = property.Values32( XA_WINDOW );
+	if ( values.empty() )
+		return false;
+
+	*transientFor = values[0];
+	return true;
+}
+
 static void
 get_size_hints(xwayland_ctx_t *ctx, steamcompmgr_win_t *w)
 {
 	XSizeHints hints;
 	long hintsSpecified = 0;
 
-	XGetWMNormalHints(ctx->dpy, w->xwayland().id, &hints, &hintsSpecified);
+	get_wm_normal_hints(ctx, w->xwayland().id, &hints, &hintsSpecified);
 
 	const bool bHasPositionAndGravityHints = ( hintsSpecified & ( PPosition | PWinGravity ) ) == ( PPosition | PWinGravity );
 	if ( bHasPositionAndGravityHints &&
@@ -4198,15 +5227,12 @@ get_win_title(xwayland_ctx_t *ctx, steamcompmgr_win_t *w, Atom atom)
 {
 	assert(atom == XA_WM_NAME || atom == ctx->atoms.netWMNameAtom);
 
-	// Allocates a title we are meant to free,
-	// let's re-use this allocation for w->title :)
-	XTextProperty tp;
-	XGetTextProperty( ctx->dpy, w->xwayland().id, &tp, atom );
+	CXProperty property = fetch_prop( ctx, w->xwayland().id, atom );
 
 	bool is_utf8;
-	if (tp.encoding == ctx->atoms.utf8StringAtom) {
+	if (property.Type() == ctx->atoms.utf8StringAtom) {
 		is_utf8 = true;
-	} else if (tp.encoding == XA_STRING) {
+	} else if (property.Type() == XA_STRING) {
 		is_utf8 = false;
 	} else {
 		return;
@@ -4219,9 +5245,9 @@ get_win_title(xwayland_ctx_t *ctx, steamcompmgr_win_t *w, Atom atom)
 		return;
 	}
 
-	if (tp.nitems > 0) {
-		// Ride off the allocation from XGetTextProperty.
-		w->title = std::make_shared<std::string>((const char *)tp.value);
+	std::string_view title = property.Bytes();
+	if (!title.empty()) {
+		w->title = std::make_shared<std::string>(title.substr(0, title.find('\0')));
 	} else {
 		w->title = NULL;
 	}
@@ -4231,30 +5257,19 @@ get_win_title(xwayland_ctx_t *ctx, steamcompmgr_win_t *w, Atom atom)
 static void
 get_net_wm_state(xwayland_ctx_t *ctx, steamcompmgr_win_t *w)
 {
-	Atom type;
-	int format;
-	unsigned long nitems;
-	unsigned long bytesAfter;
-	unsigned char *data;
-	if (XGetWindowProperty(ctx->dpy, w->xwayland().id, ctx->atoms.netWMStateAtom, 0, 2048, false,
-			AnyPropertyType, &type, &format, &nitems, &bytesAfter, &data) != Success) {
-		return;
-	}
+	CXProperty property = fetch_prop( ctx, w->xwayland().id, ctx->atoms.netWMStateAtom );
 
-	Atom *props = (Atom *)data;
-	for (size_t i = 0; i < nitems; i++) {
-		if (props[i] == ctx->atoms.netWMStateFullscreenAtom) {
+	for (Atom prop : property.Values32()) {
+		if (prop == ctx->atoms.netWMStateFullscreenAtom) {
 			w->isFullscreen = true;
-		} else if (props[i] == ctx->atoms.netWMStateSkipTaskbarAtom) {
+		} else if (prop == ctx->atoms.netWMStateSkipTaskbarAtom) {
 			w->skipTaskbar = true;
-		} else if (props[i] == ctx->atoms.netWMStateSkipPagerAtom) {
+		} else if (prop == ctx->atoms.netWMStateSkipPagerAtom) {
 			w->skipPager = true;
 		} else {
-			xwm_log.debugf("Unhandled initial NET_WM_STATE property: %s", XGetAtomName(ctx->dpy, props[i]));
+			xwm_log.debugf("Unhandled initial NET_WM_STATE property: %s", XGetAtomName(ctx->dpy, prop));
 		}
 	}
-
-	XFree(data);
 }
 
 static void
@@ -4280,6 +5295,16 @@ map_win(xwayland_ctx_t* ctx, Window id, unsigned long sequence)
 
 	XFlush(ctx->dpy);
 
+	// Ask for everything below at once rather than waiting on each in turn.
+	CXPropertyPrefetch prefetch( ctx );
+	for ( Atom prop : { ctx->atoms.opacityAtom, ctx->atoms.steamAtom, ctx->atoms.netWMNameAtom, Atom( XA_WM_NAME ), ctx->atoms.netWMIcon,
+		ctx->atoms.steamInputFocusAtom, ctx->atoms.steamStreamingClientAtom, ctx->atoms.steamStreamingClientVideoAtom, ctx->atoms.gameAtom,
+		ctx->atoms.overlayAtom, ctx->atoms.externalOverlayAtom, Atom( XA_WM_NORMAL_HINTS ), ctx->atoms.netWMStateAtom, Atom( XA_WM_HINTS ),
+		Atom( XA_WM_TRANSIENT_FOR ), ctx->atoms.winTypeAtom } )
+	{
+		prefetch.Request( w->xwayland().id, prop );
+	}
+
 	/* This needs to be here since we don't get PropertyNotify when unmapped */
 	w->opacity = get_prop(ctx, w->xwayland().id, ctx->atoms.opacityAtom, OPAQUE);
 
@@ -4326,20 +5351,20 @@ map_win(xwayland_ctx_t* ctx, Window id, unsigned long sequence)
 
 	get_net_wm_state(ctx, w);
 
-	XWMHints *wmHints = XGetWMHints( ctx->dpy, w->xwayland().id );
+	// WM_HINTS: flags, input, initial_state, ...
+	CXProperty wmHints = fetch_prop( ctx, w->xwayland().id, XA_WM_HINTS );
+	std::span<const uint32_t> wmHintsValues = wmHints.Values32( XA_WM_HINTS );
 
-	if ( wmHints != nullptr )
+	if ( wmHintsValues.size() >= 8 )
 	{
-		if ( wmHints->flags & (InputHint | StateHint ) && wmHints->input == true && wmHints->initial_state == NormalState )
+		if ( wmHintsValues[0] & (InputHint | StateHint ) && wmHintsValues[1] && wmHintsValues[2] == NormalState )
 		{
 			XRaiseWindow( ctx->dpy, w->xwayland().id );
 		}
-
-		XFree( wmHints );
 	}
 
 	Window transientFor = None;
-	if ( XGetTransientForHint( ctx->dpy, w->xwayland().id, &transientFor ) )
+	if ( get_transient_for( ctx, w->xwayland().id, &transientFor ) )
 	{
 		w->xwayland().transientFor = transientFor;
 	}
@@ -4388,97 +5413,27 @@ unmap_win(xwayland_ctx_t *ctx, Window id, bool fade)
 	set_wm_state( ctx, w->xwayland().id, ICCCM_WITHDRAWN_STATE );
 }
 
+static gamescope::CProcessTreeCache s_ProcessTreeCache;
+
 uint32_t
 get_appid_from_pid( pid_t pid )
 {
-	uint32_t unFoundAppId = 0;
-
-	char filename[256];
-	pid_t next_pid = pid;
+	return s_ProcessTreeCache.GetAppId( pid );
+}
 
-	while ( 1 )
+static gamescope::ConCommand cc_process_tree_cache_stats( "process_tree_cache_stats", "Print how app ID lookups used the process tree cache. Args: [clear]",
+[]( std::span<std::string_view> args )
+{
+	if ( args.size() > 1 && args[1] == "clear" )
 	{
-		snprintf( filename, sizeof( filename ), "/proc/%i/stat", next_pid );
-		std::ifstream proc_stat_file( filename );
-
-		if (!proc_stat_file.is_open() || proc_stat_file.bad())
-			break;
-
-		std::string proc_stat;
-
-		std::getline( proc_stat_file, proc_stat );
-
-		char *procName = nullptr;
-		char *lastParens = nullptr;
-
-		for ( uint32_t i = 0; i < proc_stat.length(); i++ )
-		{
-			if ( procName == nullptr && proc_stat[ i ] == '(' )
-			{
-				procName = &proc_stat[ i + 1 ];
-			}
-
-			if ( proc_stat[ i ] == ')' )
-			{
-				lastParens = &proc_stat[ i ];
-			}
-		}
-
-		if (!lastParens)
-			break;
-
-		*lastParens = '\0';
-		char state;
-		int parent_pid = -1;
-
-		sscanf( lastParens + 1, " %c %d", &state, &parent_pid );
-
-		if ( strcmp( "reaper", procName ) == 0 )
-		{
-			snprintf( filename, sizeof( filename ), "/proc/%i/cmdline", next_pid );
-			std::ifstream proc_cmdline_file( filename );
-			std::string proc_cmdline;
-
-			bool bSteamLaunch = false;
-			uint32_t unAppId = 0;
-
-			std::getline( proc_cmdline_file, proc_cmdline );
-
-			for ( uint32_t j = 0; j < proc_cmdline.length(); j++ )
-			{
-				if ( proc_cmdline[ j ] == '\0' && j + 1 < proc_cmdline.length() )
-				{
-					if ( strcmp( "SteamLaunch", &proc_cmdline[ j + 1 ] ) == 0 )
-					{
-						bSteamLaunch = true;
-					}
-					else if ( sscanf( &proc_cmdline[ j + 1 ], "AppId=%u", &unAppId ) == 1 && unAppId != 0 )
-					{
-						if ( bSteamLaunch == true )
-						{
-							unFoundAppId = unAppId;
-						}
-					}
-					else if ( strcmp( "--", &proc_cmdline[ j + 1 ] ) == 0 )
-					{
-						break;
-					}
-				}
-			}
-		}
-
-		if ( parent_pid == -1 || parent_pid == 0 )
-		{
-			break;
-		}
-		else
-		{
-			next_pid = parent_pid;
-		}
+		s_ProcessTreeCache.Clear();
+		return;
 	}
 
-	return unFoundAppId;
-}
+	gamescope::ProcessTreeCacheStats_t stats = s_ProcessTreeCache.GetStats();
+	console_log.infof( "Process tree cache: %" PRIu64 " processes cached, %" PRIu64 " app ID lookups walked %" PRIu64 " cached processes and read %" PRIu64 " from /proc, %" PRIu64 " dropped after exiting",
+		stats.ulEntries, stats.ulLookups, stats.ulCachedProcesses, stats.ulProcReads, stats.ulInvalidations );
+});
 
 static pid_t
 get_win_pid(xwayland_ctx_t *ctx, Window id)
@@ -4615,6 +5570,8 @@ add_win(xwayland_ctx_t *ctx, Window id, Window prev, unsigned long sequence)
 		std::unique_lock lock( ctx->list_mutex );
 		new_win->xwayland().next = *p;
 		*p = new_win;
+		ctx->windowsById.Insert( id, new_win );
+		ctx->toplevelByChild.Erase( id );
 	}
 	if (new_win->xwayland().a.map_state == IsViewable)
 		map_win(ctx, id, sequence);
@@ -4747,6 +5704,21 @@ finish_destroy_win(xwayland_ctx_t *ctx, Window id, bool gone)
 			{
 				std::unique_lock lock( ctx->list_mutex );
 				*prev = w->xwayland().next;
+
+				// If the same id got added twice, the older one is what
+				// a list walk would find now.
+				steamcompmgr_win_t *pOther = w->xwayland().next;
+				while ( pOther && pOther->xwayland().id != id )
+					pOther = pOther->xwayland().next;
+
+				if ( pOther )
+					ctx->windowsById.Insert( id, pOther );
+				else
+					ctx->windowsById.Erase( id );
+
+				ctx->windowsBySurface.EraseIf( [w]( wlr_surface *, steamcompmgr_win_t *pWindow ) { return pWindow == w; } );
+				if ( !pOther )
+					ctx->toplevelByChild.EraseIf( [id]( Window, Window toplevel ) { return toplevel == id; } );
 			}
 			if (w->xwayland().damage != None)
 			{
@@ -5256,10 +6228,17 @@ static bool steamcompmgr_should_vblank_window( bool bShouldLimitFPS, uint64_t vb
 	{
 		if ( g_nSteamCompMgrTargetFPS && bShouldLimitFPS && nRefreshHz > nTargetFPS )
 		{
-			int nVblankDivisor = nRefreshHz / nTargetFPS;
+			if ( cv_fps_limit_fractional )
+			{
+				bSendCallback = gamescope::FramePacerShouldLatch( vblank_idx, nRefreshHz, nTargetFPS );
+			}
+			else
+			{
+				int nVblankDivisor = nRefreshHz / nTargetFPS;
 
-			if ( vblank_idx % nVblankDivisor != 0 )
-				bSendCallback = false;
+				if ( vblank_idx % nVblankDivisor != 0 )
+					bSendCallback = false;
+			}
 		}
 	}
 
@@ -5519,7 +6498,7 @@ handle_property_notify(xwayland_ctx_t *ctx, XPropertyEvent *ev)
 		if (w)
 		{
 			Window transientFor = None;
-			if ( XGetTransientForHint( ctx->dpy, ev->window, &transientFor ) )
+			if ( get_transient_for( ctx, ev->window, &transientFor ) )
 			{
 				w->xwayland().transientFor = transientFor;
 			}
@@ -6115,11 +7094,18 @@ steamcompmgr_exit(void)
 	for ( auto &lut : g_ColorMgmtLutsOverride ) lut.shutdown();
 	for ( auto &lut : g_ScreenshotColorMgmtLuts ) lut.shutdown();
 	for ( auto &lut : g_ScreenshotColorMgmtLutsHDR ) lut.shutdown();
+	invalidate_color_mgmt_luts_requests();
+	s_pColorMgmtLutUploading = nullptr;
+	for ( auto &lut : s_ColorMgmtSpareLut1d ) lut = nullptr;
+	for ( auto &lut : s_ColorMgmtSpareLut3d ) lut = nullptr;
+
+	vulkan_save_pipeline_cache();
+	save_color_mgmt_lut_cache();
 
 	if ( statsThreadRun == true )
 	{
 		statsThreadRun = false;
-		statsThreadSem.signal();
+		stats_wake_thread();
 	}
 
 	{
@@ -6673,7 +7659,8 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 		std::move(reslistentry.presentation_feedbacks),
 		reslistentry.present_id,
 		reslistentry.desired_present_time,
-		reslistentry.fifo );
+		reslistentry.fifo,
+		reslistentry.oBufferDamage );
 
 	int fence = -1;
 	if ( newCommit != nullptr )
@@ -6765,6 +7752,11 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 			{
 				eventFd = reslistentry.pAcquirePoint->CreateEventFd();
 			}
+			else if ( newCommit->vulkanTex->uploadAcquirePoint() )
+			{
+				// SHM buffer, wait for our own upload instead of stalling on it when importing.
+				eventFd = newCommit->vulkanTex->uploadAcquirePoint()->CreateEventFd();
+			}
 		}
 
 		if ( gamescope::IBackendFb *pBackendFb = newCommit->vulkanTex->GetBackendFb() )
@@ -6809,31 +7801,33 @@ void update_wayland_res(CommitDoneList_t *doneCommits, steamcompmgr_win_t *w, Re
 void check_new_xwayland_res(xwayland_ctx_t *ctx)
 {
 	// When importing buffer, we'll potentially need to perform operations with
-	// a wlserver lock (e.g. wlr_buffer_lock). We can't do this with a
-	// wayland_commit_queue lock because that causes deadlocks.
-	std::vector<ResListEntry_t>& tmp_queue = ctx->xwayland_server->retrieve_commits();
-
-	for ( uint32_t i = 0; i < tmp_queue.size(); i++ )
+	// a wlserver lock (e.g. wlr_buffer_lock). That's fine here, the commit queue
+	// never blocks the wayland thread.
+	ctx->xwayland_server->retrieve_commits( [ctx]( ResListEntry_t &entry )
 	{
-		steamcompmgr_win_t	*w = find_win( ctx, tmp_queue[ i ].surf );
-		update_wayland_res( &ctx->doneCommits, w, tmp_queue[ i ]);
-	}
+		// Even if we end up dropping the commit, the surface's other buffers have to know.
+		s_BufferMemos.AddSurfaceDamage( entry.surf, entry.oBufferDamage );
+
+		steamcompmgr_win_t	*w = find_win( ctx, entry.surf );
+		update_wayland_res( &ctx->doneCommits, w, entry );
+	});
 }
 
 void check_new_xdg_res()
 {
-	std::vector<ResListEntry_t> tmp_queue = wlserver_xdg_commit_queue();
-	for ( uint32_t i = 0; i < tmp_queue.size(); i++ )
+	wlserver.xdg_commit_queue.Drain( []( ResListEntry_t &entry )
 	{
+		s_BufferMemos.AddSurfaceDamage( entry.surf, entry.oBufferDamage );
+
 		for ( const auto& xdg_win : g_steamcompmgr_xdg_wins )
 		{
-			if ( xdg_win->xdg().surface.main_surface == tmp_queue[ i ].surf )
+			if ( xdg_win->xdg().surface.main_surface == entry.surf )
 			{
-				update_wayland_res( &g_steamcompmgr_xdg_done_commits, xdg_win.get(), tmp_queue[ i ] );
+				update_wayland_res( &g_steamcompmgr_xdg_done_commits, xdg_win.get(), entry );
 				break;
 			}
 		}
-	}
+	});
 }
 
 
@@ -6849,6 +7843,68 @@ handle_xfixes_selection_notify( xwayland_ctx_t *ctx, XFixesSelectionNotifyEvent
 	XFlush(ctx->dpy);
 }
 
+static gamescope::ConVar<bool> cv_xwayland_coalesce_property_notify{ "xwayland_coalesce_property_notify", true, "Handle runs of PropertyNotify events once per window and property, with their properties fetched in one round-trip." };
+
+// Properties that ask us to do something every time they get set, rather
+// than just holding some state we track, so they can't be coalesced.
+static bool
+property_notify_is_command(xwayland_ctx_t *ctx, Atom atom)
+{
+	return atom == ctx->atoms.gamescopeScreenShotAtom ||
+		atom == ctx->atoms.gamescopeDebugScreenShotAtom ||
+		atom == ctx->atoms.gamescopeXWaylandModeControl ||
+		atom == ctx->atoms.gamescopeCreateXWaylandServer ||
+		atom == ctx->atoms.gamescopeDestroyXWaylandServer ||
+		atom == ctx->atoms.gamescopeDisplayModeNudge;
+}
+
+static void
+queue_property_notify(std::vector<XPropertyEvent> &pending, const XPropertyEvent &ev)
+{
+	s_XPropertyStats.ulPropertyNotifies++;
+
+	// Clients tend to set the same few properties over and over, only the latest value matters.
+	for ( XPropertyEvent &other : pending )
+	{
+		if ( other.window == ev.window && other.atom == ev.atom )
+		{
+			other = ev;
+			s_XPropertyStats.ulPropertyNotifiesCoalesced++;
+			return;
+		}
+	}
+
+	pending.push_back( ev );
+}
+
+static void
+flush_property_notifies(xwayland_ctx_t *ctx, std::vector<XPropertyEvent> &pending)
+{
+	if ( pending.empty() )
+		return;
+
+	// Only fetch properties we know the handler is going to read; most of what clients set, it ignores.
+	CXPropertyPrefetch prefetch( ctx );
+	for ( const XPropertyEvent &ev : pending )
+	{
+		if ( ctx->prefetchablePropertyAtoms.Find( ev.atom ) )
+			prefetch.Request( ev.window, ev.atom );
+	}
+
+	for ( XPropertyEvent &ev : pending )
+	{
+		const uint64_t ulUnbatchedRoundTrips = s_XPropertyStats.ulRoundTrips - s_XPropertyStats.ulPrefetchedRoundTrips;
+
+		handle_property_notify( ctx, &ev );
+
+		// It had to go and fetch something, do that up front next time.
+		if ( s_XPropertyStats.ulRoundTrips - s_XPropertyStats.ulPrefetchedRoundTrips != ulUnbatchedRoundTrips )
+			ctx->prefetchablePropertyAtoms.Insert( ev.atom, true );
+	}
+
+	pending.clear();
+}
+
 void xwayland_ctx_t::Dispatch()
 {
 	xwayland_ctx_t *ctx = this;
@@ -6856,6 +7912,9 @@ void xwayland_ctx_t::Dispatch()
 	MouseCursor *cursor = ctx->cursor.get();
 	bool bSetFocus = false;
 
+	// Runs of PropertyNotify get handled together before the next other event.
+	std::vector<XPropertyEvent> pendingPropertyNotifies;
+
 	while (XPending(ctx->dpy))
 	{
 		XEvent ev;
@@ -6870,10 +7929,27 @@ void xwayland_ctx_t::Dispatch()
 			gpuvis_trace_printf("event %d", ev.type);
 			printf("event %d\n", ev.type);
 		}
+
+		const bool bCoalesceProperty = cv_xwayland_coalesce_property_notify && ev.type == PropertyNotify &&
+			!property_notify_is_command( ctx, ev.xproperty.atom );
+		if ( !bCoalesceProperty )
+			flush_property_notifies( ctx, pendingPropertyNotifies );
+
 		switch (ev.type) {
 			case CreateNotify:
 				if (ev.xcreatewindow.parent == ctx->root)
 					add_win(ctx, ev.xcreatewindow.window, 0, ev.xcreatewindow.serial);
+				else
+				{
+					// Child of one of our toplevels, remember where it is
+					// so looking it up later doesn't need a round-trip.
+					Window toplevel = find_known_toplevel(ctx, ev.xcreatewindow.parent);
+					if (toplevel != None)
+					{
+						std::unique_lock lock( ctx->list_mutex );
+						ctx->toplevelByChild.Insert( ev.xcreatewindow.window, toplevel );
+					}
+				}
 				break;
 			case ConfigureNotify:
 				configure_win(ctx, &ev.xconfigure);
@@ -6884,6 +7960,11 @@ void xwayland_ctx_t::Dispatch()
 
 				if (w && w->xwayland().id == ev.xdestroywindow.window)
 					destroy_win(ctx, ev.xdestroywindow.window, true, true);
+				else if (w)
+				{
+					std::unique_lock lock( ctx->list_mutex );
+					ctx->toplevelByChild.Erase( ev.xdestroywindow.window );
+				}
 				break;
 			}
 			case MapNotify:
@@ -6939,12 +8020,29 @@ void xwayland_ctx_t::Dispatch()
 				else
 				{
 					steamcompmgr_win_t * w = find_win(ctx, ev.xreparent.window);
+					const bool bWasToplevel = w && w->xwayland().id == ev.xreparent.window;
 
-					if (w && w->xwayland().id == ev.xreparent.window)
+					if (bWasToplevel)
 					{
 						destroy_win(ctx, ev.xreparent.window, false, true);
 					}
-					else
+					else if (w)
+					{
+						// A child moved, anything we knew about its own children
+						// might be stale now, so forget all of the old toplevel's.
+						std::unique_lock lock( ctx->list_mutex );
+						Window oldToplevel = w->xwayland().id;
+						ctx->toplevelByChild.EraseIf( [oldToplevel]( Window, Window toplevel ) { return toplevel == oldToplevel; } );
+					}
+
+					Window newToplevel = find_known_toplevel(ctx, ev.xreparent.parent);
+					if (newToplevel != None)
+					{
+						std::unique_lock lock( ctx->list_mutex );
+						ctx->toplevelByChild.Insert( ev.xreparent.window, newToplevel );
+					}
+
+					if (!bWasToplevel)
 					{
 						// If something got reparented _to_ a toplevel window,
 						// go check for the fullscreen workaround again.
@@ -6972,7 +8070,13 @@ void xwayland_ctx_t::Dispatch()
 			case Expose:
 				break;
 			case PropertyNotify:
-				handle_property_notify(ctx, &ev.xproperty);
+				if ( bCoalesceProperty )
+					queue_property_notify(pendingPropertyNotifies, ev.xproperty);
+				else
+				{
+					s_XPropertyStats.ulPropertyNotifies++;
+					handle_property_notify(ctx, &ev.xproperty);
+				}
 				break;
 			case ClientMessage:
 				handle_client_message(ctx, &ev.xclient);
@@ -7004,6 +8108,9 @@ void xwayland_ctx_t::Dispatch()
 		XFlush(ctx->dpy);
 	}
 
+	flush_property_notifies( ctx, pendingPropertyNotifies );
+	XFlush(ctx->dpy);
+
 	if ( bSetFocus )
 	{
 		XSetInputFocus(ctx->dpy, ctx->currentKeyboardFocusWindow, RevertToNone, CurrentTime);
@@ -7662,11 +8769,6 @@ steamcompmgr_main(int argc, char **argv)
 				break;
 			case 'T':
 				statsThreadPath = optarg;
-				{
-					statsThreadRun = true;
-					std::thread statsThreads( statsThreadMain );
-					statsThreads.detach();
-				}
 				break;
 			case 'C':
 				cursorHideTime = uint64_t( atoi( optarg ) ) * 1'000'000ul;
@@ -7720,6 +8822,11 @@ steamcompmgr_main(int argc, char **argv)
 					g_reshade_technique_idx = atoi(optarg);
 				} else if (strcmp(opt_name, "mura-map") == 0) {
 					set_mura_overlay(optarg);
+				} else if (strcmp(opt_name, "stats-format") == 0) {
+					if ( auto oFormat = parse_stats_format( optarg ) )
+						s_eStatsFormat = *oFormat;
+					else
+						xwm_log.errorf( "Unknown stats format '%s', using text.", optarg );
 				}
 				break;
 			case '?':
@@ -7727,6 +8834,14 @@ steamcompmgr_main(int argc, char **argv)
 		}
 	}
 
+	// Started after parsing so it sees the final --stats-format.
+	if ( !statsThreadPath.empty() )
+	{
+		statsThreadRun = true;
+		std::thread statsThreads( statsThreadMain );
+		statsThreads.detach();
+	}
+
 	int subCommandArg = -1;
 	if ( optind < argc )
 	{
@@ -8109,6 +9224,10 @@ steamcompmgr_main(int argc, char **argv)
 				{
 					g_SteamCompMgrLimitedAppRefreshCycle = gamescope::mHzToRefreshCycle( gamescope::ConvertHztomHz( nTargetFPS ) );
 				}
+				else if ( cv_fps_limit_fractional )
+				{
+					g_SteamCompMgrLimitedAppRefreshCycle = gamescope::FramePacerAverageCycle( g_SteamCompMgrAppRefreshCycle, nRealRefreshHz, nTargetFPS );
+				}
 				else
 				{
 					int nVblankDivisor = nRealRefreshHz / nTargetFPS;
@@ -8385,7 +9504,8 @@ steamcompmgr_main(int argc, char **argv)
 
 		if ( bPainted )
 		{
-			hasRepaint = false;
+			// Keep painting until an async LUT rebuild has been swapped in.
+			hasRepaint = color_mgmt_luts_pending();
 			hasRepaintNonBasePlane = false;
 			nIgnoredOverlayRepaints = 0;
 
@@ -8456,8 +9576,11 @@ struct wlserver_x11_surface_info *lookup_x11_surface_info_from_xid( gamescope_xw
 	// and go back to it's top-level parent.
 	// The xwayland bypass layer does this as we can have child windows
 	// that cover the whole parent.
+	// Only reads the window indices, they're updated on the steamcompmgr thread.
 	std::unique_lock lock( xwayland_server->ctx->list_mutex );
-	steamcompmgr_win_t *w = find_win( xwayland_server->ctx.get(), xid, true );
+	steamcompmgr_win_t *w = xid != None ? find_known_win( xwayland_server->ctx.get(), xid ) : nullptr;
+	if ( !w && xid != None )
+		w = find_win_query_parents( xwayland_server->ctx.get(), xid );
 	if ( !w )
 		return nullptr;
 
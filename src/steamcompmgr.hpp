@@ -137,6 +137,9 @@ void nudge_steamcompmgr( void );
 void force_repaint( void );
 
 extern void mangoapp_update( uint64_t visible_frametime, uint64_t app_frametime_ns, uint64_t latency_ns );
+extern void init_frame_timing_channel();
+extern void frame_timing_record_frame( uint64_t ulCommitID, uint64_t ulLatchTime, uint64_t ulPresentTime, uint64_t ulVBlankTime,
+	bool bComposited, bool bFifo, GamescopeUpscaleFilter eUpscaler );
 struct wlr_surface *steamcompmgr_get_server_input_surface( size_t idx );
 wlserver_vk_swapchain_feedback* steamcompmgr_get_base_layer_swapchain_feedback();
 
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "vblankmanager.hpp"
+
+// Replays draw time traces through the vblank timer's draw time estimators
+// and reports how often each would have missed vblank and how early it woke
+// up on average (which is the latency it adds).
+//
+// Usage: gamescope_vblank_scheduler_bench [trace]
+//
+// A trace is one frame per line: "<wake to flip time in ns> <composited 0/1>",
+// eg. gathered from the drm backend's UpdateLastDrawTime calls.
+// Without one, a fixed set of synthetic traces is generated from a fixed seed.
+
+using gamescope::CVBlankTimer;
+
+struct DrawSample_t
+{
+    uint64_t ulDrawTime = 0;
+    bool bComposited = false;
+};
+
+struct Trace_t
+{
+    std::string sName;
+    std::vector<DrawSample_t> samples;
+};
+
+struct SchedulerConfig_t
+{
+    const char *pszName = nullptr;
+    bool bPercentile = false;
+    float flPercentile = 99.0f;
+};
+
+// Mirrors the fixed refresh path of CVBlankTimer::CalcNextWakeupTime.
+class CSimulatedScheduler
+{
+public:
+    explicit CSimulatedScheduler( const SchedulerConfig_t &config ) : m_Config( config ) {}
+
+    uint64_t CalcOffset( uint64_t ulRefreshInterval, uint64_t ulRedZone )
+    {
+        uint64_t ulDrawTime = m_ulLastDrawTime;
+        if ( m_bLastComposited )
+            ulDrawTime = std::max( ulDrawTime, CVBlankTimer::kDefaultVBlankDrawTimeMinCompositing );
+
+        uint64_t ulRollingDrawTime = gamescope::CalcRollingMaxDrawTime( m_ulRollingMaxDrawTime, ulDrawTime, ulRedZone,
+            CVBlankTimer::kDefaultVBlankRateOfDecayPercentage, CVBlankTimer::kVBlankRateOfDecayMax );
+        ulRollingDrawTime = std::min( ulRollingDrawTime, ulRefreshInterval - ulRedZone );
+        m_ulRollingMaxDrawTime = ulRollingDrawTime;
+
+        uint64_t ulEstimatedDrawTime = ulRollingDrawTime;
+
+        const gamescope::CDrawTimeHistogram &histogram = m_DrawTimeHistograms[ m_bLastComposited ];
+        if ( m_Config.bPercentile && histogram.SampleCount() >= CVBlankTimer::kMinPercentileSamples )
+        {
+            ulEstimatedDrawTime = histogram.GetPercentile( m_Config.flPercentile );
+            if ( m_bLastComposited )
+                ulEstimatedDrawTime = std::max( ulEstimatedDrawTime, CVBlankTimer::kDefaultVBlankDrawTimeMinCompositing );
+            ulEstimatedDrawTime = std::min( ulEstimatedDrawTime, ulRefreshInterval - ulRedZone );
+        }
+
+        return ulEstimatedDrawTime + ulRedZone;
+    }
+
+    void FinishFrame( const DrawSample_t &sample )
+    {
+        m_ulLastDrawTime = sample.ulDrawTime;
+        m_bLastComposited = sample.bComposited;
+        m_DrawTimeHistograms[ sample.bComposited ].AddSample( sample.ulDrawTime );
+    }
+
+private:
+    SchedulerConfig_t m_Config;
+    uint64_t m_ulLastDrawTime = CVBlankTimer::kStartingVBlankDrawTime;
+    bool m_bLastComposited = false;
+    uint64_t m_ulRollingMaxDrawTime = CVBlankTimer::kStartingVBlankDrawTime;
+    gamescope::CDrawTimeHistogram m_DrawTimeHistograms[2];
+};
+
+struct SimulationResult_t
+{
+    uint64_t ulMissed = 0;
+    double flAverageOffsetMs = 0.0;
+};
+
+static SimulationResult_t Simulate( const Trace_t &trace, const SchedulerConfig_t &config, uint64_t ulRefreshInterval )
+{
+    // The time between the commit returning and the flip, which the red zone covers for.
+    static constexpr uint64_t k_ulCommitToFlipTime = CVBlankTimer::kDefaultMinVBlankTime;
+    const uint64_t ulRedZone = CVBlankTimer::kDefaultVBlankRedZone;
+
+    CSimulatedScheduler scheduler( config );
+
+    SimulationResult_t result;
+    double flOffsetSum = 0.0;
+    for ( const DrawSample_t &sample : trace.samples )
+    {
+        uint64_t ulOffset = scheduler.CalcOffset( ulRefreshInterval, ulRedZone );
+        if ( sample.ulDrawTime + k_ulCommitToFlipTime > ulOffset )
+            result.ulMissed++;
+
+        flOffsetSum += ulOffset / 1'000'000.0;
+        scheduler.FinishFrame( sample );
+    }
+
+    if ( !trace.samples.empty() )
+        result.flAverageOffsetMs = flOffsetSum / trace.samples.size();
+    return result;
+}
+
+static uint64_t Jitter( std::mt19937 &rng, double flMeanMs, double flStdDevMs )
+{
+    std::normal_distribution<double> dist( flMeanMs, flStdDevMs );
+    return uint64_t( std::max( 0.05, dist( rng ) ) * 1'000'000.0 );
+}
+
+static std::vector<Trace_t> GenerateTraces()
+{
+    static constexpr uint32_t k_uFrames = 20'000;
+
+    std::mt19937 rng( 1234 );
+    std::uniform_real_distribution<double> chance( 0.0, 1.0 );
+    std::vector<Trace_t> traces;
+
+    {
+        Trace_t trace{ "scanout_steady", {} };
+        for ( uint32_t i = 0; i < k_uFrames; i++ )
+            trace.samples.push_back( { Jitter( rng, 0.8, 0.1 ), false } );
+        traces.push_back( std::move( trace ) );
+    }
+
+    {
+        Trace_t trace{ "composite_steady", {} };
+        for ( uint32_t i = 0; i < k_uFrames; i++ )
+            trace.samples.push_back( { Jitter( rng, 2.6, 0.3 ), true } );
+        traces.push_back( std::move( trace ) );
+    }
+
+    {
+        // Occasional long test commits.
+        Trace_t trace{ "scanout_spiky", {} };
+        for ( uint32_t i = 0; i < k_uFrames; i++ )
+        {
+            bool bSpike = chance( rng ) < 0.02;
+            trace.samples.push_back( { bSpike ? Jitter( rng, 4.5, 1.0 ) : Jitter( rng, 1.0, 0.15 ), false } );
+        }
+        traces.push_back( std::move( trace ) );
+    }
+
+    {
+        // eg. an overlay popping up and going away again.
+        Trace_t trace{ "scanout_composite_switching", {} };
+        for ( uint32_t i = 0; i < k_uFrames; i++ )
+        {
+            bool bComposited = ( i / 300 ) % 2;
+            trace.samples.push_back( { bComposited ? Jitter( rng, 3.0, 0.4 ) : Jitter( rng, 0.7, 0.1 ), bComposited } );
+        }
+        traces.push_back( std::move( trace ) );
+    }
+
+    {
+        // Heavy bursts, eg. shader compilation in the compositor.
+        Trace_t trace{ "composite_bursty", {} };
+        for ( uint32_t i = 0; i < k_uFrames; i++ )
+        {
+            bool bHeavy = ( i % 1000 ) < 100;
+            trace.samples.push_back( { bHeavy ? Jitter( rng, 5.0, 1.5 ) : Jitter( rng, 2.5, 0.5 ), true } );
+        }
+        traces.push_back( std::move( trace ) );
+    }
+
+    return traces;
+}
+
+static bool LoadTrace( const char *pszPath, Trace_t *pOutTrace )
+{
+    FILE *pFile = fopen( pszPath, "r" );
+    if ( !pFile )
+    {
+        fprintf( stderr, "Failed to open trace: %s\n", pszPath );
+        return false;
+    }
+
+    pOutTrace->sName = pszPath;
+
+    unsigned long ulDrawTime = 0;
+    int nComposited = 0;
+    while ( fscanf( pFile, "%lu %d", &ulDrawTime, &nComposited ) == 2 )
+        pOutTrace->samples.push_back( { uint64_t( ulDrawTime ), nComposited != 0 } );
+
+    fclose( pFile );
+    return !pOutTrace->samples.empty();
+}
+
+int main( int argc, char **argv )
+{
+    std::vector<Trace_t> traces;
+    if ( argc > 1 )
+    {
+        Trace_t trace;
+        if ( !LoadTrace( argv[1], &trace ) )
+            return 1;
+        traces.push_back( std::move( trace ) );
+    }
+    else
+    {
+        traces = GenerateTraces();
+    }
+
+    static const SchedulerConfig_t k_Configs[] =
+    {
+        { "rolling max", false },
+        { "p95", true, 95.0f },
+        { "p99", true, 99.0f },
+        { "p99.9", true, 99.9f },
+    };
+
+    static constexpr uint32_t k_uRefreshRates[] = { 60, 120 };
+
+    printf( "%-30s %6s %-12s %10s %14s\n", "trace", "hz", "scheduler", "missed", "avg offset" );
+    for ( const Trace_t &trace : traces )
+    {
+        for ( uint32_t uRefreshHz : k_uRefreshRates )
+        {
+            for ( const SchedulerConfig_t &config : k_Configs )
+            {
+                SimulationResult_t result = Simulate( trace, config, 1'000'000'000ul / uRefreshHz );
+                printf( "%-30s %6u %-12s %9.3f%% %11.3f ms\n",
+                    trace.sName.c_str(), uRefreshHz, config.pszName,
+                    100.0 * result.ulMissed / trace.samples.size(), result.flAverageOffsetMs );
+            }
+        }
+    }
+
+    return 0;
+}
@@ -25,6 +25,14 @@ namespace gamescope
 {
 	ConVar<bool> vblank_debug( "vblank_debug", false, "Enable vblank debug spew to stderr." );
 
+	enum class VBlankScheduler : int
+	{
+		RollingMax = 0,
+		Percentile = 1,
+	};
+	ConVar<int> vblank_scheduler( "vblank_scheduler", 0, "How to estimate the draw time to wake up for before vblank. 0 = Rolling max with decay. 1 = Percentile of recent draw times, tracked separately for composited and direct scanout frames." );
+	ConVar<float> vblank_scheduler_percentile( "vblank_scheduler_percentile", 99.0f, "Percentile of recent draw times to wake up for with vblank_scheduler 1." );
+
 	CVBlankTimer::CVBlankTimer()
 	{
 		m_ulTargetVBlank = get_time_in_nanos();
@@ -120,25 +128,23 @@ namespace gamescope
 			const uint64_t ulDecayAlpha = m_ulVBlankRateOfDecayPercentage; // eg. 980 = 98%
 
 			uint64_t ulDrawTime = m_ulLastDrawTime;
+			const bool bCompositing = m_bCurrentlyCompositing;
+
+			if ( !bPreemptive )
+			{
+				const uint64_t ulDrawTimeSeq = m_ulDrawTimeSeq;
+				if ( ulDrawTimeSeq != m_ulLastSampledDrawTimeSeq )
+				{
+					m_DrawTimeHistograms[ bCompositing ].AddSample( ulDrawTime );
+					m_ulLastSampledDrawTimeSeq = ulDrawTimeSeq;
+				}
+			}
+
 			/// See comment of m_ulVBlankDrawTimeMinCompositing.
-			if ( m_bCurrentlyCompositing )
+			if ( bCompositing )
 				ulDrawTime = std::max( ulDrawTime, m_ulVBlankDrawTimeMinCompositing );
 
-			uint64_t ulNewRollingDrawTime;
-			// This is a rolling average when ulDrawTime < m_ulRollingMaxDrawTime,
-			// and a maximum when ulDrawTime > m_ulRollingMaxDrawTime.
-			//
-			// This allows us to deal with spikes in the draw buffer time very easily.
-			// eg. if we suddenly spike up (eg. because of test commits taking a stupid long time),
-			// we will then be able to deal with spikes in the long term, even if several commits after
-			// we get back into a good state and then regress again.
-
-			// If we go over half of our deadzone, be more defensive about things and
-			// spike up back to our current drawtime (sawtooth).
-			if ( int64_t( ulDrawTime ) - int64_t( ulRedZone / 2 ) > int64_t( m_ulRollingMaxDrawTime ) )
-				ulNewRollingDrawTime = ulDrawTime;
-			else
-				ulNewRollingDrawTime = ( ( ulDecayAlpha * m_ulRollingMaxDrawTime ) + ( kVBlankRateOfDecayMax - ulDecayAlpha ) * ulDrawTime ) / kVBlankRateOfDecayMax;
+			uint64_t ulNewRollingDrawTime = CalcRollingMaxDrawTime( m_ulRollingMaxDrawTime, ulDrawTime, ulRedZone, ulDecayAlpha, kVBlankRateOfDecayMax );
 
 			// If we need to offset for our draw more than half of our vblank, something is very wrong.
 			// Clamp our max time to half of the vblank if we can.
@@ -146,10 +152,24 @@ namespace gamescope
 
 			// If this is not a pre-emptive re-arming, then update
 			// the rolling internal max draw time for next time.
+			// Keep this going in every mode so switching is seamless.
 			if ( !bPreemptive )
 				m_ulRollingMaxDrawTime = ulNewRollingDrawTime;
 
-			ulOffset = ulNewRollingDrawTime + ulRedZone;
+			uint64_t ulEstimatedDrawTime = ulNewRollingDrawTime;
+
+			// Guess the next frame will be like the last one as far as compositing goes,
+			// and wake up in time for the chosen percentile of those.
+			const CDrawTimeHistogram &histogram = m_DrawTimeHistograms[ bCompositing ];
+			if ( VBlankScheduler( vblank_scheduler.Get() ) == VBlankScheduler::Percentile && histogram.SampleCount() >= kMinPercentileSamples )
+			{
+				ulEstimatedDrawTime = histogram.GetPercentile( vblank_scheduler_percentile );
+				if ( bCompositing )
+					ulEstimatedDrawTime = std::max( ulEstimatedDrawTime, m_ulVBlankDrawTimeMinCompositing );
+				ulEstimatedDrawTime = std::min( ulEstimatedDrawTime, ulRefreshInterval - ulRedZone );
+			}
+
+			ulOffset = ulEstimatedDrawTime + ulRedZone;
 
 			if ( vblank_debug && !bPreemptive )
 				VBlankDebugSpew( ulOffset, ulDrawTime, ulRedZone );
@@ -215,6 +235,7 @@ namespace gamescope
 	void CVBlankTimer::UpdateLastDrawTime( uint64_t ulNanos )
 	{
 		m_ulLastDrawTime = ulNanos;
+		m_ulDrawTimeSeq++;
 	}
 
 	void CVBlankTimer::WaitToBeArmed()
@@ -2,6 +2,7 @@
 
 #include <optional>
 #include "waitable.h"
+#include "Utils/DrawTimeEstimator.h"
 
 namespace gamescope
 {
@@ -39,6 +40,9 @@ namespace gamescope
 
         static constexpr uint64_t kVRRFlushingTime = 300'000;
 
+        // Draw times needed in a histogram before the percentile scheduler trusts it.
+        static constexpr uint32_t kMinPercentileSamples = 32;
+
         CVBlankTimer();
         ~CVBlankTimer();
 
@@ -96,6 +100,10 @@ namespace gamescope
         // 3ms by default to get the ball rolling.
         // This is calculated by steamcompmgr/drm and fed-back to the vblank timer.
         std::atomic<uint64_t> m_ulLastDrawTime = { kStartingVBlankDrawTime };
+        // Bumped with every m_ulLastDrawTime update, so each draw only
+        // lands in the histograms once.
+        std::atomic<uint64_t> m_ulDrawTimeSeq = { 0 };
+        uint64_t m_ulLastSampledDrawTimeSeq = 0;
 
         //////////////////////////////////
         // VBlank timing tuneables below!
@@ -106,6 +114,11 @@ namespace gamescope
         // doing pre-emptive timer re-arms.
         uint64_t m_ulRollingMaxDrawTime = kStartingVBlankDrawTime;
 
+        // Recent draw times for the percentile scheduler, indexed by whether
+        // the frame was composited, as direct scanout is a lot cheaper.
+        // Also only touched in CalcNextWakeupTime.
+        CDrawTimeHistogram m_DrawTimeHistograms[2];
+
         // This accounts for some time we cannot account for (which (I think) is the drm_commit -> triggering the pageflip)
         // It would be nice to make this lower if we can find a way to track that effectively
         // Perhaps the missing time is spent elsewhere, but given we track from the pipe write
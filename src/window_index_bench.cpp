@@ -0,0 +1,168 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "Utils/OpenHashMap.h"
+
+// steamcompmgr looks windows up by X11 ID and by wlr_surface for pretty much
+// every event and commit it handles, and Steam with a Proton game or two running
+// easily has hundreds of windows. This compares walking the window list the way
+// find_win used to with the hashed indices it uses now.
+
+using Window = unsigned long;
+
+struct FakeSurface
+{
+    uint64_t ulPadding[8];
+};
+
+struct FakeWindow
+{
+    Window id;
+    FakeSurface *pSurface;
+    FakeWindow *pNext;
+    // Roughly the size of a steamcompmgr_win_t, so the walk touches as much memory.
+    uint8_t ubPadding[1024];
+};
+
+struct FakeWindowList
+{
+    std::vector<std::unique_ptr<FakeWindow>> windows;
+    std::vector<std::unique_ptr<FakeSurface>> surfaces;
+    FakeWindow *pList = nullptr;
+
+    gamescope::COpenHashMap<Window, FakeWindow *> windowsById;
+    gamescope::COpenHashMap<FakeSurface *, FakeWindow *> windowsBySurface;
+
+    // What we look up, in a random order.
+    std::vector<Window> lookupIds;
+    std::vector<FakeSurface *> lookupSurfaces;
+};
+
+static FakeWindowList MakeWindowList( uint32_t uWindowCount )
+{
+    FakeWindowList list;
+
+    srand( 1 );
+    for ( uint32_t i = 0; i < uWindowCount; i++ )
+    {
+        // Each X client gets its own ID range, spread them over a few clients.
+        const Window id = ( Window( 1 + i % 8 ) << 21 ) | ( 1 + i / 8 );
+
+        list.surfaces.push_back( std::make_unique<FakeSurface>() );
+        list.windows.push_back( std::make_unique<FakeWindow>() );
+
+        FakeWindow *pWindow = list.windows.back().get();
+        pWindow->id = id;
+        pWindow->pSurface = list.surfaces.back().get();
+        pWindow->pNext = list.pList;
+        list.pList = pWindow;
+
+        list.windowsById.Insert( id, pWindow );
+        list.windowsBySurface.Insert( pWindow->pSurface, pWindow );
+    }
+
+    for ( uint32_t i = 0; i < 4096; i++ )
+    {
+        const FakeWindow *pWindow = list.windows[ rand() % uWindowCount ].get();
+        list.lookupIds.push_back( pWindow->id );
+        list.lookupSurfaces.push_back( pWindow->pSurface );
+    }
+
+    return list;
+}
+
+// Args: window count
+static void BenchmarkFindWindowListWalk( benchmark::State &state )
+{
+    FakeWindowList list = MakeWindowList( uint32_t( state.range( 0 ) ) );
+
+    size_t i = 0;
+    for ( auto _ : state )
+    {
+        const Window id = list.lookupIds[ i++ % list.lookupIds.size() ];
+
+        FakeWindow *pWindow = list.pList;
+        while ( pWindow && pWindow->id != id )
+            pWindow = pWindow->pNext;
+
+        benchmark::DoNotOptimize( pWindow );
+    }
+}
+BENCHMARK(BenchmarkFindWindowListWalk)->ArgNames({ "windows" })->Arg( 100 )->Arg( 500 )->Arg( 2000 );
+
+static void BenchmarkFindWindowHashed( benchmark::State &state )
+{
+    FakeWindowList list = MakeWindowList( uint32_t( state.range( 0 ) ) );
+
+    size_t i = 0;
+    for ( auto _ : state )
+    {
+        const Window id = list.lookupIds[ i++ % list.lookupIds.size() ];
+
+        FakeWindow **ppWindow = list.windowsById.Find( id );
+
+        benchmark::DoNotOptimize( ppWindow );
+    }
+}
+BENCHMARK(BenchmarkFindWindowHashed)->ArgNames({ "windows" })->Arg( 100 )->Arg( 500 )->Arg( 2000 );
+
+static void BenchmarkFindSurfaceListWalk( benchmark::State &state )
+{
+    FakeWindowList list = MakeWindowList( uint32_t( state.range( 0 ) ) );
+
+    size_t i = 0;
+    for ( auto _ : state )
+    {
+        FakeSurface *pSurface = list.lookupSurfaces[ i++ % list.lookupSurfaces.size() ];
+
+        FakeWindow *pWindow = list.pList;
+        while ( pWindow && pWindow->pSurface != pSurface )
+            pWindow = pWindow->pNext;
+
+        benchmark::DoNotOptimize( pWindow );
+    }
+}
+BENCHMARK(BenchmarkFindSurfaceListWalk)->ArgNames({ "windows" })->Arg( 100 )->Arg( 500 )->Arg( 2000 );
+
+static void BenchmarkFindSurfaceHashed( benchmark::State &state )
+{
+    FakeWindowList list = MakeWindowList( uint32_t( state.range( 0 ) ) );
+
+    size_t i = 0;
+    for ( auto _ : state )
+    {
+        FakeSurface *pSurface = list.lookupSurfaces[ i++ % list.lookupSurfaces.size() ];
+
+        // find_win checks the cached window still has the surface.
+        FakeWindow **ppWindow = list.windowsBySurface.Find( pSurface );
+        bool bValid = ppWindow && ( *ppWindow )->pSurface == pSurface;
+
+        benchmark::DoNotOptimize( bValid );
+    }
+}
+BENCHMARK(BenchmarkFindSurfaceHashed)->ArgNames({ "windows" })->Arg( 100 )->Arg( 500 )->Arg( 2000 );
+
+// Windows coming and going (menus, tooltips, Proton's helper windows), which has
+// to stay cheap too now that every add and destroy updates the index.
+static void BenchmarkWindowIndexChurn( benchmark::State &state )
+{
+    FakeWindowList list = MakeWindowList( uint32_t( state.range( 0 ) ) );
+
+    size_t i = 0;
+    for ( auto _ : state )
+    {
+        FakeWindow *pWindow = list.windows[ i++ % list.windows.size() ].get();
+
+        list.windowsById.Erase( pWindow->id );
+        list.windowsById.Insert( pWindow->id, pWindow );
+
+        benchmark::DoNotOptimize( list.windowsById.Size() );
+    }
+}
+BENCHMARK(BenchmarkWindowIndexChurn)->ArgNames({ "windows" })->Arg( 100 )->Arg( 500 )->Arg( 2000 );
+
+BENCHMARK_MAIN();
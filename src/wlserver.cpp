@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <xf86drm.h>
 #include <sys/eventfd.h>
+#include <inttypes.h>
 
 #include <linux/input-event-codes.h>
 
@@ -66,6 +67,7 @@
 #include "commit.h"
 #include "Timeline.h"
 #include "Utils/NonCopyable.h"
+#include "convar.h"
 
 #if HAVE_PIPEWIRE
 #include "pipewire.hpp"
@@ -112,22 +114,32 @@ static void wlserver_constrain_cursor( struct wlr_pointer_constraint_v1 *pNewCon
 struct wlr_surface *wlserver_surface_to_main_surface( struct wlr_surface *pSurface );
 void wlserver_process_hotkeys( wlr_keyboard *keyboard, uint32_t key, bool press );
 
-std::vector<ResListEntry_t>& gamescope_xwayland_server_t::retrieve_commits()
+gamescope::ConVar<bool> cv_drm_debug_syncobj_force_wait_on_commit( "drm_debug_syncobj_force_wait_on_commit", false, "Force a wait on DRM sync objects before committing buffers" );
+
+// Past this many rects, upload their bounding box instead.
+static constexpr int k_nMaxBufferDamageRects = 16;
+
+// Buffer damage of the commit being applied to surf right now.
+static std::optional<std::vector<pixman_box32_t>> wlserver_surface_buffer_damage( struct wlr_surface *surf )
 {
-	static std::vector<ResListEntry_t> commits;
-	commits.clear();
-	commits.reserve(16);
+	int nRects = 0;
+	const pixman_box32_t *pRects = pixman_region32_rectangles( &surf->buffer_damage, &nRects );
+	if ( nRects == 0 )
+		return std::vector<pixman_box32_t>{};
 
-	{
-		std::lock_guard<std::mutex> lock( wayland_commit_lock );
-		commits.swap(wayland_commit_queue);
-	}
-	return commits;
-}
+	const pixman_box32_t *pExtents = pixman_region32_extents( &surf->buffer_damage );
+	if ( surf->buffer &&
+		 pExtents->x1 <= 0 && pExtents->y1 <= 0 &&
+		 pExtents->x2 >= surf->buffer->base.width && pExtents->y2 >= surf->buffer->base.height )
+		return std::nullopt;
 
-gamescope::ConVar<bool> cv_drm_debug_syncobj_force_wait_on_commit( "drm_debug_syncobj_force_wait_on_commit", false, "Force a wait on DRM sync objects before committing buffers" );
+	if ( nRects > k_nMaxBufferDamageRects )
+		return std::vector<pixman_box32_t>{ *pExtents };
+
+	return std::vector<pixman_box32_t>{ pRects, pRects + nRects };
+}
 
-std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wlr_buffer *buf )
+std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wlr_buffer *buf, std::optional<std::vector<pixman_box32_t>> oBufferDamage )
 {
 	auto wl_surf = get_wl_surface_info( surf );
 
@@ -160,7 +172,8 @@ std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wl
 		wl_surf->present_id,
 		wl_surf->desired_present_time,
 		std::move( pAcquirePoint ),
-		std::move( pReleasePoint )
+		std::move( pReleasePoint ),
+		std::move( oBufferDamage )
 	};
 	wl_surf->present_id = std::nullopt;
 	wl_surf->desired_present_time = 0;
@@ -176,16 +189,13 @@ std::optional<ResListEntry_t> PrepareCommit( struct wlr_surface *surf, struct wl
 	return oNewEntry;
 }
 
-void gamescope_xwayland_server_t::wayland_commit(struct wlr_surface *surf, struct wlr_buffer *buf)
+void gamescope_xwayland_server_t::wayland_commit(struct wlr_surface *surf, struct wlr_buffer *buf, std::optional<std::vector<pixman_box32_t>> oBufferDamage)
 {
-	std::optional<ResListEntry_t> oEntry = PrepareCommit( surf, buf );
+	std::optional<ResListEntry_t> oEntry = PrepareCommit( surf, buf, std::move( oBufferDamage ) );
 	if ( !oEntry )
 		return;
 
-	{
-		std::lock_guard<std::mutex> lock( wayland_commit_lock );
-		wayland_commit_queue.emplace_back( std::move( *oEntry ) );
-	}
+	wayland_commit_queue.Push( std::move( *oEntry ) );
 
 	nudge_steamcompmgr();
 }
@@ -198,16 +208,13 @@ struct PendingCommit_t
 
 std::list<PendingCommit_t> g_PendingCommits;
 
-void wlserver_xdg_commit(struct wlr_surface *surf, struct wlr_buffer *buf)
+void wlserver_xdg_commit(struct wlr_surface *surf, struct wlr_buffer *buf, std::optional<std::vector<pixman_box32_t>> oBufferDamage = std::nullopt)
 {
-	std::optional<ResListEntry_t> oEntry = PrepareCommit( surf, buf );
+	std::optional<ResListEntry_t> oEntry = PrepareCommit( surf, buf, std::move( oBufferDamage ) );
 	if ( !oEntry )
 		return;
 
-	{
-		std::lock_guard<std::mutex> lock( wlserver.xdg_commit_lock );
-		wlserver.xdg_commit_queue.push_back( std::move( *oEntry ) );
-	}
+	wlserver.xdg_commit_queue.Push( std::move( *oEntry ) );
 
 	nudge_steamcompmgr();
 }
@@ -249,11 +256,11 @@ void xwayland_surface_commit(struct wlr_surface *wlr_surface) {
 	if (wlserver_x11_surface_info)
 	{
 		assert(wlserver_x11_surface_info->xwayland_server);
-		wlserver_x11_surface_info->xwayland_server->wayland_commit( wlr_surface, buf );
+		wlserver_x11_surface_info->xwayland_server->wayland_commit( wlr_surface, buf, wlserver_surface_buffer_damage( wlr_surface ) );
 	}
 	else if (wlserver_xdg_surface_info)
 	{
-		wlserver_xdg_commit(wlr_surface, buf);
+		wlserver_xdg_commit(wlr_surface, buf, wlserver_surface_buffer_damage( wlr_surface ));
 	}
 	else
 	{
@@ -1056,6 +1063,23 @@ static void gamescope_control_display_sleep( struct wl_client *client, struct wl
 	}
 }
 
+static void gamescope_control_remove_frame_timing_listener( struct wl_resource *resource )
+{
+	std::erase_if( wlserver.gamescope_frame_timing_controls, [=]( struct wl_resource *control ) { return control == resource; } );
+	wlserver.uFrameTimingControlCount = uint32_t( wlserver.gamescope_frame_timing_controls.size() );
+}
+
+static void gamescope_control_set_frame_timing_events( struct wl_client *client, struct wl_resource *resource, uint32_t enabled )
+{
+	gamescope_control_remove_frame_timing_listener( resource );
+
+	if ( enabled )
+	{
+		wlserver.gamescope_frame_timing_controls.push_back( resource );
+		wlserver.uFrameTimingControlCount = uint32_t( wlserver.gamescope_frame_timing_controls.size() );
+	}
+}
+
 static void gamescope_control_handle_destroy( struct wl_client *client, struct wl_resource *resource )
 {
 	wl_resource_destroy( resource );
@@ -1066,6 +1090,7 @@ static const struct gamescope_control_interface gamescope_control_impl = {
 	.set_app_target_refresh_cycle = gamescope_control_set_app_target_refresh_cycle,
 	.take_screenshot = gamescope_control_take_screenshot,
 	.display_sleep = gamescope_control_display_sleep,
+	.set_frame_timing_events = gamescope_control_set_frame_timing_events,
 };
 
 static uint32_t get_conn_display_info_flags()
@@ -1122,6 +1147,7 @@ static void gamescope_control_bind( struct wl_client *client, void *data, uint32
 	[](struct wl_resource *resource)
 	{
 		std::erase_if(wlserver.gamescope_controls, [=](struct wl_resource *control) { return control == resource; });
+		gamescope_control_remove_frame_timing_listener( resource );
 	});
 
 	// Send feature support
@@ -1130,6 +1156,8 @@ static void gamescope_control_bind( struct wl_client *client, void *data, uint32
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_PIXEL_FILTER, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_REFRESH_CYCLE_ONLY_CHANGE_REFRESH_RATE, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_MURA_CORRECTION, 1, 0 );
+	if ( version >= GAMESCOPE_CONTROL_FRAME_TIMING_SINCE_VERSION )
+		gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_FRAME_TIMING, 1, 0 );
 	gamescope_control_send_feature_support( resource, GAMESCOPE_CONTROL_FEATURE_DONE, 0, 0 );
 
 	wlserver_send_gamescope_control( resource );
@@ -1137,9 +1165,53 @@ static void gamescope_control_bind( struct wl_client *client, void *data, uint32
 	wlserver.gamescope_controls.push_back(resource);
 }
 
+void wlserver_send_frame_timing( const gamescope::FrameTelemetryRecord_t &record )
+{
+	if ( !wlserver.uFrameTimingControlCount )
+		return;
+
+	const uint64_t ulTimings[] =
+	{
+		record.ulTargetVBlank,
+		record.ulScheduledWakeup,
+		record.ulWakeup,
+		record.ulLatch,
+		record.ulCompositeSubmit,
+		record.ulGPUDone,
+		record.ulCommit,
+		record.ulFlip,
+	};
+
+	gamescope::FrameTelemetryCounters_t counters = gamescope::CFrameTelemetry::Get().GetCounters();
+	const uint64_t ulCounters[] =
+	{
+		counters.ulFrames,
+		counters.ulComposited,
+		counters.ulScanout,
+		counters.ulMissedVBlanks,
+		counters.ulLateWakeups,
+	};
+
+	struct wl_array timings;
+	wl_array_init( &timings );
+	memcpy( wl_array_add( &timings, sizeof( ulTimings ) ), ulTimings, sizeof( ulTimings ) );
+
+	struct wl_array counterArray;
+	wl_array_init( &counterArray );
+	memcpy( wl_array_add( &counterArray, sizeof( ulCounters ) ), ulCounters, sizeof( ulCounters ) );
+
+	wlserver_lock();
+	for ( struct wl_resource *control : wlserver.gamescope_frame_timing_controls )
+		gamescope_control_send_frame_timing( control, uint32_t( record.ulFrameID ), record.uFlags, &timings, &counterArray );
+	wlserver_unlock();
+
+	wl_array_release( &timings );
+	wl_array_release( &counterArray );
+}
+
 static void create_gamescope_control( void )
 {
-	uint32_t version = 4;
+	uint32_t version = 5;
 	wl_global_create( wlserver.display, &gamescope_control_interface, version, NULL, gamescope_control_bind );
 }
 
@@ -1945,6 +2017,12 @@ extern std::mutex g_SteamCompMgrXWaylandServerMutex;
 
 static int g_wlserverNudgePipe[2] = {-1, -1};
 
+static void wlserver_nudge()
+{
+	if ( write( g_wlserverNudgePipe[ 1 ], "\n", 1 ) < 0 && errno != EAGAIN )
+		wl_log.errorf_errno( "wlserver_nudge: write failed" );
+}
+
 void wlserver_run(void)
 {
 	pthread_setname_np( pthread_self(), "gamescope-wl" );
@@ -1985,10 +2063,23 @@ void wlserver_run(void)
 			break;
 		}
 
+		if ( pollfds[ 1 ].revents & POLLIN ) {
+			char buf[ 64 ];
+			while ( read( g_wlserverNudgePipe[ 0 ], buf, sizeof( buf ) ) > 0 )
+				continue;
+
+			wlserver_lock();
+			wlserver_flush_input_queue();
+			// wlserver_unlock flushes the input we just sent out to clients.
+			wlserver_unlock();
+		}
+
 		if ( pollfds[ 0 ].revents & POLLIN ) {
 			// We have wayland stuff to do, do it while locked
 			wlserver_lock();
 
+			wlserver_flush_input_queue();
+
 			wl_display_flush_clients(wlserver.display);
 			int ret = wl_event_loop_dispatch(wlserver.event_loop, 0);
 			if (ret < 0) {
@@ -2003,10 +2094,7 @@ void wlserver_run(void)
 	wlserver.bWaylandServerRunning = false;
 	wlserver.bWaylandServerRunning.notify_all();
 
-	{
-		std::unique_lock lock3(wlserver.xdg_commit_lock);
-		wlserver.xdg_commit_queue.clear();
-	}
+	wlserver.xdg_commit_queue.Clear();
 
 	{
 		std::unique_lock lock2(g_wlserver_xdg_shell_windows_lock);
@@ -2125,10 +2213,8 @@ void wlserver_process_hotkeys( wlr_keyboard *keyboard, uint32_t key, bool press
 	}
 }
 
-void wlserver_key( uint32_t key, bool press, uint32_t time )
+static void wlserver_send_key( uint32_t key, bool press, uint32_t time )
 {
-	assert( wlserver_is_lock_held() );
-
 	wlr_keyboard *keyboard = wlserver.wlr.virtual_keyboard_device;
 
 	wlserver_process_hotkeys( keyboard, key, press );
@@ -2140,6 +2226,15 @@ void wlserver_key( uint32_t key, bool press, uint32_t time )
 	bump_input_counter();
 }
 
+void wlserver_key( uint32_t key, bool press, uint32_t time )
+{
+	assert( wlserver_is_lock_held() );
+
+	wlserver_flush_input_queue();
+
+	wlserver_send_key( key, press, time );
+}
+
 extern std::atomic<bool> hasRepaint;
 
 struct wlr_surface *wlserver_surface_to_main_surface( struct wlr_surface *pSurface )
@@ -2270,6 +2365,11 @@ void wlserver_notify_dropdown( struct wlr_surface *wlrsurface, int nX, int nY )
 
 void wlserver_mousehide()
 {
+	assert( wlserver_is_lock_held() );
+
+	// Don't let pointer input from before this show the cursor again after.
+	wlserver_flush_input_queue();
+
 	wlserver.ulLastMovedCursorTime = 0;
 	if ( wlserver.bCursorHidden != true )
 	{
@@ -2454,15 +2554,9 @@ static bool wlserver_apply_constraint( double *dx, double *dy )
 	return true;
 }
 
-void wlserver_mousemotion( double dx, double dy, uint32_t time )
+// Moves the cursor by an already scaled delta, after its relative motion got sent.
+static void wlserver_move_pointer( double dx, double dy, uint32_t time )
 {
-	assert( wlserver_is_lock_held() );
-
-	dx *= g_mouseSensitivity;
-	dy *= g_mouseSensitivity;
-
-	wlserver_perform_rel_pointer_motion( dx, dy );
-
 	if ( !wlserver_apply_constraint( &dx, &dy ) )
 	{
 		wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
@@ -2483,10 +2577,18 @@ void wlserver_mousemotion( double dx, double dy, uint32_t time )
 	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
 }
 
-void wlserver_mousewarp( double x, double y, uint32_t time, bool bSynthetic )
+static void wlserver_send_mousemotion( double dx, double dy, uint32_t time )
 {
-	assert( wlserver_is_lock_held() );
+	dx *= g_mouseSensitivity;
+	dy *= g_mouseSensitivity;
+
+	wlserver_perform_rel_pointer_motion( dx, dy );
+
+	wlserver_move_pointer( dx, dy, time );
+}
 
+static void wlserver_send_mousewarp( double x, double y, uint32_t time, bool bSynthetic )
+{
 	wlserver.mouse_surface_cursorx = x;
 	wlserver.mouse_surface_cursory = y;
 
@@ -2502,8 +2604,50 @@ void wlserver_mousewarp( double x, double y, uint32_t time, bool bSynthetic )
 	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
 }
 
+static void wlserver_send_mousebutton( int button, bool press, uint32_t time )
+{
+	wlserver.bCursorHidden = !wlserver.bCursorHasImage;
+
+	wlserver_oncursorevent();
+
+	wlr_seat_pointer_notify_button( wlserver.wlr.seat, time, button, press ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED );
+	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
+}
+
+static void wlserver_send_mousewheel( double flX, double flY, uint32_t time )
+{
+	wlr_seat_pointer_notify_axis( wlserver.wlr.seat, time, WL_POINTER_AXIS_HORIZONTAL_SCROLL, flX, flX * WLR_POINTER_AXIS_DISCRETE_STEP, WL_POINTER_AXIS_SOURCE_WHEEL, WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL );
+	wlr_seat_pointer_notify_axis( wlserver.wlr.seat, time, WL_POINTER_AXIS_VERTICAL_SCROLL, flY, flY * WLR_POINTER_AXIS_DISCRETE_STEP, WL_POINTER_AXIS_SOURCE_WHEEL, WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL );
+	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
+}
+
+// Callers holding the lock themselves go after whatever input is queued up
+// already, like the touch events do.
+
+void wlserver_mousemotion( double dx, double dy, uint32_t time )
+{
+	assert( wlserver_is_lock_held() );
+
+	wlserver_flush_input_queue();
+
+	wlserver_send_mousemotion( dx, dy, time );
+}
+
+void wlserver_mousewarp( double x, double y, uint32_t time, bool bSynthetic )
+{
+	assert( wlserver_is_lock_held() );
+
+	wlserver_flush_input_queue();
+
+	wlserver_send_mousewarp( x, y, time, bSynthetic );
+}
+
 void wlserver_fake_mouse_pos( double x, double y )
 {
+	assert( wlserver_is_lock_held() );
+
+	wlserver_flush_input_queue();
+
 	// Fake a pos for eg. hiding true cursor state from Steam.
 	wlr_seat_pointer_notify_motion( wlserver.wlr.seat, 0, x, y );
 	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
@@ -2513,23 +2657,150 @@ void wlserver_mousebutton( int button, bool press, uint32_t time )
 {
 	assert( wlserver_is_lock_held() );
 
-	wlserver.bCursorHidden = !wlserver.bCursorHasImage;
-
-	wlserver_oncursorevent();
+	wlserver_flush_input_queue();
 
-	wlr_seat_pointer_notify_button( wlserver.wlr.seat, time, button, press ? WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED );
-	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
+	wlserver_send_mousebutton( button, press, time );
 }
 
 void wlserver_mousewheel( double flX, double flY, uint32_t time )
 {
 	assert( wlserver_is_lock_held() );
 
-	wlr_seat_pointer_notify_axis( wlserver.wlr.seat, time, WL_POINTER_AXIS_HORIZONTAL_SCROLL, flX, flX * WLR_POINTER_AXIS_DISCRETE_STEP, WL_POINTER_AXIS_SOURCE_WHEEL, WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL );
-	wlr_seat_pointer_notify_axis( wlserver.wlr.seat, time, WL_POINTER_AXIS_VERTICAL_SCROLL, flY, flY * WLR_POINTER_AXIS_DISCRETE_STEP, WL_POINTER_AXIS_SOURCE_WHEEL, WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL );
-	wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
+	wlserver_flush_input_queue();
+
+	wlserver_send_mousewheel( flX, flY, time );
+}
+
+static gamescope::ConVar<bool> cv_input_queue{ "input_queue", true, "Hand pointer and keyboard input from the input threads to the Wayland thread through a lock-free queue, coalescing relative motion into one pointer motion per batch, instead of taking the wlserver lock for every event." };
+
+struct InputQueueLatencyStats_t
+{
+	std::atomic<uint64_t> ulTotalLatency = { 0 };
+	std::atomic<uint64_t> ulMaxLatency = { 0 };
+	std::atomic<uint64_t> ulHandledEvents = { 0 };
+};
+static InputQueueLatencyStats_t s_InputQueueLatency;
+
+static void wlserver_account_input_latency( const gamescope::InputEvent_t &event, uint64_t ulNow )
+{
+	const uint64_t ulLatency = ulNow > event.ulQueueTime ? ulNow - event.ulQueueTime : 0;
+
+	s_InputQueueLatency.ulTotalLatency.fetch_add( ulLatency, std::memory_order_relaxed );
+	s_InputQueueLatency.ulHandledEvents.fetch_add( 1, std::memory_order_relaxed );
+	if ( ulLatency > s_InputQueueLatency.ulMaxLatency.load( std::memory_order_relaxed ) )
+		s_InputQueueLatency.ulMaxLatency.store( ulLatency, std::memory_order_relaxed );
+}
+
+static void wlserver_handle_input_event( const gamescope::InputEvent_t &event )
+{
+	switch ( event.eType )
+	{
+		case gamescope::InputEventType::RelativeMotion:
+			wlserver_send_mousemotion( event.flX, event.flY, event.uTime );
+			break;
+		case gamescope::InputEventType::AbsoluteMotion:
+			wlserver_send_mousewarp( event.flX, event.flY, event.uTime, event.bFlag );
+			break;
+		case gamescope::InputEventType::Button:
+			wlserver_send_mousebutton( int( event.uCode ), event.bFlag, event.uTime );
+			break;
+		case gamescope::InputEventType::Key:
+			wlserver_send_key( event.uCode, event.bFlag, event.uTime );
+			break;
+		case gamescope::InputEventType::Wheel:
+			wlserver_send_mousewheel( event.flX, event.flY, event.uTime );
+			break;
+		default:
+			break;
+	}
 }
 
+void wlserver_flush_input_queue()
+{
+	assert( wlserver_is_lock_held() );
+
+	const uint64_t ulNow = get_time_in_nanos();
+
+	wlserver.input_queue.Drain(
+		[ ulNow ]( const gamescope::InputEvent_t &event )
+		{
+			// Games using relative pointer get every single delta.
+			wlserver_perform_rel_pointer_motion( event.flX * g_mouseSensitivity, event.flY * g_mouseSensitivity );
+			wlr_seat_pointer_notify_frame( wlserver.wlr.seat );
+
+			wlserver_account_input_latency( event, ulNow );
+		},
+		[]( double dx, double dy, uint32_t time )
+		{
+			// Everything else just needs to know where the cursor ended up.
+			wlserver_move_pointer( dx * g_mouseSensitivity, dy * g_mouseSensitivity, time );
+		},
+		[ ulNow ]( const gamescope::InputEvent_t &event )
+		{
+			wlserver_handle_input_event( event );
+
+			wlserver_account_input_latency( event, ulNow );
+		} );
+}
+
+static void wlserver_queue_input( gamescope::InputEvent_t event )
+{
+	// The nudge pipe only exists while the Wayland thread runs.
+	if ( !cv_input_queue || !wlserver.bWaylandServerRunning )
+	{
+		wlserver_lock();
+		wlserver_flush_input_queue();
+		wlserver_handle_input_event( event );
+		wlserver_unlock();
+		return;
+	}
+
+	event.ulQueueTime = get_time_in_nanos();
+
+	if ( wlserver.input_queue.Push( event ) )
+		wlserver_nudge();
+}
+
+void wlserver_queue_key( uint32_t key, bool press, uint32_t time )
+{
+	wlserver_queue_input( gamescope::InputEvent_t{ .eType = gamescope::InputEventType::Key, .uCode = key, .bFlag = press, .uTime = time } );
+}
+
+void wlserver_queue_mousemotion( double x, double y, uint32_t time )
+{
+	wlserver_queue_input( gamescope::InputEvent_t{ .eType = gamescope::InputEventType::RelativeMotion, .uTime = time, .flX = x, .flY = y } );
+}
+
+void wlserver_queue_mousewarp( double x, double y, uint32_t time, bool bSynthetic )
+{
+	wlserver_queue_input( gamescope::InputEvent_t{ .eType = gamescope::InputEventType::AbsoluteMotion, .bFlag = bSynthetic, .uTime = time, .flX = x, .flY = y } );
+}
+
+void wlserver_queue_mousebutton( int button, bool press, uint32_t time )
+{
+	wlserver_queue_input( gamescope::InputEvent_t{ .eType = gamescope::InputEventType::Button, .uCode = uint32_t( button ), .bFlag = press, .uTime = time } );
+}
+
+void wlserver_queue_mousewheel( double x, double y, uint32_t time )
+{
+	wlserver_queue_input( gamescope::InputEvent_t{ .eType = gamescope::InputEventType::Wheel, .uTime = time, .flX = x, .flY = y } );
+}
+
+static gamescope::ConCommand cc_input_queue_stats( "input_queue_stats", "Print how much input went through the input queue, how many pointer motions its relative motion got coalesced into and how long events waited to be handled.",
+[]( std::span<std::string_view> args )
+{
+	const gamescope::InputEventQueueStats_t stats = wlserver.input_queue.GetStats();
+
+	const uint64_t ulHandledEvents = s_InputQueueLatency.ulHandledEvents.load( std::memory_order_relaxed );
+	const uint64_t ulTotalLatency = s_InputQueueLatency.ulTotalLatency.load( std::memory_order_relaxed );
+	const uint64_t ulMaxLatency = s_InputQueueLatency.ulMaxLatency.load( std::memory_order_relaxed );
+
+	console_log.infof( "Input queue: %" PRIu64 " events, %" PRIu64 " relative motion events in %" PRIu64 " pointer motions, %" PRIu64 " wakeups, %" PRIu64 " drains",
+		stats.ulEvents, stats.ulRelativeMotionEvents, stats.ulMotionNotifies, stats.ulWakeups, stats.ulDrains );
+	console_log.infof( "Queued to handled: %.1f us avg, %.1f us max",
+		ulHandledEvents ? ulTotalLatency / double( ulHandledEvents ) / 1'000.0 : 0.0, ulMaxLatency / 1'000.0 );
+} );
+
 void wlserver_send_frame_done( struct wlr_surface *surf, const struct timespec *when )
 {
 	assert( wlserver_is_lock_held() );
@@ -2624,6 +2895,9 @@ void wlserver_touchmotion( double x, double y, int touch_id, uint32_t time, bool
 {
 	assert( wlserver_is_lock_held() );
 
+	// Touch moves the cursor too, let queued pointer input go first.
+	wlserver_flush_input_queue();
+
 	if ( wlserver.mouse_focus_surface != NULL )
 	{
 		double tx = x;
@@ -2679,6 +2953,8 @@ void wlserver_touchdown( double x, double y, int touch_id, uint32_t time )
 {
 	assert( wlserver_is_lock_held() );
 
+	wlserver_flush_input_queue();
+
 	if ( wlserver.mouse_focus_surface != NULL )
 	{
 		double tx = x;
@@ -2734,6 +3010,8 @@ void wlserver_touchup( int touch_id, uint32_t time )
 {
 	assert( wlserver_is_lock_held() );
 
+	wlserver_flush_input_queue();
+
 	if ( wlserver.mouse_focus_surface != NULL )
 	{
 		bool bReleasedAny = false;
@@ -2983,16 +3261,6 @@ bool wlserver_xdg_dirty()
 	return wlserver.xdg_dirty.exchange(false);
 }
 
-std::vector<ResListEntry_t> wlserver_xdg_commit_queue()
-{
-	std::vector<ResListEntry_t> commits;
-	{
-		std::lock_guard<std::mutex> lock( wlserver.xdg_commit_lock );
-		commits = std::move(wlserver.xdg_commit_queue);
-	}
-	return commits;
-}
-
 uint32_t wlserver_make_new_xwayland_server()
 {
 	assert( wlserver_is_lock_held() );
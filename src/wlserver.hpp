@@ -21,6 +21,9 @@
 #include "vulkan_include.h"
 
 #include "steamcompmgr_shared.hpp"
+#include "Utils/MPSCQueue.h"
+#include "Utils/InputEventQueue.h"
+#include "FrameTelemetry.h"
 
 #if HAVE_DRM
 #define HAVE_SESSION 1
@@ -48,12 +51,24 @@ struct ResListEntry_t {
 	uint64_t desired_present_time;
 	std::shared_ptr<gamescope::CAcquireTimelinePoint> pAcquirePoint;
 	std::shared_ptr<gamescope::CReleaseTimelinePoint> pReleasePoint;
+	// What changed since the surface's previous commit, in buffer coordinates.
+	// That commit may have used another buffer. nullopt if all of it may have changed.
+	std::optional<std::vector<pixman_box32_t>> oBufferDamage;
 };
 
 struct wlserver_content_override;
 
 bool wlserver_is_lock_held(void);
 
+// Commits that haven't been picked up by steamcompmgr yet, per xwayland server
+// and for xdg. Only needs to cover a few frames worth of commits, anything
+// beyond that spills into the queue's overflow list.
+static constexpr size_t k_nCommitQueueSize = 256;
+
+// Input events that haven't been handled by the Wayland thread yet. A few
+// milliseconds of an 8 kHz mouse plus a keyboard fit comfortably.
+static constexpr size_t k_nInputQueueSize = 1024;
+
 class gamescope_xwayland_server_t
 {
 public:
@@ -72,9 +87,13 @@ public:
 
 	std::unique_ptr<xwayland_ctx_t> ctx;
 
-	void wayland_commit(struct wlr_surface *surf, struct wlr_buffer *buf);
+	void wayland_commit(struct wlr_surface *surf, struct wlr_buffer *buf, std::optional<std::vector<pixman_box32_t>> oBufferDamage = std::nullopt);
 
-	std::vector<ResListEntry_t>& retrieve_commits();
+	template <typename Fn>
+	void retrieve_commits( Fn &&fn )
+	{
+		wayland_commit_queue.Drain( std::forward<Fn>( fn ) );
+	}
 
 	void handle_override_window_content( struct wl_client *client, struct wl_resource *gamescope_swapchain_resource, struct wlr_surface *surface, uint32_t x11_window );
 	void destroy_content_override( struct wlserver_x11_surface_info *x11_surface, struct wlr_surface *surf);
@@ -98,8 +117,7 @@ private:
 	bool xwayland_ready = false;
 	_XDisplay *dpy = NULL;
 
-	std::mutex wayland_commit_lock;
-	std::vector<ResListEntry_t> wayland_commit_queue;
+	gamescope::MPSCQueue<ResListEntry_t, k_nCommitQueueSize> wayland_commit_queue;
 };
 
 struct wlserver_t {
@@ -181,10 +199,14 @@ struct wlserver_t {
 	struct wl_listener new_pointer_constraint;
 	std::vector<std::shared_ptr<steamcompmgr_win_t>> xdg_wins;
 	std::atomic<bool> xdg_dirty;
-	std::mutex xdg_commit_lock;
-	std::vector<ResListEntry_t> xdg_commit_queue;
+	gamescope::MPSCQueue<ResListEntry_t, k_nCommitQueueSize> xdg_commit_queue;
+	gamescope::CInputEventQueue<k_nInputQueueSize> input_queue;
 
 	std::vector<wl_resource*> gamescope_controls;
+	// The gamescope_controls that asked for frame_timing events.
+	std::vector<wl_resource*> gamescope_frame_timing_controls;
+	// So steamcompmgr can skip taking the lock when nobody is listening.
+	std::atomic<uint32_t> uFrameTimingControlCount = { 0 };
 
 	std::atomic<bool> bWaylandServerRunning = { false };
 
@@ -196,7 +218,6 @@ struct wlserver_t {
 
 extern struct wlserver_t wlserver;
 
-std::vector<ResListEntry_t> wlserver_xdg_commit_queue();
 
 struct wlserver_pointer {
 	struct wlr_pointer *wlr;
@@ -241,6 +262,17 @@ void wlserver_mousewarp( double x, double y, uint32_t time, bool bSynthetic );
 void wlserver_mousebutton( int button, bool press, uint32_t time );
 void wlserver_mousewheel( double x, double y, uint32_t time );
 
+// Same as the above, but for the input threads: these don't need the lock,
+// the events get handled in order on the Wayland thread.
+void wlserver_queue_key( uint32_t key, bool press, uint32_t time );
+void wlserver_queue_mousemotion( double x, double y, uint32_t time );
+void wlserver_queue_mousewarp( double x, double y, uint32_t time, bool bSynthetic );
+void wlserver_queue_mousebutton( int button, bool press, uint32_t time );
+void wlserver_queue_mousewheel( double x, double y, uint32_t time );
+// Handles whatever is queued now, so something done with the lock held
+// doesn't overtake input that came in before it.
+void wlserver_flush_input_queue();
+
 void wlserver_touchmotion( double x, double y, int touch_id, uint32_t time, bool bAlwaysWarpCursor = false );
 void wlserver_touchdown( double x, double y, int touch_id, uint32_t time );
 void wlserver_touchup( int touch_id, uint32_t time );
@@ -285,6 +317,7 @@ void wlserver_refresh_cycle( struct wlr_surface *surface, uint64_t refresh_cycle
 void wlserver_shutdown();
 
 void wlserver_send_gamescope_control( wl_resource *control );
+void wlserver_send_frame_timing( const gamescope::FrameTelemetryRecord_t &record );
 
 bool wlsession_active();
 
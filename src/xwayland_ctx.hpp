@@ -2,6 +2,7 @@
 
 #include "backend.h"
 #include "waitable.h"
+#include "Utils/OpenHashMap.h"
 
 #include <mutex>
 #include <memory>
@@ -21,6 +22,8 @@ class gamescope_xwayland_server_t;
 struct ignore;
 struct steamcompmgr_win_t;
 class MouseCursor;
+class CXPropertyPrefetch;
+struct wlr_surface;
 
 extern LogScope xwm_log;
 
@@ -67,6 +70,23 @@ struct xwayland_ctx_t final : public gamescope::IWaitable
 	// wlserver wants it.
 	std::mutex list_mutex;
 	steamcompmgr_win_t				*list;
+
+	// Indices into list for find_win, so looking up a window doesn't mean
+	// walking every window (Steam and Proton make hundreds of them).
+	// Like list, they only change on the steamcompmgr thread with
+	// list_mutex held.
+	gamescope::COpenHashMap<Window, steamcompmgr_win_t *> windowsById;
+	// Lazily filled in by find_win, entries are checked before use as
+	// the surfaces get (un)associated on the wlserver thread.
+	gamescope::COpenHashMap<struct wlr_surface *, steamcompmgr_win_t *> windowsBySurface;
+	// Child window -> the toplevel it's in, from CreateNotify/ReparentNotify
+	// and whatever find_win had to ask the server for.
+	gamescope::COpenHashMap<Window, Window> toplevelByChild;
+
+	// Properties fetched up front for whatever is being handled right now.
+	CXPropertyPrefetch *pPropertyPrefetch = nullptr;
+	// Atoms handle_property_notify fetches when they change, to get along with the event.
+	gamescope::COpenHashMap<Atom, bool> prefetchablePropertyAtoms;
 	int				scr;
 	Window			root;
 	XserverRegion	allDamage;